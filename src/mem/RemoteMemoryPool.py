@@ -0,0 +1,75 @@
+# Copyright (c) 2026 The sDM Authors
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are
+# met: redistributions of source code must retain the above copyright
+# notice, this list of conditions and the following disclaimer;
+# redistributions in binary form must reproduce the above copyright
+# notice, this list of conditions and the following disclaimer in the
+# documentation and/or other materials provided with the distribution;
+# neither the name of the copyright holders nor the names of its
+# contributors may be used to endorse or promote products derived from
+# this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+# A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+# OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+# THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+# OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+from m5.params import *
+from m5.proxy import *
+from m5.SimObject import SimObject
+
+
+# RemoteMemoryPool is a memory pool shared by several hosts, each of them
+# attached through its own CXL-like link. The pool-side controllers serve
+# the media, and the sDM engine of a host sits at its end of the link, so
+# that the IIT nodes and HMACs of every host compete for the pool
+class RemoteMemoryPool(SimObject):
+    type = "RemoteMemoryPool"
+    cxx_header = "mem/remote_memory_pool.hh"
+    cxx_class = "gem5::memory::RemoteMemoryPool"
+
+    cpu_side_ports = VectorResponsePort("One link per host")
+    mem_side_ports = VectorRequestPort("Pool-side memory controllers")
+
+    system = Param.System(Parent.any, "System the pool belongs to")
+
+    # the n-th manager protects the requests of the n-th host, and
+    # allocates its metadata from a range backed by the pool
+    sdm = VectorParam.SDMManager([], "sDM manager of each host")
+
+    # the first protected host registers a shared range, the others map
+    # the same space, and their metadata caches are kept coherent by
+    # invalidations sent over their links
+    shared_ranges = VectorParam.AddrRange(
+        [], "Protected ranges mapped by every protected host"
+    )
+
+    # a message is a header slot plus one 16B slot per 16B of payload,
+    # a flit carries its slots along with the framing and the CRC
+    flit_size = Param.Unsigned(68, "Bytes of a flit on the wire")
+    flit_slots = Param.Unsigned(4, "Slots carried by a flit")
+    link_bandwidth = Param.MemoryBandwidth(
+        "32GiB/s", "Bandwidth of each direction of a host link"
+    )
+    link_latency = Param.Latency(
+        "40ns", "Latency of a host link, ports and retimers included"
+    )
+
+    # a credit is a request buffer at the pool, it is given back once the
+    # request is accepted by its controller
+    host_credits = Param.Unsigned(32, "Request buffers of a host at the pool")
+
+    crypto_latency = Param.Latency(
+        "40ns", "Encryption of a protected write or verification and "
+        "decryption of a protected read at the host"
+    )
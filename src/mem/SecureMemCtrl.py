@@ -0,0 +1,90 @@
+# Copyright (c) 2026 The sDM Authors
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are
+# met: redistributions of source code must retain the above copyright
+# notice, this list of conditions and the following disclaimer;
+# redistributions in binary form must reproduce the above copyright
+# notice, this list of conditions and the following disclaimer in the
+# documentation and/or other materials provided with the distribution;
+# neither the name of the copyright holders nor the names of its
+# contributors may be used to endorse or promote products derived from
+# this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+# A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+# OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+# THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+# OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+from m5.params import *
+from m5.proxy import *
+from m5.objects.MemCtrl import *
+
+
+# SecureMemCtrl is a MemCtrl whose dram holds sDM protected spaces.
+# Accesses to protected lines additionally fetch (and update) the IIT
+# key path and the half-page HMAC through the controller queues, and
+# pay the latency of the crypto pipeline on top of the DRAM access
+class SecureMemCtrl(MemCtrl):
+    type = "SecureMemCtrl"
+    cxx_header = "mem/secure_mem_ctrl.hh"
+    cxx_class = "gem5::memory::SecureMemCtrl"
+
+    sdm = Param.SDMManager("sDM manager owning the protected spaces")
+
+    # latency of every stage of the secure pipeline, verification is
+    # charged once per IIT level on the key path
+    verify_latency = Param.Latency("20ns", "IIT node verification latency")
+    hmac_latency = Param.Latency("40ns", "Half-page HMAC or line MAC latency")
+    decrypt_latency = Param.Latency("10ns", "OTP generation on reads")
+    encrypt_latency = Param.Latency("10ns", "OTP generation and XOR on writes")
+    tree_update_latency = Param.Latency(
+        "20ns", "Counter increment and re-tag of one IIT level"
+    )
+
+    # a pipelined stage accepts a new operation every issue interval,
+    # otherwise it is busy for its whole latency
+    crypto_pipelined = Param.Bool(True, "Crypto stages are pipelined")
+    crypto_issue_interval = Param.Latency(
+        "1ns", "Initiation interval of a pipelined crypto stage"
+    )
+
+    # the one-time pad only depends on the address and the counter, so
+    # it can be generated while the ciphertext is still in flight once
+    # the counter is known, leaving only the XOR when the data arrives
+    speculative_otp = Param.Bool(
+        True, "Generate the OTP of a read as soon as its counter is known"
+    )
+
+    # in verify-later mode a read is answered once decrypted and checked
+    # in the background; a read that fails gets an error response once
+    # its check ends, the lines are poisoned and the failure is reported
+    # through the IntegrityFault probe point
+    verify_later = Param.Bool(
+        False, "Return decrypted data before its verification ends"
+    )
+
+    # a leaf minor counter overflow re-encrypts its whole half page, the
+    # media traffic of the rewrite is issued in the background behind
+    # demand reads, protected writes are only refused once the queue of
+    # pending half pages is full
+    reencrypt_queue_depth = Param.Unsigned(
+        8, "Half pages pending re-encryption before writes are stalled"
+    )
+    reencrypt_max_bursts = Param.Unsigned(
+        4, "Re-encryption bursts in flight at once"
+    )
+    reencrypt_demand_threshold = Param.Unsigned(
+        8, "Queued read bursts above which re-encryption holds back"
+    )
+    reencrypt_max_wait = Param.Latency(
+        "5us", "Time after which a re-encryption ignores demand traffic"
+    )
@@ -0,0 +1,851 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met: redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer;
+ * redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution;
+ * neither the name of the copyright holders nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mem/remote_memory_pool.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "base/cprintf.hh"
+#include "base/intmath.hh"
+#include "base/trace.hh"
+#include "debug/Drain.hh"
+#include "debug/RemoteMemoryPool.hh"
+#include "sim/system.hh"
+
+namespace gem5
+{
+
+namespace memory
+{
+
+/** Bytes of payload carried by a slot */
+static const unsigned SLOT_BYTES = 16;
+
+RemoteMemoryPool::HostPort::HostPort(const std::string &_name,
+                                     RemoteMemoryPool &_pool, PortID _host)
+    : QueuedResponsePort(_name, &_pool, queue, _host),
+      queue(_pool, *this, true), pool(_pool), host(_host)
+{
+}
+
+Tick
+RemoteMemoryPool::HostPort::recvAtomic(PacketPtr pkt)
+{
+    return pool.recvAtomic(pkt, host);
+}
+
+void
+RemoteMemoryPool::HostPort::recvFunctional(PacketPtr pkt)
+{
+    pool.recvFunctional(pkt, host);
+}
+
+bool
+RemoteMemoryPool::HostPort::recvTimingReq(PacketPtr pkt)
+{
+    return pool.recvTimingReq(pkt, host);
+}
+
+AddrRangeList
+RemoteMemoryPool::HostPort::getAddrRanges() const
+{
+    return pool.getAddrRanges();
+}
+
+RemoteMemoryPool::PoolPort::PoolPort(const std::string &_name,
+                                     RemoteMemoryPool &_pool, PortID _ctrl)
+    : RequestPort(_name, &_pool, _ctrl), pool(_pool), ctrl(_ctrl),
+      waitingRetry(false),
+      sendEvent([this]{ trySend(); }, _name + ".sendEvent")
+{
+}
+
+void
+RemoteMemoryPool::PoolPort::schedSend(PacketPtr pkt, Tick when)
+{
+    queue.emplace(when, pkt);
+    if (waitingRetry)
+        return;
+    Tick next = std::max(queue.begin()->first, curTick());
+    if (!sendEvent.scheduled() || sendEvent.when() > next)
+        pool.reschedule(sendEvent, next, true);
+}
+
+void
+RemoteMemoryPool::PoolPort::trySend()
+{
+    if (waitingRetry)
+        return;
+
+    while (!queue.empty() && queue.begin()->first <= curTick()) {
+        PacketPtr pkt = queue.begin()->second;
+        // the sDM manager updated the pool when the request was
+        // accepted, a write leaves with what the pool holds by now so
+        // that it never puts older contents back
+        if (pkt->isWrite()) {
+            Packet snapshot(pkt->req, MemCmd::ReadReq);
+            snapshot.dataStatic(pkt->getPtr<uint8_t>());
+            sendFunctional(&snapshot);
+        }
+        if (!sendTimingReq(pkt)) {
+            waitingRetry = true;
+            return;
+        }
+        queue.erase(queue.begin());
+        pool.stats.ctrlMsgs[ctrl]++;
+        pool.messageAccepted(pkt);
+    }
+
+    if (!queue.empty() && !sendEvent.scheduled())
+        pool.schedule(sendEvent, queue.begin()->first);
+}
+
+bool
+RemoteMemoryPool::PoolPort::recvTimingResp(PacketPtr pkt)
+{
+    pool.messageDone(pkt);
+    return true;
+}
+
+void
+RemoteMemoryPool::PoolPort::recvReqRetry()
+{
+    assert(waitingRetry);
+    waitingRetry = false;
+    trySend();
+}
+
+void
+RemoteMemoryPool::PoolPort::recvRangeChange()
+{
+    pool.rangeChange();
+}
+
+RemoteMemoryPool::RemoteMemoryPool(const RemoteMemoryPoolParams &p) :
+    SimObject(p), sdms(p.sdm), routesValid(false),
+    poolProxy([this](PacketPtr pkt) { functionalAccess(pkt); }, CL_SIZE),
+    slotTicks(p.link_bandwidth * p.flit_size / std::max(p.flit_slots, 1u)),
+    linkLatency(p.link_latency), hostCredits(p.host_credits),
+    cryptoLatency(p.crypto_latency), sharedRanges(p.shared_ranges),
+    stats(*this)
+{
+    fatal_if(p.flit_slots == 0 || p.flit_size < p.flit_slots * SLOT_BYTES,
+             "%s: a flit of %d bytes cannot carry %d slots\n", name(),
+             p.flit_size, p.flit_slots);
+    fatal_if(hostCredits == 0, "%s: hosts need at least one credit\n",
+             name());
+    fatal_if(sdms.size() > p.port_cpu_side_ports_connection_count,
+             "%s: %d sDM managers for %d hosts\n", name(), sdms.size(),
+             p.port_cpu_side_ports_connection_count);
+
+    for (int i = 0; i < p.port_cpu_side_ports_connection_count; i++) {
+        hostPorts.emplace_back(new HostPort(
+            csprintf("%s.cpu_side_ports[%d]", name(), i), *this, i));
+        links.push_back(HostLink{0, 0, hostCredits, false, {}});
+        dataRequestors.push_back(
+            p.system->getRequestorId(this, csprintf("host%d", i)));
+        metaRequestors.push_back(
+            p.system->getRequestorId(this, csprintf("host%d.sdm", i)));
+    }
+    for (int i = 0; i < p.port_mem_side_ports_connection_count; i++) {
+        poolPorts.emplace_back(new PoolPort(
+            csprintf("%s.mem_side_ports[%d]", name(), i), *this, i));
+    }
+
+    // hosts without a manager are not protected
+    sdms.resize(hostPorts.size(), nullptr);
+    for (auto sdm : sdms) {
+        if (sdm)
+            sdm->setRemoteMemory(&poolProxy);
+    }
+}
+
+Port &
+RemoteMemoryPool::getPort(const std::string &if_name, PortID idx)
+{
+    if (if_name == "cpu_side_ports" && idx < hostPorts.size())
+        return *hostPorts[idx];
+    else if (if_name == "mem_side_ports" && idx < poolPorts.size())
+        return *poolPorts[idx];
+    else
+        return SimObject::getPort(if_name, idx);
+}
+
+void
+RemoteMemoryPool::init()
+{
+    SimObject::init();
+
+    for (auto &port : hostPorts) {
+        fatal_if(!port->isConnected(), "%s: host port %s not connected\n",
+                 name(), port->name());
+    }
+    fatal_if(poolPorts.empty(), "%s: no pool-side controller\n", name());
+
+    // the metadata of every host lives in the pool, and no two hosts
+    // allocate it from the same range
+    for (size_t i = 0; i < sdms.size(); i++) {
+        if (!sdms[i])
+            continue;
+        const AddrRange &meta = sdms[i]->getMetaRange();
+        route(meta.start());
+        route(meta.end() - 1);
+        for (size_t j = 0; j < i; j++) {
+            fatal_if(sdms[j] && sdms[j]->getMetaRange().intersects(meta),
+                     "%s: sDM metadata ranges of hosts %d and %d overlap\n",
+                     name(), j, i);
+        }
+    }
+
+    for (auto &port : hostPorts)
+        port->sendRangeChange();
+}
+
+void
+RemoteMemoryPool::startup()
+{
+    SimObject::startup();
+
+    // the spaces are linked once the managers registered their own
+    // ranges, or restored them from a checkpoint
+    for (const auto &range : sharedRanges) {
+        sDM::sDMmanager *home = nullptr;
+        sDM::sdmIDtype home_id = 0;
+        for (size_t i = 0; i < sdms.size(); i++) {
+            if (!sdms[i])
+                continue;
+            if (!home) {
+                home = sdms[i];
+                home_id = home->isContained(range.start());
+                if (!home_id) {
+                    fatal_if(!home->sDMspace_register(range),
+                             "%s: shared range %s overlaps a space of "
+                             "host %d\n", name(), range.to_string(), i);
+                    home_id = home->isContained(range.start());
+                }
+                continue;
+            }
+            fatal_if(!sdms[i]->sDMspace_attach(*home, home_id),
+                     "%s: host %d cannot map shared range %s\n", name(), i,
+                     range.to_string());
+        }
+    }
+}
+
+DrainState
+RemoteMemoryPool::drain()
+{
+    // the messages already on their way are completed, the responses
+    // to the hosts are drained by their queues
+    return transfers.empty() ? DrainState::Drained : DrainState::Draining;
+}
+
+void
+RemoteMemoryPool::checkDrained()
+{
+    if (drainState() == DrainState::Draining && transfers.empty()) {
+        DPRINTF(Drain, "RemoteMemoryPool done draining, signaling drain "
+                "manager\n");
+        signalDrainDone();
+    }
+}
+
+RemoteMemoryPool::PoolPort &
+RemoteMemoryPool::route(Addr addr)
+{
+    if (!routesValid) {
+        routes.clear();
+        for (PortID i = 0; i < poolPorts.size(); i++) {
+            for (const auto &range : poolPorts[i]->getAddrRanges()) {
+                fatal_if(routes.insert(range, i) == routes.end(),
+                         "%s: range %s of %s overlaps another controller\n",
+                         name(), range.to_string(), poolPorts[i]->name());
+            }
+        }
+        routesValid = true;
+    }
+
+    auto it = routes.contains(addr);
+    fatal_if(it == routes.end(), "%s: no pool controller for address %#x\n",
+             name(), addr);
+    return *poolPorts[it->second];
+}
+
+AddrRangeList
+RemoteMemoryPool::getAddrRanges() const
+{
+    AddrRangeList ranges;
+    for (auto &port : poolPorts) {
+        AddrRangeList ctrl_ranges = port->getAddrRanges();
+        ranges.splice(ranges.end(), ctrl_ranges);
+    }
+    return ranges;
+}
+
+void
+RemoteMemoryPool::rangeChange()
+{
+    routesValid = false;
+    for (auto &port : hostPorts) {
+        if (port->isConnected())
+            port->sendRangeChange();
+    }
+}
+
+sDM::sDMmanager *
+RemoteMemoryPool::protector(PortID host, PacketPtr pkt) const
+{
+    sDM::sDMmanager *sdm = sdms[host];
+    if (!sdm)
+        return nullptr;
+    Addr end = pkt->getAddr() + pkt->getSize();
+    for (Addr line = pkt->getAddr() & CL_ALIGN_MASK; line < end;
+         line += CL_SIZE) {
+        if (sdm->isContained(line))
+            return sdm;
+    }
+    return nullptr;
+}
+
+void
+RemoteMemoryPool::functionalAccess(PacketPtr pkt)
+{
+    route(pkt->getAddr()).sendFunctional(pkt);
+}
+
+Tick
+RemoteMemoryPool::backInvalidate(PortID host, unsigned payload, Tick when)
+{
+    // the invalidation goes down the response direction of the link,
+    // and the acknowledgement comes back as a header on the request
+    // direction
+    HostLink &link = links[host];
+    unsigned n = slots(payload);
+    Tick start = std::max(when, link.respFree);
+    link.respFree = start + wireTime(n);
+    Tick ack = std::max(link.respFree + linkLatency, link.reqFree);
+    link.reqFree = ack + wireTime(slots(0));
+
+    stats.invalMsgs[host]++;
+    stats.invalSlots[host] += n + slots(0);
+    return link.reqFree + linkLatency;
+}
+
+Tick
+RemoteMemoryPool::sendInvalidations(sDM::sDMmanager *sdm, Tick when)
+{
+    std::vector<sDM::CoherenceMsg> msgs;
+    sdm->takeCoherenceMsgs(msgs);
+
+    Tick acked = when;
+    for (const auto &msg : msgs) {
+        auto it = std::find(sdms.begin(), sdms.end(), msg.peer);
+        assert(it != sdms.end());
+        PortID peer = it - sdms.begin();
+        // the root is sent along, every other line is only dropped
+        acked = std::max(acked, backInvalidate(peer,
+                                               msg.root ? CL_SIZE : 0,
+                                               when));
+        DPRINTF(RemoteMemoryPool, "Invalidate %s %#x at host %d\n",
+                msg.root ? "root of" : "line", msg.line, peer);
+    }
+    return acked;
+}
+
+void
+RemoteMemoryPool::checkRequest(PacketPtr pkt) const
+{
+    panic_if(!(pkt->isRead() || pkt->isWrite()),
+             "%s: should only see reads and writes\n", name());
+    // the pool is not a point of coherence, the contents are updated
+    // when a request is accepted
+    panic_if(pkt->isAtomicOp() || pkt->cmd == MemCmd::SwapReq ||
+             (pkt->isLLSC() && pkt->isWrite()),
+             "%s: unsupported access to the pool %s\n", name(),
+             pkt->print());
+}
+
+void
+RemoteMemoryPool::collectMetadata(sDM::sDMmanager *sdm, PacketPtr pkt,
+                                  std::vector<Addr> &meta_reads,
+                                  std::vector<Addr> &meta_writes)
+{
+    Addr key_path[MAX_HEIGHT];
+    Addr end = pkt->getAddr() + pkt->getSize();
+    for (Addr line = pkt->getAddr() & CL_ALIGN_MASK; line < end;
+         line += CL_SIZE) {
+        sDM::sdmIDtype id = sdm->isContained(line);
+        if (!id)
+            continue;
+        Addr rva = sdm->getVirtualOffset(id, line);
+        bool full_path = pkt->isWrite() && !sdm->writeBack();
+        sdm->getMetaMisses(id, rva, full_path, meta_reads);
+        if (!pkt->isWrite())
+            continue;
+        // the metadata cache is write-through, unless in write-back
+        // mode where only the HMAC line is written at once, and side-band
+        // MACs travel with the data
+        if (!sdm->writeBack()) {
+            int h = sdm->getKeyPathAddr(id, rva, key_path);
+            meta_writes.insert(meta_writes.end(), key_path, key_path + h);
+        }
+        if (!sdm->sidebandMac())
+            meta_writes.push_back(sdm->getHMACAddr(id, rva) & CL_ALIGN_MASK);
+    }
+    for (auto meta_addrs : {&meta_reads, &meta_writes}) {
+        std::sort(meta_addrs->begin(), meta_addrs->end());
+        meta_addrs->erase(std::unique(meta_addrs->begin(), meta_addrs->end()),
+                          meta_addrs->end());
+    }
+}
+
+unsigned
+RemoteMemoryPool::slots(unsigned payload) const
+{
+    return 1 + divCeil(payload, SLOT_BYTES);
+}
+
+unsigned
+RemoteMemoryPool::sidebandBytes(sDM::sDMmanager *sdm, Addr addr,
+                                unsigned size) const
+{
+    if (!sdm || !sdm->sidebandMac())
+        return 0;
+    unsigned bytes = 0;
+    for (Addr line = addr & CL_ALIGN_MASK; line < addr + size;
+         line += CL_SIZE) {
+        if (sdm->isContained(line))
+            bytes += INLINE_MAC_SIZE;
+    }
+    return bytes;
+}
+
+Tick
+RemoteMemoryPool::wireTime(unsigned n) const
+{
+    return std::ceil(n * slotTicks);
+}
+
+void
+RemoteMemoryPool::queueMessage(PortID host, Addr addr, unsigned size,
+                               bool is_read, bool meta, PacketPtr owner,
+                               Tick ready, unsigned sideband)
+{
+    RequestPtr req = std::make_shared<Request>(addr, size, 0,
+        meta ? metaRequestors[host] : dataRequestors[host]);
+    PacketPtr msg = new Packet(req, is_read ? MemCmd::ReadReq :
+                               MemCmd::WriteReq);
+    msg->allocate();
+    transfers.emplace(msg, Transfer{host, owner, meta, ready, sideband});
+    if (owner)
+        pendingAccesses.at(owner).outstanding++;
+    links[host].outbound.push_back(msg);
+}
+
+void
+RemoteMemoryPool::sendMessages(PortID host)
+{
+    HostLink &link = links[host];
+    while (!link.outbound.empty() && link.credits > 0) {
+        PacketPtr msg = link.outbound.front();
+        link.outbound.pop_front();
+        link.credits--;
+
+        // a read request is a header, a write carries its payload
+        const Transfer &transfer = transfers.at(msg);
+        unsigned n = slots(msg->isWrite() ?
+                           msg->getSize() + transfer.sideband : 0);
+        Tick start = std::max({curTick(), transfer.ready, link.reqFree});
+        link.reqFree = start + wireTime(n);
+
+        if (transfer.meta) {
+            stats.metaMsgs[host]++;
+            stats.metaSlots[host] += n;
+        } else {
+            stats.dataMsgs[host]++;
+            stats.dataSlots[host] += n;
+        }
+        stats.totLinkWait[host] += start - transfer.ready;
+
+        DPRINTF(RemoteMemoryPool, "Host %d %s %s to addr %#x, %d slots, "
+                "arrives at %d\n", host, transfer.meta ? "metadata" : "data",
+                msg->isWrite() ? "write" : "read", msg->getAddr(), n,
+                link.reqFree + linkLatency);
+
+        route(msg->getAddr()).schedSend(msg, link.reqFree + linkLatency);
+    }
+}
+
+void
+RemoteMemoryPool::messageAccepted(PacketPtr pkt)
+{
+    // the buffer of the message at the pool is free again
+    PortID host = transfers.at(pkt).host;
+    HostLink &link = links[host];
+    link.credits++;
+    sendMessages(host);
+
+    if (link.retry && link.outbound.empty() && link.credits > 0) {
+        DPRINTF(RemoteMemoryPool, "Host %d has credits again\n", host);
+        link.retry = false;
+        hostPorts[host]->sendRetryReq();
+    }
+}
+
+void
+RemoteMemoryPool::messageDone(PacketPtr pkt)
+{
+    auto it = transfers.find(pkt);
+    assert(it != transfers.end());
+    Transfer transfer = it->second;
+    transfers.erase(it);
+
+    // the answer to a read carries the data, a write is acknowledged
+    HostLink &link = links[transfer.host];
+    unsigned n = slots(pkt->isRead() ? pkt->getSize() + transfer.sideband
+                       : 0);
+    Tick start = std::max(curTick(), link.respFree);
+    link.respFree = start + wireTime(n);
+    if (transfer.meta)
+        stats.metaSlots[transfer.host] += n;
+    else
+        stats.dataSlots[transfer.host] += n;
+    Tick arrival = link.respFree + linkLatency;
+    delete pkt;
+
+    if (transfer.owner) {
+        PendingAccess &pending = pendingAccesses.at(transfer.owner);
+        pending.done = std::max(pending.done, arrival);
+        if (--pending.outstanding == 0)
+            finishAccess(transfer.owner);
+    }
+
+    checkDrained();
+}
+
+void
+RemoteMemoryPool::finishAccess(PacketPtr pkt)
+{
+    auto it = pendingAccesses.find(pkt);
+    assert(it != pendingAccesses.end());
+    PendingAccess pending = it->second;
+    pendingAccesses.erase(it);
+
+    // the host verifies and decrypts a protected read once its data
+    // and metadata are back
+    Tick done = pending.done;
+    if (pending.secure && pkt->isRead())
+        done += cryptoLatency;
+    stats.totAccessLat[pending.host] += done - pending.entered;
+
+    DPRINTF(RemoteMemoryPool, "Host %d access to %#x done after %d ticks\n",
+            pending.host, pkt->getAddr(), done - pending.entered);
+
+    // as in MemCtrl, the response is also charged with the delay
+    // provided by the xbar
+    pkt->makeResponse();
+    Tick response_time = done + pkt->headerDelay + pkt->payloadDelay;
+    pkt->headerDelay = pkt->payloadDelay = 0;
+    hostPorts[pending.host]->schedTimingResp(pkt, response_time);
+}
+
+bool
+RemoteMemoryPool::recvTimingReq(PacketPtr pkt, PortID host)
+{
+    // a cache above answers the request
+    if (pkt->cacheResponding()) {
+        pendingDelete.reset(pkt);
+        return true;
+    }
+    checkRequest(pkt);
+
+    // the host only puts a request on its link behind the messages
+    // that already wait for credits
+    HostLink &link = links[host];
+    if (!link.outbound.empty() || link.credits == 0) {
+        DPRINTF(RemoteMemoryPool, "Host %d out of credits, not accepting "
+                "%s\n", host, pkt->print());
+        link.retry = true;
+        stats.creditStalls[host]++;
+        return false;
+    }
+
+    sDM::sDMmanager *sdm = protector(host, pkt);
+    std::vector<Addr> meta_reads, meta_writes;
+    if (sdm)
+        collectMetadata(sdm, pkt, meta_reads, meta_writes);
+
+    // the contents of the pool are updated at once, the messages below
+    // only carry the timing
+    Addr addr = pkt->getAddr();
+    unsigned size = pkt->getSize();
+    bool is_read = pkt->isRead();
+    unsigned sideband = sidebandBytes(sdm, addr, size);
+    std::vector<Addr> overflows;
+    std::vector<std::pair<Addr, bool>> flushes;
+    if (!sdm) {
+        Packet access(pkt->req, is_read ? MemCmd::ReadReq : MemCmd::WriteReq);
+        access.dataStatic(pkt->getPtr<uint8_t>());
+        functionalAccess(&access);
+    } else if (is_read) {
+        panic_if(!sdm->read(pkt), "%s: integrity check failed for %s\n",
+                 name(), pkt->print());
+    } else {
+        // the manager leaves the ciphertext in the payload, which the
+        // requestor may still own
+        std::vector<uint8_t> plain(pkt->getConstPtr<uint8_t>(),
+                                   pkt->getConstPtr<uint8_t>() + size);
+        panic_if(!sdm->write(pkt, &overflows),
+                 "%s: integrity check failed for %s\n", name(),
+                 pkt->print());
+        sdm->takeFlushTraffic(flushes);
+        std::memcpy(pkt->getPtr<uint8_t>(), plain.data(), size);
+    }
+
+    // a protected write is encrypted before it leaves the host, and
+    // its metadata is written once updated; a read fetches the data
+    // and the metadata together
+    Tick encrypted = curTick() + (sdm ? cryptoLatency : 0);
+
+    // the other hosts of a shared space are invalidated once the
+    // updated metadata reached the pool, and the write is done when
+    // the host hears that they all acknowledged
+    Tick done = curTick();
+    if (sdm && !is_read) {
+        Tick arrival = encrypted + linkLatency;
+        Tick acked = sendInvalidations(sdm, arrival);
+        if (acked > arrival)
+            done = acked + linkLatency;
+    }
+
+    PacketPtr owner = pkt->needsResponse() ? pkt : nullptr;
+    if (owner) {
+        pendingAccesses.emplace(pkt, PendingAccess{host, 0, done,
+                                                   sdm != nullptr,
+                                                   curTick()});
+    }
+    stats.accesses[host]++;
+
+    queueMessage(host, addr, size, is_read, false, owner,
+                 is_read ? curTick() : encrypted, sideband);
+    for (Addr line : meta_reads)
+        queueMessage(host, line, CL_SIZE, true, true, owner, curTick());
+    for (Addr line : meta_writes)
+        queueMessage(host, line, CL_SIZE, false, true, nullptr, encrypted);
+
+    // the rest of an overflowed half page is read and written back, and
+    // the dirty IIT nodes propagated in write-back mode are written, in
+    // the background but on the same link
+    unsigned line_sideband = sdm && sdm->sidebandMac() ? INLINE_MAC_SIZE : 0;
+    for (Addr half : overflows) {
+        for (Addr line = half; line < half + HALF_PAGE_SIZE;
+             line += CL_SIZE) {
+            if (line == (addr & CL_ALIGN_MASK))
+                continue;
+            queueMessage(host, line, CL_SIZE, true, false, nullptr,
+                         curTick(), line_sideband);
+            queueMessage(host, line, CL_SIZE, false, false, nullptr,
+                         encrypted, line_sideband);
+        }
+    }
+    for (auto [line, flush_read] : flushes)
+        queueMessage(host, line, CL_SIZE, flush_read, true, nullptr, curTick());
+
+    sendMessages(host);
+
+    if (!owner)
+        pendingDelete.reset(pkt);
+    return true;
+}
+
+Tick
+RemoteMemoryPool::atomicMessage(PortID host, Addr addr, unsigned size,
+                                bool is_read, bool meta, unsigned sideband)
+{
+    RequestPtr req = std::make_shared<Request>(addr, size, 0,
+        meta ? metaRequestors[host] : dataRequestors[host]);
+    Packet msg(req, is_read ? MemCmd::ReadReq : MemCmd::WriteReq);
+    msg.allocate();
+    if (!is_read) {
+        Packet snapshot(req, MemCmd::ReadReq);
+        snapshot.dataStatic(msg.getPtr<uint8_t>());
+        functionalAccess(&snapshot);
+    }
+    // each direction carries the payload once and a header
+    return route(addr).sendAtomic(&msg) + 2 * linkLatency +
+        wireTime(slots(size + sideband) + slots(0));
+}
+
+Tick
+RemoteMemoryPool::recvAtomic(PacketPtr pkt, PortID host)
+{
+    if (pkt->cacheResponding())
+        return 0;
+    checkRequest(pkt);
+
+    sDM::sDMmanager *sdm = protector(host, pkt);
+    if (!sdm) {
+        Tick link_time = 2 * linkLatency +
+            wireTime(slots(pkt->getSize()) + slots(0));
+        return route(pkt->getAddr()).sendAtomic(pkt) + link_time;
+    }
+
+    std::vector<Addr> meta_reads, meta_writes;
+    collectMetadata(sdm, pkt, meta_reads, meta_writes);
+    Addr addr = pkt->getAddr();
+    unsigned size = pkt->getSize();
+    bool is_read = pkt->isRead();
+    if (is_read) {
+        panic_if(!sdm->read(pkt), "%s: integrity check failed for %s\n",
+                 name(), pkt->print());
+    } else {
+        // atomic mode has no background traffic, the metadata writes
+        // and the propagated nodes are posted
+        std::vector<uint8_t> plain(pkt->getConstPtr<uint8_t>(),
+                                   pkt->getConstPtr<uint8_t>() + size);
+        std::vector<std::pair<Addr, bool>> traffic;
+        std::vector<sDM::CoherenceMsg> msgs;
+        panic_if(!sdm->write(pkt), "%s: integrity check failed for %s\n",
+                 name(), pkt->print());
+        sdm->takeFlushTraffic(traffic);
+        sdm->takeCoherenceMsgs(msgs);
+        std::memcpy(pkt->getPtr<uint8_t>(), plain.data(), size);
+    }
+
+    // the metadata is fetched in parallel with the data
+    Tick latency = atomicMessage(host, addr, size, is_read, false,
+                                 sidebandBytes(sdm, addr, size));
+    for (Addr line : meta_reads)
+        latency = std::max(latency, atomicMessage(host, line, CL_SIZE,
+                                                  true, true));
+    if (pkt->needsResponse())
+        pkt->makeResponse();
+    return latency + cryptoLatency;
+}
+
+void
+RemoteMemoryPool::recvFunctional(PacketPtr pkt, PortID host)
+{
+    // responses waiting for the host may hold the data
+    if (hostPorts[host]->trySatisfyFunctional(pkt))
+        return;
+
+    sDM::sDMmanager *sdm = protector(host, pkt);
+    if (!sdm) {
+        functionalAccess(pkt);
+        return;
+    }
+
+    // functional accesses bypass the metadata cache and the statistics,
+    // and post no flush traffic or coherence messages
+    if (pkt->isWrite()) {
+        std::vector<uint8_t> plain(pkt->getConstPtr<uint8_t>(),
+                                   pkt->getConstPtr<uint8_t>() +
+                                   pkt->getSize());
+        panic_if(!sdm->functionalWrite(pkt),
+                 "%s: integrity check failed for %s\n", name(),
+                 pkt->print());
+        std::memcpy(pkt->getPtr<uint8_t>(), plain.data(), plain.size());
+    } else {
+        panic_if(!sdm->functionalRead(pkt),
+                 "%s: integrity check failed for %s\n", name(),
+                 pkt->print());
+    }
+    if (pkt->needsResponse())
+        pkt->makeResponse();
+}
+
+RemoteMemoryPool::PoolStats::PoolStats(RemoteMemoryPool &_pool)
+    : statistics::Group(&_pool), pool(_pool),
+
+    ADD_STAT(accesses, statistics::units::Count::get(),
+             "Number of requests of each host"),
+    ADD_STAT(dataMsgs, statistics::units::Count::get(),
+             "Number of data messages sent by each host"),
+    ADD_STAT(metaMsgs, statistics::units::Count::get(),
+             "Number of IIT and HMAC messages sent by each host"),
+    ADD_STAT(dataSlots, statistics::units::Count::get(),
+             "Number of link slots used by data, both directions"),
+    ADD_STAT(metaSlots, statistics::units::Count::get(),
+             "Number of link slots used by IIT nodes and HMACs, both "
+             "directions"),
+    ADD_STAT(creditStalls, statistics::units::Count::get(),
+             "Number of requests refused while a host was out of credits"),
+    ADD_STAT(totLinkWait, statistics::units::Tick::get(),
+             "Total time messages waited for credits and for the link"),
+    ADD_STAT(totAccessLat, statistics::units::Tick::get(),
+             "Total latency of the requests of each host"),
+    ADD_STAT(ctrlMsgs, statistics::units::Count::get(),
+             "Number of messages accepted by each pool-side controller"),
+    ADD_STAT(invalMsgs, statistics::units::Count::get(),
+             "Number of shared metadata invalidations sent to each host"),
+    ADD_STAT(invalSlots, statistics::units::Count::get(),
+             "Number of link slots used by invalidations and their "
+             "acknowledgements"),
+
+    ADD_STAT(metaShare, statistics::units::Ratio::get(),
+             "Share of the link slots used by IIT nodes and HMACs"),
+    ADD_STAT(avgLinkWait, statistics::units::Rate<
+                statistics::units::Tick, statistics::units::Count>::get(),
+             "Average time a message waited for credits and for the link"),
+    ADD_STAT(avgAccessLat, statistics::units::Rate<
+                statistics::units::Tick, statistics::units::Count>::get(),
+             "Average latency of the requests of each host"),
+    ADD_STAT(invalShare, statistics::units::Ratio::get(),
+             "Share of the link slots used by invalidations")
+{
+}
+
+void
+RemoteMemoryPool::PoolStats::regStats()
+{
+    statistics::Group::regStats();
+
+    const size_t hosts = pool.hostPorts.size();
+    for (auto stat : {&accesses, &dataMsgs, &metaMsgs, &dataSlots,
+                      &metaSlots, &creditStalls, &totLinkWait,
+                      &totAccessLat, &invalMsgs, &invalSlots}) {
+        stat->init(hosts);
+        for (size_t i = 0; i < hosts; i++)
+            stat->subname(i, csprintf("host%d", i));
+    }
+    ctrlMsgs.init(pool.poolPorts.size());
+    for (size_t i = 0; i < pool.poolPorts.size(); i++)
+        ctrlMsgs.subname(i, csprintf("ctrl%d", i));
+
+    metaShare.precision(4);
+    metaShare = metaSlots / (dataSlots + metaSlots);
+    avgLinkWait.precision(2);
+    avgLinkWait = totLinkWait / (dataMsgs + metaMsgs);
+    avgAccessLat.precision(2);
+    avgAccessLat = totAccessLat / accesses;
+    invalShare.precision(4);
+    invalShare = invalSlots / (dataSlots + metaSlots + invalSlots);
+}
+
+} // namespace memory
+} // namespace gem5
@@ -0,0 +1,416 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met: redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer;
+ * redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution;
+ * neither the name of the copyright holders nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * RemoteMemoryPool declaration
+ */
+
+#ifndef __REMOTE_MEMORY_POOL_HH__
+#define __REMOTE_MEMORY_POOL_HH__
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/addr_range_map.hh"
+#include "base/statistics.hh"
+#include "mem/port.hh"
+#include "mem/port_proxy.hh"
+#include "mem/qport.hh"
+#include "mem/sDM/sDM.hh"
+#include "params/RemoteMemoryPool.hh"
+#include "sim/eventq.hh"
+#include "sim/sim_object.hh"
+
+namespace gem5
+{
+
+namespace memory
+{
+
+/**
+ * A disaggregated memory pool shared by several hosts, each of them
+ * attached through its own CXL-like link. The media of the pool is
+ * served by the pool-side controllers connected to the memory side
+ * ports, and each host may attach an sDM manager whose spaces and
+ * metadata live in the pool.
+ *
+ * A host link carries messages made of one header slot and one slot
+ * per 16 bytes of payload. Slots are packed into flits, and the wire
+ * time of a message is its share of the flits, framing and CRC
+ * included, at the bandwidth of the link. Both directions of a link
+ * are serialized independently, and every message then pays the
+ * latency of the link.
+ *
+ * The pool buffers the requests of a host in a fixed number of slots.
+ * A host spends one credit per message it puts on the link, and gets
+ * it back once the pool-side controller accepted the message. A host
+ * request is refused while its link has messages waiting for credits.
+ *
+ * The sDM engine of a host sits at its end of the link: the lines of
+ * a protected access, as well as the IIT nodes and HMAC lines missing
+ * in the metadata cache of the manager, cross the link and compete
+ * with every other host for the pool controllers. As in
+ * SecureMemCtrl, the manager keeps the contents of the pool up to
+ * date functionally when a request is accepted, and the messages on
+ * the links only carry the timing: a read discards the data it gets
+ * back, and a write carries what the pool holds when it leaves.
+ *
+ * The shared ranges are mapped by every protected host. The first one
+ * registers them, and the others attach to its space, so that they
+ * use the same IIT, HMACs and keys. After a write to a shared space,
+ * the pool sends an invalidation to every other host for each IIT node
+ * and HMAC line the write changed, plus the new root, and the write
+ * completes once they are all acknowledged. Only the metadata caches
+ * of the sDM engines are kept coherent, the data caches of the hosts
+ * are not snooped.
+ *
+ * With side-band MACs, the truncated MAC of a protected line travels
+ * with its data instead of in a separate HMAC line. The link has no
+ * ECC bits to spare for it, so it is carried as extra payload of the
+ * data messages.
+ */
+class RemoteMemoryPool : public SimObject
+{
+  private:
+
+    /**
+     * End of a host link at the pool.
+     */
+    class HostPort : public QueuedResponsePort
+    {
+      private:
+
+        RespPacketQueue queue;
+        RemoteMemoryPool &pool;
+        const PortID host;
+
+      public:
+
+        HostPort(const std::string &_name, RemoteMemoryPool &_pool,
+                 PortID _host);
+
+      protected:
+
+        Tick recvAtomic(PacketPtr pkt) override;
+        void recvFunctional(PacketPtr pkt) override;
+        bool recvTimingReq(PacketPtr pkt) override;
+        AddrRangeList getAddrRanges() const override;
+    };
+
+    /**
+     * Port to a pool-side controller. Messages are sent in the order
+     * they arrive at the pool.
+     */
+    class PoolPort : public RequestPort
+    {
+      private:
+
+        RemoteMemoryPool &pool;
+        const PortID ctrl;
+
+        /** Messages arrived at the pool, by arrival tick */
+        std::multimap<Tick, PacketPtr> queue;
+
+        /** The controller refused the oldest message */
+        bool waitingRetry;
+
+        EventFunctionWrapper sendEvent;
+
+        /**
+         * Send the messages that arrived by now, until the controller
+         * refuses one.
+         */
+        void trySend();
+
+      public:
+
+        PoolPort(const std::string &_name, RemoteMemoryPool &_pool,
+                 PortID _ctrl);
+
+        /**
+         * Queue a message for the controller.
+         *
+         * @param pkt The message
+         * @param when Tick at which it arrives at the pool
+         */
+        void schedSend(PacketPtr pkt, Tick when);
+
+        bool empty() const { return queue.empty(); }
+
+      protected:
+
+        bool recvTimingResp(PacketPtr pkt) override;
+        void recvReqRetry() override;
+        void recvRangeChange() override;
+    };
+
+    /**
+     * Timing state of one host link.
+     */
+    struct HostLink
+    {
+        /** Tick at which each direction is done with its last message */
+        Tick reqFree;
+        Tick respFree;
+        /** Buffer slots left at the pool for this host */
+        unsigned credits;
+        /** A request of the host was refused */
+        bool retry;
+        /** Messages of the host waiting for a credit, oldest first */
+        std::deque<PacketPtr> outbound;
+    };
+
+    /**
+     * A message on a host link, from the pool packet that carries it.
+     */
+    struct Transfer
+    {
+        PortID host;
+        /** Host request waiting for the message, nullptr if none */
+        PacketPtr owner;
+        /** IIT or HMAC line rather than data */
+        bool meta;
+        /** Tick from which the host may put it on the link */
+        Tick ready;
+        /** Bytes of side-band MACs carried along with the payload */
+        unsigned sideband;
+    };
+
+    /**
+     * A host request waiting for its messages to come back.
+     */
+    struct PendingAccess
+    {
+        PortID host;
+        /** Messages not back at the host yet */
+        unsigned outstanding;
+        /** Tick at which the last message was back */
+        Tick done;
+        /** The request goes through the sDM engine */
+        bool secure;
+        /** Tick at which the host sent the request */
+        Tick entered;
+    };
+
+    std::vector<std::unique_ptr<HostPort>> hostPorts;
+    std::vector<std::unique_ptr<PoolPort>> poolPorts;
+
+    /** sDM manager of each host, nullptr for an unprotected host */
+    std::vector<sDM::sDMmanager *> sdms;
+
+    std::vector<HostLink> links;
+
+    /** Requestor ids of the data and metadata of each host */
+    std::vector<RequestorID> dataRequestors;
+    std::vector<RequestorID> metaRequestors;
+
+    /** Pool-side controller of every address of the pool */
+    AddrRangeMap<PortID> routes;
+    bool routesValid;
+
+    /** Functional access to the pool used by the sDM managers */
+    PortProxy poolProxy;
+
+    /** Wire time of one slot, framing included */
+    const double slotTicks;
+    const Tick linkLatency;
+    const unsigned hostCredits;
+    const Tick cryptoLatency;
+
+    std::unordered_map<PacketPtr, Transfer> transfers;
+    std::unordered_map<PacketPtr, PendingAccess> pendingAccesses;
+
+    /** Ranges mapped by all the protected hosts */
+    const std::vector<AddrRange> sharedRanges;
+
+    /** Packet to delete once the call stack unwinds */
+    std::unique_ptr<Packet> pendingDelete;
+
+    /**
+     * @return The port of the controller serving an address
+     */
+    PoolPort &route(Addr addr);
+
+    /**
+     * @return The sDM manager of a host if it protects a line of the
+     *         packet, nullptr otherwise
+     */
+    sDM::sDMmanager *protector(PortID host, PacketPtr pkt) const;
+
+    /**
+     * Access the pool functionally.
+     */
+    void functionalAccess(PacketPtr pkt);
+
+    /**
+     * Collect the metadata lines a protected access brings over the
+     * link, as SecureMemCtrl::collectMetadata does for its media.
+     */
+    void collectMetadata(sDM::sDMmanager *sdm, PacketPtr pkt,
+                         std::vector<Addr> &meta_reads,
+                         std::vector<Addr> &meta_writes);
+
+    /**
+     * Number of slots of a message with a given payload.
+     */
+    unsigned slots(unsigned payload) const;
+
+    /**
+     * Bytes of side-band MACs carried with the data of an access.
+     *
+     * @param sdm The sDM manager of the host, nullptr if none
+     */
+    unsigned sidebandBytes(sDM::sDMmanager *sdm, Addr addr,
+                           unsigned size) const;
+
+    /**
+     * Wire time of a number of slots.
+     */
+    Tick wireTime(unsigned n) const;
+
+    /**
+     * Send an invalidation to a host and get its acknowledgement back.
+     *
+     * @param host The host to invalidate
+     * @param payload Bytes carried by the invalidation
+     * @param when Tick from which the pool may send it
+     * @return Tick at which the acknowledgement is back at the pool
+     */
+    Tick backInvalidate(PortID host, unsigned payload, Tick when);
+
+    /**
+     * Send the invalidations produced by a write of a host.
+     *
+     * @param sdm The sDM manager of the host
+     * @param when Tick from which the pool may send them
+     * @return Tick at which the last acknowledgement is back at the pool
+     */
+    Tick sendInvalidations(sDM::sDMmanager *sdm, Tick when);
+
+    /**
+     * Check that the pool supports a host request.
+     */
+    void checkRequest(PacketPtr pkt) const;
+
+    /**
+     * Build a message of a host and queue it behind the others.
+     */
+    void queueMessage(PortID host, Addr addr, unsigned size,
+                           bool is_read, bool meta, PacketPtr owner,
+                           Tick ready, unsigned sideband = 0);
+
+    /**
+     * Put the messages of a host on its link while it has credits.
+     */
+    void sendMessages(PortID host);
+
+    /**
+     * A controller accepted a message, give the credit back.
+     */
+    void messageAccepted(PacketPtr pkt);
+
+    /**
+     * A controller answered a message, send the answer to the host.
+     */
+    void messageDone(PacketPtr pkt);
+
+    /**
+     * All the messages of a host request are back, answer it.
+     */
+    void finishAccess(PacketPtr pkt);
+
+    bool recvTimingReq(PacketPtr pkt, PortID host);
+    Tick recvAtomic(PacketPtr pkt, PortID host);
+    void recvFunctional(PacketPtr pkt, PortID host);
+
+    /**
+     * Latency of a pool access in atomic mode, the contents are left
+     * untouched.
+     */
+    Tick atomicMessage(PortID host, Addr addr, unsigned size, bool is_read,
+                       bool meta, unsigned sideband = 0);
+
+    AddrRangeList getAddrRanges() const;
+
+    /**
+     * The ranges of a controller changed, tell the hosts.
+     */
+    void rangeChange();
+
+    /**
+     * Signal the end of the drain once nothing is in flight.
+     */
+    void checkDrained();
+
+    struct PoolStats : public statistics::Group
+    {
+        PoolStats(RemoteMemoryPool &pool);
+
+        void regStats() override;
+
+        RemoteMemoryPool &pool;
+
+        statistics::Vector accesses;
+        statistics::Vector dataMsgs;
+        statistics::Vector metaMsgs;
+        statistics::Vector dataSlots;
+        statistics::Vector metaSlots;
+        statistics::Vector creditStalls;
+        statistics::Vector totLinkWait;
+        statistics::Vector totAccessLat;
+        statistics::Vector ctrlMsgs;
+        statistics::Vector invalMsgs;
+        statistics::Vector invalSlots;
+
+        statistics::Formula metaShare;
+        statistics::Formula avgLinkWait;
+        statistics::Formula avgAccessLat;
+        statistics::Formula invalShare;
+    };
+
+    PoolStats stats;
+
+  public:
+
+    RemoteMemoryPool(const RemoteMemoryPoolParams &p);
+
+    Port &getPort(const std::string &if_name,
+                  PortID idx=InvalidPortID) override;
+
+    void init() override;
+    void startup() override;
+
+    DrainState drain() override;
+};
+
+} // namespace memory
+} // namespace gem5
+
+#endif //__REMOTE_MEMORY_POOL_HH__
@@ -3,13 +3,8 @@
 
 #include <string.h>
 #include <stdint.h>
-#define SM3_PADLEN (SM3_len >> 3) // = SM3_SIZE
-#define GETOPAD(x, y)                    \
-    for (int i = 0; i < SM3_PADLEN; i++) \
-        (x)[i] = (y)[i] ^ 0x5c;
-#define GETIPAD(x, y)                    \
-    for (int i = 0; i < SM3_PADLEN; i++) \
-        (x)[i] = (y)[i] ^ 0x36;
+
+#include <algorithm>
 namespace gem5
 {
     namespace CME
@@ -44,15 +39,15 @@ namespace gem5
         {
             memset(OTP, 0, CL_SIZE);
             for (int i = 0; i < counterLen; i++)
-                *(OTP + 0 + i) = *counter;         // 0~9B  :counter
+                *(OTP + 0 + i) = counter[i];         // 0~9B  :counter
             *((sDM::Addr *)(OTP + 10)) = paddr2CL; // 10~17B:addr
                                                    // 18~19B:0x0
             for (int i = 0; i < counterLen; i++)
-                *(OTP + 20 + i) = *counter;        // 20~29B:counter
+                *(OTP + 20 + i) = counter[i];        // 20~29B:counter
             *((sDM::Addr *)(OTP + 30)) = paddr2CL; // 30~37B:addr
                                                    // 38~39B:0x0
             for (int i = 0; i < counterLen; i++)
-                *(OTP + 40 + i) = *counter;        // 40~49B:counter
+                *(OTP + 40 + i) = counter[i];        // 40~49B:counter
             *((sDM::Addr *)(OTP + 50)) = paddr2CL; // 50-47B:addr
                                                    // 58~59B:0x0
 
@@ -69,21 +64,18 @@ namespace gem5
          * @param counter CL counter指针
          * @param counterLen 计数器字节长度10B(sizeof(CL_Counter))
          * @param paddr2CL CL的物理地址
-         * @param key2EncryptionCL 加密密钥指针
+         * @param ctx 由加密密钥扩展的轮密钥
+         * @attention OTP的4个分组互相独立,一次交给多块引擎
          */
-        void sDM_Encrypt(uint8_t *plaint, uint8_t *counter, int counterLen, sDM::Addr paddr2CL, uint8_t *key2EncryptionCL)
+        void sDM_Encrypt(uint8_t *plaint, uint8_t *counter, int counterLen, sDM::Addr paddr2CL, const CipherKey *ctx)
         {
-            // 加密分块数
-            uint8_t OTP[CL_SIZE], otp_cipher[SM4_INPUT_SIZE];
+            if (!ctx->backend->functional())
+                return;
+            uint8_t OTP[CL_SIZE];
             ConstructOTP(paddr2CL, counter, counterLen, OTP);
-            memset(otp_cipher, 0, SM4_INPUT_SIZE);
-            int rdcnt = CL_SIZE / SM4_INPUT_SIZE;
-            for (int i = 0; i < rdcnt; i++)
-            {
-                sm4::SM4_Encrypt(key2EncryptionCL, OTP + (i << 4), otp_cipher);
-                for (int j = 0; j < SM4_INPUT_SIZE; j++)
-                    (*(plaint + (i << 4) + j)) ^= otp_cipher[j];
-            }
+            ctx->backend->encryptBlocks(ctx, OTP, OTP, CL_SIZE / CRYPTO_BLOCK_SIZE);
+            for (int j = 0; j < CL_SIZE; j++)
+                plaint[j] ^= OTP[j];
         }
         /**
          * @brief 使用counter mode解密cipher
@@ -92,59 +84,151 @@ namespace gem5
          * @param counter CL_Counter指针
          * @param counterLen 计数器字节长度10B(sizeof(CL_Counter))
          * @param paddr2CL CL物理地址
-         * @param key2EncryptionCL 密钥指针
+         * @param ctx 由加密密钥扩展的轮密钥
          */
-        void sDM_Decrypt(uint8_t *cipher, uint8_t *counter, int counterLen, sDM::Addr paddr2CL, uint8_t *key2EncryptionCL)
+        void sDM_Decrypt(uint8_t *cipher, uint8_t *counter, int counterLen, sDM::Addr paddr2CL, const CipherKey *ctx)
         {
-            // 加密分块数
-            uint8_t OTP[CL_SIZE], otp_plaint[SM4_INPUT_SIZE];
-            ConstructOTP(paddr2CL, counter, counterLen, OTP);
-
-            memset(otp_plaint, 0, SM4_INPUT_SIZE);
-            int rdcnt = CL_SIZE / SM4_INPUT_SIZE;
-            for (int i = 0; i < rdcnt; i++)
+            // counter mode解密同样是加密OTP得到密钥流
+            sDM_Encrypt(cipher, counter, counterLen, paddr2CL, ctx);
+        }
+        /**
+         * @author yqy
+         * @brief 将src按8B字异或到dst上,编译器可以将其展开为向量指令
+         */
+        static void xorWords(uint8_t *dst, const uint8_t *src, int len)
+        {
+            for (int j = 0; j < len; j += sizeof(uint64_t))
+            {
+                uint64_t a, b;
+                memcpy(&a, dst + j, sizeof(uint64_t));
+                memcpy(&b, src + j, sizeof(uint64_t));
+                a ^= b;
+                memcpy(dst + j, &a, sizeof(uint64_t));
+            }
+        }
+        /**
+         * @author yqy
+         * @brief 只由计数器与地址生成n个物理连续的CL的OTP,不需要密文,读操作可以在取回密文之前调用
+         * @param counters n个计数器依次存放,每个counterLen字节
+         * @param paddr2CL 第一个CL的物理地址
+         * @param OTP      输出n*CL_SIZE字节的密钥流,不做加密的后端输出全0
+         * @attention 所有分组一次交给多块引擎
+         */
+        void sDM_GenerateOTP(const uint8_t *counters, int counterLen, sDM::Addr paddr2CL, int n, const CipherKey *ctx, uint8_t *OTP)
+        {
+            if (!ctx->backend->functional())
+            {
+                memset(OTP, 0, n * CL_SIZE);
+                return;
+            }
+            for (int i = 0; i < n; i++)
+                ConstructOTP(paddr2CL + (sDM::Addr)i * CL_SIZE, (uint8_t *)counters + i * counterLen, counterLen, OTP + i * CL_SIZE);
+            ctx->backend->encryptBlocks(ctx, OTP, OTP, n * CL_SIZE / CRYPTO_BLOCK_SIZE);
+        }
+        /**
+         * @author yqy
+         * @brief 将sDM_GenerateOTP生成的OTP异或到n个CL上,完成加密或解密
+         */
+        void sDM_ApplyOTP(uint8_t *data, const uint8_t *OTP, int n)
+        {
+            xorWords(data, OTP, n * CL_SIZE);
+        }
+        /**
+         * @author yqy
+         * @brief 使用counter mode加密/解密n个物理连续的CL
+         * @param data       n个CL,原地更新
+         * @param counters   n个计数器依次存放,每个counterLen字节
+         * @param counterLen 计数器字节长度10B(sizeof(CL_Counter))
+         * @param paddr2CL   第一个CL的物理地址
+         * @param n          CL个数
+         * @param ctx        由加密密钥扩展的轮密钥
+         * @attention 每次构造一页的OTP,一次交给多块引擎后整体异或,结果与逐行调用sDM_Encrypt相同
+         */
+        void sDM_EncryptLines(uint8_t *data, const uint8_t *counters, int counterLen, sDM::Addr paddr2CL, int n, const CipherKey *ctx)
+        {
+            if (!ctx->backend->functional())
+                return;
+            uint8_t OTP[PAGE_SIZE];
+            for (int base = 0; base < n; base += PAGE_SIZE / CL_SIZE)
             {
-                sm4::SM4_Decrypt(key2EncryptionCL, OTP + (i << 4), otp_plaint);
-                for (int j = 0; j < SM4_INPUT_SIZE; j++)
-                    (*(cipher + (i << 4) + j)) ^= otp_plaint[j];
+                int lines = std::min(n - base, PAGE_SIZE / CL_SIZE);
+                sDM_GenerateOTP(counters + base * counterLen, counterLen, paddr2CL + (sDM::Addr)base * CL_SIZE, lines, ctx, OTP);
+                sDM_ApplyOTP(data + base * CL_SIZE, OTP, lines);
             }
         }
+        /**
+         * @author yqy
+         * @brief 加密一页(4K)数据,远端内存的传输粒度为页
+         * @param counters 页内64个CL的计数器依次存放
+         */
+        void sDM_EncryptPage(uint8_t *page, const uint8_t *counters, int counterLen, sDM::Addr pagePaddr, const CipherKey *ctx)
+        {
+            sDM_EncryptLines(page, counters, counterLen, pagePaddr, PAGE_SIZE / CL_SIZE, ctx);
+        }
+        /**
+         * @author yqy
+         * @brief 解密一页(4K)数据
+         */
+        void sDM_DecryptPage(uint8_t *page, const uint8_t *counters, int counterLen, sDM::Addr pagePaddr, const CipherKey *ctx)
+        {
+            // counter mode解密同样是加密OTP得到密钥流
+            sDM_EncryptLines(page, counters, counterLen, pagePaddr, PAGE_SIZE / CL_SIZE, ctx);
+        }
         /**
          * @author
          * yqy
          * @brief
-         * 计算密文数据(半页)的HMAC
+         * 计算密文数据(半页)的HMAC: HMAC(input||counter||paddr)
          * @param input    输入消息指针
          * @param inputLen 输入消息字节长度
-         * @param hamc_key 用于计算hmac的密钥
+         * @param hmac_key 由后端预处理的MAC密钥
          * @param paddr    输入消息的物理地址
          * @param counter  512bit(含有部分填充0)的计数器指针
          * @param counterLen 计数器字节长度
          * @param hmac     计算结果存储指针
          * @param hmacLen  输出字节长度
          * @attention
-         * 这个函数用于计算iit节点的hash_tag(传入的counter是全零)和hamc
+         * 这个函数用于计算iit节点的hash_tag和半页数据的hmac
+         * 消息各部分直接流式处理,不需要拼接缓冲区
+         */
+        void sDM_HMAC(uint8_t *input, int inputLen, const MacKey *hmac_key, sDM::Addr paddr, uint8_t *counter, int counterLen, uint8_t *hmac, int hmacLen)
+        {
+            hmac_key->backend->mac_xN(hmac_key, &input, inputLen, &paddr, &counter, counterLen, &hmac, hmacLen, 1);
+        }
+        /**
+         * @author yqy
+         * @brief 批量计算n个等长消息的HMAC,sm3后端每SM3_MB_LANES个消息在SIMD寄存器中并行压缩
+         * @param input    n个输入消息指针
+         * @param inputLen 每个输入消息的字节长度
+         * @param hmac_key 由后端预处理的MAC密钥
+         * @param paddr    n个输入消息的物理地址
+         * @param counter  n个计数器指针
+         * @param counterLen 计数器字节长度
+         * @param hmac     n个计算结果存储指针
+         * @param hmacLen  输出字节长度
+         * @param n        消息个数
+         * @attention 结果与逐个调用sDM_HMAC相同
+         */
+        void sDM_HMAC_xN(uint8_t *const input[], int inputLen, const MacKey *hmac_key, const sDM::Addr paddr[],
+                         uint8_t *const counter[], int counterLen, uint8_t *const hmac[], int hmacLen, int n)
+        {
+            hmac_key->backend->mac_xN(hmac_key, input, inputLen, paddr, counter, counterLen, hmac, hmacLen, n);
+        }
+        /**
+         * @author yqy
+         * @brief 一次计算一页中两个半页的HMAC,两个消息在SIMD寄存器中并行压缩
+         * @param page      一页密文
+         * @param pagePaddr 页的物理地址
+         * @param sum       低/高半页对应叶节点的计数器之和
+         * @param hmac      低/高半页的HMAC
+         * @attention 结果与分别对两个半页调用sDM_HMAC相同
          */
-        void sDM_HMAC(uint8_t *input, int inputLen, uint8_t *hamc_key, sDM::Addr paddr, uint8_t *counter, int counterLen, uint8_t *hmac, int hmacLen)
+        void sDM_PageHMAC(uint8_t *page, const MacKey *hmac_key, sDM::Addr pagePaddr, uint8_t *const sum[2], int counterLen,
+                          uint8_t *const hmac[2], int hmacLen)
         {
-            assert(hmacLen <= SM3_SIZE && "invalid output length");
-            int Mlen = (inputLen + counterLen + sizeof(sDM::Addr));
-            int PaddingLen = (SM3_SIZE - (Mlen % SM3_SIZE)) % SM3_SIZE;
-            uint8_t V[SM3_PADLEN + Mlen + PaddingLen], p1[SM3_SIZE];
-            GETIPAD(V, hamc_key);
-            // (ipad ^ K)||(M[input||counter||addr]|padding|)
-            memcpy(V + SM3_PADLEN, input, inputLen);
-            memcpy(V + SM3_PADLEN + inputLen, counter, counterLen);
-            memcpy(V + SM3_PADLEN + inputLen + counterLen, &paddr, sizeof(sDM::Addr));
-            // H((ipad ^ K)||M)
-            sm3::SM3_256(V, SM3_PADLEN + Mlen + PaddingLen, p1); // P1= H((ipad ^ K)||M)
-            // (opad ^ K) || H((ipad ^ K)||M)
-            GETOPAD(V, hamc_key);
-            memcpy(V + SM3_SIZE, p1, SM3_SIZE);
-            // H((opad ^ K) || H((ipad ^ K)||M)
-            sm3::SM3_256(V, SM3_SIZE + SM3_SIZE, p1);
-            // cut
-            memcpy(hmac, p1, hmacLen);
+            uint8_t *const input[2] = {page, page + HALF_PAGE_SIZE};
+            const sDM::Addr paddr[2] = {pagePaddr, pagePaddr + HALF_PAGE_SIZE};
+            sDM_HMAC_xN(input, HALF_PAGE_SIZE, hmac_key, paddr, sum, counterLen, hmac, hmacLen, 2);
         }
     }
 }
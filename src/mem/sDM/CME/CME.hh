@@ -2,17 +2,25 @@
 #define _CME_HH_
 
 #include "../sDM_def.hh"
-#include "../alg_src/sm4/SM4_ENC.hh"
-#include "../alg_src/sm3/SM3.hh"
+#include "Crypto.hh"
 
 namespace gem5
 {
     namespace CME
     {
         void ConstructOTP(sDM::Addr paddr2CL, uint8_t *counter, int counterLen, uint8_t *OTP);
-        void sDM_Encrypt(uint8_t *plaint, uint8_t *counter, int counterLen, sDM::Addr paddr2CL, uint8_t *key2EncryptionCL);
-        void sDM_Decrypt(uint8_t *cipher, uint8_t *counter, int counterLen, sDM::Addr paddr2CL, uint8_t *key2EncryptionCL);
-        void sDM_HMAC(uint8_t *input, int inputLen, uint8_t *hamc_key, sDM::Addr paddr, uint8_t *counter, int counterLen, uint8_t *hmac, int hmacLen);
+        void sDM_Encrypt(uint8_t *plaint, uint8_t *counter, int counterLen, sDM::Addr paddr2CL, const CipherKey *ctx);
+        void sDM_Decrypt(uint8_t *cipher, uint8_t *counter, int counterLen, sDM::Addr paddr2CL, const CipherKey *ctx);
+        void sDM_GenerateOTP(const uint8_t *counters, int counterLen, sDM::Addr paddr2CL, int n, const CipherKey *ctx, uint8_t *OTP);
+        void sDM_ApplyOTP(uint8_t *data, const uint8_t *OTP, int n);
+        void sDM_EncryptLines(uint8_t *data, const uint8_t *counters, int counterLen, sDM::Addr paddr2CL, int n, const CipherKey *ctx);
+        void sDM_EncryptPage(uint8_t *page, const uint8_t *counters, int counterLen, sDM::Addr pagePaddr, const CipherKey *ctx);
+        void sDM_DecryptPage(uint8_t *page, const uint8_t *counters, int counterLen, sDM::Addr pagePaddr, const CipherKey *ctx);
+        void sDM_HMAC(uint8_t *input, int inputLen, const MacKey *hmac_key, sDM::Addr paddr, uint8_t *counter, int counterLen, uint8_t *hmac, int hmacLen);
+        void sDM_HMAC_xN(uint8_t *const input[], int inputLen, const MacKey *hmac_key, const sDM::Addr paddr[],
+                         uint8_t *const counter[], int counterLen, uint8_t *const hmac[], int hmacLen, int n);
+        void sDM_PageHMAC(uint8_t *page, const MacKey *hmac_key, sDM::Addr pagePaddr, uint8_t *const sum[2], int counterLen,
+                          uint8_t *const hmac[2], int hmacLen);
     }
 }
 #endif // _CME_HH_
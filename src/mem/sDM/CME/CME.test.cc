@@ -0,0 +1,139 @@
+/**
+ * @author yqy
+ * @brief CME批量接口和页接口的单元测试:结果必须与逐行接口相同
+ */
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <vector>
+
+#include "CME.hh"
+
+using namespace gem5;
+using namespace gem5::CME;
+
+namespace
+{
+
+const int counterLen = 10; // sizeof(CL_Counter)
+
+class CMETest : public ::testing::TestWithParam<CryptoType>
+{
+  protected:
+    void
+    SetUp() override
+    {
+        backend = getCryptoBackend(GetParam());
+        uint8_t raw[CRYPTO_KEY_SIZE];
+        for (int i = 0; i < CRYPTO_KEY_SIZE; i++)
+            raw[i] = (uint8_t)(i * 13 + 5);
+        backend->setCipherKey(&ctx, raw);
+        backend->setMacKey(&mac, raw, CRYPTO_KEY_SIZE);
+    }
+
+    const CryptoBackend *backend;
+    CipherKey ctx;
+    MacKey mac;
+};
+
+std::vector<uint8_t>
+pattern(int len, int seed)
+{
+    std::vector<uint8_t> v(len);
+    for (int i = 0; i < len; i++)
+        v[i] = (uint8_t)(seed * 29 + i * 7 + 3);
+    return v;
+}
+
+} // anonymous namespace
+
+/* 跨越一页OTP缓冲的行数也要与逐行加密一致 */
+TEST_P(CMETest, EncryptLinesMatchesPerLine)
+{
+    const sDM::Addr base = 0x12345000;
+    const int maxLines = PAGE_SIZE / CL_SIZE + 5;
+    for (int n : {1, 7, PAGE_SIZE / CL_SIZE / 2, PAGE_SIZE / CL_SIZE, maxLines}) {
+        std::vector<uint8_t> data = pattern(n * CL_SIZE, n);
+        std::vector<uint8_t> counters = pattern(n * counterLen, n + 1);
+        std::vector<uint8_t> ref = data;
+        for (int i = 0; i < n; i++)
+            sDM_Encrypt(ref.data() + i * CL_SIZE, counters.data() + i * counterLen, counterLen,
+                        base + (sDM::Addr)i * CL_SIZE, &ctx);
+        sDM_EncryptLines(data.data(), counters.data(), counterLen, base, n, &ctx);
+        ASSERT_EQ(ref, data) << n << " lines";
+
+        // counter mode解密即再加密一次
+        sDM_EncryptLines(data.data(), counters.data(), counterLen, base, n, &ctx);
+        ASSERT_EQ(pattern(n * CL_SIZE, n), data) << n << " lines";
+    }
+}
+
+TEST_P(CMETest, HMACxNMatchesPerMessage)
+{
+    const int n = 5;
+    const int hmacLen = 8;
+    std::vector<uint8_t> msg[n], ctr[n];
+    uint8_t out[n][hmacLen], ref[hmacLen];
+    uint8_t *in[n], *cp[n], *op[n];
+    sDM::Addr paddr[n];
+    for (int i = 0; i < n; i++) {
+        msg[i] = pattern(HALF_PAGE_SIZE, i);
+        ctr[i] = pattern(CL_SIZE, i + 100);
+        in[i] = msg[i].data();
+        cp[i] = ctr[i].data();
+        op[i] = out[i];
+        paddr[i] = 0x40000000 + (sDM::Addr)i * HALF_PAGE_SIZE;
+    }
+    for (int len : {CL_SIZE, HALF_PAGE_SIZE}) {
+        sDM_HMAC_xN(in, len, &mac, paddr, cp, CL_SIZE, op, hmacLen, n);
+        for (int i = 0; i < n; i++) {
+            sDM_HMAC(in[i], len, &mac, paddr[i], cp[i], CL_SIZE, ref, hmacLen);
+            ASSERT_EQ(0, memcmp(ref, out[i], hmacLen)) << "length " << len << ", message " << i;
+        }
+    }
+}
+
+TEST_P(CMETest, PageMatchesPerLine)
+{
+    const sDM::Addr page = 0x7654000;
+    const int lines = PAGE_SIZE / CL_SIZE;
+    std::vector<uint8_t> data = pattern(PAGE_SIZE, 1);
+    std::vector<uint8_t> counters = pattern(lines * counterLen, 2);
+    std::vector<uint8_t> ref = data;
+    for (int i = 0; i < lines; i++)
+        sDM_Encrypt(ref.data() + i * CL_SIZE, counters.data() + i * counterLen, counterLen,
+                    page + (sDM::Addr)i * CL_SIZE, &ctx);
+    sDM_EncryptPage(data.data(), counters.data(), counterLen, page, &ctx);
+    ASSERT_EQ(ref, data);
+    for (int i = 0; i < lines; i++)
+        sDM_Decrypt(ref.data() + i * CL_SIZE, counters.data() + i * counterLen, counterLen,
+                    page + (sDM::Addr)i * CL_SIZE, &ctx);
+    sDM_DecryptPage(data.data(), counters.data(), counterLen, page, &ctx);
+    EXPECT_EQ(ref, data);
+    EXPECT_EQ(pattern(PAGE_SIZE, 1), data);
+}
+
+TEST_P(CMETest, PageHMACMatchesHalves)
+{
+    const sDM::Addr page = 0x7654000;
+    std::vector<uint8_t> data = pattern(PAGE_SIZE, 3);
+    std::vector<uint8_t> lo = pattern(CL_SIZE, 4), hi = pattern(CL_SIZE, 5);
+    uint8_t out[2][HMAC_SIZE], ref[HMAC_SIZE];
+    uint8_t *const sum[2] = {lo.data(), hi.data()};
+    uint8_t *const hmac[2] = {out[0], out[1]};
+    sDM_PageHMAC(data.data(), &mac, page, sum, counterLen, hmac, HMAC_SIZE);
+    for (int i = 0; i < 2; i++) {
+        sDM_HMAC(data.data() + i * HALF_PAGE_SIZE, HALF_PAGE_SIZE, &mac, page + i * HALF_PAGE_SIZE, sum[i],
+                 counterLen, ref, HMAC_SIZE);
+        EXPECT_EQ(0, memcmp(ref, out[i], HMAC_SIZE)) << "half " << i;
+    }
+}
+
+TEST_P(CMETest, SelfCheck)
+{
+    EXPECT_EQ(0, backend->selfCheck());
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, CMETest,
+                         ::testing::Values(CRYPTO_SM4_SM3, CRYPTO_AES_GHASH, CRYPTO_NULL));
@@ -0,0 +1,191 @@
+#include "Crypto.hh"
+#include "cassert"
+
+#include <string.h>
+#include <stdint.h>
+
+#include <algorithm>
+namespace gem5
+{
+    namespace CME
+    {
+        /**
+         * @author yqy
+         * @brief SM4计数器模式 + SM3-HMAC,sDM的默认算法
+         */
+        class SM4SM3Backend : public CryptoBackend
+        {
+          public:
+            const char *name() const override { return "sm4_sm3"; }
+            int selfCheck() const override
+            {
+                // 多块sm4引擎与标量实现必须一致,否则密文会随宿主CPU不同而不同
+                return sm3::SM3_HMAC_SelfTest() || sm3::SM3_MB_SelfTest() || sm4::SM4_MB_SelfCheck();
+            }
+            void setCipherKey(CipherKey *key, const uint8_t *raw) const override
+            {
+                key->backend = this;
+                sm4::SM4_SetKey(&key->sm4, (unsigned char *)raw);
+            }
+            void setMacKey(MacKey *key, const uint8_t *raw, int rawLen) const override
+            {
+                key->backend = this;
+                sm3::SM3_HMAC_SetKey(&key->sm3, raw, rawLen);
+            }
+            void encryptBlocks(const CipherKey *key, const uint8_t *in, uint8_t *out, int nblocks) const override
+            {
+                sm4::SM4_EncryptBlocks(&key->sm4, in, out, nblocks);
+            }
+            /**
+             * @attention 单个消息直接流式压缩,多个消息每SM3_MB_LANES个在SIMD寄存器中并行压缩
+             */
+            void mac_xN(const MacKey *key, uint8_t *const input[], int inputLen, const sDM::Addr paddr[],
+                        uint8_t *const counter[], int counterLen, uint8_t *const mac[], int macLen, int n) const override
+            {
+                assert(macLen <= SM3_SIZE && "invalid output length");
+                if (n == 1)
+                {
+                    sm3::SM3_HMAC_STATE hs;
+                    uint8_t out[SM3_SIZE];
+                    sm3::SM3_HMAC_init(&hs, &key->sm3);
+                    sm3::SM3_HMAC_process(&hs, input[0], inputLen);
+                    sm3::SM3_HMAC_process(&hs, counter[0], counterLen);
+                    sm3::SM3_HMAC_process(&hs, (const uint8_t *)&paddr[0], sizeof(sDM::Addr));
+                    sm3::SM3_HMAC_done(&hs, out);
+                    // cut
+                    memcpy(mac[0], out, macLen);
+                    return;
+                }
+                sm3::SM3_HMAC_STATE hs[SM3_MB_LANES];
+                sm3::SM3_HMAC_STATE *hp[SM3_MB_LANES];
+                const uint8_t *in[SM3_MB_LANES];
+                uint8_t out[SM3_MB_LANES][SM3_SIZE];
+                uint8_t *op[SM3_MB_LANES];
+                for (int base = 0; base < n; base += SM3_MB_LANES)
+                {
+                    int lanes = std::min(n - base, SM3_MB_LANES);
+                    for (int l = 0; l < lanes; l++)
+                    {
+                        sm3::SM3_HMAC_init(&hs[l], &key->sm3);
+                        hp[l] = &hs[l];
+                        op[l] = out[l];
+                    }
+                    for (int l = 0; l < lanes; l++)
+                        in[l] = input[base + l];
+                    sm3::SM3_HMAC_process_xN(hp, in, inputLen, lanes);
+                    for (int l = 0; l < lanes; l++)
+                        in[l] = counter[base + l];
+                    sm3::SM3_HMAC_process_xN(hp, in, counterLen, lanes);
+                    for (int l = 0; l < lanes; l++)
+                        in[l] = (const uint8_t *)&paddr[base + l];
+                    sm3::SM3_HMAC_process_xN(hp, in, sizeof(sDM::Addr), lanes);
+                    sm3::SM3_HMAC_done_xN(hp, op, lanes);
+                    // cut
+                    for (int l = 0; l < lanes; l++)
+                        memcpy(mac[base + l], out[l], macLen);
+                }
+            }
+        };
+        /**
+         * @author yqy
+         * @brief AES-128计数器模式 + GMAC形式的MAC
+         * MAC = GHASH_H(input||counter||paddr) ^ E_K(counter||paddr)
+         * |---10B---|---6B---|
+         * |-counter-|-pADDR--|  nonce分组,paddr取低48bit
+         * @attention 标签只有128bit,HMAC_SIZE中多出的字节填0,保持元数据布局与访存量不变
+         */
+        class AESGHASHBackend : public CryptoBackend
+        {
+          public:
+            const char *name() const override { return "aes_ghash"; }
+            int selfCheck() const override
+            {
+                return aes::AES_SelfCheck() || aes::GHASH_SelfCheck();
+            }
+            void setCipherKey(CipherKey *key, const uint8_t *raw) const override
+            {
+                key->backend = this;
+                aes::AES_SetKey(&key->aes, raw);
+            }
+            void setMacKey(MacKey *key, const uint8_t *raw, int rawLen) const override
+            {
+                assert(rawLen >= AES_KEY_SIZE && "mac key too short");
+                uint8_t h[AES_INPUT_SIZE] = {0};
+                key->backend = this;
+                aes::AES_SetKey(&key->gmac.aes, raw);
+                aes::AES_EncryptBlocks(&key->gmac.aes, h, h, 1);
+                aes::GHASH_SetKey(&key->gmac.ghash, h);
+            }
+            void encryptBlocks(const CipherKey *key, const uint8_t *in, uint8_t *out, int nblocks) const override
+            {
+                aes::AES_EncryptBlocks(&key->aes, in, out, nblocks);
+            }
+            void mac_xN(const MacKey *key, uint8_t *const input[], int inputLen, const sDM::Addr paddr[],
+                        uint8_t *const counter[], int counterLen, uint8_t *const mac[], int macLen, int n) const override
+            {
+                const int ctrBytes = 10;
+                for (int i = 0; i < n; i++)
+                {
+                    aes::GHASH_STATE gs;
+                    uint8_t tag[GHASH_SIZE], nonce[AES_INPUT_SIZE] = {0};
+                    aes::GHASH_init(&gs, &key->gmac.ghash);
+                    aes::GHASH_process(&gs, input[i], inputLen);
+                    aes::GHASH_process(&gs, counter[i], counterLen);
+                    aes::GHASH_process(&gs, (const uint8_t *)&paddr[i], sizeof(sDM::Addr));
+                    aes::GHASH_done(&gs, tag);
+                    memcpy(nonce, counter[i], std::min(counterLen, ctrBytes));
+                    memcpy(nonce + ctrBytes, &paddr[i], AES_INPUT_SIZE - ctrBytes);
+                    aes::AES_EncryptBlocks(&key->gmac.aes, nonce, nonce, 1);
+                    for (int j = 0; j < GHASH_SIZE; j++)
+                        tag[j] ^= nonce[j];
+                    memcpy(mac[i], tag, std::min(macLen, GHASH_SIZE));
+                    if (macLen > GHASH_SIZE)
+                        memset(mac[i] + GHASH_SIZE, 0, macLen - GHASH_SIZE);
+                }
+            }
+        };
+        /**
+         * @author yqy
+         * @brief 只保留时序的后端:不加密,MAC恒为0,因此所有校验都会通过
+         * @attention 加解密延迟与元数据访存仍由内存控制器按配置建模
+         */
+        class NullBackend : public CryptoBackend
+        {
+          public:
+            const char *name() const override { return "null"; }
+            bool functional() const override { return false; }
+            int selfCheck() const override { return 0; }
+            void setCipherKey(CipherKey *key, const uint8_t *raw) const override { key->backend = this; }
+            void setMacKey(MacKey *key, const uint8_t *raw, int rawLen) const override { key->backend = this; }
+            void encryptBlocks(const CipherKey *key, const uint8_t *in, uint8_t *out, int nblocks) const override
+            {
+                if (out != in)
+                    memmove(out, in, nblocks * CRYPTO_BLOCK_SIZE);
+            }
+            void mac_xN(const MacKey *key, uint8_t *const input[], int inputLen, const sDM::Addr paddr[],
+                        uint8_t *const counter[], int counterLen, uint8_t *const mac[], int macLen, int n) const override
+            {
+                for (int i = 0; i < n; i++)
+                    memset(mac[i], 0, macLen);
+            }
+        };
+
+        const CryptoBackend *getCryptoBackend(CryptoType type)
+        {
+            static const SM4SM3Backend sm4sm3;
+            static const AESGHASHBackend aesghash;
+            static const NullBackend null;
+            switch (type)
+            {
+            case CRYPTO_SM4_SM3:
+                return &sm4sm3;
+            case CRYPTO_AES_GHASH:
+                return &aesghash;
+            case CRYPTO_NULL:
+                return &null;
+            default:
+                return nullptr;
+            }
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef _CME_CRYPTO_HH_
+#define _CME_CRYPTO_HH_
+
+#include "../sDM_def.hh"
+#include "../alg_src/aes/AES.hh"
+#include "../alg_src/sm3/SM3.hh"
+#include "../alg_src/sm4/SM4_MB.hh"
+
+namespace gem5
+{
+    namespace CME
+    {
+        /**
+         * @author yqy
+         * @brief CME与IIT使用的密码算法组合
+         * CRYPTO_SM4_SM3:   SM4计数器模式 + SM3-HMAC
+         * CRYPTO_AES_GHASH: AES-128计数器模式 + GHASH(GMAC形式),用于与国密算法对比
+         * CRYPTO_NULL:      不做任何宿主计算,数据以明文存放,MAC恒为0,只保留时序与访存
+         */
+        enum CryptoType
+        {
+            CRYPTO_SM4_SM3,
+            CRYPTO_AES_GHASH,
+            CRYPTO_NULL,
+            CRYPTO_NUM
+        };
+        const int CRYPTO_BLOCK_SIZE = 16; // 分组字节长度,SM4与AES相同
+        const int CRYPTO_KEY_SIZE = 16;   // 数据加密密钥字节长度
+        class CryptoBackend;
+        /**
+         * @author yqy
+         * @brief 由数据加密密钥扩展得到的轮密钥,具体内容由所属后端决定
+         */
+        struct CipherKey
+        {
+            const CryptoBackend *backend;
+            union
+            {
+                sm4::SM4Context sm4;
+                aes::AESContext aes;
+            };
+        };
+        /**
+         * @author yqy
+         * @brief 由完整性密钥预先处理得到的MAC密钥,具体内容由所属后端决定
+         */
+        struct MacKey
+        {
+            const CryptoBackend *backend;
+            union
+            {
+                sm3::SM3_HMAC_KEY sm3; // 预先压缩的K^ipad和K^opad
+                struct
+                {
+                    aes::AESContext aes; // 加密nonce的轮密钥
+                    aes::GHASH_KEY ghash; // H = E_K(0)
+                } gmac;
+            };
+        };
+        /**
+         * @author yqy
+         * @brief 密码算法后端接口,CME和IIT只通过它访问分组密码和MAC
+         * @attention 后端是无状态的单例,所有状态都在CipherKey/MacKey中
+         */
+        class CryptoBackend
+        {
+          public:
+            virtual ~CryptoBackend() {}
+            virtual const char *name() const = 0;
+            /**
+             * @brief 后端是否真正计算密文和MAC,为false时调用者可以跳过只为计算而做的远端读取
+             */
+            virtual bool functional() const { return true; }
+            /**
+             * @brief 检查本后端的算法实现
+             * @return 1 失败 ; 0 成功
+             */
+            virtual int selfCheck() const = 0;
+            /**
+             * @brief 扩展CRYPTO_KEY_SIZE字节的数据加密密钥
+             */
+            virtual void setCipherKey(CipherKey *key, const uint8_t *raw) const = 0;
+            /**
+             * @brief 预处理rawLen字节的完整性密钥
+             */
+            virtual void setMacKey(MacKey *key, const uint8_t *raw, int rawLen) const = 0;
+            /**
+             * @brief ECB加密nblocks个相互独立的分组,out可以与in重叠
+             */
+            virtual void encryptBlocks(const CipherKey *key, const uint8_t *in, uint8_t *out, int nblocks) const = 0;
+            /**
+             * @brief 计算n个等长消息的MAC: MAC(input||counter||paddr),截取前macLen字节
+             */
+            virtual void mac_xN(const MacKey *key, uint8_t *const input[], int inputLen, const sDM::Addr paddr[],
+                                uint8_t *const counter[], int counterLen, uint8_t *const mac[], int macLen, int n) const = 0;
+        };
+        /**
+         * @author yqy
+         * @brief 返回type对应的后端单例
+         */
+        const CryptoBackend *getCryptoBackend(CryptoType type);
+    }
+}
+#endif // _CME_CRYPTO_HH_
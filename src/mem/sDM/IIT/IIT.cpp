@@ -1,9 +1,106 @@
 #include "IIT.hh"
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 namespace gem5
 {
     namespace sDM
     {
+        /**
+         * @author yqy
+         * @brief 可移植实现:逐个取出掩码中的位
+         */
+        static uint64_t iit_gather_portable(const uint64_t *w, uint64_t mask)
+        {
+            uint64_t v = 0;
+            int pos = 0;
+            for (int i = 0; i < IIT_NODE_SIZE / 8; i++)
+                for (uint64_t m = mask; m; m &= m - 1)
+                    v |= ((w[i] >> __builtin_ctzll(m)) & 1) << pos++;
+            return v;
+        }
+
+        static void iit_scatter_portable(uint64_t *w, uint64_t v, uint64_t mask)
+        {
+            for (int i = 0; i < IIT_NODE_SIZE / 8; i++)
+            {
+                uint64_t x = 0;
+                for (uint64_t m = mask; m; m &= m - 1, v >>= 1)
+                    x |= (v & 1) << __builtin_ctzll(m);
+                w[i] = (w[i] & ~mask) | x;
+            }
+        }
+
+#if defined(__x86_64__)
+        /**
+         * @author yqy
+         * @brief BMI2实现:每个64位字一条PEXT/PDEP
+         */
+        __attribute__((target("bmi2"))) static uint64_t iit_gather_bmi2(const uint64_t *w, uint64_t mask)
+        {
+            uint64_t v = 0;
+            for (int i = 0; i < IIT_NODE_SIZE / 8; i++)
+                v |= _pext_u64(w[i], mask) << (i * 8);
+            return v;
+        }
+
+        __attribute__((target("bmi2"))) static void iit_scatter_bmi2(uint64_t *w, uint64_t v, uint64_t mask)
+        {
+            for (int i = 0; i < IIT_NODE_SIZE / 8; i++)
+                w[i] = (w[i] & ~mask) | _pdep_u64(v >> (i * 8), mask);
+        }
+
+        static bool iit_HaveBMI2 = __builtin_cpu_supports("bmi2");
+#endif
+
+        bool iit_UseBMI2(bool use)
+        {
+#if defined(__x86_64__)
+            bool prev = iit_HaveBMI2;
+            iit_HaveBMI2 = use && __builtin_cpu_supports("bmi2");
+            return prev;
+#else
+            return false;
+#endif
+        }
+
+        uint64_t iit_gather(const void *node, uint64_t mask)
+        {
+            // 每个64位字中的字段恰好占8位,拼接后为64位
+            assert(__builtin_popcountll(mask) == 8);
+            uint64_t w[IIT_NODE_SIZE / 8];
+            memcpy(w, node, IIT_NODE_SIZE);
+#if defined(__x86_64__)
+            if (iit_HaveBMI2)
+                return iit_gather_bmi2(w, mask);
+#endif
+            return iit_gather_portable(w, mask);
+        }
+
+        void iit_scatter(void *node, uint64_t v, uint64_t mask)
+        {
+            assert(__builtin_popcountll(mask) == 8);
+            uint64_t w[IIT_NODE_SIZE / 8];
+            memcpy(w, node, IIT_NODE_SIZE);
+#if defined(__x86_64__)
+            if (iit_HaveBMI2)
+                iit_scatter_bmi2(w, v, mask);
+            else
+#endif
+                iit_scatter_portable(w, v, mask);
+            memcpy(node, w, IIT_NODE_SIZE);
+        }
+
+        // 默认几何之外的节点只用于比较树形,显式实例化保证它们与默认几何一同编译
+        template struct iit_NodeT<128, 3, 1>; // 128叉中间节点,3位副计数器
+        template struct iit_NodeT<128, 2, 1>; // 128叉中间节点,2位副计数器,每个unit保留1位
+        template struct iit_NodeT<64, 5, 2>;  // 64叉,5位副计数器
+        template struct iit_NodeT<32, 10, 4>; // 32叉叶节点,10位副计数器
+        template struct iit_MorphNodeT<64>;   // 可变编码的叶节点,覆盖一页
+        template struct iit_MorphNodeT<128>;  // 可变编码的叶节点,覆盖两页
+
         /**
          * @author yqy
          * @brief 比较计数器a和b
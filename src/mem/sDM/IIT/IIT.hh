@@ -3,8 +3,10 @@
 #include "../sDM_def.hh"
 #include "../CME/CME.hh"
 
+#include <algorithm>
 #include <cassert>
 #include <string.h>
+#include <vector>
 namespace gem5
 {
     namespace sDM
@@ -21,251 +23,707 @@ namespace gem5
         typedef uint8_t _iit_mid_node[CL_SIZE];
         typedef uint16_t _iit_leaf_node[CL_SIZE >> 1];
 
-        typedef struct _iit_Node
+        /**
+         * @author yqy
+         * @brief 从64B打包节点中抽取mask在每个64位字中选中的位并按小端拼接,有BMI2时使用PEXT
+         * @param node 打包节点
+         * @param mask 字段在一个64位字中所占的位,恰好8位
+         * @attention 每个64位字贡献8位,结果为64位
+         */
+        uint64_t iit_gather(const void *node, uint64_t mask);
+        /**
+         * @author yqy
+         * @brief iit_gather的逆操作,按小端把v分散嵌入各64位字,有BMI2时使用PDEP
+         * @attention 只修改字段所在位
+         */
+        void iit_scatter(void *node, uint64_t v, uint64_t mask);
+        /**
+         * @author yqy
+         * @brief 选择iit_gather/iit_scatter的实现,主机不支持BMI2时总是使用可移植实现
+         * @param use 为false时强制使用可移植实现,用于检查两种实现一致
+         * @return 之前是否使用BMI2
+         */
+        bool iit_UseBMI2(bool use);
+
+        /**
+         * @author yqy
+         * @brief 一个64位字中每个unit的[shift, shift+width)位组成的掩码
+         */
+        constexpr uint64_t iit_unit_mask(int unitBits, int shift, int width)
         {
-            union
+            uint64_t mask = 0;
+            for (int i = 0; i < 64; i += unitBits)
+                mask |= ((1ULL << width) - 1) << (i + shift);
+            return mask;
+        }
+        /**
+         * @author yqy
+         * @brief 一个64位字中主计数器(field为0)或hash_tag(field为1)的嵌入位
+         * @attention embBits为偶数时每个unit前一半嵌入位属于主计数器、后一半属于hash_tag,
+         * embBits为1时字中前一半unit嵌入主计数器、后一半嵌入hash_tag
+         */
+        constexpr uint64_t iit_emb_mask(int unitBits, int minorBits, int embBits, int field)
+        {
+            if (embBits % 2 == 0)
+                return iit_unit_mask(unitBits, minorBits + field * (embBits / 2), embBits / 2);
+            uint64_t mask = 0;
+            for (int u = 0; u < 64 / unitBits; u++)
             {
-                /**
-                 * 每个unit又一个副计数器和主计数器以及hash_tag的部分位组成
-                 * 一个arity表示一个unit
-                 */
-                /* iIT中间节点
-                 * |mid_node|
-                 * |--512bit-\
-                 * |          -----------------------------------\
-                 * |---8---|---8---|---8---|... |----8---|----8---|
-                 * |-unit1-|-unit2-|-unit3-|... |-uint63-|-uint64-|
-                 * |        \
-                 * |         ---------------\
-                 * 0                         8
-                 * |--6--|----1---|-----1----|
-                 * |-ctr-|-major--|-hash_tag-|
-                 */
-                _iit_mid_node midNode;
-                /* iIT叶子节点
-                 * |leaf_node|
-                 * |--512bit--\
-                 * |           ------------------------------------------------\
-                 * |----16----|----16----|----16----|...|-----16----|-----16----|
-                 * |---unit1--|---unit2--|---unit3--|...|---unit31--|---unit32--|
-                 * |           \
-                 * |            --------------\
-                 * 0                          16
-                 * |--12--|----2----|-----2----|
-                 * |--ctr-|--major--|-hash_tag-|
-                 * */
-                _iit_leaf_node leafNode;
-            };
+                if ((u < 32 / unitBits) == (field == 0))
+                    mask |= 1ULL << (u * unitBits + minorBits);
+            }
+            return mask;
+        }
+        /**
+         * @author yqy
+         * @brief 将节点计数器之和转换为sum格式(IIT_MID_MINOR_BIT_SIZE位副计数器)的计数器
+         * @param major 主计数器,以2^MinorBits为单位
+         * @param s 所有副计数器之和
+         */
+        template <int MinorBits>
+        inline void iit_sum_counter(iit_major_counter major, uint64_t s, CL_Counter container)
+        {
+            const int P = IIT_MID_MINOR_BIT_SIZE;
+            iit_major_counter m;
+            if constexpr (MinorBits >= P)
+                m = (major << (MinorBits - P)) + (s >> P);
+            else
+            {
+                s += (major & ((1ULL << (P - MinorBits)) - 1)) << MinorBits;
+                m = (major >> (P - MinorBits)) + (s >> P);
+            }
+            s &= (1ULL << P) - 1;
+            *((iit_minor_counter *)(container)) = (iit_minor_counter)s;
+            *((iit_major_counter *)(&container[sizeof(iit_minor_counter)])) = m;
+        }
+
+        /**
+         * @author yqy
+         * @brief 编译期确定几何的IIT节点,叶节点与中间节点是不同的类型,所有访问都不再按节点类型分支
+         * @param Arity     计数器个数,64B平分为Arity个unit
+         * @param MinorBits 每个unit中副计数器的位数,位于unit低位
+         * @param EmbBits   每个unit中嵌入的主计数器与hash_tag位数之和,紧接副计数器,unit中其余位保留为0
+         * 所有unit的嵌入位拼出64位主计数器和64位hash_tag,因此Arity * EmbBits必须为128
+         * 默认几何 叶<32, 12, 4>、中间<64, 6, 2> 与原来的打包格式逐位相同:
+         * |--12--|----2----|-----2----|        |--6--|----1---|-----1----|
+         * |--ctr-|--major--|-hash_tag-|        |-ctr-|-major--|-hash_tag-|
+         * @attention 按64位字访问,假设主机为小端(unit在字内由低到高排列)
+         */
+        template <int Arity, int MinorBits, int EmbBits>
+        struct iit_NodeT
+        {
+            static constexpr int ARITY = Arity;
+            static constexpr int MINOR_BITS = MinorBits;
+            static constexpr int EMB_BITS = EmbBits;
+            static constexpr int WORDS = IIT_NODE_SIZE / sizeof(uint64_t);
+            static constexpr int UNIT_BITS = IIT_NODE_SIZE * BYTE2BIT / Arity;
+            static constexpr int UNITS_PER_WORD = 64 / UNIT_BITS;
+            static constexpr iit_minor_counter MINOR_MAX = (1U << MinorBits) - 1;
+            static constexpr uint64_t MINOR_MASK = iit_unit_mask(UNIT_BITS, 0, MinorBits);
+            static constexpr uint64_t MAJOR_MASK = iit_emb_mask(UNIT_BITS, MinorBits, EmbBits, 0);
+            static constexpr uint64_t HASH_TAG_MASK = iit_emb_mask(UNIT_BITS, MinorBits, EmbBits, 1);
+            static constexpr uint64_t COUNTER_MASK = MINOR_MASK | MAJOR_MASK; // 抹去hash_tag时保留的位
+
+            static_assert(UNIT_BITS * Arity == IIT_NODE_SIZE * BYTE2BIT && 64 % UNIT_BITS == 0,
+                          "units must tile the 64-bit words of the node");
+            static_assert(MinorBits > 0 && MinorBits <= (int)(BYTE2BIT * sizeof(iit_minor_counter)),
+                          "minor counter does not fit iit_minor_counter");
+            static_assert(MinorBits + EmbBits <= UNIT_BITS, "minor and embedded bits exceed the unit");
+            static_assert(Arity * EmbBits == 2 * 64 && (EmbBits % 2 == 0 || EmbBits == 1),
+                          "embedded bits must carry a 64-bit major counter and hash_tag");
+
+            uint64_t w[WORDS];
+
+            iit_minor_counter minor(uint32_t k) const
+            {
+                assert(k < (uint32_t)Arity);
+                return (w[k / UNITS_PER_WORD] >> ((k % UNITS_PER_WORD) * UNIT_BITS)) & MINOR_MAX;
+            }
+            void setMinor(uint32_t k, iit_minor_counter v)
+            {
+                assert(k < (uint32_t)Arity);
+                int shift = (k % UNITS_PER_WORD) * UNIT_BITS;
+                uint64_t &word = w[k / UNITS_PER_WORD];
+                word = (word & ~((uint64_t)MINOR_MAX << shift)) | ((uint64_t)(v & MINOR_MAX) << shift);
+            }
+            iit_major_counter major() const { return iit_gather(w, MAJOR_MASK); }
+            void setMajor(iit_major_counter major) { iit_scatter(w, major, MAJOR_MASK); }
+            iit_hash_tag hashTag() const { return iit_gather(w, HASH_TAG_MASK); }
+            void setHashTag(iit_hash_tag hash_tag) { iit_scatter(w, hash_tag, HASH_TAG_MASK); }
             /**
              * @author yqy
-             * @brief 检查给出计数器下标是否合法
+             * @brief 将抹去hash_tag的节点拷贝到container中
              */
-            void ctr_range_sanity(int iit_node_type, uint32_t k)
+            void eraseHashTag(iit_NodeT *container) const
             {
-                assert((iit_node_type == IIT_LEAF_TYPE && k < IIT_LEAF_ARITY) ||
-                       (iit_node_type == IIT_MID_TYPE && k < IIT_MID_ARITY));
+                for (int i = 0; i < WORDS; i++)
+                    container->w[i] = w[i] & COUNTER_MASK;
             }
             /**
              * @author yqy
-             * @brief 检查参数给出的节点类型
+             * @brief 返回第k个计数器:主计数器+副计数器,存储到CL_Counter中(64bit+16bit)
              */
-            void node_type_sanity(int iit_node_type)
+            void getCounter_k(uint32_t k, CL_Counter counter) const
             {
-                assert((iit_node_type == IIT_LEAF_TYPE || iit_node_type == IIT_MID_TYPE) && "undefined type of node");
+                *((iit_minor_counter *)counter) = minor(k);
+                *((iit_major_counter *)(&counter[sizeof(iit_minor_counter)])) = major();
             }
             /**
              * @author yqy
-             * @brief  从节点中提取出hash_tag
-             * @return 返回提取出的hash_tag
+             * @brief 将第k个计数器置0
              */
-            iit_hash_tag abstract_hash_tag(int iit_node_type)
+            void resetCounter_k(uint32_t k) { setMinor(k, 0); }
+            /**
+             * @brief 给第k个计数器增加1
+             * @author yqy
+             * @param OF 记录副计数器是否溢出,溢出时主计数器加1,用于引发页面重加密和HMAC刷新
+             * @attention 主计数器变化后其余副计数器保持不变
+             */
+            void incCounter(uint32_t k, bool &OF)
             {
-                node_type_sanity(iit_node_type);
-                iit_hash_tag hash_tag = 0x0;
-                if (iit_node_type == IIT_LEAF_TYPE)
+                iit_minor_counter m = minor(k);
+                OF = m == MINOR_MAX;
+                if (OF)
                 {
-                    uint16_t scanner;
-                    for (int i = IIT_LEAF_ARITY - 1; i >= 0; i--)
-                    {
-                        scanner = (leafNode[i]) & IIT_LEAF_NODE_HASH_TAG_MASK;
-                        hash_tag = (hash_tag << IIT_LEAF_NODE_EMB) | scanner;
-                    }
+                    iit_major_counter major = this->major() + 1;
+                    assert(major != 0 && "Major counter overflow");
+                    setMajor(major);
+                    setMinor(k, 0);
                 }
                 else
-                {
-                    uint8_t scanner;
-                    for (int i = IIT_MID_ARITY - 1; i >= 0; i--)
-                    {
-                        scanner = (midNode[i]) & IIT_MID_NODE_HASH_TAG_MASK;
-                        hash_tag = (hash_tag << IIT_MID_NODE_EMB) | scanner;
-                    }
-                }
-                return hash_tag;
+                    setMinor(k, m + 1);
+            }
+            /**
+             * @author yqy
+             * @brief 求当前节点第[first, first + n)个计数器的和,转换为sum格式的计数器写入container
+             * @attention 主计数器按整个节点共享计入一次
+             */
+            void sum(CL_Counter container, uint32_t first = 0, uint32_t n = Arity) const
+            {
+                assert(first + n <= (uint32_t)Arity);
+                uint64_t s = 0;
+                for (uint32_t k = first; k < first + n; k++)
+                    s += minor(k);
+                iit_sum_counter<MinorBits>(major(), s, container);
             }
 
             /**
              * @author yqy
-             * @brief 从节点中提取出主计数器
-             * @return 返回计算得到的主计数器
+             * @brief 节点的解码形式:主计数器、副计数器和hash_tag都是普通字段,访问为O(1)
+             * @attention 只在内存中使用,存储和计算hash_tag仍使用64B的打包形式
              */
-            iit_major_counter
-            abstract_major(int iit_node_type)
+            struct Decoded
             {
-                node_type_sanity(iit_node_type);
-                iit_major_counter major = 0x0;
-                if (iit_node_type == IIT_LEAF_TYPE)
+                iit_major_counter major;
+                iit_hash_tag hash_tag;
+                iit_minor_counter minor[Arity];
+
+                void getCounter_k(uint32_t k, CL_Counter counter) const
                 {
-                    iit_leaf_minor_counter scanner;
-                    for (int i = IIT_LEAF_ARITY - 1; i >= 0; i--)
-                    {
-                        scanner = (leafNode[i]) & IIT_LEAF_NODE_MAJOR_MASK; // 取出该unit中嵌入的部分位
-                        major = (major << IIT_LEAF_NODE_EMB) | scanner;     // 拼接
-                    }
+                    assert(k < (uint32_t)Arity);
+                    *((iit_minor_counter *)counter) = minor[k];
+                    *((iit_major_counter *)(&counter[sizeof(iit_minor_counter)])) = major;
                 }
-                else
+                void inc_counter(uint32_t k, bool &OF)
                 {
-                    iit_mid_minor_counter scanner;
-                    for (int i = IIT_MID_ARITY - 1; i >= 0; i--)
+                    assert(k < (uint32_t)Arity);
+                    OF = minor[k] == MINOR_MAX;
+                    if (OF)
                     {
-                        scanner = (midNode[i]) & IIT_MID_NODE_MAJOR_MASK; // 取出该unit中嵌入的部分位
-                        major = (major << IIT_MID_NODE_EMB) | scanner;    // 拼接
+                        minor[k] = 0;
+                        major++;
+                        assert(major != 0 && "Major counter overflow");
                     }
+                    else
+                        minor[k]++;
+                }
+                void sum(CL_Counter container) const
+                {
+                    uint64_t s = 0;
+                    for (int k = 0; k < Arity; k++)
+                        s += minor[k];
+                    iit_sum_counter<MinorBits>(major, s, container);
                 }
-                return major;
+            };
+            /**
+             * @author yqy
+             * @brief 解码为Decoded,之后的计数器访问不再需要逐unit拼接
+             */
+            void decode(Decoded &d) const
+            {
+                d.major = major();
+                d.hash_tag = hashTag();
+                for (int k = 0; k < Arity; k++)
+                    d.minor[k] = minor(k);
+            }
+            /**
+             * @author yqy
+             * @brief 将解码形式重新打包到本节点(包括hash_tag)
+             */
+            void encode(const Decoded &d)
+            {
+                memset(w, 0, sizeof(w));
+                for (int k = 0; k < Arity; k++)
+                    setMinor(k, d.minor[k]);
+                setMajor(d.major);
+                setHashTag(d.hash_tag);
             }
+        };
+
+        /**
+         * @author yqy
+         * @brief 可变编码(morphable)的叶节点,每个节点按其计数器的分布选择编码,一个64B节点覆盖Arity个缓存行
+         * @param Arity 计数器个数,64或128
+         * 每个缓存行有独立的逻辑计数器,节点只保存其中的最小值base和各计数器相对base的增量,
+         * 编码随增量的分布变化(与src/mem/cache/compressors中BDI的base+delta、FPC的零值压缩思路相同):
+         * 1. UNIFORM 所有增量等宽,每个UNIFORM_BITS位,适合写次数均匀的页面
+         * 2. GROUP   每GROUP_LINES个缓存行一个GROUP_BASE_BITS位的组基值,组内GROUP_DELTA_BITS位的增量,适合组间不均匀
+         * 3. SPARSE  位图标出增量非0的缓存行,只为它们保存较宽的增量,适合少数缓存行被频繁写
+         * |------------------------payload(384)------------------------|-base(62)-|-format(2)-|-hash_tag(64)-|
+         * @attention 换编码和base只改变表示,逻辑计数器不变,不需要重加密;
+         * 没有编码能表示时溢出,先只把组内增量超出GROUP_DELTA_BITS位的组提升到组内最大值,只有这些组的缓存行需要重加密;
+         * 仍无法表示时所有计数器提升到其中的最大值,整个节点覆盖的缓存行都需要重加密
+         * @attention 全零节点为UNIFORM编码、base为0,与隐式的全零节点一致
+         */
+        template <int Arity>
+        struct iit_MorphNodeT
+        {
+            static constexpr int ARITY = Arity;
+            static constexpr int WORDS = IIT_NODE_SIZE / sizeof(uint64_t);
+            static constexpr int HEADER = WORDS - 2; // base和编码所在的字
+            static constexpr int TAG = WORDS - 1;    // hash_tag所在的字
+            static constexpr int PAYLOAD_BITS = HEADER * 64;
+            static constexpr int BASE_BITS = 62;
+            static constexpr uint64_t BASE_MASK = (1ULL << BASE_BITS) - 1;
+            static constexpr int UNIFORM_BITS = PAYLOAD_BITS / Arity;
+            static constexpr int GROUP_LINES = 8;
+            static constexpr int GROUPS = Arity / GROUP_LINES;
+            static constexpr int GROUP_DELTA_BITS = PAYLOAD_BITS * 2 / 3 / Arity;
+            static constexpr int GROUP_BASE_BITS = (PAYLOAD_BITS - Arity * GROUP_DELTA_BITS) / GROUPS;
+            static constexpr int SPARSE_MAX_BITS = 32;
+            enum Format
+            {
+                UNIFORM,
+                GROUP,
+                SPARSE
+            };
+
+            static_assert(Arity == 64 || Arity == 128, "the bitmap of the sparse format spans whole words");
+            static_assert(GROUP_BASE_BITS * GROUPS + GROUP_DELTA_BITS * Arity <= PAYLOAD_BITS &&
+                              GROUP_BASE_BITS <= SPARSE_MAX_BITS,
+                          "group bases and deltas exceed the payload");
+
+            uint64_t w[WORDS];
 
             /**
              * @author yqy
-             * @brief 将抹去hash_tag的节点拷贝到container中
-             * @return 将结果存储在container中
+             * @brief 读取payload中从pos开始的width位,width不超过64
              */
-            void erase_hash_tag(int iit_node_type, _iit_Node *container)
+            static uint64_t getBits(const uint64_t *w, int pos, int width)
             {
-                node_type_sanity(iit_node_type);
-                memcpy((void *)container, leafNode, sizeof(_iit_leaf_node));
-                if (iit_node_type == IIT_LEAF_TYPE)
-                {
-                    for (int i = IIT_LEAF_ARITY - 1; i >= 0; i--)
-                        container->leafNode[i] &= IIT_LEAF_COUNTER_RESERVED_MASK; // 将嵌入的hash_tag位置0
-                }
-                else
+                int off = pos % 64;
+                uint64_t v = w[pos / 64] >> off;
+                if (off + width > 64)
+                    v |= w[pos / 64 + 1] << (64 - off);
+                return width == 64 ? v : v & ((1ULL << width) - 1);
+            }
+            static void putBits(uint64_t *w, int pos, int width, uint64_t v)
+            {
+                uint64_t mask = width == 64 ? ~0ULL : (1ULL << width) - 1;
+                int off = pos % 64;
+                v &= mask;
+                w[pos / 64] = (w[pos / 64] & ~(mask << off)) | (v << off);
+                if (off + width > 64)
+                    w[pos / 64 + 1] = (w[pos / 64 + 1] & ~(mask >> (64 - off))) | (v >> (64 - off));
+            }
+            /**
+             * @author yqy
+             * @brief 稀疏编码中n个非0增量各自的位数
+             */
+            static int sparseBits(int n)
+            {
+                return n ? std::min(SPARSE_MAX_BITS, (PAYLOAD_BITS - Arity) / n) : 0;
+            }
+            /**
+             * @author yqy
+             * @brief 选择能表示这组逻辑计数器的编码,依次尝试UNIFORM、GROUP、SPARSE
+             * @param base 返回计数器的最小值
+             * @return 编码,都无法表示时返回-1
+             */
+            static int chooseFormat(const uint64_t *ctr, uint64_t &base)
+            {
+                base = *std::min_element(ctr, ctr + Arity);
+                uint64_t max_delta = *std::max_element(ctr, ctr + Arity) - base;
+                if (!(max_delta >> UNIFORM_BITS))
+                    return UNIFORM;
+                bool group = true;
+                for (int g = 0; g < GROUPS && group; g++)
                 {
-                    for (int i = IIT_MID_ARITY - 1; i >= 0; i--)
-                        container->midNode[i] &= IIT_MID_COUNTER_RESERVED_MASK; // 将嵌入的hash_tag位置0
+                    auto [lo, hi] = std::minmax_element(ctr + g * GROUP_LINES, ctr + (g + 1) * GROUP_LINES);
+                    group = !((*lo - base) >> GROUP_BASE_BITS) && !((*hi - *lo) >> GROUP_DELTA_BITS);
                 }
+                if (group)
+                    return GROUP;
+                int n = Arity - std::count(ctr, ctr + Arity, base);
+                if (!(max_delta >> sparseBits(n)))
+                    return SPARSE;
+                return -1;
+            }
+            /**
+             * @author yqy
+             * @brief 逻辑计数器整体作为主计数器,副计数器为0,因此计数器为0当且仅当该行从未被写过
+             */
+            static void toCounter(uint64_t v, CL_Counter counter)
+            {
+                *((iit_minor_counter *)counter) = 0;
+                *((iit_major_counter *)(&counter[sizeof(iit_minor_counter)])) = v;
             }
 
+            int format() const { return w[HEADER] >> BASE_BITS; }
             /**
              * @author yqy
-             * @brief 将hash_tag采用小段模式嵌入到节点中
-             * @attention 这个函数会改变hash_tag,注意修改之前校验操作的必要性
+             * @brief 返回第k个缓存行的逻辑计数器
              */
-            void embed_hash_tag(int iit_node_type, iit_hash_tag hash_tag)
+            uint64_t value(uint32_t k) const
             {
-                // 采用小端模式嵌入
-                if (iit_node_type == IIT_LEAF_TYPE)
+                assert(k < (uint32_t)Arity);
+                uint64_t base = w[HEADER] & BASE_MASK;
+                switch (format())
                 {
-                    iit_leaf_minor_counter scatter;
-                    for (int i = 0; i < IIT_LEAF_ARITY; i++)
-                    {
-                        scatter = hash_tag & ((1 << IIT_LEAF_NODE_EMB) - 1); // 每次取最低的IIT_LEAF_NODE_EMB位
-                        leafNode[i] = (scatter << (BYTE2BIT * sizeof(iit_leaf_minor_counter) - IIT_LEAF_NODE_EMB)) |
-                                      (leafNode[i] & IIT_LEAF_COUNTER_RESERVED_MASK);
-                        hash_tag >>= (IIT_LEAF_NODE_EMB);
-                    }
-                }
-                else
+                case UNIFORM:
+                    return base + getBits(w, k * UNIFORM_BITS, UNIFORM_BITS);
+                case GROUP:
+                    return base + getBits(w, k / GROUP_LINES * GROUP_BASE_BITS, GROUP_BASE_BITS) +
+                           getBits(w, GROUPS * GROUP_BASE_BITS + k * GROUP_DELTA_BITS, GROUP_DELTA_BITS);
+                default:
                 {
-                    iit_mid_minor_counter scatter;
-                    for (int i = 0; i < IIT_MID_ARITY; i++)
+                    if (!getBits(w, k, 1))
+                        return base;
+                    int j = 0, n = 0;
+                    for (int i = 0; i < Arity / 64; i++)
                     {
-                        scatter = hash_tag & ((1 << IIT_MID_NODE_EMB) - 1); // 每次取最低的IIT_LEAF_MID_EMB位
-                        midNode[i] = (scatter << (BYTE2BIT * sizeof(iit_mid_minor_counter) - IIT_MID_NODE_EMB)) |
-                                     (midNode[i] & IIT_MID_COUNTER_RESERVED_MASK);
-                        hash_tag >>= (IIT_MID_NODE_EMB);
+                        n += __builtin_popcountll(w[i]);
+                        if (i < (int)k / 64)
+                            j += __builtin_popcountll(w[i]);
                     }
+                    j += __builtin_popcountll(w[k / 64] & ((1ULL << (k % 64)) - 1));
+                    int bits = sparseBits(n);
+                    return base + getBits(w, Arity + j * bits, bits);
+                }
                 }
             }
+            iit_major_counter major() const { return w[HEADER] & BASE_MASK; }
+            void setMajor(iit_major_counter major) { w[HEADER] = (w[HEADER] & ~BASE_MASK) | (major & BASE_MASK); }
+            iit_hash_tag hashTag() const { return w[TAG]; }
+            void setHashTag(iit_hash_tag hash_tag) { w[TAG] = hash_tag; }
+            void eraseHashTag(iit_MorphNodeT *container) const
+            {
+                memcpy(container->w, w, sizeof(w));
+                container->w[TAG] = 0;
+            }
+            void getCounter_k(uint32_t k, CL_Counter counter) const { toCounter(value(k), counter); }
             /**
              * @author yqy
-             * @brief 将第minor计数器的值写入第k个unit
+             * @brief 求第[first, first + n)个逻辑计数器的和,转换为sum格式的计数器写入container
              */
-            void embed_minor_k(int iit_node_type, iit_minor_counter minor, uint32_t k)
+            void sum(CL_Counter container, uint32_t first = 0, uint32_t n = Arity) const
             {
-                node_type_sanity(iit_node_type);
-                if (iit_node_type == IIT_LEAF_TYPE)
+                assert(first + n <= (uint32_t)Arity);
+                uint64_t s = 0;
+                for (uint32_t k = first; k < first + n; k++)
+                    s += value(k);
+                iit_sum_counter<0>(0, s, container);
+            }
+
+            /**
+             * @author yqy
+             * @brief 节点的解码形式:每个缓存行的逻辑计数器
+             */
+            struct Decoded
+            {
+                iit_hash_tag hash_tag;
+                uint64_t ctr[Arity];
+
+                void getCounter_k(uint32_t k, CL_Counter counter) const
                 {
-                    leafNode[k] = (leafNode[k] & (IIT_LEAF_NODE_MAJOR_MASK | IIT_LEAF_NODE_HASH_TAG_MASK)) | minor;
+                    assert(k < (uint32_t)Arity);
+                    toCounter(ctr[k], counter);
                 }
-                else
+                /**
+                 * @author yqy
+                 * @param OF 加1后没有编码能表示这组计数器,组内增量过大的组或所有计数器已提升到最大值
+                 * @attention 偏斜的写集中在少数组上,只重置这些组时其余组的计数器不变,不需要重加密
+                 */
+                void inc_counter(uint32_t k, bool &OF)
                 {
-                    midNode[k] = (midNode[k] & (IIT_MID_NODE_MAJOR_MASK | IIT_MID_NODE_HASH_TAG_MASK)) | minor;
+                    assert(k < (uint32_t)Arity);
+                    ctr[k]++;
+                    assert(!(ctr[k] >> BASE_BITS) && "Counter overflow");
+                    uint64_t base;
+                    OF = chooseFormat(ctr, base) < 0;
+                    if (!OF)
+                        return;
+                    for (int g = 0; g < GROUPS; g++)
+                    {
+                        uint64_t *c = ctr + g * GROUP_LINES;
+                        auto [lo, hi] = std::minmax_element(c, c + GROUP_LINES);
+                        uint64_t top = *hi;
+                        if ((top - *lo) >> GROUP_DELTA_BITS)
+                            std::fill(c, c + GROUP_LINES, top);
+                    }
+                    if (chooseFormat(ctr, base) < 0)
+                        std::fill(ctr, ctr + Arity, *std::max_element(ctr, ctr + Arity));
                 }
+                void sum(CL_Counter container, uint32_t first = 0, uint32_t n = Arity) const
+                {
+                    assert(first + n <= (uint32_t)Arity);
+                    uint64_t s = 0;
+                    for (uint32_t k = first; k < first + n; k++)
+                        s += ctr[k];
+                    iit_sum_counter<0>(0, s, container);
+                }
+            };
+            void decode(Decoded &d) const
+            {
+                d.hash_tag = hashTag();
+                if (format() != SPARSE)
+                {
+                    for (int k = 0; k < Arity; k++)
+                        d.ctr[k] = value(k);
+                    return;
+                }
+                uint64_t base = major();
+                int n = 0;
+                for (int i = 0; i < Arity / 64; i++)
+                    n += __builtin_popcountll(w[i]);
+                int bits = sparseBits(n), j = 0;
+                for (int k = 0; k < Arity; k++)
+                    d.ctr[k] = base + (getBits(w, k, 1) ? getBits(w, Arity + j++ * bits, bits) : 0);
             }
             /**
              * @author yqy
-             * @brief 将major_counter采用小段模式嵌入到节点中
+             * @brief 按当前的计数器选择编码并重新打包(包括hash_tag)
              */
-            void
-            embed_major(int iit_node_type, iit_major_counter major)
+            void encode(const Decoded &d)
             {
-                // 采用小端模式嵌入
-                node_type_sanity(iit_node_type);
-                if (iit_node_type == IIT_LEAF_TYPE)
+                uint64_t base;
+                int fmt = chooseFormat(d.ctr, base);
+                assert(fmt >= 0 && "counters fit no encoding");
+                memset(w, 0, sizeof(w));
+                w[HEADER] = base | (uint64_t)fmt << BASE_BITS;
+                w[TAG] = d.hash_tag;
+                if (fmt == UNIFORM)
                 {
-                    iit_leaf_minor_counter scatter;
-                    for (int i = 0; i < IIT_LEAF_ARITY; i++) // 嵌入到每个unit中
+                    for (int k = 0; k < Arity; k++)
+                        putBits(w, k * UNIFORM_BITS, UNIFORM_BITS, d.ctr[k] - base);
+                }
+                else if (fmt == GROUP)
+                {
+                    for (int g = 0; g < GROUPS; g++)
                     {
-                        scatter = major & ((1 << IIT_LEAF_NODE_EMB) - 1); // 每次取最低的IIT_LEAF_MID_EMB位
-                        leafNode[i] = (scatter << (BYTE2BIT * sizeof(iit_leaf_minor_counter) - IIT_LEAF_NODE_EMB - IIT_LEAF_NODE_EMB)) |
-                                      (leafNode[i] & IIT_LEAF_COUNTER_RESERVED_MASK); // 嵌入到第k个unit的对应位
-                        major >>= (IIT_LEAF_NODE_EMB);                                // 丢弃已经嵌入的位
+                        const uint64_t *c = d.ctr + g * GROUP_LINES;
+                        uint64_t gbase = *std::min_element(c, c + GROUP_LINES);
+                        putBits(w, g * GROUP_BASE_BITS, GROUP_BASE_BITS, gbase - base);
+                        for (int i = 0; i < GROUP_LINES; i++)
+                            putBits(w, GROUPS * GROUP_BASE_BITS + (g * GROUP_LINES + i) * GROUP_DELTA_BITS,
+                                    GROUP_DELTA_BITS, c[i] - gbase);
                     }
                 }
                 else
                 {
-                    iit_mid_minor_counter scatter;
-                    for (int i = 0; i < IIT_MID_ARITY; i++) // 嵌入到每个unit中
+                    int bits = sparseBits(Arity - std::count(d.ctr, d.ctr + Arity, base)), j = 0;
+                    for (int k = 0; k < Arity; k++)
                     {
-                        scatter = major & ((1 << IIT_MID_NODE_EMB) - 1); // 每次取最低的IIT_LEAF_MID_EMB位
-                        midNode[i] = (scatter << (BYTE2BIT * sizeof(iit_mid_minor_counter) - IIT_MID_NODE_EMB - IIT_MID_NODE_EMB)) |
-                                     (midNode[i] & IIT_MID_COUNTER_RESERVED_MASK); // 嵌入到第k个unit的对应位
-                        major >>= (IIT_MID_NODE_EMB);                              // 丢弃已经嵌入的位
+                        if (d.ctr[k] == base)
+                            continue;
+                        putBits(w, k, 1, 1);
+                        putBits(w, Arity + j++ * bits, bits, d.ctr[k] - base);
                     }
                 }
             }
+            void resetCounter_k(uint32_t k)
+            {
+                Decoded d;
+                decode(d);
+                d.ctr[k] = 0;
+                encode(d);
+            }
+            void incCounter(uint32_t k, bool &OF)
+            {
+                Decoded d;
+                decode(d);
+                d.inc_counter(k, OF);
+                encode(d);
+            }
+        };
+
+        // sDM使用的几何,由sDM_def.hh中的宏给出
+#if IIT_LEAF_MORPHABLE
+        typedef iit_MorphNodeT<IIT_LEAF_ARITY> iit_LeafNode;
+#else
+        typedef iit_NodeT<IIT_LEAF_ARITY, IIT_LEAF_MINOR_BIT_SIZE, 2 * IIT_LEAF_NODE_EMB> iit_LeafNode;
+        static_assert(iit_LeafNode::MINOR_BITS >= IIT_MID_MINOR_BIT_SIZE, "a leaf sum must fit a mid counter");
+#endif
+        typedef iit_NodeT<IIT_MID_ARITY, IIT_MID_MINOR_BIT_SIZE, 2 * IIT_MID_NODE_EMB> iit_MidNode;
+        static_assert(sizeof(iit_LeafNode) == IIT_NODE_SIZE && sizeof(iit_MidNode) == IIT_NODE_SIZE);
+
+        typedef struct _iit_Node
+        {
+            union
+            {
+                _iit_mid_node midNode;
+                _iit_leaf_node leafNode;
+                iit_LeafNode leaf;
+                iit_MidNode mid;
+            };
+            /**
+             * @author yqy
+             * @brief 按编译期类型访问节点,热路径上使用
+             */
+            iit_LeafNode &asLeaf() { return leaf; }
+            const iit_LeafNode &asLeaf() const { return leaf; }
+            iit_MidNode &asMid() { return mid; }
+            const iit_MidNode &asMid() const { return mid; }
+            /**
+             * @author yqy
+             * @brief 检查参数给出的节点类型
+             */
+            static void node_type_sanity(int iit_node_type)
+            {
+                assert((iit_node_type == IIT_LEAF_TYPE || iit_node_type == IIT_MID_TYPE) && "undefined type of node");
+            }
+            /**
+             * @author yqy
+             * @brief 运行时给出节点类型时(例如一条关键路径上的节点)按类型分派一次
+             */
+            template <typename F>
+            auto dispatch(int iit_node_type, F f)
+            {
+                node_type_sanity(iit_node_type);
+                return iit_node_type == IIT_LEAF_TYPE ? f(leaf) : f(mid);
+            }
+            /**
+             * @author yqy
+             * @brief  从节点中提取出hash_tag
+             */
+            iit_hash_tag abstract_hash_tag(int iit_node_type)
+            {
+                return dispatch(iit_node_type, [](auto &n) { return n.hashTag(); });
+            }
+            /**
+             * @author yqy
+             * @brief 从节点中提取出主计数器
+             */
+            iit_major_counter abstract_major(int iit_node_type)
+            {
+                return dispatch(iit_node_type, [](auto &n) { return n.major(); });
+            }
+            /**
+             * @author yqy
+             * @brief 将抹去hash_tag的节点拷贝到container中
+             */
+            void erase_hash_tag(int iit_node_type, _iit_Node *container)
+            {
+                if (iit_node_type == IIT_LEAF_TYPE)
+                    leaf.eraseHashTag(&container->leaf);
+                else
+                    mid.eraseHashTag(&container->mid);
+            }
+            /**
+             * @author yqy
+             * @brief 将hash_tag采用小端模式嵌入到节点中
+             * @attention 这个函数会改变hash_tag,注意修改之前校验操作的必要性
+             */
+            void embed_hash_tag(int iit_node_type, iit_hash_tag hash_tag)
+            {
+                dispatch(iit_node_type, [hash_tag](auto &n) { n.setHashTag(hash_tag); });
+            }
+            /**
+             * @author yqy
+             * @brief 将major_counter采用小端模式嵌入到节点中
+             */
+            void embed_major(int iit_node_type, iit_major_counter major)
+            {
+                dispatch(iit_node_type, [major](auto &n) { n.setMajor(major); });
+            }
             /**
              * @brief 计算hash_tag
              * @author yqy
              * @param iit_node_type 此节点类型
-             * @param hash_tag_key  此节点所属sdm的hash_tag密钥
+             * @param hash_tag_key  此节点所属sdm的MAC密钥
              * @param paddr         此节点的物理地址
+             * @param f_counter     父节点中对应本节点的计数器,为空时使用全零计数器
              * @return 返回计算得到的hash值
+             * @attention hash_tag绑定父计数器,父计数器变化后旧节点无法通过校验(防重放)
              */
             iit_hash_tag
-            get_hash_tag(int iit_node_type, uint8_t *hash_tag_key, Addr paddr)
+            get_hash_tag(int iit_node_type, const CME::MacKey *hash_tag_key, Addr paddr, uint8_t *f_counter = nullptr)
             {
-                node_type_sanity(iit_node_type);
                 _iit_Node node;
                 CL_Counter counter;
                 iit_hash_tag hash_tag;
-                memset(counter, 0, sizeof(CL_Counter));
+                if (f_counter)
+                    memcpy(counter, f_counter, sizeof(CL_Counter));
+                else
+                    memset(counter, 0, sizeof(CL_Counter));
                 erase_hash_tag(iit_node_type, &node);
                 CME::sDM_HMAC((uint8_t *)(&node.leafNode), sizeof(_iit_Node), hash_tag_key,
-                              paddr, counter, sizeof(iit_hash_tag), (uint8_t *)(&hash_tag), sizeof(iit_hash_tag));
+                              paddr, counter, sizeof(CL_Counter), (uint8_t *)(&hash_tag), sizeof(iit_hash_tag));
                 return hash_tag;
             }
+            /**
+             * @brief 批量计算n个节点的hash_tag,例如整条关键路径或一个父节点的所有子节点
+             * @author yqy
+             * @param n             节点个数
+             * @param nodes         节点指针
+             * @param types         每个节点的类型
+             * @param hash_tag_key  节点所属sdm的hmac密钥
+             * @param paddr         每个节点的物理地址
+             * @param f_counter     每个节点的父计数器
+             * @param hash_tags     计算结果
+             * @attention 节点消息等长,按SM3_MB_LANES个一组并行计算,结果与get_hash_tag相同
+             */
+            static void
+            get_hash_tags(int n, _iit_Node *const nodes[], const int types[], const CME::MacKey *hash_tag_key,
+                          const Addr paddr[], uint8_t *const f_counter[], iit_hash_tag hash_tags[])
+            {
+                std::vector<_iit_Node> erased(n);
+                std::vector<uint8_t *> input(n), output(n);
+                for (int i = 0; i < n; i++)
+                {
+                    nodes[i]->erase_hash_tag(types[i], &erased[i]);
+                    input[i] = (uint8_t *)&erased[i].leafNode;
+                    output[i] = (uint8_t *)&hash_tags[i];
+                }
+                CME::sDM_HMAC_xN(input.data(), sizeof(_iit_Node), hash_tag_key, paddr, f_counter, sizeof(CL_Counter),
+                                 output.data(), sizeof(iit_hash_tag), n);
+            }
             /**
              * @brief 将当节点置为0,并给出正确的hash_tag
              * @author yqy
              */
-            void init(int iit_node_type, uint8_t *hash_tag_key, Addr paddr)
+            void init(int iit_node_type, const CME::MacKey *hash_tag_key, Addr paddr, uint8_t *f_counter = nullptr)
             {
-                node_type_sanity(iit_node_type);
                 memset(leafNode, 0, sizeof(_iit_leaf_node));
-                iit_hash_tag hash_tag = get_hash_tag(iit_node_type, hash_tag_key, paddr);
+                iit_hash_tag hash_tag = get_hash_tag(iit_node_type, hash_tag_key, paddr, f_counter);
                 embed_hash_tag(iit_node_type, hash_tag);
             }
+            /**
+             * @author yqy
+             * @brief 使用父计数器重新计算并嵌入hash_tag
+             */
+            void update_hash_tag(int iit_node_type, const CME::MacKey *hash_tag_key, Addr paddr, uint8_t *f_counter)
+            {
+                embed_hash_tag(iit_node_type, get_hash_tag(iit_node_type, hash_tag_key, paddr, f_counter));
+            }
+            /**
+             * @author yqy
+             * @brief 校验节点中嵌入的hash_tag是否与计算值一致
+             */
+            bool check_hash_tag(int iit_node_type, const CME::MacKey *hash_tag_key, Addr paddr, uint8_t *f_counter)
+            {
+                return abstract_hash_tag(iit_node_type) == get_hash_tag(iit_node_type, hash_tag_key, paddr, f_counter);
+            }
             /**
              * @author yqy
              * @paramiit_node_type 节点类型
@@ -273,9 +731,8 @@ namespace gem5
              * 2. IIT_MID_TYPE  节点类型是中间节点
              * @brief 检查当前节点是否有效 hash_tag = 0则无效
              */
-            bool isvalid(int iit_node_type, uint8_t *hash_tag_key, Addr paddr)
+            bool isvalid(int iit_node_type, const CME::MacKey *hash_tag_key, Addr paddr)
             {
-                node_type_sanity(iit_node_type);
                 iit_hash_tag hash_tag = get_hash_tag(iit_node_type, hash_tag_key, paddr);
                 return hash_tag == INVALID_NODE ? false : true;
             }
@@ -286,73 +743,24 @@ namespace gem5
              */
             void getCounter_k(int iit_node_type, uint32_t k, CL_Counter counter)
             {
-                node_type_sanity(iit_node_type);
-                // k不能超过当前类型的arity
-                ctr_range_sanity(iit_node_type, k);
-                iit_major_counter major = abstract_major(iit_node_type);
-                *((iit_major_counter *)(&counter[sizeof(iit_minor_counter)])) = major;
-                if (iit_node_type == IIT_LEAF_TYPE)
-                {
-                    *((iit_minor_counter *)counter) = (leafNode[k] & IIT_LEAF_NODE_MAJOR_MASK);
-                }
-                else
-                {
-                    *((iit_minor_counter *)counter) = (midNode[k] & IIT_MID_NODE_MAJOR_MASK);
-                }
+                dispatch(iit_node_type, [k, counter](auto &n) { n.getCounter_k(k, counter); });
             }
-
             /**
              * @author yqy
              * @brief 将第k个计数器置0
-             *
              */
             void reset_counter_k(int iit_node_type, uint32_t k)
             {
-                node_type_sanity(iit_node_type);
-                ctr_range_sanity(iit_node_type, k);
-                if (iit_node_type == IIT_LEAF_TYPE)
-                    leafNode[k] &= (IIT_LEAF_NODE_HASH_TAG_MASK | IIT_LEAF_NODE_MAJOR_MASK);
-                else
-                    leafNode[k] &= (IIT_MID_NODE_HASH_TAG_MASK | IIT_MID_NODE_MAJOR_MASK);
+                dispatch(iit_node_type, [k](auto &n) { n.resetCounter_k(k); });
             }
             /**
              * @brief 给第k个计数器增加1
              * @author yqy
              * @param OF记录是否发生溢出,用于引发页面重加密和HMAC刷新
-             * @attention 未完全实现
              */
-            void
-            inc_counter(int iit_node_type, uint32_t k, bool &OF)
+            void inc_counter(int iit_node_type, uint32_t k, bool &OF)
             {
-                OF = false;
-                CL_Counter counter;
-                node_type_sanity(iit_node_type);
-                getCounter_k(iit_node_type, k, counter);
-                (*((iit_minor_counter *)counter))++;
-
-                if (iit_node_type == IIT_LEAF_TYPE)
-                {
-                    if ((*((iit_minor_counter *)counter)) > IIT_LEAF_MINOR_MAXM)
-                    {
-                        *((iit_minor_counter *)counter) = 0;
-                        OF = true;
-                        (*((iit_major_counter *)(&counter[sizeof(iit_minor_counter)])))++;
-                        assert(*((iit_major_counter *)(&counter[sizeof(iit_minor_counter)])) != 0 && "Major counter overflow");
-                    }
-                }
-                else
-                {
-                    if ((*((iit_minor_counter *)counter)) > IIT_MID_MINOR_MAXM)
-                    {
-                        *((iit_minor_counter *)counter) = 0;
-                        OF = true;
-                        (*((iit_major_counter *)(&counter[sizeof(iit_minor_counter)])))++;
-                        assert(*((iit_major_counter *)(&counter[sizeof(iit_minor_counter)])) != 0 && "Major counter overflow");
-                    }
-                }
-                if (OF) // 副计数器溢出
-                    embed_major(iit_node_type, *((iit_major_counter *)(&counter[sizeof(iit_minor_counter)])) + 1);
-                embed_minor_k(iit_node_type, *((iit_minor_counter *)(counter)), k);
+                dispatch(iit_node_type, [k, &OF](auto &n) { n.incCounter(k, OF); });
             }
             /**
              * @author:yqy
@@ -361,40 +769,9 @@ namespace gem5
              * @attention 结果计数器格式为中间节点
              * @brief:求当前节点的和,并转换为mid类型的节点写入指针参数中
              */
-            void sum(int iit_node_type, CL_Counter container, int dest_iit_node_type = IIT_MID_ARITY)
+            void sum(int iit_node_type, CL_Counter container)
             {
-                iit_major_counter major = abstract_major(iit_node_type);
-                iit_major_counter minor = 0x0;
-                if (iit_node_type == IIT_LEAF_TYPE)
-                {
-                    major <<= (IIT_LEAF_MINOR_BIT_SIZE - IIT_MID_MINOR_BIT_SIZE);
-                    for (int i = 0; i < IIT_LEAF_ARITY; i++)
-                        minor += ((leafNode[i]) & IIT_LEAF_MINOR_RESERVED_MASK);
-                }
-                else
-                {
-                    for (int i = 0; i < IIT_MID_ARITY; i++)
-                        minor += ((leafNode[i]) & IIT_MID_MINOR_RESERVED_MASK);
-                    minor &= (1 << IIT_LEAF_MINOR_BIT_SIZE);
-                }
-                // switch (dest_iit_node_type)
-                // {
-                // case IIT_LEAF_TYPE:
-                //     major += (minor / (IIT_LEAF_MINOR_MAXM + 1));
-                //     minor &= (1 << IIT_LEAF_MINOR_BIT_SIZE);
-                //     break;
-                // case IIT_MID_TYPE:
-                // 中间节点计数器更快溢出
-                major += (minor / (IIT_MID_MINOR_MAXM + 1));
-                minor &= ((1 << IIT_MID_MINOR_BIT_SIZE) - 1);
-                // break;
-                // default:
-                //     assert(0 && "undefined type of node");
-                //     break;
-                // }
-                *((iit_minor_counter *)(container)) = (iit_minor_counter)minor;
-                *((iit_major_counter *)(&container[sizeof(iit_minor_counter)])) = major;
-                return;
+                dispatch(iit_node_type, [container](auto &n) { n.sum(container); });
             }
             /**
              * @brief
@@ -404,7 +781,6 @@ namespace gem5
              */
             void print(int iit_node_type, uint32_t k)
             {
-                node_type_sanity(iit_node_type);
                 CL_Counter counter_k;
                 getCounter_k(iit_node_type, k, counter_k);
                 uint64_t *major = (uint64_t *)(&counter_k[sizeof(iit_minor_counter)]); // 2~10B
@@ -0,0 +1,395 @@
+/**
+ * @author yqy
+ * @brief IIT节点打包格式的单元测试
+ */
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include "IIT.hh"
+
+using namespace gem5::sDM;
+
+namespace
+{
+
+/**
+ * @brief 逐位的参考实现:按小端取出每个64位字中mask选中的位
+ */
+uint64_t
+refGather(const uint64_t *w, uint64_t mask)
+{
+    uint64_t v = 0;
+    int pos = 0;
+    for (int i = 0; i < IIT_NODE_SIZE / 8; i++) {
+        for (int b = 0; b < 64; b++) {
+            if (mask >> b & 1)
+                v |= (w[i] >> b & 1) << pos++;
+        }
+    }
+    return v;
+}
+
+template <typename Node>
+void
+randomize(Node &n, std::mt19937_64 &rng)
+{
+    for (auto &w : n.w)
+        w = rng();
+}
+
+/**
+ * @brief 每个掩码分别用PEXT/PDEP和可移植实现拼接、嵌入,两者都要与参考实现一致
+ */
+template <typename Node>
+void
+checkGatherScatter()
+{
+    std::mt19937_64 rng(Node::ARITY * 131 + Node::MINOR_BITS);
+    for (uint64_t mask : {Node::MAJOR_MASK, Node::HASH_TAG_MASK}) {
+        for (int t = 0; t < 64; t++) {
+            Node node;
+            randomize(node, rng);
+            uint64_t v = rng();
+            uint64_t ref = refGather(node.w, mask);
+            Node packed[2];
+            for (int bmi2 = 0; bmi2 < 2; bmi2++) {
+                bool prev = iit_UseBMI2(bmi2);
+                EXPECT_EQ(ref, iit_gather(node.w, mask));
+                packed[bmi2] = node;
+                iit_scatter(packed[bmi2].w, v, mask);
+                iit_UseBMI2(prev);
+            }
+            ASSERT_EQ(0, memcmp(packed[0].w, packed[1].w, IIT_NODE_SIZE));
+            EXPECT_EQ(v, refGather(packed[0].w, mask));
+            for (int i = 0; i < Node::WORDS; i++)
+                EXPECT_EQ(node.w[i] & ~mask, packed[0].w[i] & ~mask);
+        }
+    }
+}
+
+/**
+ * @brief 打包节点与解码形式互相转换后逐位不变,计数器访问结果一致
+ */
+template <typename Node>
+void
+checkRoundTrip()
+{
+    std::mt19937_64 rng(Node::ARITY * 7 + Node::EMB_BITS);
+    for (int t = 0; t < 64; t++) {
+        Node node, repacked;
+        memset(node.w, 0, sizeof(node.w));
+        for (int k = 0; k < Node::ARITY; k++)
+            node.setMinor(k, rng() & Node::MINOR_MAX);
+        node.setMajor(rng());
+        node.setHashTag(rng());
+
+        typename Node::Decoded d;
+        node.decode(d);
+        EXPECT_EQ(node.major(), d.major);
+        EXPECT_EQ(node.hashTag(), d.hash_tag);
+        for (int k = 0; k < Node::ARITY; k++) {
+            CL_Counter a, b;
+            node.getCounter_k(k, a);
+            d.getCounter_k(k, b);
+            ASSERT_EQ(0, memcmp(a, b, sizeof(CL_Counter)));
+        }
+        repacked.encode(d);
+        ASSERT_EQ(0, memcmp(node.w, repacked.w, IIT_NODE_SIZE));
+
+        CL_Counter a, b;
+        node.sum(a);
+        d.sum(b);
+        EXPECT_EQ(0, memcmp(a, b, sizeof(CL_Counter)));
+    }
+}
+
+/**
+ * @brief 副计数器溢出时主计数器加1,其余副计数器不变
+ */
+template <typename Node>
+void
+checkOverflow()
+{
+    Node node;
+    memset(node.w, 0, sizeof(node.w));
+    node.setMajor(5);
+    node.setMinor(1, 3);
+    bool of;
+    for (int i = 0; i < Node::MINOR_MAX; i++) {
+        node.incCounter(0, of);
+        ASSERT_FALSE(of);
+    }
+    EXPECT_EQ(Node::MINOR_MAX, node.minor(0));
+    node.incCounter(0, of);
+    EXPECT_TRUE(of);
+    EXPECT_EQ(6u, node.major());
+    EXPECT_EQ(0, node.minor(0));
+    EXPECT_EQ(3, node.minor(1));
+}
+
+} // anonymous namespace
+
+TEST(IITNodeTest, GatherScatterDefaultGeometry)
+{
+    checkGatherScatter<iit_NodeT<32, 12, 4>>();
+    checkGatherScatter<iit_NodeT<64, 6, 2>>();
+}
+
+TEST(IITNodeTest, RoundTripDefaultGeometry)
+{
+    checkRoundTrip<iit_NodeT<32, 12, 4>>();
+    checkRoundTrip<iit_NodeT<64, 6, 2>>();
+}
+
+TEST(IITNodeTest, OverflowDefaultGeometry)
+{
+    checkOverflow<iit_NodeT<32, 12, 4>>();
+    checkOverflow<iit_NodeT<64, 6, 2>>();
+}
+
+/**
+ * @brief IIT.cpp中显式实例化的其余几何
+ */
+TEST(IITNodeTest, GatherScatterOtherGeometries)
+{
+    checkGatherScatter<iit_NodeT<128, 3, 1>>();
+    checkGatherScatter<iit_NodeT<128, 2, 1>>();
+    checkGatherScatter<iit_NodeT<64, 5, 2>>();
+    checkGatherScatter<iit_NodeT<32, 10, 4>>();
+}
+
+TEST(IITNodeTest, RoundTripOtherGeometries)
+{
+    checkRoundTrip<iit_NodeT<128, 3, 1>>();
+    checkRoundTrip<iit_NodeT<128, 2, 1>>();
+    checkRoundTrip<iit_NodeT<64, 5, 2>>();
+    checkRoundTrip<iit_NodeT<32, 10, 4>>();
+}
+
+TEST(IITNodeTest, OverflowOtherGeometries)
+{
+    checkOverflow<iit_NodeT<128, 3, 1>>();
+    checkOverflow<iit_NodeT<128, 2, 1>>();
+    checkOverflow<iit_NodeT<64, 5, 2>>();
+    checkOverflow<iit_NodeT<32, 10, 4>>();
+}
+
+/**
+ * @brief 默认几何与原来的打包格式逐位相同:叶节点每个16位unit的低12位为副计数器
+ */
+TEST(IITNodeTest, DefaultLeafLayout)
+{
+    typedef iit_NodeT<32, 12, 4> Leaf;
+    Leaf node;
+    memset(node.w, 0, sizeof(node.w));
+    node.setMinor(3, 0xabc);
+    node.setMajor(~0ULL);
+    const uint16_t *unit = (const uint16_t *)node.w;
+    EXPECT_EQ(0xabc, unit[3] & 0xfff);
+    for (int k = 0; k < Leaf::ARITY; k++)
+        EXPECT_EQ(0x3, unit[k] >> 12 & 0x3);
+    EXPECT_EQ(0u, node.hashTag());
+}
+
+namespace
+{
+
+/**
+ * @brief 可变编码叶节点:打包后逐个逻辑计数器与解码形式一致
+ */
+template <int Arity>
+void
+checkMorph(const typename iit_MorphNodeT<Arity>::Decoded &d, int format)
+{
+    typedef iit_MorphNodeT<Arity> Node;
+    Node node;
+    node.encode(d);
+    EXPECT_EQ(format, node.format());
+    typename Node::Decoded back;
+    node.decode(back);
+    EXPECT_EQ(d.hash_tag, back.hash_tag);
+    for (int k = 0; k < Arity; k++) {
+        ASSERT_EQ(d.ctr[k], back.ctr[k]) << "counter " << k;
+        ASSERT_EQ(d.ctr[k], node.value(k)) << "counter " << k;
+    }
+}
+
+/**
+ * @brief 按给定的写序列递增计数器,每一步都与逻辑计数器的模型比较
+ * @return 发生溢出的次数
+ */
+template <int Arity, typename Next>
+int
+writeSequence(int writes, Next next)
+{
+    typedef iit_MorphNodeT<Arity> Node;
+    Node node;
+    memset(node.w, 0, sizeof(node.w));
+    uint64_t model[Arity] = {0};
+    int overflows = 0;
+    for (int t = 0; t < writes; t++) {
+        uint32_t k = next(t);
+        uint64_t before[Arity];
+        memcpy(before, model, sizeof(model));
+        bool of;
+        node.incCounter(k, of);
+        model[k]++;
+        for (int i = 0; i < Arity; i++) {
+            // 溢出只会提升计数器,逻辑计数器从不回退
+            uint64_t v = node.value(i);
+            EXPECT_GE(v, model[i]);
+            if (!of) {
+                EXPECT_EQ(model[i], v);
+            }
+            model[i] = v;
+        }
+        overflows += of;
+        // 写入的缓存行的计数器必须严格增加
+        EXPECT_GT(model[k], before[k]);
+    }
+    return overflows;
+}
+
+} // anonymous namespace
+
+TEST(IITMorphTest, EncodingsRoundTrip)
+{
+    typedef iit_MorphNodeT<64> Node;
+    Node::Decoded d;
+    d.hash_tag = 0x1234567890abcdefULL;
+
+    // 增量都小于2^UNIFORM_BITS
+    for (int k = 0; k < 64; k++)
+        d.ctr[k] = 1000 + k % (1 << Node::UNIFORM_BITS);
+    checkMorph<64>(d, Node::UNIFORM);
+
+    // 组间不均匀,组内增量较小
+    for (int k = 0; k < 64; k++)
+        d.ctr[k] = 1000 + (k / Node::GROUP_LINES) * 5000 + k % 8;
+    checkMorph<64>(d, Node::GROUP);
+
+    // 少数缓存行被频繁写
+    for (int k = 0; k < 64; k++)
+        d.ctr[k] = 1000;
+    d.ctr[3] += 1ULL << 30;
+    d.ctr[40] += 77;
+    checkMorph<64>(d, Node::SPARSE);
+
+    typedef iit_MorphNodeT<128> Node2;
+    Node2::Decoded d2;
+    d2.hash_tag = 7;
+    for (int k = 0; k < 128; k++)
+        d2.ctr[k] = 1ULL << 40;
+    d2.ctr[127] += 100000;
+    d2.ctr[64] += 3;
+    checkMorph<128>(d2, Node2::SPARSE);
+    for (int k = 0; k < 128; k++)
+        d2.ctr[k] = k % (1 << Node2::UNIFORM_BITS);
+    checkMorph<128>(d2, Node2::UNIFORM);
+}
+
+TEST(IITMorphTest, ZeroNodeIsUniform)
+{
+    iit_MorphNodeT<64> node;
+    memset(node.w, 0, sizeof(node.w));
+    EXPECT_EQ(iit_MorphNodeT<64>::UNIFORM, node.format());
+    for (int k = 0; k < 64; k++)
+        EXPECT_EQ(0u, node.value(k));
+}
+
+/**
+ * @brief 均匀写:始终为UNIFORM编码,不溢出
+ */
+TEST(IITMorphTest, UniformWritesNeverOverflow)
+{
+    EXPECT_EQ(0, writeSequence<64>(64 * 500, [](int t) { return t % 64; }));
+    EXPECT_EQ(0, writeSequence<128>(128 * 100, [](int t) { return t % 128; }));
+}
+
+/**
+ * @brief 组内偏斜的写:UNIFORM放不下后溢出只重置组内增量过大的组,其余组的计数器不变
+ */
+TEST(IITMorphTest, SkewedWritesResetOneGroup)
+{
+    typedef iit_MorphNodeT<64> Node;
+    Node::Decoded d;
+    d.hash_tag = 0;
+    // 每组内各行的计数器为0..7,稀疏编码放不下这么多非0增量
+    for (int k = 0; k < 64; k++)
+        d.ctr[k] = k % Node::GROUP_LINES;
+    Node node;
+    node.encode(d);
+    ASSERT_EQ(Node::UNIFORM, node.format());
+
+    int overflows = 0;
+    for (int t = 0; t < 1000; t++) {
+        // 第0组和第3组各有一行被频繁写
+        uint32_t k = t % 2 ? 0 : 3 * Node::GROUP_LINES + 1;
+        Node::Decoded before, after;
+        node.decode(before);
+        bool of;
+        node.incCounter(k, of);
+        node.decode(after);
+        if (!of) {
+            for (int i = 0; i < 64; i++)
+                ASSERT_EQ(before.ctr[i] + (i == (int)k), after.ctr[i]);
+            continue;
+        }
+        overflows++;
+        EXPECT_EQ(Node::GROUP, node.format());
+        EXPECT_EQ(before.ctr[k] + 1, after.ctr[k]);
+        for (int g = 0; g < Node::GROUPS; g++) {
+            const uint64_t *b = before.ctr + g * Node::GROUP_LINES;
+            const uint64_t *a = after.ctr + g * Node::GROUP_LINES;
+            bool reset = std::equal(a + 1, a + Node::GROUP_LINES, a) &&
+                !std::equal(b + 1, b + Node::GROUP_LINES, b);
+            // 只有写入的两个组会被重置,重置的组都提升到组内最大值
+            if (g != 0 && g != 3) {
+                ASSERT_FALSE(reset) << "group " << g;
+            }
+            for (int i = 0; !reset && i < Node::GROUP_LINES; i++) {
+                ASSERT_EQ(b[i] + (g * Node::GROUP_LINES + i == (int)k), a[i])
+                    << "group " << g;
+            }
+        }
+    }
+    EXPECT_GT(overflows, 0);
+}
+
+/**
+ * @brief 没有编码能表示、重置一组也不够时所有计数器提升到最大值
+ */
+TEST(IITMorphTest, FullOverflowRaisesAll)
+{
+    typedef iit_MorphNodeT<64> Node;
+    Node::Decoded d;
+    d.hash_tag = 0;
+    // 第1到7组各有一行比最小值大2^20,组基值放不下;15个非0增量时稀疏编码刚好放得下
+    const uint64_t far = 1ULL << 20;
+    for (int k = 0; k < 64; k++)
+        d.ctr[k] = k % Node::GROUP_LINES == 0 && k ? far : 0;
+    for (int k = 1; k < Node::GROUP_LINES; k++)
+        d.ctr[k] = 1;
+    d.ctr[Node::GROUP_LINES + 1] = 1;
+    Node node;
+    node.encode(d);
+    ASSERT_EQ(Node::SPARSE, node.format());
+    // 第16个非0增量使稀疏编码放不下,重置组后组基值仍放不下
+    bool of;
+    node.incCounter(Node::GROUP_LINES + 2, of);
+    EXPECT_TRUE(of);
+    EXPECT_EQ(Node::UNIFORM, node.format());
+    for (int k = 0; k < 64; k++)
+        EXPECT_EQ(far, node.value(k)) << "counter " << k;
+}
+
+TEST(IITMorphTest, RandomWritesMatchModel)
+{
+    std::mt19937_64 rng(24);
+    writeSequence<64>(20000, [&rng](int) { return rng() % 64; });
+    writeSequence<128>(20000, [&rng](int) {
+        // 一半的写集中在前两个组
+        return rng() % 2 ? rng() % 16 : rng() % 128;
+    });
+}
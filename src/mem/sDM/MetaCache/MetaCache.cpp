@@ -0,0 +1,92 @@
+#include "MetaCache.hh"
+
+#include "mem/cache/prefetch/associative_set_impl.hh"
+
+namespace gem5
+{
+    namespace sDM
+    {
+        MetaCache::MetaCache(int assoc, int num_entries, BaseIndexingPolicy *idx_policy,
+                             replacement_policy::Base *rpl_policy)
+            : entries(assoc, num_entries, idx_policy, rpl_policy)
+        {
+        }
+        /**
+         * @author yqy
+         * @brief 查询paddr所在缓存行是否在缓存中,不改变替换状态
+         */
+        bool MetaCache::probe(Addr paddr) const
+        {
+            return entries.findEntry(paddr & CL_ALIGN_MASK, false) != nullptr;
+        }
+        /**
+         * @author yqy
+         * @brief 读取paddr所在的缓存行
+         * @param line 命中时返回缓存行内容
+         * @return 是否命中
+         */
+        bool MetaCache::read(Addr paddr, uint8_t *line)
+        {
+            MetaCacheEntry *entry = entries.findEntry(paddr & CL_ALIGN_MASK, false);
+            if (!entry)
+                return false;
+            entries.accessEntry(entry);
+            memcpy(line, entry->data, CL_SIZE);
+            return true;
+        }
+        /**
+         * @author yqy
+         * @brief 将已经校验过的缓存行插入缓存
+         * @attention 写直达,被替换的缓存行直接丢弃
+         */
+        void MetaCache::insert(Addr paddr, const uint8_t *line)
+        {
+            paddr &= CL_ALIGN_MASK;
+            MetaCacheEntry *entry = entries.findEntry(paddr, false);
+            if (!entry)
+            {
+                entry = entries.findVictim(paddr);
+                entries.insertEntry(paddr, false, entry);
+                entry->paddr = paddr;
+            }
+            else
+                entries.accessEntry(entry);
+            memcpy(entry->data, line, CL_SIZE);
+        }
+        /**
+         * @author yqy
+         * @brief 元数据写直达远端内存时,同步更新缓存中的副本(若存在)
+         * @param size 写入的字节数,不能跨越缓存行
+         */
+        void MetaCache::update(Addr paddr, const uint8_t *data, int size)
+        {
+            assert((paddr & CL_ALIGNED_CHK) + size <= CL_SIZE && "update crosses a cache line");
+            MetaCacheEntry *entry = entries.findEntry(paddr & CL_ALIGN_MASK, false);
+            if (entry)
+                memcpy(entry->data + (paddr & CL_ALIGNED_CHK), data, size);
+        }
+        /**
+         * @author yqy
+         * @brief 使paddr所在的缓存行失效
+         */
+        void MetaCache::invalidate(Addr paddr)
+        {
+            MetaCacheEntry *entry = entries.findEntry(paddr & CL_ALIGN_MASK, false);
+            if (entry)
+                entries.invalidate(entry);
+        }
+        /**
+         * @author yqy
+         * @brief 使[start, start + size)内的所有缓存行失效,用于释放sdm空间的元数据区
+         * @attention 遍历整个缓存,代价与缓存容量成正比而与区域大小无关
+         */
+        void MetaCache::invalidateRange(Addr start, Addr size)
+        {
+            for (auto &entry : entries)
+            {
+                if (entry.isValid() && entry.paddr >= start && entry.paddr < start + size)
+                    entries.invalidate(&entry);
+            }
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef _META_CACHE_HH_
+#define _META_CACHE_HH_
+
+#include "../sDM_def.hh"
+#include "base/types.hh"
+#include "mem/cache/prefetch/associative_set.hh"
+#include "mem/cache/replacement_policies/base.hh"
+#include "mem/cache/tags/indexing_policies/base.hh"
+#include "mem/cache/tags/tagged_entry.hh"
+
+#include <cstring>
+
+/**
+ * 元数据缓存
+ * 位于本地安全内存控制器中,缓存已经校验过的iit节点和HMAC缓存行
+ * 1. 缓存中的iit节点是可信的,校验关键路径时遇到命中的节点即可提前结束
+ * 2. 采用写直达:修改元数据时同时写远端内存和缓存,替换时无需写回
+ */
+namespace gem5
+{
+    namespace sDM
+    {
+        /**
+         * @author yqy
+         * @brief 元数据缓存的一项,保存一个64B的iit节点或HMAC缓存行
+         */
+        class MetaCacheEntry : public TaggedEntry
+        {
+        public:
+            Addr paddr; // 缓存行地址,用于按地址范围失效
+            uint8_t data[CL_SIZE];
+        };
+
+        class MetaCache
+        {
+        private:
+            AssociativeSet<MetaCacheEntry> entries;
+
+        public:
+            MetaCache(int assoc, int num_entries, BaseIndexingPolicy *idx_policy,
+                      replacement_policy::Base *rpl_policy);
+            bool probe(Addr paddr) const;
+            bool read(Addr paddr, uint8_t *line);
+            void insert(Addr paddr, const uint8_t *line);
+            void update(Addr paddr, const uint8_t *data, int size);
+            void invalidate(Addr paddr);
+            void invalidateRange(Addr start, Addr size);
+        };
+    }
+}
+#endif // _META_CACHE_HH_
@@ -0,0 +1,100 @@
+# Copyright (c) 2026 The sDM Authors
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are
+# met: redistributions of source code must retain the above copyright
+# notice, this list of conditions and the following disclaimer;
+# redistributions in binary form must reproduce the above copyright
+# notice, this list of conditions and the following disclaimer in the
+# documentation and/or other materials provided with the distribution;
+# neither the name of the copyright holders nor the names of its
+# contributors may be used to endorse or promote products derived from
+# this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+# A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+# OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+# LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+# THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+# (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+# OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+from m5.params import *
+from m5.proxy import *
+from m5.SimObject import SimObject
+from m5.objects.IndexingPolicies import *
+from m5.objects.ReplacementPolicies import *
+
+
+# Cipher and MAC used by CME and the IIT. aes_ghash is AES-128 counter
+# mode with a GMAC-style tag, kept for comparison with the SM4/SM3 pair;
+# null does no host work at all (plaintext data, all-zero MACs) so that
+# long timing studies only pay for the modelled latency and traffic.
+class SDMCrypto(Enum):
+    vals = ["sm4_sm3", "aes_ghash", "null"]
+
+
+# Where the MACs of the data live. half_page keeps one HMAC per half page
+# in a separate region, fetched through the metadata cache, and a line is
+# only verified together with the rest of its half page. sideband gives
+# every line a truncated 64-bit MAC carried in the ECC bits of its own
+# data burst, so neither HMAC lines nor neighbouring lines are fetched.
+class SDMMacLayout(Enum):
+    vals = ["half_page", "sideband"]
+
+
+# sDMmanager is the hardware abstraction of the secure disaggregated
+# memory: it owns the CME keys, the incomplete integrity tree (IIT) and
+# the half-page HMACs of every sdm space. Data, IIT nodes and HMACs all
+# live in the remote memory behind the memory controller that uses it.
+class SDMManager(SimObject):
+    type = "SDMManager"
+    cxx_header = "mem/sDM/sDM.hh"
+    cxx_class = "gem5::sDM::sDMmanager"
+
+    pool_id = Param.Int(0, "Local memory pool the manager belongs to")
+
+    # every range is registered as one sdm space at init time
+    sdm_ranges = VectorParam.AddrRange(
+        [], "Physical ranges protected as sdm spaces"
+    )
+
+    # IIT nodes and HMACs are allocated from this range, it must be
+    # backed by the memory controller the manager is attached to
+    metadata_range = Param.AddrRange(
+        "Remote range reserved for IIT nodes and HMACs"
+    )
+
+    crypto_backend = Param.SDMCrypto("sm4_sm3", "Crypto backend of CME/IIT")
+    mac_layout = Param.SDMMacLayout("half_page", "Layout of the data MACs")
+
+    # verified IIT nodes and HMAC lines are kept in a local write-through
+    # cache, a cached node ends the key path walk of a read early
+    meta_cache_size = Param.MemorySize("32KiB", "Size of the metadata cache")
+    meta_cache_assoc = Param.Unsigned(8, "Associativity of the metadata cache")
+    meta_cache_indexing_policy = Param.BaseIndexingPolicy(
+        SetAssociative(
+            entry_size=64,
+            assoc=Parent.meta_cache_assoc,
+            size=Parent.meta_cache_size,
+        ),
+        "Indexing policy of the metadata cache",
+    )
+    meta_cache_replacement_policy = Param.BaseReplacementPolicy(
+        LRURP(), "Replacement policy of the metadata cache"
+    )
+
+    # in write-back mode a write only updates its leaf, which stays dirty
+    # in trusted local storage; parent counters and hash tags are only
+    # propagated when a dirty node is replaced or at the end of an epoch,
+    # so a burst of writes to one leaf costs a single path update
+    iit_write_back = Param.Bool(False, "Defer IIT parent updates")
+    iit_dirty_nodes = Param.Unsigned(64, "Dirty IIT nodes kept locally")
+    iit_epoch_writes = Param.Unsigned(
+        0, "Writes between two full propagations, 0 for replacement only"
+    )
@@ -0,0 +1,204 @@
+/************************************************************
+FileName:
+ AES.cpp
+Description:
+ AES-128 block encryption, used by the AES-CTR/GHASH crypto
+backend of sDM for comparison with SM4/SM3. Only the forward
+cipher is needed: counter mode decrypts by encrypting the OTP.
+ The S-box is generated at load time from the inverse in GF(2^8)
+instead of being tabulated. The round keys are kept in FIPS-197
+byte order so that AES-NI can load them directly; the portable
+rounds are the reference AES-NI is checked against.
+************************************************************/
+#include "AES.hh"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AES_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define AES_X86 0
+#endif
+
+namespace gem5
+{
+	namespace aes
+	{
+		static uint8_t AES_Sbox[256];
+
+		static inline uint8_t AES_Rotl8(uint8_t x, int n)
+		{
+			return (uint8_t)((x << n) | (x >> (8 - n)));
+		}
+		static inline uint8_t AES_Xtime(uint8_t x)
+		{
+			return (uint8_t)((x << 1) ^ ((x & 0x80) ? 0x1B : 0));
+		}
+		/************************************************************
+		p walks the multiplicative group with generator 3 while q
+		walks it backwards, so q = p^-1 and Sbox[p] = affine(q)
+		************************************************************/
+		static bool AES_SboxInit()
+		{
+			uint8_t p = 1, q = 1;
+			do
+			{
+				p = p ^ (uint8_t)(p << 1) ^ ((p & 0x80) ? 0x1B : 0);
+				q ^= (uint8_t)(q << 1);
+				q ^= (uint8_t)(q << 2);
+				q ^= (uint8_t)(q << 4);
+				q ^= (q & 0x80) ? 0x09 : 0;
+				uint8_t x = q ^ AES_Rotl8(q, 1) ^ AES_Rotl8(q, 2) ^ AES_Rotl8(q, 3) ^ AES_Rotl8(q, 4);
+				AES_Sbox[p] = x ^ 0x63;
+			} while (p != 1);
+			AES_Sbox[0] = 0x63;
+			return true;
+		}
+		static const bool AES_SboxReady = AES_SboxInit();
+
+		void AES_SetKey(AESContext *ctx, const uint8_t key[])
+		{
+			uint8_t *w = &ctx->rk[0][0];
+			uint8_t rcon = 0x01;
+			memcpy(w, key, AES_KEY_SIZE);
+			for (int i = 4; i < 4 * (AES_ROUNDS + 1); i++)
+			{
+				uint8_t t[4];
+				memcpy(t, w + 4 * (i - 1), 4);
+				if (i % 4 == 0)
+				{
+					// RotWord, SubWord, Rcon
+					uint8_t t0 = t[0];
+					t[0] = AES_Sbox[t[1]] ^ rcon;
+					t[1] = AES_Sbox[t[2]];
+					t[2] = AES_Sbox[t[3]];
+					t[3] = AES_Sbox[t0];
+					rcon = AES_Xtime(rcon);
+				}
+				for (int j = 0; j < 4; j++)
+					w[4 * i + j] = w[4 * (i - 4) + j] ^ t[j];
+			}
+		}
+		/************************************************************
+		Portable rounds: one block after the other, the state is
+		column major as in FIPS-197
+		************************************************************/
+		static void AES_EncryptScalar(const AESContext *ctx, const uint8_t *in, uint8_t *out, int nblocks)
+		{
+			for (int b = 0; b < nblocks; b++, in += AES_INPUT_SIZE, out += AES_INPUT_SIZE)
+			{
+				uint8_t s[16], t[16];
+				for (int j = 0; j < 16; j++)
+					s[j] = in[j] ^ ctx->rk[0][j];
+				for (int r = 1; r <= AES_ROUNDS; r++)
+				{
+					// SubBytes and ShiftRows
+					for (int c = 0; c < 4; c++)
+						for (int row = 0; row < 4; row++)
+							t[row + 4 * c] = AES_Sbox[s[row + 4 * ((c + row) & 3)]];
+					if (r != AES_ROUNDS)
+					{
+						// MixColumns
+						for (int c = 0; c < 4; c++)
+						{
+							uint8_t *a = t + 4 * c;
+							uint8_t all = a[0] ^ a[1] ^ a[2] ^ a[3], a0 = a[0];
+							a[0] ^= all ^ AES_Xtime(a[0] ^ a[1]);
+							a[1] ^= all ^ AES_Xtime(a[1] ^ a[2]);
+							a[2] ^= all ^ AES_Xtime(a[2] ^ a[3]);
+							a[3] ^= all ^ AES_Xtime(a[3] ^ a0);
+						}
+					}
+					for (int j = 0; j < 16; j++)
+						s[j] = t[j] ^ ctx->rk[r][j];
+				}
+				memcpy(out, s, AES_INPUT_SIZE);
+			}
+		}
+#if AES_X86
+		/************************************************************
+		AES-NI rounds, 4 independent blocks interleaved to hide the
+		latency of AESENC
+		************************************************************/
+		__attribute__((target("aes,sse2"))) static void AES_EncryptNI(const AESContext *ctx, const uint8_t *in, uint8_t *out, int nblocks)
+		{
+			__m128i k[AES_ROUNDS + 1];
+			for (int r = 0; r <= AES_ROUNDS; r++)
+				k[r] = _mm_loadu_si128((const __m128i *)ctx->rk[r]);
+			int b = 0;
+			for (; b + 4 <= nblocks; b += 4)
+			{
+				const __m128i *src = (const __m128i *)(in + b * AES_INPUT_SIZE);
+				__m128i x0 = _mm_xor_si128(_mm_loadu_si128(src + 0), k[0]);
+				__m128i x1 = _mm_xor_si128(_mm_loadu_si128(src + 1), k[0]);
+				__m128i x2 = _mm_xor_si128(_mm_loadu_si128(src + 2), k[0]);
+				__m128i x3 = _mm_xor_si128(_mm_loadu_si128(src + 3), k[0]);
+				for (int r = 1; r < AES_ROUNDS; r++)
+				{
+					x0 = _mm_aesenc_si128(x0, k[r]);
+					x1 = _mm_aesenc_si128(x1, k[r]);
+					x2 = _mm_aesenc_si128(x2, k[r]);
+					x3 = _mm_aesenc_si128(x3, k[r]);
+				}
+				__m128i *dst = (__m128i *)(out + b * AES_INPUT_SIZE);
+				_mm_storeu_si128(dst + 0, _mm_aesenclast_si128(x0, k[AES_ROUNDS]));
+				_mm_storeu_si128(dst + 1, _mm_aesenclast_si128(x1, k[AES_ROUNDS]));
+				_mm_storeu_si128(dst + 2, _mm_aesenclast_si128(x2, k[AES_ROUNDS]));
+				_mm_storeu_si128(dst + 3, _mm_aesenclast_si128(x3, k[AES_ROUNDS]));
+			}
+			for (; b < nblocks; b++)
+			{
+				__m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(in + b * AES_INPUT_SIZE)), k[0]);
+				for (int r = 1; r < AES_ROUNDS; r++)
+					x = _mm_aesenc_si128(x, k[r]);
+				_mm_storeu_si128((__m128i *)(out + b * AES_INPUT_SIZE), _mm_aesenclast_si128(x, k[AES_ROUNDS]));
+			}
+		}
+		static bool AES_HaveNI()
+		{
+			unsigned int a, b, c, d;
+			if (!__get_cpuid(1, &a, &b, &c, &d))
+				return false;
+			return (c & bit_AES) && (d & bit_SSE2);
+		}
+		static const bool AES_UseNI = AES_HaveNI();
+#endif
+
+		void AES_EncryptBlocks(const AESContext *ctx, const uint8_t *in, uint8_t *out, int nblocks)
+		{
+#if AES_X86
+			if (AES_UseNI)
+			{
+				AES_EncryptNI(ctx, in, out, nblocks);
+				return;
+			}
+#endif
+			AES_EncryptScalar(ctx, in, out, nblocks);
+		}
+
+		int AES_SelfCheck()
+		{
+			// FIPS-197 appendix C.1
+			static const uint8_t key[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+											0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+			static const uint8_t plain[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+											  0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+			static const uint8_t cipher[16] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+											   0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+			AESContext ctx;
+			uint8_t in[7 * AES_INPUT_SIZE], ref[7 * AES_INPUT_SIZE], out[7 * AES_INPUT_SIZE];
+			AES_SetKey(&ctx, key);
+			AES_EncryptScalar(&ctx, plain, out, 1);
+			if (memcmp(out, cipher, AES_INPUT_SIZE) != 0)
+				return 1;
+			// 4路交织与剩余块的路径都要和标量结果一致
+			for (int j = 0; j < (int)sizeof(in); j++)
+				in[j] = (uint8_t)(j * 37 + 11);
+			AES_EncryptScalar(&ctx, in, ref, 7);
+			AES_EncryptBlocks(&ctx, in, out, 7);
+			return memcmp(out, ref, sizeof(out)) != 0;
+		}
+	}
+}
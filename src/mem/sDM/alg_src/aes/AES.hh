@@ -0,0 +1,111 @@
+//Function List:
+//AES_SetKey         //Expand the AES-128 round keys of a context once
+//AES_EncryptBlocks  //Multi-block encryption with precomputed round keys
+//AES_SelfCheck      //Self-check against the FIPS-197 vector
+//GHASH_SetKey       //Hash subkey H of the GHASH universal hash
+//GHASH_init         //Start a GHASH
+//GHASH_process      //Absorb 16-byte blocks
+//GHASH_done         //Length block and output
+//GHASH_SelfCheck    //Self-check against a GCM test vector
+#ifndef __AES_H
+#define __AES_H
+#include <stdint.h>
+#define AES_INPUT_SIZE 16 // AES 分组字节长度
+#define AES_KEY_SIZE 16   // AES-128 密钥字节长度
+#define AES_ROUNDS 10
+#define GHASH_SIZE 16     // GHASH 输出字节长度
+namespace gem5
+{
+    namespace aes
+    {
+        /************************************************************
+        Struct:
+        AESContext
+        Description:
+        Expanded round keys of one AES-128 key, in the byte order of
+        FIPS-197 so that both the portable rounds and AES-NI can use
+        them directly
+        ************************************************************/
+        typedef struct
+        {
+            uint8_t rk[AES_ROUNDS + 1][AES_INPUT_SIZE];
+        } AESContext;
+        /************************************************************
+        Function:
+        void AES_SetKey(AESContext *ctx, const uint8_t key[]);
+        Description:
+        Expand the round keys of a 16 byte key
+        ************************************************************/
+        void AES_SetKey(AESContext *ctx, const uint8_t key[]);
+        /************************************************************
+        Function:
+        void AES_EncryptBlocks(const AESContext *ctx, const uint8_t *in, uint8_t *out, int nblocks);
+        Description:
+        Encrypt nblocks independent blocks (ECB), with AES-NI when the
+        host CPU supports it, 4 blocks interleaved
+        @param
+        ctx: context initialized by AES_SetKey
+        in: nblocks * 16 bytes
+        @result
+        out: nblocks * 16 bytes, may alias in
+        ************************************************************/
+        void AES_EncryptBlocks(const AESContext *ctx, const uint8_t *in, uint8_t *out, int nblocks);
+        /************************************************************
+        Function:
+        int AES_SelfCheck();
+        Description:
+        Check the portable rounds and AES-NI (if supported) against
+        the FIPS-197 appendix C.1 vector
+        Return:
+        1 fail ; 0 success
+        ************************************************************/
+        int AES_SelfCheck();
+        /************************************************************
+        Struct:
+        GHASH_KEY / GHASH_STATE
+        Description:
+        Multiples of the hash subkey H (usually E_K(0^128)) by every
+        4-bit value, high and low big-endian words, and the running
+        value Y of a GHASH
+        ************************************************************/
+        typedef struct
+        {
+            uint64_t hh[16];
+            uint64_t hl[16];
+        } GHASH_KEY;
+        typedef struct
+        {
+            uint64_t y[2];
+            uint64_t len;
+            const GHASH_KEY *key;
+        } GHASH_STATE;
+        void GHASH_SetKey(GHASH_KEY *key, const uint8_t h[]);
+        void GHASH_init(GHASH_STATE *gs, const GHASH_KEY *key);
+        /************************************************************
+        Function:
+        void GHASH_process(GHASH_STATE *gs, const uint8_t *buf, int len);
+        Description:
+        Y = (Y ^ X_i) * H for each block, a partial last block is
+        padded with zeros
+        ************************************************************/
+        void GHASH_process(GHASH_STATE *gs, const uint8_t *buf, int len);
+        /************************************************************
+        Function:
+        void GHASH_done(GHASH_STATE *gs, uint8_t out[]);
+        Description:
+        Absorb the length block (0 || bit length) and output Y
+        ************************************************************/
+        void GHASH_done(GHASH_STATE *gs, uint8_t out[]);
+        /************************************************************
+        Function:
+        int GHASH_SelfCheck();
+        Description:
+        Rebuild the tag of GCM test case 2 (zero key, IV and block)
+        from AES_EncryptBlocks and GHASH
+        Return:
+        1 fail ; 0 success
+        ************************************************************/
+        int GHASH_SelfCheck();
+    }
+}
+#endif
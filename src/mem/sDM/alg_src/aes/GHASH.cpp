@@ -0,0 +1,140 @@
+/************************************************************
+FileName:
+ GHASH.cpp
+Description:
+ GHASH universal hash of GCM (NIST SP 800-38D): Y = (Y ^ X_i) * H
+in GF(2^128) with the bit-reflected polynomial x^128+x^7+x^2+x+1.
+The multiplication uses the 4-bit tables of Shoup: 16 multiples
+of H are computed once per key, a block then costs 32 table
+lookups instead of 128 conditional shifts.
+************************************************************/
+#include "AES.hh"
+
+#include <string.h>
+
+namespace gem5
+{
+	namespace aes
+	{
+		static inline uint64_t GHASH_Load64(const uint8_t *p)
+		{
+			uint64_t v = 0;
+			for (int i = 0; i < 8; i++)
+				v = (v << 8) | p[i];
+			return v;
+		}
+		static inline void GHASH_Store64(uint8_t *p, uint64_t v)
+		{
+			for (int i = 7; i >= 0; i--, v >>= 8)
+				p[i] = (uint8_t)v;
+		}
+		/* reduction of the 4 bits shifted out of the low word */
+		static const uint64_t GHASH_Last4[16] = {
+			0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+			0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0};
+		/* x = x * H, x[0] holds the first 8 bytes of the block */
+		static void GHASH_Mul(uint64_t x[2], const GHASH_KEY *key)
+		{
+			uint8_t b[16];
+			GHASH_Store64(b, x[0]);
+			GHASH_Store64(b + 8, x[1]);
+			uint64_t zh = 0, zl = 0;
+			for (int i = 15; i >= 0; i--)
+			{
+				for (int nib = 0; nib < 2; nib++)
+				{
+					uint8_t n = nib == 0 ? b[i] & 0xf : b[i] >> 4;
+					if (i != 15 || nib != 0)
+					{
+						uint8_t rem = zl & 0xf;
+						zl = (zh << 60) | (zl >> 4);
+						zh = (zh >> 4) ^ (GHASH_Last4[rem] << 48);
+					}
+					zh ^= key->hh[n];
+					zl ^= key->hl[n];
+				}
+			}
+			x[0] = zh;
+			x[1] = zl;
+		}
+
+		void GHASH_SetKey(GHASH_KEY *key, const uint8_t h[])
+		{
+			// hh/hl[8] = H, hh/hl[4,2,1] = H * x, x^2, x^3, the others are sums
+			uint64_t vh = GHASH_Load64(h), vl = GHASH_Load64(h + 8);
+			key->hh[0] = key->hl[0] = 0;
+			key->hh[8] = vh;
+			key->hl[8] = vl;
+			for (int i = 4; i > 0; i >>= 1)
+			{
+				uint64_t t = (vl & 1) ? 0xE100000000000000ULL : 0;
+				vl = (vh << 63) | (vl >> 1);
+				vh = (vh >> 1) ^ t;
+				key->hh[i] = vh;
+				key->hl[i] = vl;
+			}
+			for (int i = 2; i <= 8; i <<= 1)
+			{
+				for (int j = 1; j < i; j++)
+				{
+					key->hh[i + j] = key->hh[i] ^ key->hh[j];
+					key->hl[i + j] = key->hl[i] ^ key->hl[j];
+				}
+			}
+		}
+		void GHASH_init(GHASH_STATE *gs, const GHASH_KEY *key)
+		{
+			gs->y[0] = gs->y[1] = 0;
+			gs->len = 0;
+			gs->key = key;
+		}
+		void GHASH_process(GHASH_STATE *gs, const uint8_t *buf, int len)
+		{
+			gs->len += len;
+			for (; len > 0; buf += AES_INPUT_SIZE, len -= AES_INPUT_SIZE)
+			{
+				uint8_t blk[AES_INPUT_SIZE];
+				const uint8_t *p = buf;
+				if (len < AES_INPUT_SIZE)
+				{
+					memset(blk, 0, sizeof(blk));
+					memcpy(blk, buf, len);
+					p = blk;
+				}
+				gs->y[0] ^= GHASH_Load64(p);
+				gs->y[1] ^= GHASH_Load64(p + 8);
+				GHASH_Mul(gs->y, gs->key);
+			}
+		}
+		void GHASH_done(GHASH_STATE *gs, uint8_t out[])
+		{
+			gs->y[1] ^= gs->len * 8;
+			GHASH_Mul(gs->y, gs->key);
+			GHASH_Store64(out, gs->y[0]);
+			GHASH_Store64(out + 8, gs->y[1]);
+		}
+
+		int GHASH_SelfCheck()
+		{
+			// GCM test case 2: K = 0, IV = 0^96, P = 0^128
+			static const uint8_t tag[16] = {0xab, 0x6e, 0x47, 0xd4, 0x2c, 0xec, 0x13, 0xbd,
+											0xf5, 0x3a, 0x67, 0xb2, 0x12, 0x57, 0xbd, 0xdf};
+			uint8_t key[AES_KEY_SIZE] = {0}, blk[3 * AES_INPUT_SIZE] = {0}, out[GHASH_SIZE];
+			AESContext ctx;
+			GHASH_KEY gk;
+			GHASH_STATE gs;
+			AES_SetKey(&ctx, key);
+			// H = E(0), E(J0), C = E(inc32(J0)) ^ P
+			blk[2 * AES_INPUT_SIZE - 1] = 1;
+			blk[3 * AES_INPUT_SIZE - 1] = 2;
+			AES_EncryptBlocks(&ctx, blk, blk, 3);
+			GHASH_SetKey(&gk, blk);
+			GHASH_init(&gs, &gk);
+			GHASH_process(&gs, blk + 2 * AES_INPUT_SIZE, AES_INPUT_SIZE);
+			GHASH_done(&gs, out);
+			for (int j = 0; j < GHASH_SIZE; j++)
+				out[j] ^= blk[AES_INPUT_SIZE + j];
+			return memcmp(out, tag, sizeof(tag)) != 0;
+		}
+	}
+}
@@ -32,6 +32,17 @@ change the
  //little-endian format into big-endian format.
  10.SM3_SelfTest //test whether the SM3 calculation is correct by comparing the hash result
 with the standard data
+ 11.SM3_HMAC_SetKey //compress K^ipad and K^opad once per key
+ 12.SM3_HMAC_init //start a HMAC from the precomputed midstates
+ 13.SM3_HMAC_process //absorb the message incrementally
+ 14.SM3_HMAC_done //finish the inner hash and run the outer one
+ 15.SM3_HMAC_SelfTest //compare the streaming HMAC with the definition
+ 16.SM3_compress_xN //compress one block of up to SM3_MB_LANES messages at once
+ 17.SM3_process_xN //absorb messages of the same length in lock-step
+ 18.SM3_done_xN //output the hash values of messages of the same length
+ 19.SM3_HMAC_process_xN //absorb HMAC messages of the same length in lock-step
+ 20.SM3_HMAC_done_xN //output the HMAC values of messages of the same length
+ 21.SM3_MB_SelfTest //compare the multi-buffer functions with the single buffer ones
  History:
  1. Date: Sep 18,2016
  Author: Mao Yingying, Huo Lili
@@ -66,16 +77,41 @@ with the standard data
 			unsigned int curlen;
 			unsigned char buf[64];
 		} SM3_STATE;
+#define SM3_BLOCK_SIZE 64 // byte size of a message block
+#define SM3_MB_LANES 8 // max messages hashed at once by the _xN functions
+		/* HMAC key: states after compressing (K^ipad) and (K^opad) */
+		typedef struct
+		{
+			SM3_STATE ipad;
+			SM3_STATE opad;
+		} SM3_HMAC_KEY;
+		/* HMAC in progress, the inner hash state */
+		typedef struct
+		{
+			SM3_STATE md;
+			const SM3_HMAC_KEY *key;
+		} SM3_HMAC_STATE;
 		void BiToWj(unsigned int Bi[], unsigned int Wj[]);
 		void WjToWj1(unsigned int Wj[], unsigned int Wj1[]);
 		void CF(unsigned int Wj[], unsigned int Wj1[], unsigned int V[]);
 		void BigEndian(unsigned char src[], unsigned int bytelen, unsigned char des[]);
 		void SM3_init(SM3_STATE *md);
 		void SM3_compress(SM3_STATE *md);
-		void SM3_process(SM3_STATE *md, unsigned char buf[], int len);
+		void SM3_process(SM3_STATE *md, const unsigned char buf[], int len);
 		void SM3_done(SM3_STATE *md, unsigned char *hash);
 		void SM3_256(unsigned char buf[], int len, unsigned char hash[]);
 		int SM3_SelfTest();
+		void SM3_HMAC_SetKey(SM3_HMAC_KEY *key, const unsigned char k[], int keyLen);
+		void SM3_HMAC_init(SM3_HMAC_STATE *hs, const SM3_HMAC_KEY *key);
+		void SM3_HMAC_process(SM3_HMAC_STATE *hs, const unsigned char buf[], int len);
+		void SM3_HMAC_done(SM3_HMAC_STATE *hs, unsigned char mac[]);
+		int SM3_HMAC_SelfTest();
+		void SM3_compress_xN(SM3_STATE *md[], int n);
+		void SM3_process_xN(SM3_STATE *md[], const unsigned char *buf[], int len, int n);
+		void SM3_done_xN(SM3_STATE *md[], unsigned char *hash[], int n);
+		void SM3_HMAC_process_xN(SM3_HMAC_STATE *hs[], const unsigned char *buf[], int len, int n);
+		void SM3_HMAC_done_xN(SM3_HMAC_STATE *hs[], unsigned char *mac[], int n);
+		int SM3_MB_SelfTest();
 	};
 };
 #endif // !_SM3_HH_
@@ -0,0 +1,346 @@
+/************************************************************************
+ File name: SM3_MB.cpp
+ Description: multi-buffer SM3. Up to SM3_MB_LANES independent messages of
+ the same length are hashed in lock-step, lane l of every vector register
+ holding the state of message l, so one pass of the 64 rounds compresses
+ one block of each message.
+ Function List:
+ 1.SM3_compress_xN //compress the buffered block of N states
+ 2.SM3_process_xN //absorb N messages of the same length
+ 3.SM3_done_xN //pad and output N hash values
+ 4.SM3_HMAC_process_xN //absorb N HMAC messages of the same length
+ 5.SM3_HMAC_done_xN //finish N HMAC values
+ 6.SM3_MB_SelfTest //compare every lane count with the single buffer functions
+**************************************************************************/
+#include "SM3.hh"
+
+namespace gem5
+{
+	namespace sm3
+	{
+		typedef unsigned int SM3_V4 __attribute__((vector_size(16)));
+		typedef unsigned int SM3_V8 __attribute__((vector_size(32)));
+
+#define SM3_VROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define SM3_VP0(x) ((x) ^ SM3_VROTL(x, 9) ^ SM3_VROTL(x, 17))
+#define SM3_VP1(x) ((x) ^ SM3_VROTL(x, 15) ^ SM3_VROTL(x, 23))
+
+		/* T_j <<< (j mod 32) of every round */
+		static unsigned int SM3_Tj[64];
+		static bool SM3_TjInit()
+		{
+			for (int j = 0; j < 64; j++)
+				SM3_Tj[j] = j < 16 ? SM3_rotl32(SM3_T1, j) : (j % 32 ? SM3_rotl32(SM3_T2, j % 32) : SM3_T2);
+			return true;
+		}
+		static bool SM3_TjReady = SM3_TjInit();
+
+		/******************************************************************************
+		 Function: SM3_CompressLanes
+		 Description: BiToW, WToW1 and CF on vectors of N lanes, lanes from n on
+		 are padding and are not written back
+		 Others: inlined into the callers so that the vector code is generated
+		 for their target
+		*******************************************************************************/
+		template <typename V, int N>
+		static inline __attribute__((always_inline)) void SM3_CompressLanes(SM3_STATE *md[], int n)
+		{
+			V W[68], A, B, C, D, E, F, G, H, SS1, SS2, TT1, TT2;
+			V S[8];
+			for (int j = 0; j < 16; j++)
+				for (int l = 0; l < N; l++)
+				{
+					const unsigned char *p = md[l < n ? l : 0]->buf + 4 * j;
+					W[j][l] = ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+				}
+			for (int j = 16; j < 68; j++)
+			{
+				V tmp = W[j - 16] ^ W[j - 9] ^ SM3_VROTL(W[j - 3], 15);
+				W[j] = SM3_VP1(tmp) ^ SM3_VROTL(W[j - 13], 7) ^ W[j - 6];
+			}
+			for (int i = 0; i < 8; i++)
+				for (int l = 0; l < N; l++)
+					S[i][l] = md[l < n ? l : 0]->state[i];
+			A = S[0];
+			B = S[1];
+			C = S[2];
+			D = S[3];
+			E = S[4];
+			F = S[5];
+			G = S[6];
+			H = S[7];
+			for (int j = 0; j < 64; j++)
+			{
+				SS1 = SM3_VROTL(A, 12) + E + SM3_Tj[j];
+				SS1 = SM3_VROTL(SS1, 7);
+				SS2 = SS1 ^ SM3_VROTL(A, 12);
+				if (j <= 15)
+				{
+					TT1 = (A ^ B ^ C) + D + SS2 + (W[j] ^ W[j + 4]);
+					TT2 = (E ^ F ^ G) + H + SS1 + W[j];
+				}
+				else
+				{
+					TT1 = ((A & B) | (A & C) | (B & C)) + D + SS2 + (W[j] ^ W[j + 4]);
+					TT2 = ((E & F) | (~E & G)) + H + SS1 + W[j];
+				}
+				D = C;
+				C = SM3_VROTL(B, 9);
+				B = A;
+				A = TT1;
+				H = G;
+				G = SM3_VROTL(F, 19);
+				F = E;
+				E = SM3_VP0(TT2);
+			}
+			S[0] ^= A;
+			S[1] ^= B;
+			S[2] ^= C;
+			S[3] ^= D;
+			S[4] ^= E;
+			S[5] ^= F;
+			S[6] ^= G;
+			S[7] ^= H;
+			for (int i = 0; i < 8; i++)
+				for (int l = 0; l < n; l++)
+					md[l]->state[i] = S[i][l];
+		}
+		static void SM3_Compress4(SM3_STATE *md[], int n)
+		{
+			SM3_CompressLanes<SM3_V4, 4>(md, n);
+		}
+#if defined(__x86_64__) || defined(__i386__)
+		__attribute__((target("avx2"))) static void SM3_Compress8(SM3_STATE *md[], int n)
+		{
+			SM3_CompressLanes<SM3_V8, 8>(md, n);
+		}
+		static bool SM3_HaveAVX2 = __builtin_cpu_supports("avx2");
+#else
+		static void SM3_Compress8(SM3_STATE *md[], int n)
+		{
+			SM3_Compress4(md, n < 4 ? n : 4);
+			if (n > 4)
+				SM3_Compress4(md + 4, n - 4);
+		}
+		static bool SM3_HaveAVX2 = false;
+#endif
+		/******************************************************************************
+		 Function: SM3_compress_xN
+		 Description: compress the full buffer of n states, n <= SM3_MB_LANES
+		 Calls: SM3_compress
+		 Called By: SM3_process_xN, SM3_done_xN
+		 Input: SM3_STATE *md[n]
+		 int n
+		 Output: SM3_STATE *md[n]
+		 Return: null
+		 Others: a single lane goes through SM3_compress, the others through
+		 8 lanes (AVX2) or 4 lanes vectors
+		*******************************************************************************/
+		void SM3_compress_xN(SM3_STATE *md[], int n)
+		{
+			(void)SM3_TjReady;
+			if (n == 1)
+				SM3_compress(md[0]);
+			else if (n > 4 && SM3_HaveAVX2)
+				SM3_Compress8(md, n);
+			else
+			{
+				SM3_Compress4(md, n < 4 ? n : 4);
+				if (n > 4)
+					SM3_Compress4(md + 4, n - 4);
+			}
+		}
+		/******************************************************************************
+		 Function: SM3_process_xN
+		 Description: absorb len bytes into each of n states, the states must have
+		 absorbed the same number of bytes so far
+		 Calls: SM3_compress_xN
+		 Called By: SM3_HMAC_process_xN
+		 Input: SM3_STATE *md[n]
+		 const unsigned char *buf[n] //the input messages
+		 int len //bytelen of every message
+		 int n //number of messages, n <= SM3_MB_LANES
+		 Output: SM3_STATE *md[n]
+		 Return: null
+		 Others:
+		*******************************************************************************/
+		void SM3_process_xN(SM3_STATE *md[], const unsigned char *buf[], int len, int n)
+		{
+			int off = 0;
+			while (off < len)
+			{
+				int cur = md[0]->curlen;
+				int take = 64 - cur < len - off ? 64 - cur : len - off;
+				for (int l = 0; l < n; l++)
+				{
+					memcpy(md[l]->buf + cur, buf[l] + off, take);
+					md[l]->curlen += take;
+				}
+				off += take;
+				if (md[0]->curlen == 64)
+				{
+					SM3_compress_xN(md, n);
+					for (int l = 0; l < n; l++)
+					{
+						md[l]->length += 512;
+						md[l]->curlen = 0;
+					}
+				}
+			}
+		}
+		/******************************************************************************
+		 Function: SM3_done_xN
+		 Description: pad and compress the rest of n messages of the same length
+		 Calls: SM3_compress_xN
+		 BigEndian
+		 Called By: SM3_HMAC_done_xN
+		 Input: SM3_STATE *md[n]
+		 Output: unsigned char *hash[n] //32 bytes each
+		 Return: null
+		 Others: the padding only depends on the length, so it is the same for
+		 every lane
+		*******************************************************************************/
+		void SM3_done_xN(SM3_STATE *md[], unsigned char *hash[], int n)
+		{
+			unsigned char pad[128];
+			unsigned int curlen = md[0]->curlen;
+			unsigned int length = md[0]->length + (curlen << 3);
+			int padlen = curlen < 56 ? 64 - curlen : 128 - curlen;
+			memset(pad, 0, sizeof(pad));
+			pad[0] = 0x80;
+			/* since all messages are under 2^32 bits we mark the top bits zero */
+			pad[padlen - 1] = length & 0xff;
+			pad[padlen - 2] = (length >> 8) & 0xff;
+			pad[padlen - 3] = (length >> 16) & 0xff;
+			pad[padlen - 4] = (length >> 24) & 0xff;
+			const unsigned char *p[SM3_MB_LANES];
+			for (int l = 0; l < n; l++)
+				p[l] = pad;
+			SM3_process_xN(md, p, padlen, n);
+			for (int l = 0; l < n; l++)
+			{
+				memcpy(hash[l], md[l]->state, SM3_len / 8);
+				BigEndian(hash[l], SM3_len / 8, hash[l]);
+			}
+		}
+		/******************************************************************************
+		 Function: SM3_HMAC_process_xN
+		 Description: absorb len bytes into each of n HMAC states started with
+		 SM3_HMAC_init, the keys may differ
+		 Calls: SM3_process_xN
+		 Called By:
+		 Input: SM3_HMAC_STATE *hs[n]
+		 const unsigned char *buf[n]
+		 int len
+		 int n //n <= SM3_MB_LANES
+		 Output: SM3_HMAC_STATE *hs[n]
+		 Return: null
+		 Others:
+		*******************************************************************************/
+		void SM3_HMAC_process_xN(SM3_HMAC_STATE *hs[], const unsigned char *buf[], int len, int n)
+		{
+			SM3_STATE *md[SM3_MB_LANES];
+			for (int l = 0; l < n; l++)
+				md[l] = &hs[l]->md;
+			SM3_process_xN(md, buf, len, n);
+		}
+		/******************************************************************************
+		 Function: SM3_HMAC_done_xN
+		 Description: finish n inner hashes, then hash them from the outer midstates
+		 Calls: SM3_done_xN
+		 SM3_process_xN
+		 Called By:
+		 Input: SM3_HMAC_STATE *hs[n]
+		 Output: unsigned char *mac[n] //32 bytes each
+		 Return: null
+		 Others:
+		*******************************************************************************/
+		void SM3_HMAC_done_xN(SM3_HMAC_STATE *hs[], unsigned char *mac[], int n)
+		{
+			unsigned char inner[SM3_MB_LANES][SM3_SIZE];
+			unsigned char *ip[SM3_MB_LANES];
+			SM3_STATE outer[SM3_MB_LANES];
+			SM3_STATE *md[SM3_MB_LANES];
+			for (int l = 0; l < n; l++)
+			{
+				md[l] = &hs[l]->md;
+				ip[l] = inner[l];
+			}
+			SM3_done_xN(md, ip, n);
+			for (int l = 0; l < n; l++)
+			{
+				outer[l] = hs[l]->key->opad;
+				md[l] = &outer[l];
+			}
+			SM3_process_xN(md, (const unsigned char **)ip, SM3_SIZE, n);
+			SM3_done_xN(md, mac, n);
+		}
+		/******************************************************************************
+		 Function: SM3_MB_SelfTest
+		 Description: hash messages of several lengths with every lane count and
+		 compare with SM3_256 and SM3_HMAC_done
+		 Calls: SM3_256
+		 Called By:
+		 Input: null
+		 Output: null
+		 Return: 0 //the multi-buffer operation is correct
+		 1 //the multi-buffer operation is wrong
+		 Others:
+		*******************************************************************************/
+		int SM3_MB_SelfTest()
+		{
+			const int lens[] = {0, 3, 55, 56, 64, 82, 130};
+			unsigned char msg[SM3_MB_LANES][130], key[SM3_SIZE];
+			unsigned char out[SM3_MB_LANES][SM3_SIZE], ref[SM3_SIZE];
+			const unsigned char *mp[SM3_MB_LANES];
+			unsigned char *op[SM3_MB_LANES];
+			SM3_STATE st[SM3_MB_LANES];
+			SM3_STATE *md[SM3_MB_LANES];
+			SM3_HMAC_KEY hk;
+			SM3_HMAC_STATE hst[SM3_MB_LANES];
+			SM3_HMAC_STATE *hs[SM3_MB_LANES];
+			for (int i = 0; i < SM3_SIZE; i++)
+				key[i] = (unsigned char)(i * 3 + 11);
+			SM3_HMAC_SetKey(&hk, key, SM3_SIZE);
+			for (int l = 0; l < SM3_MB_LANES; l++)
+			{
+				for (int i = 0; i < 130; i++)
+					msg[l][i] = (unsigned char)(l * 31 + i * 7 + 1);
+				mp[l] = msg[l];
+				op[l] = out[l];
+				md[l] = &st[l];
+				hs[l] = &hst[l];
+			}
+			for (unsigned int t = 0; t < sizeof(lens) / sizeof(lens[0]); t++)
+			{
+				for (int n = 1; n <= SM3_MB_LANES; n++)
+				{
+					for (int l = 0; l < n; l++)
+						SM3_init(md[l]);
+					SM3_process_xN(md, mp, lens[t], n);
+					SM3_done_xN(md, op, n);
+					for (int l = 0; l < n; l++)
+					{
+						SM3_256(msg[l], lens[t], ref);
+						if (memcmp(ref, out[l], SM3_SIZE))
+							return 1;
+					}
+					for (int l = 0; l < n; l++)
+						SM3_HMAC_init(hs[l], &hk);
+					SM3_HMAC_process_xN(hs, mp, lens[t], n);
+					SM3_HMAC_done_xN(hs, op, n);
+					for (int l = 0; l < n; l++)
+					{
+						SM3_HMAC_STATE one;
+						SM3_HMAC_init(&one, &hk);
+						SM3_HMAC_process(&one, msg[l], lens[t]);
+						SM3_HMAC_done(&one, ref);
+						if (memcmp(ref, out[l], SM3_SIZE))
+							return 1;
+					}
+				}
+			}
+			return 0;
+		}
+	};
+};
@@ -0,0 +1,150 @@
+/************************************************************************
+ File name: SM3_MB.test.cc
+ Description: the multi-buffer hash and HMAC functions against the single
+ buffer ones, for every lane count and messages of zero to several blocks
+**************************************************************************/
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <vector>
+
+#include "SM3.hh"
+
+using namespace gem5::sm3;
+
+namespace
+{
+
+const int maxLen = 5 * SM3_BLOCK_SIZE + 7;
+
+std::vector<unsigned char>
+message(int lane)
+{
+    std::vector<unsigned char> msg(maxLen);
+    for (int i = 0; i < maxLen; i++)
+        msg[i] = (unsigned char)(lane * 31 + i * 7 + 1);
+    return msg;
+}
+
+/* message lengths around the padding and block boundaries */
+std::vector<int>
+lengths()
+{
+    std::vector<int> lens;
+    for (int blocks = 0; blocks * SM3_BLOCK_SIZE < maxLen; blocks++) {
+        for (int off : {0, 1, 55, 56, 63}) {
+            if (blocks * SM3_BLOCK_SIZE + off <= maxLen)
+                lens.push_back(blocks * SM3_BLOCK_SIZE + off);
+        }
+    }
+    return lens;
+}
+
+} // anonymous namespace
+
+TEST(SM3MBTest, HashMatchesSingleBuffer)
+{
+    std::vector<unsigned char> msg[SM3_MB_LANES];
+    unsigned char out[SM3_MB_LANES][SM3_SIZE], ref[SM3_SIZE];
+    const unsigned char *mp[SM3_MB_LANES];
+    unsigned char *op[SM3_MB_LANES];
+    SM3_STATE st[SM3_MB_LANES];
+    SM3_STATE *md[SM3_MB_LANES];
+    for (int l = 0; l < SM3_MB_LANES; l++) {
+        msg[l] = message(l);
+        mp[l] = msg[l].data();
+        op[l] = out[l];
+        md[l] = &st[l];
+    }
+    for (int len : lengths()) {
+        for (int n = 1; n <= SM3_MB_LANES; n++) {
+            for (int l = 0; l < n; l++)
+                SM3_init(md[l]);
+            SM3_process_xN(md, mp, len, n);
+            SM3_done_xN(md, op, n);
+            for (int l = 0; l < n; l++) {
+                SM3_256(msg[l].data(), len, ref);
+                ASSERT_EQ(0, memcmp(ref, out[l], SM3_SIZE))
+                    << "length " << len << ", " << n << " lanes, lane " << l;
+            }
+        }
+    }
+}
+
+/* absorbing a message in two calls must not depend on the split */
+TEST(SM3MBTest, SplitProcess)
+{
+    std::vector<unsigned char> msg[SM3_MB_LANES];
+    unsigned char out[SM3_MB_LANES][SM3_SIZE], ref[SM3_SIZE];
+    const unsigned char *mp[SM3_MB_LANES];
+    unsigned char *op[SM3_MB_LANES];
+    SM3_STATE st[SM3_MB_LANES];
+    SM3_STATE *md[SM3_MB_LANES];
+    for (int l = 0; l < SM3_MB_LANES; l++) {
+        msg[l] = message(l);
+        op[l] = out[l];
+        md[l] = &st[l];
+    }
+    for (int split : {1, 20, SM3_BLOCK_SIZE, SM3_BLOCK_SIZE + 9}) {
+        for (int l = 0; l < SM3_MB_LANES; l++) {
+            SM3_init(md[l]);
+            mp[l] = msg[l].data();
+        }
+        SM3_process_xN(md, mp, split, SM3_MB_LANES);
+        for (int l = 0; l < SM3_MB_LANES; l++)
+            mp[l] = msg[l].data() + split;
+        SM3_process_xN(md, mp, maxLen - split, SM3_MB_LANES);
+        SM3_done_xN(md, op, SM3_MB_LANES);
+        for (int l = 0; l < SM3_MB_LANES; l++) {
+            SM3_256(msg[l].data(), maxLen, ref);
+            ASSERT_EQ(0, memcmp(ref, out[l], SM3_SIZE))
+                << "split " << split << ", lane " << l;
+        }
+    }
+}
+
+TEST(SM3MBTest, HMACMatchesSingleBuffer)
+{
+    unsigned char key[SM3_SIZE];
+    for (int i = 0; i < SM3_SIZE; i++)
+        key[i] = (unsigned char)(i * 3 + 11);
+    SM3_HMAC_KEY hk;
+    SM3_HMAC_SetKey(&hk, key, SM3_SIZE);
+
+    std::vector<unsigned char> msg[SM3_MB_LANES];
+    unsigned char out[SM3_MB_LANES][SM3_SIZE], ref[SM3_SIZE];
+    const unsigned char *mp[SM3_MB_LANES];
+    unsigned char *op[SM3_MB_LANES];
+    SM3_HMAC_STATE hst[SM3_MB_LANES];
+    SM3_HMAC_STATE *hs[SM3_MB_LANES];
+    for (int l = 0; l < SM3_MB_LANES; l++) {
+        msg[l] = message(l);
+        mp[l] = msg[l].data();
+        op[l] = out[l];
+        hs[l] = &hst[l];
+    }
+    for (int len : lengths()) {
+        for (int n = 1; n <= SM3_MB_LANES; n++) {
+            for (int l = 0; l < n; l++)
+                SM3_HMAC_init(hs[l], &hk);
+            SM3_HMAC_process_xN(hs, mp, len, n);
+            SM3_HMAC_done_xN(hs, op, n);
+            for (int l = 0; l < n; l++) {
+                SM3_HMAC_STATE one;
+                SM3_HMAC_init(&one, &hk);
+                SM3_HMAC_process(&one, msg[l].data(), len);
+                SM3_HMAC_done(&one, ref);
+                ASSERT_EQ(0, memcmp(ref, out[l], SM3_SIZE))
+                    << "length " << len << ", " << n << " lanes, lane " << l;
+            }
+        }
+    }
+}
+
+TEST(SM3MBTest, SelfTest)
+{
+    EXPECT_EQ(0, SM3_SelfTest());
+    EXPECT_EQ(0, SM3_HMAC_SelfTest());
+    EXPECT_EQ(0, SM3_MB_SelfTest());
+}
@@ -21,6 +21,8 @@ History:
  2)add SM4_SelfCheck function
 ************************************************************/
 #include "SM4_ENC.hh"
+
+#include <string.h>
 /************************************************************
 Function:
  void SM4_KeySchedule(unsigned char MK[], unsigned int rk[]);
@@ -111,29 +113,28 @@ namespace gem5
 		}
 		/************************************************************
 		Function:
-		void SM4_Encrypt(unsigned char MK[],unsigned char PlainText[],unsigned char
-		CipherText[]);
+		static void SM4_Rounds(const unsigned int rk[], const unsigned char in[], unsigned char out[]);
 		Description:
-		Encryption function
-		Calls:
-		SM4_KeySchedule
+		32 rounds and reverse transform with the given round keys
 		Called By:
+		SM4_Encrypt;
+		SM4_Decrypt;
+		SM4_EncryptBlock;
+		SM4_DecryptBlock;
 		Input:
-		MK[]: Master key
-		PlainText[]: input text
+		rk[]: round keys, in decryption order for decryption
+		in[]: input text
 		Output:
-		CipherText[]: output text
+		out[]: output text, may alias in
 		Return:null
-		Others:
 		************************************************************/
-		void SM4_Encrypt(unsigned char MK[],unsigned char PlainText[],unsigned char CipherText[])
+		static void SM4_Rounds(const unsigned int rk[],const unsigned char in[],unsigned char out[])
 		{
-			unsigned int rk[32],X[36],tmp,buf;
+			unsigned int X[36],tmp,buf;
 			int i,j;
-			SM4_KeySchedule(MK,rk);
 			for(j=0;j<4;j++)
 			{
-				X[j]=(PlainText[j*4]<<24) |(PlainText[j*4+1]<<16)|(PlainText[j*4+2]<<8)|(PlainText[j*4+3]);
+				X[j]=(in[j*4]<<24) |(in[j*4+1]<<16)|(in[j*4+2]<<8)|(in[j*4+3]);
 			}
 			for(i=0;i<32;i++)
 			{
@@ -145,14 +146,39 @@ namespace gem5
 			}
 			for(j=0;j<4;j++)
 			{
-				CipherText[4*j]=(X[35-j]>> 24)& 0xFF;
-				CipherText[4*j+1]=(X[35-j]>> 16)& 0xFF;
-				CipherText[4*j+2]=(X[35-j]>> 8)& 0xFF;
-				CipherText[4*j+3]=(X[35-j])& 0xFF;
+				out[4*j]=(X[35-j]>> 24)& 0xFF;
+				out[4*j+1]=(X[35-j]>> 16)& 0xFF;
+				out[4*j+2]=(X[35-j]>> 8)& 0xFF;
+				out[4*j+3]=(X[35-j])& 0xFF;
 			}
 		}
 		/************************************************************
 		Function:
+		void SM4_Encrypt(unsigned char MK[],unsigned char PlainText[],unsigned char
+		CipherText[]);
+		Description:
+		Encryption function
+		Calls:
+		SM4_KeySchedule
+		Called By:
+		Input:
+		MK[]: Master key
+		PlainText[]: input text
+		Output:
+		CipherText[]: output text
+		Return:null
+		Others:
+		Runs the key schedule on every call, use SM4_EncryptBlock
+		with a SM4Context when the key is reused
+		************************************************************/
+		void SM4_Encrypt(unsigned char MK[],unsigned char PlainText[],unsigned char CipherText[])
+		{
+			unsigned int rk[32];
+			SM4_KeySchedule(MK,rk);
+			SM4_Rounds(rk,PlainText,CipherText);
+		}
+		/************************************************************
+		Function:
 		void SM4_Decrypt(unsigned char MK[],unsigned char CipherText[], unsigned char PlainText[]);
 		Description:
 		Decryption function
@@ -166,41 +192,85 @@ namespace gem5
 		PlainText[]: output text
 		Return:null
 		Others:
+		Runs the key schedule on every call, use SM4_DecryptBlock
+		with a SM4Context when the key is reused
 		************************************************************/
 		void SM4_Decrypt(unsigned char MK[],unsigned char CipherText[],unsigned char PlainText[])
 		{
-			unsigned int rk[32],X[36],tmp,buf;
-			int i,j;
-			SM4_KeySchedule(MK,rk);
-			for(j=0;j<4;j++)
-			{
-				X[j]=(CipherText[j*4]<<24) |(CipherText[j*4+1]<<16)|(CipherText[j*4+2]<<8)|(CipherText[j*4+3]);
-			}
+			SM4Context ctx;
+			SM4_SetKey(&ctx,MK);
+			SM4_Rounds(ctx.rk_dec,CipherText,PlainText);
+		}
+		/************************************************************
+		Function:
+		void SM4_SetKey(SM4Context *ctx, unsigned char MK[]);
+		Description:
+		Expand encryption and decryption round keys into ctx
+		Calls:
+		SM4_KeySchedule
+		Input:
+		MK[]: Master key
+		Output:
+		ctx: round keys
+		Return:null
+		************************************************************/
+		void SM4_SetKey(SM4Context *ctx,unsigned char MK[])
+		{
+			int i;
+			SM4_KeySchedule(MK,ctx->rk_enc);
 			for(i=0;i<32;i++)
 			{
-				tmp = X[i+1]^X[i+2]^X[i+3]^rk[31-i];
-			//nonlinear operation
-				buf= (SM4_Sbox[(tmp >> 24) & 0xFF]) << 24|(SM4_Sbox[(tmp >> 16) & 0xFF]) << 16|(SM4_Sbox[(tmp >> 8) & 0xFF]) << 8|(SM4_Sbox[tmp & 0xFF]);
-			//linear operation
-				X[i+4]=X[i]^(buf^SM4_Rotl32((buf),2)^ SM4_Rotl32((buf),10)^ SM4_Rotl32((buf),18)^ SM4_Rotl32((buf),24));
-			}
-			for(j=0;j<4;j++)
-			{
-				PlainText[4*j]=(X[35-j]>> 24)& 0xFF;
-				PlainText[4*j+1]=(X[35-j]>>16)& 0xFF;
-				PlainText[4*j+2]=(X[35-j]>> 8)& 0xFF;
-				PlainText[4*j+3]=(X[35-j])& 0xFF;
+				ctx->rk_dec[i]=ctx->rk_enc[31-i];
 			}
 		}
 		/************************************************************
 		Function:
+		void SM4_EncryptBlock(const SM4Context *ctx, const unsigned char PlainText[], unsigned char CipherText[]);
+		Description:
+		Encrypt one block with precomputed round keys
+		Calls:
+		SM4_Rounds
+		Input:
+		ctx: context initialized by SM4_SetKey
+		PlainText[]: input text
+		Output:
+		CipherText[]: output text
+		Return:null
+		************************************************************/
+		void SM4_EncryptBlock(const SM4Context *ctx,const unsigned char PlainText[],unsigned char CipherText[])
+		{
+			SM4_Rounds(ctx->rk_enc,PlainText,CipherText);
+		}
+		/************************************************************
+		Function:
+		void SM4_DecryptBlock(const SM4Context *ctx, const unsigned char CipherText[], unsigned char PlainText[]);
+		Description:
+		Decrypt one block with precomputed round keys
+		Calls:
+		SM4_Rounds
+		Input:
+		ctx: context initialized by SM4_SetKey
+		CipherText[]: input text
+		Output:
+		PlainText[]: output text
+		Return:null
+		************************************************************/
+		void SM4_DecryptBlock(const SM4Context *ctx,const unsigned char CipherText[],unsigned char PlainText[])
+		{
+			SM4_Rounds(ctx->rk_dec,CipherText,PlainText);
+		}
+		/************************************************************
+		Function:
 		int SM4_SelfCheck()
 		Description:
 		Self-check with standard data
 		Calls:
 		SM4_Encrypt;
 		SM4_Decrypt;
+		SM4_EncryptBlock;
+		SM4_DecryptBlock;
 		Called By:
+		SM4_MB_SelfCheck;
 		Input:
 		Output:
 		Return:
@@ -209,22 +279,24 @@ namespace gem5
 		************************************************************/
 		int SM4_SelfCheck()
 		{
-			int i;
 			//Standard data
 			unsigned char key[16] =
 			{0x01,0x23,0x45,0x67,0x89,0xab,0xcd,0xef,0xfe,0xdc,0xba,0x98,0x76,0x54,0x32,0x10};
-			unsigned char plain[17]=
-		//	{0x01,0x23,0x45,0x67,0x89,0xab,0xcd,0xef,0xfe,0xdc,0xba,0x98,0x76,0x54,0x32,0x10,0x0};
-			{0x68,0x65,0x6c,0x6c,0x6f,0x2c,0x68,0x65,0x6c,0x6c,0x6f,0x2c,0x68,0x65,0x68,0x65,0x0};
-			unsigned char cipher[17]=
-			{0x68,0x1e,0xdf,0x34,0xd2,0x06,0x96,0x5e,0x86,0xb3,0xe9,0x4f,0x53,0x6e,0x42,0x46,0x0};
+			unsigned char cipher[16]=
+			{0x68,0x1e,0xdf,0x34,0xd2,0x06,0x96,0x5e,0x86,0xb3,0xe9,0x4f,0x53,0x6e,0x42,0x46};
 			unsigned char En_output[16];
-			unsigned char De_output[17]={0};
-			printf("plain=%s\n",plain);
-			SM4_Encrypt(key,plain,En_output);
+			unsigned char De_output[16];
+			SM4Context ctx;
+			//the standard data encrypts the key itself
+			SM4_Encrypt(key,key,En_output);
 			SM4_Decrypt(key,En_output,De_output);
-			printf("plain=%s\n",De_output);
-			printf("Self-check success");
+			if(memcmp(En_output,cipher,16)||memcmp(De_output,key,16))
+				return 1;
+			SM4_SetKey(&ctx,key);
+			SM4_EncryptBlock(&ctx,key,En_output);
+			SM4_DecryptBlock(&ctx,En_output,De_output);
+			if(memcmp(En_output,cipher,16)||memcmp(De_output,key,16))
+				return 1;
 			return 0;
 		}
 	}
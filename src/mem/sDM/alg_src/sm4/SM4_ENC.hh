@@ -3,6 +3,9 @@
 //SM4_Encrypt    //Encryption function
 //SM4_Decrypt    //Decryption function
 //SM4_SelfCheck  //Self-check
+//SM4_SetKey     //Expand the round keys of a context once
+//SM4_EncryptBlock //Encryption with precomputed round keys
+//SM4_DecryptBlock //Decryption with precomputed round keys
 #ifndef __SM4_H
 #define __SM4_H
 #include <stdio.h>
@@ -19,6 +22,20 @@ namespace gem5
         extern unsigned int SM4_FK[4];
         extern unsigned char SM4_n[16];
         /************************************************************
+        Struct:
+        SM4Context
+        Description:
+        Expanded round keys of one master key, computed once by
+        SM4_SetKey so that each block only runs the 32 rounds
+        Others:
+        rk_dec is rk_enc in reverse order
+        ************************************************************/
+        typedef struct _SM4Context
+        {
+            unsigned int rk_enc[32];
+            unsigned int rk_dec[32];
+        } SM4Context;
+        /************************************************************
         Function:
         void SM4_KeySchedule(unsigned char MK[], unsigned int rk[]);
         Description:
@@ -86,6 +103,46 @@ namespace gem5
         Others:
         ************************************************************/
         int SM4_SelfCheck();
+        /************************************************************
+        Function:
+        void SM4_SetKey(SM4Context *ctx, unsigned char MK[]);
+        Description:
+        Expand encryption and decryption round keys into ctx
+        Calls:
+        SM4_KeySchedule
+        @param
+        MK[]: Master key
+        @result
+        ctx: round keys
+        @return null
+        ************************************************************/
+        void SM4_SetKey(SM4Context *ctx, unsigned char MK[]);
+        /************************************************************
+        Function:
+        void SM4_EncryptBlock(const SM4Context *ctx, const unsigned char PlainText[], unsigned char CipherText[]);
+        Description:
+        Encrypt one block with precomputed round keys
+        @param
+        ctx: context initialized by SM4_SetKey
+        PlainText[]: input text
+        @result
+        CipherText[]: output text, may alias PlainText
+        @return null
+        ************************************************************/
+        void SM4_EncryptBlock(const SM4Context *ctx, const unsigned char PlainText[], unsigned char CipherText[]);
+        /************************************************************
+        Function:
+        void SM4_DecryptBlock(const SM4Context *ctx, const unsigned char CipherText[], unsigned char PlainText[]);
+        Description:
+        Decrypt one block with precomputed round keys
+        @param
+        ctx: context initialized by SM4_SetKey
+        CipherText[]: input text
+        @result
+        PlainText[]: output text, may alias CipherText
+        @return null
+        ************************************************************/
+        void SM4_DecryptBlock(const SM4Context *ctx, const unsigned char CipherText[], unsigned char PlainText[]);
     }
 }
 #endif
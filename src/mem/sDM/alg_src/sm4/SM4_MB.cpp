@@ -0,0 +1,396 @@
+/************************************************************
+FileName:
+ SM4_MB.cpp
+Description:
+ Multi-block SM4 engine. Blocks of counter mode OTPs are
+independent, so several of them can go through the 32 rounds
+together:
+ 1. T-table: S-box and L transform are merged into four 256-entry
+tables, 4 blocks are interleaved to hide the table latency
+ 2. SSE/AVX2: the state of 4 (8) blocks is transposed so that one
+register holds the same word of every block. The S-box is applied
+to all bytes at once: SM4 and AES S-boxes are both built on the
+inverse in GF(2^8), so the SM4 S-box is an affine map, the AES
+S-box (AESENCLAST) and another affine map. The affine maps are
+evaluated with two 16-entry nibble lookups (PSHUFB)
+ The engine is chosen at runtime by CPU feature detection, the
+scalar path is the reference every engine is checked against.
+************************************************************/
+#include "SM4_MB.hh"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SM4_MB_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#else
+#define SM4_MB_X86 0
+#endif
+
+namespace gem5
+{
+	namespace sm4
+	{
+		typedef void (*SM4_RoundsN)(const unsigned int rk[], const unsigned char *in, unsigned char *out, int nblocks);
+
+		static inline unsigned int SM4_Load32(const unsigned char *p)
+		{
+			return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+		}
+		static inline void SM4_Store32(unsigned char *p, unsigned int v)
+		{
+			p[0] = (v >> 24) & 0xFF;
+			p[1] = (v >> 16) & 0xFF;
+			p[2] = (v >> 8) & 0xFF;
+			p[3] = v & 0xFF;
+		}
+		/************************************************************
+		Scalar engine: reference, one block after the other
+		************************************************************/
+		static void SM4_RoundsScalar(const unsigned int rk[], const unsigned char *in, unsigned char *out, int nblocks)
+		{
+			unsigned int X[36], tmp, buf;
+			for (int b = 0; b < nblocks; b++, in += SM4_INPUT_SIZE, out += SM4_INPUT_SIZE)
+			{
+				for (int j = 0; j < 4; j++)
+					X[j] = SM4_Load32(in + 4 * j);
+				for (int i = 0; i < 32; i++)
+				{
+					tmp = X[i + 1] ^ X[i + 2] ^ X[i + 3] ^ rk[i];
+					buf = (SM4_Sbox[(tmp >> 24) & 0xFF]) << 24 | (SM4_Sbox[(tmp >> 16) & 0xFF]) << 16 |
+						  (SM4_Sbox[(tmp >> 8) & 0xFF]) << 8 | (SM4_Sbox[tmp & 0xFF]);
+					X[i + 4] = X[i] ^ (buf ^ SM4_Rotl32((buf), 2) ^ SM4_Rotl32((buf), 10) ^ SM4_Rotl32((buf), 18) ^ SM4_Rotl32((buf), 24));
+				}
+				for (int j = 0; j < 4; j++)
+					SM4_Store32(out + 4 * j, X[35 - j]);
+			}
+		}
+		/************************************************************
+		T-table engine
+		SM4_T[k][x] = L(Sbox[x] << (24 - 8k)), so that
+		L(tau(a)) = T0[a0] ^ T1[a1] ^ T2[a2] ^ T3[a3]
+		************************************************************/
+		static unsigned int SM4_T[4][256];
+		static bool SM4_TInit()
+		{
+			for (int x = 0; x < 256; x++)
+			{
+				unsigned int b = (unsigned int)SM4_Sbox[x] << 24;
+				unsigned int l = b ^ SM4_Rotl32(b, 2) ^ SM4_Rotl32(b, 10) ^ SM4_Rotl32(b, 18) ^ SM4_Rotl32(b, 24);
+				for (int k = 0; k < 4; k++)
+					SM4_T[k][x] = k ? ((l >> (8 * k)) | (l << (32 - 8 * k))) : l;
+			}
+			return true;
+		}
+		static inline unsigned int SM4_TT(unsigned int a)
+		{
+			return SM4_T[0][a >> 24] ^ SM4_T[1][(a >> 16) & 0xFF] ^ SM4_T[2][(a >> 8) & 0xFF] ^ SM4_T[3][a & 0xFF];
+		}
+		static void SM4_RoundsTTable(const unsigned int rk[], const unsigned char *in, unsigned char *out, int nblocks)
+		{
+			static bool init = SM4_TInit();
+			(void)init;
+			for (int b = 0; b < nblocks; b += SM4_MB_LANES)
+			{
+				unsigned int X[SM4_MB_LANES][4];
+				for (int l = 0; l < SM4_MB_LANES; l++)
+					for (int j = 0; j < 4; j++)
+						X[l][j] = SM4_Load32(in + (b + l) * SM4_INPUT_SIZE + 4 * j);
+				// 4轮展开,X[l][i%4]依次作为被更新的字
+				for (int i = 0; i < 32; i += 4)
+				{
+					for (int r = 0; r < 4; r++)
+						for (int l = 0; l < SM4_MB_LANES; l++)
+							X[l][r] ^= SM4_TT(X[l][(r + 1) & 3] ^ X[l][(r + 2) & 3] ^ X[l][(r + 3) & 3] ^ rk[i + r]);
+				}
+				for (int l = 0; l < SM4_MB_LANES; l++)
+					for (int j = 0; j < 4; j++)
+						SM4_Store32(out + (b + l) * SM4_INPUT_SIZE + 4 * j, X[l][3 - j]);
+			}
+		}
+#if SM4_MB_X86
+		/************************************************************
+		SIMD engines
+		Affine maps around AESENCLAST (round key 0x0f flips the low
+		nibbles, undone in the post map), and the inverse ShiftRows
+		that puts the bytes back in their words
+		************************************************************/
+#define SM4_PRE_LO 0xC7C1B4B222245157ULL, 0x9197E2E474720701ULL
+#define SM4_PRE_HI 0xF052B91BF95BB012ULL, 0xE240AB09EB49A200ULL
+#define SM4_POST_LO 0xEDD14478172BBE82ULL, 0x5B67F2CEA19D0834ULL
+#define SM4_POST_HI 0x11CDBE62CC1063BFULL, 0xAE7201DD73AFDC00ULL
+#define SM4_INV_SHIFT_ROW 0x0306090C0F020508ULL, 0x0B0E0104070A0D00ULL
+#define SM4_BSWAP32 0x0C0D0E0F08090A0BULL, 0x0405060700010203ULL
+
+		__attribute__((target("aes,ssse3"))) static inline __m128i SM4_SboxSSE(__m128i x)
+		{
+			const __m128i m = _mm_set1_epi8(0x0f);
+			__m128i t = _mm_and_si128(x, m);
+			__m128i h = _mm_srli_epi32(_mm_andnot_si128(m, x), 4);
+			x = _mm_xor_si128(_mm_shuffle_epi8(_mm_set_epi64x(SM4_PRE_LO), t),
+							  _mm_shuffle_epi8(_mm_set_epi64x(SM4_PRE_HI), h));
+			x = _mm_aesenclast_si128(x, m);
+			t = _mm_andnot_si128(x, m);
+			h = _mm_and_si128(_mm_srli_epi32(x, 4), m);
+			x = _mm_xor_si128(_mm_shuffle_epi8(_mm_set_epi64x(SM4_POST_LO), t),
+							  _mm_shuffle_epi8(_mm_set_epi64x(SM4_POST_HI), h));
+			return _mm_shuffle_epi8(x, _mm_set_epi64x(SM4_INV_SHIFT_ROW));
+		}
+		__attribute__((target("aes,ssse3"))) static inline __m128i SM4_Rotl32SSE(__m128i x, int n)
+		{
+			return _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - n));
+		}
+		__attribute__((target("aes,ssse3"))) static inline __m128i SM4_TSSE(__m128i x)
+		{
+			x = SM4_SboxSSE(x);
+			return _mm_xor_si128(_mm_xor_si128(x, SM4_Rotl32SSE(x, 2)),
+								 _mm_xor_si128(_mm_xor_si128(SM4_Rotl32SSE(x, 10), SM4_Rotl32SSE(x, 18)),
+											   SM4_Rotl32SSE(x, 24)));
+		}
+		// 4x4 32bit转置:s[j]中为4个块的第j个字
+		__attribute__((target("aes,ssse3"))) static inline void SM4_TransposeSSE(__m128i s[4])
+		{
+			__m128i t0 = _mm_unpacklo_epi32(s[0], s[1]);
+			__m128i t1 = _mm_unpacklo_epi32(s[2], s[3]);
+			__m128i t2 = _mm_unpackhi_epi32(s[0], s[1]);
+			__m128i t3 = _mm_unpackhi_epi32(s[2], s[3]);
+			s[0] = _mm_unpacklo_epi64(t0, t1);
+			s[1] = _mm_unpackhi_epi64(t0, t1);
+			s[2] = _mm_unpacklo_epi64(t2, t3);
+			s[3] = _mm_unpackhi_epi64(t2, t3);
+		}
+		__attribute__((target("aes,ssse3"))) static void SM4_RoundsSSE(const unsigned int rk[], const unsigned char *in, unsigned char *out, int nblocks)
+		{
+			const __m128i bswap = _mm_set_epi64x(SM4_BSWAP32);
+			for (int b = 0; b < nblocks; b += 4)
+			{
+				__m128i s[4];
+				for (int j = 0; j < 4; j++)
+					s[j] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + (b + j) * SM4_INPUT_SIZE)), bswap);
+				SM4_TransposeSSE(s);
+				for (int i = 0; i < 32; i += 4)
+				{
+					for (int r = 0; r < 4; r++)
+					{
+						__m128i x = _mm_xor_si128(_mm_xor_si128(s[(r + 1) & 3], s[(r + 2) & 3]),
+												  _mm_xor_si128(s[(r + 3) & 3], _mm_set1_epi32(rk[i + r])));
+						s[r] = _mm_xor_si128(s[r], SM4_TSSE(x));
+					}
+				}
+				// 反序变换R:输出X35,X34,X33,X32
+				__m128i o[4] = {s[3], s[2], s[1], s[0]};
+				SM4_TransposeSSE(o);
+				for (int j = 0; j < 4; j++)
+					_mm_storeu_si128((__m128i *)(out + (b + j) * SM4_INPUT_SIZE), _mm_shuffle_epi8(o[j], bswap));
+			}
+		}
+		__attribute__((target("avx2,aes"))) static inline __m256i SM4_SboxAVX2(__m256i x)
+		{
+			const __m256i m = _mm256_set1_epi8(0x0f);
+			const __m256i pre_lo = _mm256_broadcastsi128_si256(_mm_set_epi64x(SM4_PRE_LO));
+			const __m256i pre_hi = _mm256_broadcastsi128_si256(_mm_set_epi64x(SM4_PRE_HI));
+			const __m256i post_lo = _mm256_broadcastsi128_si256(_mm_set_epi64x(SM4_POST_LO));
+			const __m256i post_hi = _mm256_broadcastsi128_si256(_mm_set_epi64x(SM4_POST_HI));
+			const __m256i isr = _mm256_broadcastsi128_si256(_mm_set_epi64x(SM4_INV_SHIFT_ROW));
+			__m256i t = _mm256_and_si256(x, m);
+			__m256i h = _mm256_srli_epi32(_mm256_andnot_si256(m, x), 4);
+			x = _mm256_xor_si256(_mm256_shuffle_epi8(pre_lo, t), _mm256_shuffle_epi8(pre_hi, h));
+			// AVX2没有256位AESENCLAST,两个128位通道分别计算
+			__m128i lo = _mm_aesenclast_si128(_mm256_castsi256_si128(x), _mm_set1_epi8(0x0f));
+			__m128i hi = _mm_aesenclast_si128(_mm256_extracti128_si256(x, 1), _mm_set1_epi8(0x0f));
+			x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+			t = _mm256_andnot_si256(x, m);
+			h = _mm256_and_si256(_mm256_srli_epi32(x, 4), m);
+			x = _mm256_xor_si256(_mm256_shuffle_epi8(post_lo, t), _mm256_shuffle_epi8(post_hi, h));
+			return _mm256_shuffle_epi8(x, isr);
+		}
+		__attribute__((target("avx2,aes"))) static inline __m256i SM4_Rotl32AVX2(__m256i x, int n)
+		{
+			return _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - n));
+		}
+		__attribute__((target("avx2,aes"))) static inline __m256i SM4_TAVX2(__m256i x)
+		{
+			x = SM4_SboxAVX2(x);
+			return _mm256_xor_si256(_mm256_xor_si256(x, SM4_Rotl32AVX2(x, 2)),
+									_mm256_xor_si256(_mm256_xor_si256(SM4_Rotl32AVX2(x, 10), SM4_Rotl32AVX2(x, 18)),
+													 SM4_Rotl32AVX2(x, 24)));
+		}
+		// 每个128位通道内4x4 32bit转置:低通道为块0~3,高通道为块4~7
+		__attribute__((target("avx2,aes"))) static inline void SM4_TransposeAVX2(__m256i s[4])
+		{
+			__m256i t0 = _mm256_unpacklo_epi32(s[0], s[1]);
+			__m256i t1 = _mm256_unpacklo_epi32(s[2], s[3]);
+			__m256i t2 = _mm256_unpackhi_epi32(s[0], s[1]);
+			__m256i t3 = _mm256_unpackhi_epi32(s[2], s[3]);
+			s[0] = _mm256_unpacklo_epi64(t0, t1);
+			s[1] = _mm256_unpackhi_epi64(t0, t1);
+			s[2] = _mm256_unpacklo_epi64(t2, t3);
+			s[3] = _mm256_unpackhi_epi64(t2, t3);
+		}
+		__attribute__((target("avx2,aes"))) static void SM4_RoundsAVX2(const unsigned int rk[], const unsigned char *in, unsigned char *out, int nblocks)
+		{
+			const __m256i bswap = _mm256_broadcastsi128_si256(_mm_set_epi64x(SM4_BSWAP32));
+			int b = 0;
+			for (; b + 8 <= nblocks; b += 8)
+			{
+				__m256i s[4];
+				for (int j = 0; j < 4; j++)
+				{
+					__m128i lo = _mm_loadu_si128((const __m128i *)(in + (b + j) * SM4_INPUT_SIZE));
+					__m128i hi = _mm_loadu_si128((const __m128i *)(in + (b + 4 + j) * SM4_INPUT_SIZE));
+					s[j] = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), bswap);
+				}
+				SM4_TransposeAVX2(s);
+				for (int i = 0; i < 32; i += 4)
+				{
+					for (int r = 0; r < 4; r++)
+					{
+						__m256i x = _mm256_xor_si256(_mm256_xor_si256(s[(r + 1) & 3], s[(r + 2) & 3]),
+													 _mm256_xor_si256(s[(r + 3) & 3], _mm256_set1_epi32(rk[i + r])));
+						s[r] = _mm256_xor_si256(s[r], SM4_TAVX2(x));
+					}
+				}
+				__m256i o[4] = {s[3], s[2], s[1], s[0]};
+				SM4_TransposeAVX2(o);
+				for (int j = 0; j < 4; j++)
+				{
+					__m256i v = _mm256_shuffle_epi8(o[j], bswap);
+					_mm_storeu_si128((__m128i *)(out + (b + j) * SM4_INPUT_SIZE), _mm256_castsi256_si128(v));
+					_mm_storeu_si128((__m128i *)(out + (b + 4 + j) * SM4_INPUT_SIZE), _mm256_extracti128_si256(v, 1));
+				}
+			}
+			// 剩余4块
+			if (b < nblocks)
+				SM4_RoundsSSE(rk, in + b * SM4_INPUT_SIZE, out + b * SM4_INPUT_SIZE, nblocks - b);
+		}
+#endif
+		/************************************************************
+		Engine selection
+		************************************************************/
+		static const SM4_RoundsN SM4_Engines[SM4_ENGINE_NUM] =
+		{
+			SM4_RoundsScalar,
+			SM4_RoundsTTable,
+#if SM4_MB_X86
+			SM4_RoundsSSE,
+			SM4_RoundsAVX2,
+#else
+			nullptr,
+			nullptr,
+#endif
+		};
+		int SM4_EngineSupported(SM4_Engine engine)
+		{
+			if (engine == SM4_ENGINE_SCALAR || engine == SM4_ENGINE_TTABLE)
+				return 1;
+#if SM4_MB_X86
+			unsigned int eax, ebx, ecx, edx;
+			if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+				return 0;
+			bool ssse3 = ecx & bit_SSSE3, aes = ecx & bit_AES;
+			if (engine == SM4_ENGINE_SSE)
+				return ssse3 && aes;
+			if (engine == SM4_ENGINE_AVX2)
+			{
+				// 还需要操作系统保存YMM状态
+				bool osxsave = ecx & bit_OSXSAVE;
+				if (!aes || !osxsave || __get_cpuid_max(0, nullptr) < 7)
+					return 0;
+				unsigned int xcr0_lo, xcr0_hi;
+				__asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+				if ((xcr0_lo & 0x6) != 0x6)
+					return 0;
+				__cpuid_count(7, 0, eax, ebx, ecx, edx);
+				return (ebx & bit_AVX2) != 0;
+			}
+#endif
+			return 0;
+		}
+		static SM4_Engine SM4_DetectEngine()
+		{
+			for (int e = SM4_ENGINE_NUM - 1; e > SM4_ENGINE_SCALAR; e--)
+				if (SM4_EngineSupported((SM4_Engine)e))
+					return (SM4_Engine)e;
+			return SM4_ENGINE_SCALAR;
+		}
+		static SM4_Engine SM4_CurEngine = SM4_DetectEngine();
+		SM4_Engine SM4_GetEngine()
+		{
+			return SM4_CurEngine;
+		}
+		int SM4_SetEngine(SM4_Engine engine)
+		{
+			if (engine >= SM4_ENGINE_NUM || !SM4_EngineSupported(engine))
+				return 1;
+			SM4_CurEngine = engine;
+			return 0;
+		}
+		/************************************************************
+		Function:
+		static void SM4_CryptBlocks(const unsigned int rk[], const unsigned char *in, unsigned char *out, int nblocks);
+		Description:
+		Groups of 16, 8 and 4 blocks go through the current engine,
+		the remaining blocks through the scalar one
+		************************************************************/
+		static void SM4_CryptBlocks(const unsigned int rk[], const unsigned char *in, unsigned char *out, int nblocks)
+		{
+			int vec = nblocks & ~(SM4_MB_LANES - 1);
+			if (vec)
+				SM4_Engines[SM4_CurEngine](rk, in, out, vec);
+			if (vec < nblocks)
+				SM4_RoundsScalar(rk, in + vec * SM4_INPUT_SIZE, out + vec * SM4_INPUT_SIZE, nblocks - vec);
+		}
+		void SM4_EncryptBlocks(const SM4Context *ctx, const unsigned char *in, unsigned char *out, int nblocks)
+		{
+			SM4_CryptBlocks(ctx->rk_enc, in, out, nblocks);
+		}
+		void SM4_DecryptBlocks(const SM4Context *ctx, const unsigned char *in, unsigned char *out, int nblocks)
+		{
+			SM4_CryptBlocks(ctx->rk_dec, in, out, nblocks);
+		}
+		/************************************************************
+		Function:
+		int SM4_MB_SelfCheck()
+		Description:
+		Standard data through SM4_SelfCheck, then 16 blocks of
+		derived data through every supported engine compared with
+		the scalar engine, both directions
+		Return:
+		1 fail ; 0 success
+		************************************************************/
+		int SM4_MB_SelfCheck()
+		{
+			if (SM4_SelfCheck())
+				return 1;
+			unsigned char key[SM4_KEY_SIZE] =
+			{0x01,0x23,0x45,0x67,0x89,0xab,0xcd,0xef,0xfe,0xdc,0xba,0x98,0x76,0x54,0x32,0x10};
+			const int n = 16;
+			unsigned char in[n * SM4_INPUT_SIZE], ref[n * SM4_INPUT_SIZE], out[n * SM4_INPUT_SIZE];
+			SM4Context ctx;
+			SM4_SetKey(&ctx, key);
+			for (int i = 0; i < n * SM4_INPUT_SIZE; i++)
+				in[i] = (unsigned char)(i * 0x9d + 0x3b);
+			for (int dir = 0; dir < 2; dir++)
+			{
+				const unsigned int *rk = dir ? ctx.rk_dec : ctx.rk_enc;
+				SM4_RoundsScalar(rk, in, ref, n);
+				for (int e = SM4_ENGINE_SCALAR + 1; e < SM4_ENGINE_NUM; e++)
+				{
+					if (!SM4_EngineSupported((SM4_Engine)e))
+						continue;
+					// 4/8/16块分组都要覆盖
+					for (int group = SM4_MB_LANES; group <= n; group <<= 1)
+					{
+						memset(out, 0, sizeof(out));
+						for (int b = 0; b < n; b += group)
+							SM4_Engines[e](rk, in + b * SM4_INPUT_SIZE, out + b * SM4_INPUT_SIZE, group);
+						if (memcmp(out, ref, sizeof(ref)))
+							return 1;
+					}
+				}
+			}
+			return 0;
+		}
+	}
+}
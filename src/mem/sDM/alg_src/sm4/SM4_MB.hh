@@ -0,0 +1,96 @@
+//Function List:
+//SM4_GetEngine      //Engine used by the multi-block functions
+//SM4_SetEngine      //Force an engine
+//SM4_EncryptBlocks  //Multi-block encryption with precomputed round keys
+//SM4_DecryptBlocks  //Multi-block decryption with precomputed round keys
+//SM4_MB_SelfCheck   //Self-check of every available engine
+#ifndef __SM4_MB_H
+#define __SM4_MB_H
+#include "SM4_ENC.hh"
+#define SM4_MB_LANES 4 // 多块引擎每次处理的最少块数,4/8/16块一组
+namespace gem5
+{
+    namespace sm4
+    {
+        /************************************************************
+        Enum:
+        SM4_Engine
+        Description:
+        Implementations of the multi-block engine
+        SM4_ENGINE_SCALAR: one block after the other, reference
+        SM4_ENGINE_TTABLE: combined S-box and L transform tables,
+                           4 blocks interleaved
+        SM4_ENGINE_SSE:    4 blocks per 128-bit register, the S-box
+                           is evaluated on all bytes at once through
+                           the AES S-box (AES-NI) and affine maps
+        SM4_ENGINE_AVX2:   same as SSE with 8 blocks per register
+        ************************************************************/
+        typedef enum
+        {
+            SM4_ENGINE_SCALAR,
+            SM4_ENGINE_TTABLE,
+            SM4_ENGINE_SSE,
+            SM4_ENGINE_AVX2,
+            SM4_ENGINE_NUM
+        } SM4_Engine;
+        /************************************************************
+        Function:
+        SM4_Engine SM4_GetEngine();
+        Description:
+        Engine used by SM4_EncryptBlocks/SM4_DecryptBlocks, the fastest
+        one supported by the host CPU unless forced by SM4_SetEngine
+        ************************************************************/
+        SM4_Engine SM4_GetEngine();
+        /************************************************************
+        Function:
+        int SM4_SetEngine(SM4_Engine engine);
+        Description:
+        Force an engine
+        Return:
+        1 not supported by the host CPU ; 0 success
+        ************************************************************/
+        int SM4_SetEngine(SM4_Engine engine);
+        /************************************************************
+        Function:
+        int SM4_EngineSupported(SM4_Engine engine);
+        Description:
+        Runtime CPU feature detection
+        Return:
+        1 supported ; 0 not supported
+        ************************************************************/
+        int SM4_EngineSupported(SM4_Engine engine);
+        /************************************************************
+        Function:
+        void SM4_EncryptBlocks(const SM4Context *ctx, const unsigned char *in, unsigned char *out, int nblocks);
+        Description:
+        Encrypt nblocks independent blocks (ECB), groups of 16, 8 and
+        4 blocks go through the engine, the remaining ones through
+        SM4_EncryptBlock
+        @param
+        ctx: context initialized by SM4_SetKey
+        in: nblocks * 16 bytes
+        @result
+        out: nblocks * 16 bytes, may alias in
+        @return null
+        ************************************************************/
+        void SM4_EncryptBlocks(const SM4Context *ctx, const unsigned char *in, unsigned char *out, int nblocks);
+        /************************************************************
+        Function:
+        void SM4_DecryptBlocks(const SM4Context *ctx, const unsigned char *in, unsigned char *out, int nblocks);
+        Description:
+        Decrypt nblocks independent blocks (ECB)
+        ************************************************************/
+        void SM4_DecryptBlocks(const SM4Context *ctx, const unsigned char *in, unsigned char *out, int nblocks);
+        /************************************************************
+        Function:
+        int SM4_MB_SelfCheck();
+        Description:
+        Run SM4_SelfCheck, then check that every engine supported by
+        the host gives the same output as the scalar one
+        Return:
+        1 fail ; 0 success
+        ************************************************************/
+        int SM4_MB_SelfCheck();
+    }
+}
+#endif
@@ -1,5 +1,11 @@
 #include "sDM.hh"
 
+#include <zlib.h>
+
+#include <algorithm>
+
+#include "base/logging.hh"
+
 namespace gem5
 {
     namespace sDM
@@ -29,22 +35,42 @@ namespace gem5
              * h=3,L2,iit叶节点数:64^3,数据区大小:64^3*2KB=512MB
              * h=4,L2,iit叶节点数:64^4,数据区大小:64^4*2KB=32GB
              */
-            assert(data_size > IIT_LEAF_ARITY * CL_SIZE); // >2KB 树至少高于1层(包含根)
-            uint64_t leaf_num = data_size / (IIT_LEAF_ARITY * CL_SIZE);
+            assert(data_size >= PAGE_SIZE);
+            // 树至少高于1层(包含根),可变编码的叶节点覆盖一页,只有一页的空间也使用两个叶节点
+            uint64_t leaf_num = std::max<uint64_t>(2, ceil(data_size, IIT_LEAF_ARITY * CL_SIZE));
             uint64_t node_num = 1; // root
             while (leaf_num > 1)
             {
                 node_num += leaf_num;
-                leaf_num >>= 6; // /64
+                leaf_num = ceil(leaf_num, IIT_MID_ARITY); // 不满64个子节点时也需要一个父节点
             }
             return node_num * CL_SIZE; // 转换为字节大小
         }
         /**
          * sDMmanager构造函数
          */
-        sDMmanager::sDMmanager(int sdm_pool_id) : sdm_pool_id(sdm_pool_id)
+        sDMmanager::sDMmanager(const Params &p)
+            : SimObject(p), sdm_space_cnt(0), sdm_pool_id(p.pool_id), lastHitId(0), remoteMem(nullptr),
+              metaRange(p.metadata_range), metaNext(p.metadata_range.start()),
+              metaCache(p.meta_cache_assoc, p.meta_cache_size / CL_SIZE,
+                        p.meta_cache_indexing_policy, p.meta_cache_replacement_policy),
+              crypto(CME::getCryptoBackend((CME::CryptoType)p.crypto_backend)),
+              sidebandMacs(p.mac_layout == enums::sideband),
+              iitWriteBack(p.iit_write_back), maxDirtyNodes(p.iit_dirty_nodes), epochWrites(p.iit_epoch_writes),
+              writesInEpoch(0), functional(false), stats(*this)
         {
-            printf("!!sDMmanager!!\n");
+            // id=0表示不属于任何sdm,sdm_table[0]仅占位,使sdm_table可以直接用id下标
+            sdm_table.resize(1);
+            // 多块引擎与标量实现必须一致,否则密文会随宿主CPU不同而不同
+            fatal_if(!crypto, "unknown crypto backend %d", (int)p.crypto_backend);
+            fatal_if(crypto->selfCheck(), "%s crypto backend failed self-check", crypto->name());
+            fatal_if(iitWriteBack && maxDirtyNodes == 0, "iit write-back mode needs room for dirty nodes");
+            // 配置中的范围在init中依次获得id 1, 2, ...
+            for (size_t i = 1; i <= p.sdm_ranges.size(); i++)
+                spaceStats.emplace_back(new SpaceStats(this, "space" + std::to_string(i)));
+            spaceStats.emplace_back(new SpaceStats(this, "dynamicSpaces"));
+            // 不属于任何统计组,不会被输出
+            functionalStats.reset(new SpaceStats(nullptr, "functional"));
         }
         /**
          * sDMmanager
@@ -52,6 +78,102 @@ namespace gem5
         sDMmanager::~sDMmanager()
         {
         }
+        /**
+         * @author yqy
+         * @brief 返回id所属的空间统计,运行时注册的空间共用最后一组
+         * @attention 功能性访问的统计记入不输出的functionalStats,不影响模拟的统计
+         */
+        sDMmanager::SpaceStats &sDMmanager::getSpaceStats(sdmIDtype id)
+        {
+            assert(id != 0);
+            if (functional)
+                return *functionalStats;
+            return *spaceStats[std::min<size_t>(id, spaceStats.size()) - 1];
+        }
+        /**
+         * @author yqy
+         * @brief 将配置中给出的每个地址范围注册为一个sdm空间
+         * @attention 需要内存控制器已经通过setRemoteMemory接入远端内存
+         */
+        void sDMmanager::init()
+        {
+            SimObject::init();
+            fatal_if(!remoteMem && !params().sdm_ranges.empty(),
+                     "%s: sDM spaces configured but no memory controller attached\n", name());
+            for (const auto &range : params().sdm_ranges)
+            {
+                fatal_if(!sDMspace_register(range), "%s: sdm range %s overlaps another one\n",
+                         name(), range.to_string());
+            }
+        }
+        /**
+         * @author yqy
+         * @brief 在远端元数据区中按页对齐分配size字节
+         * @return 分配得到的远端物理地址
+         * @attention 优先从已释放的区域中首次适配,否则从未分配的区域末尾分配
+         */
+        Addr sDMmanager::metaAlloc(sdm_size size)
+        {
+            size = ceil(size, PAGE_SIZE) * PAGE_SIZE;
+            for (auto it = metaFreeList.begin(); it != metaFreeList.end(); ++it)
+            {
+                if (it->second < size)
+                    continue;
+                Addr paddr = it->first;
+                sdm_size rest = it->second - size;
+                metaFreeList.erase(it);
+                if (rest)
+                    metaFreeList[paddr + size] = rest;
+                return paddr;
+            }
+            Addr paddr = metaNext;
+            metaNext += size;
+            fatal_if(metaNext > metaRange.end(), "%s: sDM metadata region %s exhausted\n",
+                     name(), metaRange.to_string());
+            return paddr;
+        }
+        /**
+         * @author yqy
+         * @brief 归还metaAlloc分配的区域,与相邻的空闲区域合并
+         */
+        void sDMmanager::metaFree(Addr paddr, sdm_size size)
+        {
+            size = ceil(size, PAGE_SIZE) * PAGE_SIZE;
+            auto next = metaFreeList.lower_bound(paddr);
+            if (next != metaFreeList.end() && paddr + size == next->first)
+            {
+                size += next->second;
+                next = metaFreeList.erase(next);
+            }
+            if (next != metaFreeList.begin())
+            {
+                auto prev = std::prev(next);
+                if (prev->first + prev->second == paddr)
+                {
+                    paddr = prev->first;
+                    size += prev->second;
+                    metaFreeList.erase(prev);
+                }
+            }
+            // 位于末尾的空闲区域直接退回未分配区域
+            if (paddr + size == metaNext)
+                metaNext = paddr;
+            else
+                metaFreeList[paddr] = size;
+        }
+        /**
+         * @author yqy
+         * @brief 为sdm空间派生密钥
+         * @attention 模拟中使用sm3(pool_id||id||key_type)派生,真实硬件中密钥由本地安全模块生成
+         */
+        void sDMmanager::deriveKey(sdmIDtype id, int key_type, uint8_t *key, int keyLen)
+        {
+            uint64_t seed[3] = {(uint64_t)sdm_pool_id, id, (uint64_t)key_type};
+            uint8_t digest[SM3_SIZE];
+            assert(keyLen <= SM3_SIZE);
+            sm3::SM3_256((uint8_t *)seed, sizeof(seed), digest);
+            memcpy(key, digest, keyLen);
+        }
         /**
          * @author
          * yqy
@@ -64,15 +186,16 @@ namespace gem5
          */
         sdmIDtype sDMmanager::isContained(Addr paddr)
         {
-            paddr &= PAGE_ALIGN_MASK;
-            auto id = sdm_paddr2id.find(paddr);
-            if (id == sdm_paddr2id.end())
+            // 连续的访问大多落在同一个物理连续段
+            if (lastHitRange.contains(paddr))
+                return lastHitId;
+            auto it = sdm_paddr2id.contains(paddr);
+            if (it == sdm_paddr2id.end())
                 return 0;
-            return id->second;
+            lastHitRange = it->first;
+            lastHitId = it->second;
+            return it->second;
         }
-        /**
-         *
-         */
 
         /**
          * @author yqy
@@ -80,27 +203,225 @@ namespace gem5
          * @param id:所属sdm的编号(sdmIDtype)
          * @param paddr:物理地址
          * @return 虚拟空间的相对偏移
-         * @attention 未实现
+         * @attention 在按物理地址排序的二元组中二分查找,O(log n)
          */
         Addr sDMmanager::getVirtualOffset(sdmIDtype id, Addr paddr)
         {
-            // Addr = sdm_table[id].dataPtrPagePtr.next;
-            // sdm_table[id].dataPtrPagePtr.getMaxBound(, );
-            return paddr;
+            auto &index = sdm_table[id].extentIndex;
+            // 第一个起始地址大于paddr的二元组的前一个即为可能包含paddr的二元组
+            auto it = std::upper_bound(index.begin(), index.end(), paddr,
+                                       [](Addr a, const sdm_pagePtrPair &pair)
+                                       { return a < pair.curPageAddr; });
+            panic_if(it == index.begin(), "%s: %#x is not in sdm space %d\n", name(), paddr, id);
+            --it;
+            panic_if(paddr >= it->curPageAddr + (Addr)it->cnum * PAGE_SIZE,
+                     "%s: %#x is not in sdm space %d\n", name(), paddr, id);
+            return (Addr)it->pnum * PAGE_SIZE + (paddr - it->curPageAddr);
         }
         /**
          * @author yqy
-         * @brief 查找关键路径上节点的远端物理地址
+         * @brief 计算关键路径上节点的远端物理地址
+         * @param id 访问地址所属sdm的id
+         * @param rva 访问的物理地址对应的虚拟空间偏移
+         * @param keyPathAddr 返回关键路径物理地址,keyPathAddr[0]为叶节点
+         * @return 返回层数(不含本地root)
+         */
+        int sDMmanager::getKeyPathAddr(sdmIDtype id, Addr rva, Addr *keyPathAddr)
+        {
+            sdm_space &sp = sdm_table[id];
+            uint64_t idx = rva / (IIT_LEAF_ARITY * CL_SIZE); // 叶节点序号
+            for (int i = 0; i < sp.height; i++)
+            {
+                keyPathAddr[i] = sp.nodeAddr(i, idx);
+                idx /= IIT_MID_ARITY;
+            }
+            return sp.height;
+        }
+        /**
+         * @author yqy
+         * @brief 查找关键路径上节点的远端物理地址并读出节点
          * @param id 访问地址所属sdm的id
          * @param rva 访问的物理地址对应的虚拟空间偏移
          * @param keyPathAddr 返回关键路径物理地址
          * @param keyPathNode 返回关键路径节点
          * @return 返回层数
-         * @attention 未实现
          */
         int sDMmanager::getKeyPath(sdmIDtype id, Addr rva, Addr *keyPathAddr, iit_NodePtr keyPathNode)
         {
-            return 0;
+            int h = getKeyPathAddr(id, rva, keyPathAddr);
+            for (int i = 0; i < h; i++)
+                remoteMem->readBlob(keyPathAddr[i], &keyPathNode[i], IIT_NODE_SIZE);
+            return h;
+        }
+        /**
+         * @author yqy
+         * @brief 返回rva所在半页的HMAC的远端物理地址
+         * @attention sideband布局下返回rva所在缓存行的MAC在边带存储中的位置
+         */
+        Addr sDMmanager::getHMACAddr(sdmIDtype id, Addr rva)
+        {
+            if (sidebandMacs)
+                return sdm_table[id].hmacBase + (rva / CL_SIZE) * INLINE_MAC_SIZE;
+            return sdm_table[id].hmacBase + (rva / HALF_PAGE_SIZE) * HMAC_SIZE;
+        }
+        /**
+         * @author yqy
+         * @brief 数据区大小为data_size的空间需要的HMAC/MAC区域大小
+         * @attention sideband布局的MAC在硬件中占用ECC位,这里仍从元数据区分配,只用于功能性地保存MAC
+         */
+        sdm_size sDMmanager::getMACsize(sdm_size data_size) const
+        {
+            if (sidebandMacs)
+                return data_size / CL_SIZE * INLINE_MAC_SIZE;
+            return data_size / SDM_HMAC_ZOOM;
+        }
+        /**
+         * @author yqy
+         * @brief 从叶节点中取出rva对应缓存行的计数器
+         */
+        void sDMmanager::getCounter(iit_Node &leaf, Addr rva, CL_Counter counter)
+        {
+            leaf.asLeaf().getCounter_k((rva / CL_SIZE) % IIT_LEAF_ARITY, counter);
+        }
+        /**
+         * @author yqy
+         * @brief 计数器为0表示缓存行注册后从未被写过
+         */
+        bool sDMmanager::isZeroCounter(const CL_Counter counter)
+        {
+            static const CL_Counter zero = {0};
+            return memcmp(counter, zero, sizeof(CL_Counter)) == 0;
+        }
+        /**
+         * @author yqy
+         * @brief 叶节点中半页halfPageAddr的计数器之和
+         * @attention 叶节点覆盖一个半页或一页,页面在物理上连续,半页在叶节点中的位置由物理地址得到
+         */
+        void sDMmanager::halfPageSum(iit_Node &leaf, Addr halfPageAddr, CL_Counter sum)
+        {
+            static_assert(IIT_LEAF_ARITY * CL_SIZE <= PAGE_SIZE, "a leaf must not span discontiguous pages");
+            static_assert(IIT_LEAF_ARITY * CL_SIZE >= HALF_PAGE_SIZE, "a half page must be covered by one leaf");
+            uint32_t first = (halfPageAddr % (IIT_LEAF_ARITY * CL_SIZE)) / CL_SIZE;
+            leaf.asLeaf().sum(sum, first & ~(HALF_PAGE_SIZE / CL_SIZE - 1), HALF_PAGE_SIZE / CL_SIZE);
+        }
+        /**
+         * @author yqy
+         * @brief 叶节点中半页的计数器之和为0表示该半页从未被写过
+         */
+        bool sDMmanager::isUnwritten(iit_Node &leaf, Addr halfPageAddr)
+        {
+            CL_Counter sum;
+            halfPageSum(leaf, halfPageAddr, sum);
+            return isZeroCounter(sum);
+        }
+        /**
+         * @author yqy
+         * @brief 计算一页中选中的半页密文的HMAC
+         * @param paths    该页的叶节点,下标为叶节点在页中的序号
+         * @param page     页的物理地址
+         * @param half     是否计算低/高半页的HMAC
+         * @param pageData 整页密文,只需要选中的半页有效
+         * @param hmac     低/高半页的HMAC
+         * @attention HMAC绑定叶节点中该半页的计数器之和,每次写都会使其增加,防止重放旧的密文和HMAC
+         * @attention 两个半页都选中时一次计算,两个消息在SIMD寄存器中并行压缩
+         */
+        void sDMmanager::pageHMAC(sdm_space &sp, KeyPath *paths, Addr page, const bool half[2], uint8_t *pageData, sdm_HMACPtr hmac[2])
+        {
+            CL_Counter sum[2];
+            for (int i = 0; i < 2; i++)
+            {
+                if (half[i])
+                    halfPageSum(paths[i * PAGE_LEAVES / 2].node[0], page + i * HALF_PAGE_SIZE, sum[i]);
+            }
+            if (half[0] && half[1])
+            {
+                uint8_t *const sums[2] = {sum[0], sum[1]};
+                uint8_t *const out[2] = {hmac[0], hmac[1]};
+                CME::sDM_PageHMAC(pageData, &sp.iit_hmac, page, sums, sizeof(CL_Counter), out, HMAC_SIZE);
+                return;
+            }
+            for (int i = 0; i < 2; i++)
+            {
+                if (half[i])
+                    CME::sDM_HMAC(pageData + i * HALF_PAGE_SIZE, HALF_PAGE_SIZE, &sp.iit_hmac, page + i * HALF_PAGE_SIZE,
+                                  sum[i], sizeof(CL_Counter), hmac[i], HMAC_SIZE);
+            }
+        }
+        /**
+         * @author yqy
+         * @brief 计算一个缓存行密文的截断MAC(sideband布局)
+         * @attention MAC绑定该行的计数器和物理地址,计数器每次写都会增加,防止重放旧的密文和MAC
+         */
+        void sDMmanager::lineMAC(sdm_space &sp, Addr paddr, uint8_t *cl, CL_Counter counter, uint8_t *mac)
+        {
+            CME::sDM_HMAC(cl, CL_SIZE, &sp.iit_hmac, paddr, counter, sizeof(CL_Counter), mac, INLINE_MAC_SIZE);
+        }
+        /**
+         * @author yqy
+         * @brief 中间节点主计数器溢出后,其所有子节点的父计数器都发生变化,需要重新计算子节点的hash_tag
+         * @param level 子节点所在层
+         * @param fidx 父节点在其所在层的序号
+         * @param old_father 溢出前的父节点,用于先校验子节点
+         * @param father 溢出后的父节点
+         * @param skip 关键路径上的子节点,由调用者负责更新
+         */
+        void sDMmanager::retagChildren(sdm_space &sp, int level, uint64_t fidx, iit_Node &old_father, iit_Node &father, uint64_t skip)
+        {
+            int type = level == 0 ? IIT_LEAF_TYPE : IIT_MID_TYPE;
+            SpaceStats &ss = getSpaceStats(sp.id);
+            uint64_t end = std::min((fidx + 1) * IIT_MID_ARITY, sp.levelCount[level]);
+            // 所有子节点的hash_tag先用旧计数器批量校验,再用新计数器批量重算
+            int n = 0, nv = 0;
+            iit_Node children[IIT_MID_ARITY];
+            iit_NodePtr nodes[IIT_MID_ARITY], vnodes[IIT_MID_ARITY];
+            int types[IIT_MID_ARITY];
+            Addr addrs[IIT_MID_ARITY], vaddrs[IIT_MID_ARITY];
+            CL_Counter f_cl[IIT_MID_ARITY], old_cl[IIT_MID_ARITY];
+            uint8_t *f_ptr[IIT_MID_ARITY], *old_ptr[IIT_MID_ARITY];
+            iit_hash_tag tags[IIT_MID_ARITY];
+            iit_MidNode::Decoded oldF, newF;
+            old_father.asMid().decode(oldF);
+            father.asMid().decode(newF);
+            for (uint64_t c = fidx * IIT_MID_ARITY; c < end; c++)
+            {
+                Addr paddr = sp.nodeAddr(level, c);
+                // 脏子节点在传播时用届时的父计数器重新计算hash_tag
+                if (c == skip || dirtyNodes.count(paddr))
+                    continue;
+                oldF.getCounter_k(c % IIT_MID_ARITY, old_cl[nv]);
+                // 旧父计数器为0的子节点是隐式的全零节点,现在父计数器不再为0,需要实际写出
+                if (isZeroCounter(old_cl[nv]))
+                    memset(&children[n], 0, sizeof(iit_Node));
+                // 缓存中的节点已经校验过,功能性访问不使用元数据缓存
+                else if (!functional && metaCache.read(paddr, (uint8_t *)&children[n]))
+                    ss.levelHits[level]++;
+                else
+                {
+                    ss.levelMisses[level]++;
+                    ss.extraBytes += IIT_NODE_SIZE;
+                    remoteMem->readBlob(paddr, &children[n], IIT_NODE_SIZE);
+                    if (!functional)
+                        noteFetch(paddr);
+                    old_ptr[nv] = old_cl[nv];
+                    vnodes[nv] = &children[n];
+                    vaddrs[nv++] = paddr;
+                }
+                newF.getCounter_k(c % IIT_MID_ARITY, f_cl[n]);
+                f_ptr[n] = f_cl[n];
+                nodes[n] = &children[n];
+                types[n] = type;
+                addrs[n++] = paddr;
+            }
+            ss.cryptoOps[OP_HASH_TAG] += nv + n;
+            iit_Node::get_hash_tags(nv, vnodes, types, &sp.iit_hmac, vaddrs, old_ptr, tags);
+            for (int i = 0; i < nv; i++)
+                assert(vnodes[i]->abstract_hash_tag(type) == tags[i] && "verify failed before retag");
+            iit_Node::get_hash_tags(n, nodes, types, &sp.iit_hmac, addrs, f_ptr, tags);
+            for (int i = 0; i < n; i++)
+            {
+                children[i].embed_hash_tag(type, tags[i]);
+                metaWrite(addrs[i], &children[i], IIT_NODE_SIZE);
+            }
         }
         /**
          * @brief 为数据空间构建sDM空间
@@ -108,170 +429,1422 @@ namespace gem5
          * @param 该sDM空间内的数据页物理地址列表
          * @return 是否成功注册
          * //sdm metadata指针(这里sdm metadata是sdm结构体指针)
-         * @attention 未完全实现
+         * @attention 新注册的空间视为新分配的内存:读出全零,所有计数器为0
          */
         bool sDMmanager::sDMspace_register(std::vector<Addr> &pPageList)
         {
             assert(pPageList.size() && "data is empty");
-            // 可以使用某种hash结构存
+            // 构建数据页指针二元组,物理连续的页合并为一项
+            std::vector<sdm_pagePtrPair> extents;
+            uint32_t pnum = 0;
+            for (auto paddr : pPageList)
+            {
+                assert(!(paddr & ~PAGE_ALIGN_MASK) && "page is not aligned");
+                if (!extents.empty() &&
+                    extents.back().curPageAddr + (Addr)extents.back().cnum * PAGE_SIZE == paddr)
+                    extents.back().cnum++;
+                else
+                    extents.push_back({paddr, pnum, 1});
+                pnum++;
+            }
+            return registerExtents(extents);
+        }
+        /**
+         * @brief 将一段物理连续的地址范围注册为sDM空间
+         * @author yqy
+         * @attention 只有一个二元组,注册的代价与空间大小无关
+         */
+        bool sDMmanager::sDMspace_register(const AddrRange &range)
+        {
+            Addr start = range.start() & PAGE_ALIGN_MASK;
+            assert(range.end() > start && "data is empty");
+            uint32_t pages = ceil(range.end() - start, PAGE_SIZE);
+            std::vector<sdm_pagePtrPair> extents = {{start, 0, pages}};
+            return registerExtents(extents);
+        }
+        /**
+         * @brief 由数据页指针二元组构建sDM空间
+         * @author yqy
+         * @param extents 按虚拟偏移排序的数据页指针二元组
+         * @return 是否成功注册,与已注册的空间或自身重叠时失败
+         * @attention 数据区和iit都不需要初始化,注册的代价只与二元组个数有关
+         */
+        bool sDMmanager::registerExtents(std::vector<sdm_pagePtrPair> &extents)
+        {
+            assert(remoteMem && "remote memory is not attached");
             // 这里需要计算所需的额外空间
             // 1. data大小
-            sdm_size data_size = pPageList.size() * PAGE_SIZE;
+            sdm_size data_size = (sdm_size)(extents.back().pnum + extents.back().cnum) * PAGE_SIZE;
             // 2. IIT树大小
             sdm_size iit_size = getIITsize(data_size);
             // 3. HMAC大小
-            sdm_size hmac_size = data_size * SDM_HMAC_ZOOM;
-            // 额外所需空间的总大小
-            sdm_size extra_size = iit_size + hmac_size;
+            sdm_size hmac_size = getMACsize(data_size);
 
             sdm_space sp;
+            sp.sDataSize = data_size;
+            sp.extents = std::move(extents);
+            sp.extentIndex = sp.extents;
+            std::sort(sp.extentIndex.begin(), sp.extentIndex.end(),
+                      [](const sdm_pagePtrPair &a, const sdm_pagePtrPair &b)
+                      { return a.curPageAddr < b.curPageAddr; });
 
-            sp.id = ++sdm_space_cnt;
+            // 按物理连续段添加地址映射,与已注册的空间或自身重叠时注册失败
+            sp.id = sdm_space_cnt + 1;
+            std::vector<AddrRangeMap<sdmIDtype>::iterator> inserted;
+            for (auto &pair : sp.extents)
+            {
+                auto it = sdm_paddr2id.insert(RangeSize(pair.curPageAddr, (Addr)pair.cnum * PAGE_SIZE), sp.id);
+                if (it == sdm_paddr2id.end())
+                {
+                    warn("%s: page list overlaps a registered sdm space\n", name());
+                    for (auto &i : inserted)
+                        sdm_paddr2id.erase(i);
+                    return false;
+                }
+                inserted.push_back(it);
+            }
+            sdm_space_cnt++;
+            deriveKey(sp.id, HASH_KEY_TYPE, sp.iit_key, sizeof(sdm_hashKey));
+            deriveKey(sp.id, CME_KEY_TYPE, sp.cme_key, sizeof(sdm_CMEKey));
+            // 轮密钥只在注册时扩展一次
+            crypto->setCipherKey(&sp.cme_ctx, sp.cme_key);
+            crypto->setMacKey(&sp.iit_hmac, sp.iit_key, sizeof(sdm_hashKey));
             // 这里为hmac和iit申请远端内存空间
-            // ...
-            // Addr dataPtrPagePtr = phyalloc(xxx);
-            // uint8_t *vdataPtrPagePtr = malloc(4K);
-            // sp.dataPtrPagePtr = dataPtrPagePtr;
-            // vdataPtrPagePtrxxx
-            // 向本地申请内存空间构建三个链表
-            // ...
-
-            for (auto paddr : pPageList)
+            sp.iitBase = metaAlloc(iit_size);
+            sp.hmacBase = metaAlloc(hmac_size);
+            // 计算iit每层的节点数,第0层为叶节点,最上层为root
+            uint64_t num = std::max<uint64_t>(2, ceil(data_size, IIT_LEAF_ARITY * CL_SIZE)), start = 0;
+            sp.height = 0;
+            while (num > 1)
             {
-                // 该地址不可能已经存在于其他sdm空间
-                assert(!sdm_paddr2id[paddr] && "reused before free");
-                // 添加地址映射
-                sdm_paddr2id[paddr] = sp.id;
+                fatal_if(sp.height >= MAX_HEIGHT - 1, "%s: sdm space of %d bytes is too large\n", name(), data_size);
+                sp.levelStart[sp.height] = start;
+                sp.levelCount[sp.height] = num;
+                start += num;
+                sp.height++;
+                num = ceil(num, IIT_MID_ARITY);
             }
+            sp.levelStart[sp.height] = start;
+            sp.levelCount[sp.height] = 1;
+            memset(&sp.root, 0, sizeof(iit_Node));
+            // 数据区不需要清零:计数器为0的缓存行从未被写过,读出全零,其密文和所在半页的HMAC都不会被使用
+            // iit不需要初始化:root全零,其下所有节点都是隐式的全零节点,第一次写其下的缓存行时才实际写出
+            // 新空间的id和由id派生的密钥都是新的,之前空间遗留的密文、HMAC和iit节点都无法通过校验
 
             sdm_table.push_back(sp);
             return true;
         }
         /**
+         * @brief 释放sDM空间
          * @author yqy
-         * @brief 对paddr CL的数据进行校验
-         * @brief 并将一些中间值通过传输的指针参数返回
-         * @attention HMAC校验未完成
+         * @param id 要释放的sdm空间
+         * @return 是否成功释放,id无效或已经释放时返回false
+         * @attention 归还iit和HMAC区域,删除地址映射;数据页不需要清零
+         * @attention id不会被重用,之后在同一批页上注册的空间使用新的密钥,计数器从0开始也不会重用OTP
+         * @attention 共享空间的home在其他主机都释放之前不能释放,其他主机释放时只退出共享组,不归还iit和HMAC区域
          */
-        bool sDMmanager::verify(Addr paddr, sdmIDtype id, Addr *rva, int &h, Addr *keyPathAddr, iit_NodePtr keyPathNode, sdm_hashKey key)
+        bool sDMmanager::sDMspace_release(sdmIDtype id)
         {
-            *rva = getVirtualOffset(id, paddr);
-            // 执行校验
-            // HMAC校验
-            // ...
-            // iit校验
-            h = getKeyPath(id, *rva, keyPathAddr, keyPathNode);
-            int type = IIT_LEAF_TYPE;
-            // paddr对应的缓存行位于上层节点的哪个计数器
-            uint32_t next_k = *rva / IIT_LEAF_ARITY * CL_SIZE;
-            next_k /= IIT_MID_ARITY;
-            // 用于存放当前节点和父节点的major-minor计数器
-            CL_Counter cl, f_cl;
-            bool verified = true;
-            for (int i = 0; i < h && verified; i++)
+            if (id == 0 || id >= sdm_table.size() || sdm_table[id].extents.empty())
+                return false;
+            sdm_space &sp = sdm_table[id];
+            bool owner = true;
+            if (sp.share)
+            {
+                auto &members = sp.share->members;
+                owner = members.front().first == this;
+                if (owner && members.size() > 1)
+                {
+                    warn("%s: sdm space %d is still mapped by other hosts\n", name(), id);
+                    return false;
+                }
+                members.erase(std::find(members.begin(), members.end(), std::make_pair(this, id)));
+                sharedMeta.erase(sharedMeta.contains(sp.iitBase));
+                sharedMeta.erase(sharedMeta.contains(sp.hmacBase));
+                touchedShared.erase(id);
+                sp.share.reset();
+            }
+            for (auto &pair : sp.extents)
+            {
+                auto it = sdm_paddr2id.contains(pair.curPageAddr);
+                assert(it != sdm_paddr2id.end() && it->second == id);
+                sdm_paddr2id.erase(it);
+            }
+            if (lastHitId == id)
+            {
+                lastHitRange = AddrRange();
+                lastHitId = 0;
+            }
+            sdm_size iit_size = getIITsize(sp.sDataSize);
+            sdm_size hmac_size = getMACsize(sp.sDataSize);
+            // 脏节点随空间一起丢弃
+            for (auto it = dirtyNodes.begin(); it != dirtyNodes.end();)
+            {
+                if (it->second.id == id)
+                {
+                    dirtyLRU.erase(it->second.lru);
+                    it = dirtyNodes.erase(it);
+                }
+                else
+                    ++it;
+            }
+            metaCache.invalidateRange(sp.iitBase, iit_size);
+            metaCache.invalidateRange(sp.hmacBase, hmac_size);
+            if (owner)
+            {
+                metaFree(sp.iitBase, iit_size);
+                metaFree(sp.hmacBase, hmac_size);
+            }
+            // 表项保留,只清除内容,使id仍然可以直接作为sdm_table下标
+            sp.extents.clear();
+            sp.extents.shrink_to_fit();
+            sp.extentIndex.clear();
+            sp.extentIndex.shrink_to_fit();
+            sp.sDataSize = 0;
+            memset(sp.iit_key, 0, sizeof(sdm_hashKey));
+            memset(sp.cme_key, 0, sizeof(sdm_CMEKey));
+            return true;
+        }
+        /**
+         * @brief 映射另一个主机注册的sDM空间,两个主机共享同一组数据页、iit、HMAC和密钥
+         * @author yqy
+         * @param home 注册该空间的sDMmanager
+         * @param home_id 该空间在home中的id
+         * @return 该空间在本地的id,与本地已注册的空间重叠时返回0
+         * @attention 本地只保存空间的描述和root副本,由其他主机的写通过coherenceUpdate保持一致
+         * @attention 从检查点恢复时本地已有该空间,只需重新加入共享组
+         */
+        sdmIDtype sDMmanager::sDMspace_attach(sDMmanager &home, sdmIDtype home_id)
+        {
+            assert(&home != this && "attaching a space to its home");
+            assert(home_id && home_id < home.sdm_table.size() && !home.sdm_table[home_id].extents.empty());
+            // 写回模式的脏节点只在本地可见,其他主机无法校验
+            fatal_if(iitWriteBack || home.iitWriteBack, "%s: shared sdm spaces need a write-through iit\n", name());
+            fatal_if(crypto != home.crypto, "%s: shared sdm space uses %s but this host uses %s\n",
+                     name(), home.crypto->name(), crypto->name());
+            fatal_if(sidebandMacs != home.sidebandMacs, "%s: shared sdm space uses another MAC layout\n", name());
+            sdm_space &hsp = home.sdm_table[home_id];
+            if (!hsp.share)
+            {
+                hsp.share = std::make_shared<ShareGroup>();
+                hsp.share->members.emplace_back(&home, home_id);
+                home.addSharedMeta(hsp);
+            }
+            sdmIDtype id = isContained(hsp.extents.front().curPageAddr);
+            if (id)
+            {
+                fatal_if(sdm_table[id].iitBase != hsp.iitBase, "%s: shared sdm space overlaps a private one\n", name());
+                if (sdm_table[id].share)
+                    return id;
+            }
+            else
+            {
+                sdm_space sp = hsp;
+                sp.id = sdm_space_cnt + 1;
+                std::vector<AddrRangeMap<sdmIDtype>::iterator> inserted;
+                for (auto &pair : sp.extents)
+                {
+                    auto it = sdm_paddr2id.insert(RangeSize(pair.curPageAddr, (Addr)pair.cnum * PAGE_SIZE), sp.id);
+                    if (it == sdm_paddr2id.end())
+                    {
+                        warn("%s: shared sdm space overlaps a registered one\n", name());
+                        for (auto &i : inserted)
+                            sdm_paddr2id.erase(i);
+                        return 0;
+                    }
+                    inserted.push_back(it);
+                }
+                sdm_space_cnt++;
+                id = sp.id;
+                sdm_table.push_back(std::move(sp));
+            }
+            sdm_space &sp = sdm_table[id];
+            sp.share = hsp.share;
+            sp.share->members.emplace_back(this, id);
+            addSharedMeta(sp);
+            return id;
+        }
+        /**
+         * @author yqy
+         * @brief 读取元数据:命中元数据缓存时直接返回,否则从远端读取所在缓存行并插入缓存
+         * @attention 只用于HMAC,HMAC本身无需可信,被篡改的HMAC会使校验失败
+         * @attention 功能性访问不查询也不填充元数据缓存,缓存是写直达的,直接读远端即可
+         * @return 是否命中元数据缓存
+         */
+        bool sDMmanager::metaRead(Addr paddr, void *data, int size)
+        {
+            CL line;
+            Addr lineAddr = paddr & CL_ALIGN_MASK;
+            assert((paddr - lineAddr) + size <= CL_SIZE && "metadata crosses a cache line");
+            if (functional)
+            {
+                remoteMem->readBlob(paddr, data, size);
+                return false;
+            }
+            bool hit = metaCache.read(lineAddr, line);
+            if (hit)
+                stats.metaCacheHits++;
+            else
+            {
+                stats.metaCacheMisses++;
+                remoteMem->readBlob(lineAddr, line, CL_SIZE);
+                noteFetch(lineAddr);
+                metaCache.insert(lineAddr, line);
+            }
+            memcpy(data, line + (paddr - lineAddr), size);
+            return hit;
+        }
+        /**
+         * @author yqy
+         * @brief 写直达:写远端内存的同时更新元数据缓存中的副本
+         * @attention 共享空间的元数据记入touchedShared,写结束时使其他主机中的副本失效
+         */
+        void sDMmanager::metaWrite(Addr paddr, const void *data, int size)
+        {
+            remoteMem->writeBlob(paddr, data, size);
+            metaCache.update(paddr, (const uint8_t *)data, size);
+            auto it = sharedMeta.contains(paddr);
+            if (it != sharedMeta.end())
+                touchedShared[it->second].insert(paddr & CL_ALIGN_MASK);
+        }
+        /**
+         * @author yqy
+         * @brief 返回访问rva时需要从远端读取的元数据缓存行
+         * @param full_path 写操作需要整条关键路径,读操作遇到缓存中的节点即可结束
+         * @param missAddrs 返回未命中元数据缓存的关键路径节点和HMAC缓存行地址
+         * @param zeroLine 不为空时(读操作)返回该行计数器是否为0,为0的行读出全零,不需要HMAC
+         * @return 需要校验的节点数
+         * @attention 只查询,不改变元数据缓存的替换状态
+         */
+        int sDMmanager::getMetaMisses(sdmIDtype id, Addr rva, bool full_path, std::vector<Addr> &missAddrs, bool *zeroLine)
+        {
+            sdm_space &sp = sdm_table[id];
+            Addr keyPathAddr[MAX_HEIGHT];
+            int h = getKeyPathAddr(id, rva, keyPathAddr);
+            int loaded = h;
+            // 读操作遇到缓存中的节点即可结束
+            for (int i = 0; i < h && !full_path; i++)
+            {
+                if (readDirty(keyPathAddr[i], nullptr) || metaCache.probe(keyPathAddr[i]))
+                {
+                    loaded = i + 1;
+                    break;
+                }
+            }
+            // 自顶向下,父计数器为0的隐式节点不需要取回
+            // 元数据缓存是写直达的,远端内存中的节点与缓存中的一致,直接功能性读取父节点
+            // 写回模式下脏节点比远端的副本新
+            uint64_t k[MAX_HEIGHT];
+            k[0] = rva / (IIT_LEAF_ARITY * CL_SIZE);
+            for (int i = 1; i < h; i++)
+                k[i] = k[i - 1] / IIT_MID_ARITY;
+            iit_Node father = sp.root;
+            CL_Counter f_cl;
+            int n = 0;
+            // 循环结束时father为叶节点,提前结束时该行所在的子树从未被写过
+            bool implicit = false;
+            for (int i = h - 1; i >= 0; i--)
+            {
+                father.asMid().getCounter_k(k[i] % IIT_MID_ARITY, f_cl);
+                if (isZeroCounter(f_cl))
+                {
+                    implicit = true;
+                    break;
+                }
+                if (readDirty(keyPathAddr[i], &father))
+                    continue;
+                if (i < loaded && !metaCache.probe(keyPathAddr[i]))
+                {
+                    missAddrs.push_back(keyPathAddr[i]);
+                    n++;
+                }
+                remoteMem->readBlob(keyPathAddr[i], &father, IIT_NODE_SIZE);
+            }
+            if (zeroLine)
+            {
+                CL_Counter counter;
+                if (!implicit)
+                    getCounter(father, rva, counter);
+                *zeroLine = implicit || isZeroCounter(counter);
+                if (*zeroLine)
+                    return n;
+            }
+            // MAC随数据突发一起到达
+            if (sidebandMacs)
+                return n;
+            Addr hmacLine = getHMACAddr(id, rva) & CL_ALIGN_MASK;
+            if (!metaCache.probe(hmacLine))
+                missAddrs.push_back(hmacLine);
+            return n;
+        }
+        /**
+         * @author yqy
+         * @brief 校验rva关键路径上第from层及以上的节点
+         * @param from 从哪一层开始校验,0为叶节点
+         * @param full_path 是否需要取回整条关键路径(写操作需要修改路径上的所有节点)
+         * @param record 是否将取回的节点记入flushTraffic
+         * @attention 自底向上校验,每个节点的hash_tag绑定其父节点中对应的计数器,root位于本地可信存储
+         * @attention 脏节点和元数据缓存中的节点都已经校验过,读操作遇到命中的节点即可提前结束
+         * @attention full_path为false时,keyPathNode中只有命中节点及其以下的节点有效
+         * @attention 功能性访问不使用元数据缓存,只在脏节点处提前结束,取回的节点也不插入缓存
+         */
+        bool sDMmanager::verifyPath(sdmIDtype id, Addr rva, int from, Addr *keyPathAddr, iit_NodePtr keyPathNode,
+                                    const CME::MacKey *key, bool full_path, bool record)
+        {
+            sdm_space &sp = sdm_table[id];
+            SpaceStats &ss = getSpaceStats(id);
+            int h = getKeyPathAddr(id, rva, keyPathAddr);
+            bool cached[MAX_HEIGHT] = {false};
+            int loaded = h;
+            // 自底向上查询脏节点和元数据缓存,读操作遇到命中的节点即可结束,以上的节点无需再取回和校验
+            for (int i = from; i < h; i++)
             {
-                if (i < h - 1) // sum check
+                // 脏节点比远端内存中的副本新,需要先于缓存查询
+                cached[i] = readDirty(keyPathAddr[i], &keyPathNode[i]) ||
+                            (!functional && metaCache.read(keyPathAddr[i], (uint8_t *)&keyPathNode[i]));
+                if (cached[i])
                 {
-                    keyPathNode[i].sum(type, cl);
-                    // 取出父计数器
-                    keyPathNode[i + 1].getCounter_k(IIT_MID_TYPE, next_k, f_cl);
-                    // 比较父计数器是否与当前计数器相等
-                    verified = counter_cmp(cl, f_cl);
+                    if (!functional)
+                        stats.metaCacheHits++;
+                    ss.levelHits[i]++;
+                    if (!full_path)
+                    {
+                        loaded = i + 1;
+                        if (!functional)
+                            stats.earlyStops++;
+                        break;
+                    }
                 }
-                iit_hash_tag has_tag = keyPathNode[i].abstract_hash_tag(type);
-                iit_hash_tag chas_tag = keyPathNode[i].get_hash_tag(type, key, keyPathAddr[i]);
+            }
+            // 自顶向下取回未命中的节点
+            // 父计数器为0的节点从未被写过,是隐式的全零节点,不需要取回和校验,其下的节点也都是隐式的
+            int n = 0;
+            int types[MAX_HEIGHT], lvl[MAX_HEIGHT];
+            CL_Counter f_cl[MAX_HEIGHT];
+            iit_NodePtr nodes[MAX_HEIGHT];
+            uint8_t *f_ptr[MAX_HEIGHT];
+            Addr addrs[MAX_HEIGHT];
+            iit_hash_tag tags[MAX_HEIGHT];
+            // paddr对应的节点位于上层节点的哪个计数器
+            uint64_t k[MAX_HEIGHT];
+            k[0] = rva / (IIT_LEAF_ARITY * CL_SIZE);
+            for (int i = 1; i < h; i++)
+                k[i] = k[i - 1] / IIT_MID_ARITY;
+            for (int i = loaded - 1; i >= from; i--)
+            {
+                if (cached[i])
+                    continue;
+                iit_NodePtr father = (i + 1 < h) ? &keyPathNode[i + 1] : &sp.root;
+                // 取出父计数器,父节点此时可能尚未校验,被篡改的父节点自身无法通过校验
+                father->asMid().getCounter_k(k[i] % IIT_MID_ARITY, f_cl[n]);
+                if (isZeroCounter(f_cl[n]))
+                {
+                    memset(&keyPathNode[i], 0, sizeof(iit_Node));
+                    if (!functional)
+                        stats.implicitNodes++;
+                    continue;
+                }
+                if (!functional)
+                {
+                    stats.metaCacheMisses++;
+                    noteFetch(keyPathAddr[i]);
+                }
+                ss.levelMisses[i]++;
+                ss.extraBytes += IIT_NODE_SIZE;
+                remoteMem->readBlob(keyPathAddr[i], &keyPathNode[i], IIT_NODE_SIZE);
+                if (record)
+                    flushTraffic.emplace_back(keyPathAddr[i], true);
+                types[n] = i == 0 ? IIT_LEAF_TYPE : IIT_MID_TYPE;
+                nodes[n] = &keyPathNode[i];
+                f_ptr[n] = f_cl[n];
+                addrs[n] = keyPathAddr[i];
+                lvl[n++] = i;
+            }
+            ss.pathLength.sample(loaded - from);
+            ss.cryptoOps[OP_HASH_TAG] += n;
+            // 取回的节点的hash_tag互相独立,整条路径一次批量计算
+            iit_Node::get_hash_tags(n, nodes, types, key, addrs, f_ptr, tags);
+            // 自顶向下:每个取回的节点用已经可信的父节点(缓存中的、刚校验过的或root)校验
+            bool verified = true;
+            for (int j = 0; j < n && verified; j++)
+            {
                 // 比较计算值和存储值
-                verified = (has_tag == chas_tag);
-                type = IIT_MID_TYPE;
+                verified = nodes[j]->abstract_hash_tag(types[j]) == tags[j];
+                if (verified && !functional)
+                    metaCache.insert(keyPathAddr[lvl[j]], (uint8_t *)nodes[j]);
             }
             return verified;
         }
         /**
          * @author yqy
-         * @brief 读取paddr的CL时进行校验
-         * @return 是否通过校验
-         * @attention 未实现
+         * @brief 对一页中从paddr开始的n个CL的数据进行校验
+         * @brief 并将覆盖它们的叶节点的关键路径通过paths返回
+         * @param paths 下标为叶节点在页中的序号,只有覆盖这n个CL的叶节点有效
+         * @param full_path 是否需要取回整条关键路径(写操作需要修改路径上的所有节点)
+         * @param skip_zero 计数器为0的行不校验MAC,读操作直接返回全零,既不需要密文也不需要MAC
+         * @attention 每个叶节点的关键路径只校验一次,再用叶节点校验涉及的半页HMAC,两个半页的HMAC一次计算
+         * @attention sideband布局下只校验这n行的MAC,不需要读取半页
          */
-        void sDMmanager::read(Addr paddr)
+        bool sDMmanager::verify(sdmIDtype id, Addr paddr, int n, KeyPath *paths, bool full_path, bool skip_zero)
         {
-            sdmIDtype id = sDMmanager::isContained(paddr);
-            if (id == 0) // 该物理地址不包含在任何sdm中,无需对数据包做修改
-                return;
-            Addr rva;
-            int h;
-            Addr keyPathAddr[MAX_HEIGHT] = {0};
-            iit_Node keyPathNode[MAX_HEIGHT] = {0};
-            sdm_hashKey hash_key;
-            sdm_table[id].key_get(HASH_KEY_TYPE, hash_key);
-            bool verified = verify(paddr, id, &rva, h, keyPathAddr, keyPathNode, hash_key);
-            assert(verified && "verify failed before read");
-            assert(0 && "sDM_Decrypt failed");
-            //... 这里需要对数据包进行解密
-            // uint8_t* data = PacketPtr->getdataPtr<uint8_t*>;
-            CL_Counter cl;
-            keyPathNode[0].getCounter_k(IIT_LEAF_TYPE, rva / (IIT_LEAF_ARITY * CL_SIZE), cl);
-            sdm_CMEKey cme_key;
-            sdm_table[id].key_get(CME_KEY_TYPE, cme_key);
-            // CME::sDM_Decrypt(data, counter, paddr, cl, cme_key);
-        }
-        /**
-         * @author yqy
-         * @brief 写入paddr的CL时进行校验,并加密、维护iit、计算hmac
-         * @return 是否完成写入
-         * @attention 未实现
-         */
-        void
-        sDMmanager::write(Addr paddr)
-        {
-            sdmIDtype id;
-            id = isContained(paddr);
-            if (!id) // 无需修改任何数据包
+            sdm_space &sp = sdm_table[id];
+            SpaceStats &ss = getSpaceStats(id);
+            const Addr leafSpan = IIT_LEAF_ARITY * CL_SIZE;
+            Addr page = paddr & PAGE_ALIGN_MASK;
+            Addr end = paddr + (Addr)n * CL_SIZE;
+            Addr pageRva = getVirtualOffset(id, page);
+            assert(n > 0 && end <= page + PAGE_SIZE && "lines cross a page");
+            ss.verifies++;
+            bool verified = true;
+            for (Addr leaf = paddr & ~(leafSpan - 1); verified && leaf < end; leaf += leafSpan)
+                verified = verifyPath(id, pageRva + (leaf - page), 0, paths[(leaf - page) / leafSpan].addr,
+                                      paths[(leaf - page) / leafSpan].node, &sp.iit_hmac, full_path);
+            // 可信的叶节点中计数器为0的行从未被写过
+            CL_Counter counter[PAGE_LINES];
+            int zeros = 0;
+            for (int i = 0; verified && i < n; i++)
+            {
+                Addr line = paddr + (Addr)i * CL_SIZE;
+                getCounter(paths[(line - page) / leafSpan].node[0], pageRva + (line - page), counter[i]);
+                zeros += isZeroCounter(counter[i]);
+            }
+            if (verified && skip_zero)
+                ss.zeroReads += zeros;
+            if (verified && sidebandMacs)
+            {
+                // 校验每行自己的MAC,从未写过的缓存行还没有MAC
+                // MAC位于数据突发的边带中,随密文一起到达,不需要额外的远端访问
+                uint8_t lines[PAGE_SIZE], macs[PAGE_LINES][INLINE_MAC_SIZE], stored[PAGE_LINES][INLINE_MAC_SIZE];
+                uint8_t *in[PAGE_LINES], *ctr[PAGE_LINES], *out[PAGE_LINES];
+                Addr addrs[PAGE_LINES];
+                int m = 0;
+                for (int i = 0; i < n; i++)
+                {
+                    if (isZeroCounter(counter[i]))
+                        continue;
+                    in[m] = lines + i * CL_SIZE;
+                    ctr[m] = counter[i];
+                    out[m] = macs[i];
+                    addrs[m++] = paddr + (Addr)i * CL_SIZE;
+                }
+                ss.sidebandBytes += m * INLINE_MAC_SIZE;
+                ss.cryptoOps[OP_HMAC] += m;
+                if (m && crypto->functional())
+                {
+                    remoteMem->readBlob(paddr, lines, n * CL_SIZE);
+                    remoteMem->readBlob(getHMACAddr(id, pageRva + (paddr - page)), stored, n * INLINE_MAC_SIZE);
+                    // 所有行的MAC一次批量计算
+                    CME::sDM_HMAC_xN(in, CL_SIZE, &sp.iit_hmac, addrs, ctr, sizeof(CL_Counter), out, INLINE_MAC_SIZE, m);
+                    for (int i = 0; verified && i < n; i++)
+                        verified = isZeroCounter(counter[i]) || memcmp(macs[i], stored[i], INLINE_MAC_SIZE) == 0;
+                }
+            }
+            else if (verified)
+            {
+                // HMAC校验,半页内没有缓存行被写过时还没有HMAC
+                // 读操作只涉及从未写过的行时不需要该半页的HMAC
+                bool half[2] = {false, false};
+                sdm_HMACPtr hmac[2], stored[2];
+                for (int i = 0; i < 2; i++)
+                {
+                    Addr lo = std::max(paddr, page + i * HALF_PAGE_SIZE);
+                    Addr hi = std::min(end, page + (i + 1) * HALF_PAGE_SIZE);
+                    if (lo >= hi || isUnwritten(paths[i * PAGE_LEAVES / 2].node[0], lo))
+                        continue;
+                    bool written = !skip_zero;
+                    for (Addr line = lo; !written && line < hi; line += CL_SIZE)
+                        written = !isZeroCounter(counter[(line - paddr) / CL_SIZE]);
+                    if (!written)
+                        continue;
+                    half[i] = true;
+                    if (metaRead(getHMACAddr(id, pageRva + (lo - page)), stored[i], HMAC_SIZE))
+                        ss.hmacHits++;
+                    else
+                    {
+                        ss.hmacMisses++;
+                        ss.extraBytes += CL_SIZE;
+                    }
+                    // HMAC覆盖整个半页,其余缓存行也要读取
+                    ss.extraBytes += HALF_PAGE_SIZE - (hi - lo);
+                    ss.cryptoOps[OP_HMAC]++;
+                }
+                // null后端的HMAC恒为0,不需要读取半页
+                if ((half[0] || half[1]) && crypto->functional())
+                {
+                    uint8_t pageData[PAGE_SIZE];
+                    for (int i = 0; i < 2; i++)
+                    {
+                        if (half[i])
+                            remoteMem->readBlob(page + i * HALF_PAGE_SIZE, pageData + i * HALF_PAGE_SIZE, HALF_PAGE_SIZE);
+                    }
+                    pageHMAC(sp, paths, page, half, pageData, hmac);
+                    for (int i = 0; i < 2; i++)
+                        verified &= !half[i] || memcmp(hmac[i], stored[i], HMAC_SIZE) == 0;
+                }
+            }
+            if (!verified)
+                ss.verifyFailures++;
+            return verified;
+        }
+        /**
+         * @author yqy
+         * @brief 查询paddr处的节点是否为脏节点
+         * @param node 不为空时返回脏节点的内容
+         */
+        bool sDMmanager::readDirty(Addr paddr, iit_Node *node)
+        {
+            auto it = dirtyNodes.find(paddr);
+            if (it == dirtyNodes.end())
+                return false;
+            if (node)
+                *node = it->second.node;
+            return true;
+        }
+        /**
+         * @author yqy
+         * @brief 写回模式下记录被修改的节点,远端内存中的副本和缓存中的干净副本都已过时
+         */
+        void sDMmanager::markDirty(sdm_space &sp, int level, uint64_t idx, const iit_Node &node)
+        {
+            Addr paddr = sp.nodeAddr(level, idx);
+            auto it = dirtyNodes.find(paddr);
+            if (it == dirtyNodes.end())
+            {
+                metaCache.invalidate(paddr);
+                it = dirtyNodes.emplace(paddr, DirtyNode{sp.id, level, idx, node, dirtyLRU.end()}).first;
+            }
+            else
+                dirtyLRU.erase(it->second.lru);
+            it->second.node = node;
+            it->second.lru = dirtyLRU.insert(dirtyLRU.end(), paddr);
+        }
+        /**
+         * @author yqy
+         * @brief 将一个脏节点传播到父节点:父计数器加1,用新的父计数器重算hash_tag后写回远端
+         * @attention 父节点因此变脏,root的修改直接生效
+         * @attention 该节点自上次写回以来的所有修改只使父计数器加1
+         */
+        void sDMmanager::flushNode(Addr paddr)
+        {
+            auto it = dirtyNodes.find(paddr);
+            assert(it != dirtyNodes.end());
+            DirtyNode d = it->second;
+            dirtyLRU.erase(d.lru);
+            dirtyNodes.erase(it);
+
+            sdm_space &sp = sdm_table[d.id];
+            int fl = d.level + 1;
+            uint64_t fidx = d.idx / IIT_MID_ARITY;
+            Addr keyPathAddr[MAX_HEIGHT];
+            iit_Node keyPathNode[MAX_HEIGHT];
+            iit_NodePtr father = &sp.root;
+            if (fl < sp.height)
+            {
+                // 父节点可能是脏节点、缓存中的节点,或需要从远端取回并校验
+                Addr rva = d.idx * (IIT_LEAF_ARITY * CL_SIZE);
+                for (int l = 0; l < d.level; l++)
+                    rva *= IIT_MID_ARITY;
+                panic_if(!verifyPath(d.id, rva, fl, keyPathAddr, keyPathNode, &sp.iit_hmac, false, true),
+                         "%s: iit verification failed before propagating node %#x\n", name(), paddr);
+                father = &keyPathNode[fl];
+            }
+            iit_Node old_father = *father;
+            bool OF;
+            father->asMid().incCounter(d.idx % IIT_MID_ARITY, OF);
+            if (OF)
+            {
+                getSpaceStats(d.id).midOverflows++;
+                retagChildren(sp, d.level, fidx, old_father, *father, d.idx);
+            }
+            CL_Counter f_cl;
+            father->asMid().getCounter_k(d.idx % IIT_MID_ARITY, f_cl);
+            d.node.update_hash_tag(d.level == 0 ? IIT_LEAF_TYPE : IIT_MID_TYPE, &sp.iit_hmac, paddr, f_cl);
+            getSpaceStats(d.id).cryptoOps[OP_HASH_TAG]++;
+            metaWrite(paddr, &d.node, IIT_NODE_SIZE);
+            // 写回后的节点是干净且可信的
+            metaCache.insert(paddr, (uint8_t *)&d.node);
+            flushTraffic.emplace_back(paddr, false);
+            stats.dirtyFlushes++;
+            if (fl < sp.height)
+                markDirty(sp, fl, fidx, *father);
+        }
+        /**
+         * @author yqy
+         * @brief 将所有脏节点传播到root,用于epoch结束和drain
+         * @attention 按地址顺序传播,同一空间中子节点先于父节点,父节点只需传播一次
+         */
+        void sDMmanager::flushAll()
+        {
+            while (!dirtyNodes.empty())
+                flushNode(dirtyNodes.begin()->first);
+        }
+        /**
+         * @author yqy
+         * @brief 取出上次调用以来传播脏节点产生的远端访问
+         */
+        void sDMmanager::takeFlushTraffic(std::vector<std::pair<Addr, bool>> &traffic)
+        {
+            traffic.insert(traffic.end(), flushTraffic.begin(), flushTraffic.end());
+            flushTraffic.clear();
+        }
+        /**
+         * @author yqy
+         * @brief 记录共享空间的iit和HMAC区域,写这些区域时需要通知其他主机
+         */
+        void sDMmanager::addSharedMeta(sdm_space &sp)
+        {
+            if (sharedMeta.contains(sp.iitBase) != sharedMeta.end())
                 return;
-            // 该地址在所属空间中的相对偏移
-            Addr rva;
-            int h;
-            Addr keyPathAddr[MAX_HEIGHT] = {0};
-            iit_Node keyPathNode[MAX_HEIGHT] = {0};
-            sdm_hashKey hash_key;
-            sdm_table[id].key_get(HASH_KEY_TYPE, hash_key);
-            bool verified = verify(paddr, id, &rva, h, keyPathAddr, keyPathNode, hash_key);
-            assert(verified && "verify failed before write");
+            sharedMeta.insert(RangeSize(sp.iitBase, getIITsize(sp.sDataSize)), sp.id);
+            sharedMeta.insert(RangeSize(sp.hmacBase, getMACsize(sp.sDataSize)), sp.id);
+        }
+        /**
+         * @author yqy
+         * @brief 写结束时将修改过的共享元数据和新的root发给共享组中的其他主机
+         * @attention 每个主机每个缓存行一条失效消息,另有一条root更新
+         */
+        void sDMmanager::publishShared()
+        {
+            for (auto &[id, lines] : touchedShared)
+            {
+                sdm_space &sp = sdm_table[id];
+                for (auto &[peer, pid] : sp.share->members)
+                {
+                    if (peer == this)
+                        continue;
+                    peer->coherenceUpdate(pid, lines, sp.root);
+                    // 功能性写不产生需要模拟时序的消息
+                    if (functional)
+                        continue;
+                    for (Addr line : lines)
+                        coherenceMsgs.push_back({peer, line, false});
+                    coherenceMsgs.push_back({peer, sp.iitBase, true});
+                    stats.invalsSent += lines.size();
+                }
+            }
+            touchedShared.clear();
+        }
+        /**
+         * @author yqy
+         * @brief 其他主机写了共享空间id:丢弃缓存中过时的元数据,更新root副本
+         * @attention 只有缓存中确有副本的缓存行之后需要重新取回
+         */
+        void sDMmanager::coherenceUpdate(sdmIDtype id, const std::set<Addr> &lines, const iit_Node &root)
+        {
+            sdm_table[id].root = root;
+            stats.rootUpdates++;
+            for (Addr line : lines)
+            {
+                stats.invalsReceived++;
+                if (metaCache.probe(line))
+                {
+                    metaCache.invalidate(line);
+                    staleLines.insert(line);
+                    stats.staleInvals++;
+                }
+            }
+        }
+        /**
+         * @author yqy
+         * @brief 元数据缓存缺失时调用,统计因失效而重新取回的缓存行
+         */
+        void sDMmanager::noteFetch(Addr lineAddr)
+        {
+            if (staleLines.erase(lineAddr))
+                stats.staleRefetches++;
+        }
+        /**
+         * @author yqy
+         * @brief 取出上次调用以来发往其他主机的失效消息
+         */
+        void sDMmanager::takeCoherenceMsgs(std::vector<CoherenceMsg> &msgs)
+        {
+            msgs.insert(msgs.end(), coherenceMsgs.begin(), coherenceMsgs.end());
+            coherenceMsgs.clear();
+        }
+        /**
+         * @author yqy
+         * @brief drain时传播所有脏节点,使远端内存中的iit完整
+         */
+        DrainState sDMmanager::drain()
+        {
+            flushAll();
+            flushTraffic.clear();
+            return DrainState::Drained;
+        }
+        /**
+         * @author yqy
+         * @brief 保存检查点:标量写入ini,其余状态写入一个压缩的二进制文件
+         * 每个空间:id,数据大小,密钥,iit/HMAC区域位置,各层节点数,root,数据页二元组
+         * 之后是元数据区的空闲表和按替换顺序排列的脏节点
+         * @attention iit节点和HMAC位于远端内存,随内存控制器的后备存储一起保存
+         * @attention drain时脏节点已经全部传播,这里仍然保存以保持状态完整
+         */
+        void sDMmanager::serialize(CheckpointOut &cp) const
+        {
+            uint64_t spaces = sdm_table.size() - 1;
+            SERIALIZE_SCALAR(sdm_space_cnt);
+            SERIALIZE_SCALAR(metaNext);
+            SERIALIZE_SCALAR(writesInEpoch);
+            SERIALIZE_SCALAR(spaces);
+            std::string filename = name() + ".sdm";
+            SERIALIZE_SCALAR(filename);
+
+            std::string filepath = CheckpointIn::dir() + "/" + filename;
+            gzFile blob = gzopen(filepath.c_str(), "wb");
+            fatal_if(blob == NULL, "%s: can't open sDM checkpoint file '%s'\n", name(), filename);
+            auto put = [&](const void *data, size_t len)
+            {
+                fatal_if(gzwrite(blob, data, len) != (int)len, "%s: write failed on sDM checkpoint file '%s'\n",
+                         name(), filename);
+            };
+            for (sdmIDtype id = 1; id <= spaces; id++)
+            {
+                const sdm_space &sp = sdm_table[id];
+                uint64_t n = sp.extents.size();
+                put(&sp.id, sizeof(sp.id));
+                put(&sp.sDataSize, sizeof(sp.sDataSize));
+                put(sp.iit_key, sizeof(sdm_hashKey));
+                put(sp.cme_key, sizeof(sdm_CMEKey));
+                put(&sp.iitBase, sizeof(sp.iitBase));
+                put(&sp.hmacBase, sizeof(sp.hmacBase));
+                put(&sp.height, sizeof(sp.height));
+                put(sp.levelStart, sizeof(sp.levelStart));
+                put(sp.levelCount, sizeof(sp.levelCount));
+                put(&sp.root, sizeof(iit_Node));
+                put(&n, sizeof(n));
+                put(sp.extents.data(), n * sizeof(sdm_pagePtrPair));
+            }
+            uint64_t n = metaFreeList.size();
+            put(&n, sizeof(n));
+            for (const auto &f : metaFreeList)
+            {
+                put(&f.first, sizeof(f.first));
+                put(&f.second, sizeof(f.second));
+            }
+            n = dirtyLRU.size();
+            put(&n, sizeof(n));
+            for (Addr paddr : dirtyLRU)
+            {
+                const DirtyNode &d = dirtyNodes.at(paddr);
+                put(&paddr, sizeof(paddr));
+                put(&d.id, sizeof(d.id));
+                put(&d.level, sizeof(d.level));
+                put(&d.idx, sizeof(d.idx));
+                put(&d.node, sizeof(iit_Node));
+            }
+            fatal_if(gzclose(blob), "%s: close failed on sDM checkpoint file '%s'\n", name(), filename);
+        }
+        /**
+         * @author yqy
+         * @brief 恢复检查点,init中按配置注册的空间被检查点中的状态替换
+         * @attention 轮密钥和地址映射由检查点中的密钥和数据页二元组重建,元数据缓存从空开始
+         */
+        void sDMmanager::unserialize(CheckpointIn &cp)
+        {
+            uint64_t spaces;
+            UNSERIALIZE_SCALAR(sdm_space_cnt);
+            UNSERIALIZE_SCALAR(metaNext);
+            UNSERIALIZE_SCALAR(writesInEpoch);
+            UNSERIALIZE_SCALAR(spaces);
+            std::string filename;
+            UNSERIALIZE_SCALAR(filename);
+
+            std::string filepath = cp.getCptDir() + "/" + filename;
+            gzFile blob = gzopen(filepath.c_str(), "rb");
+            fatal_if(blob == NULL, "%s: can't open sDM checkpoint file '%s'\n", name(), filename);
+            auto get = [&](void *data, size_t len)
+            {
+                fatal_if(gzread(blob, data, len) != (int)len, "%s: sDM checkpoint file '%s' is truncated\n",
+                         name(), filename);
+            };
+
+            sdm_table.resize(1);
+            sdm_paddr2id.clear();
+            lastHitRange = AddrRange();
+            lastHitId = 0;
+            metaFreeList.clear();
+            dirtyNodes.clear();
+            dirtyLRU.clear();
+            flushTraffic.clear();
+            // 共享组不保存在检查点中,由内存池在startup中重新建立
+            sharedMeta.clear();
+            touchedShared.clear();
+            staleLines.clear();
+            coherenceMsgs.clear();
+            metaCache.invalidateRange(metaRange.start(), metaRange.size());
+            for (sdmIDtype id = 1; id <= spaces; id++)
+            {
+                sdm_space sp = {};
+                uint64_t n;
+                get(&sp.id, sizeof(sp.id));
+                get(&sp.sDataSize, sizeof(sp.sDataSize));
+                get(sp.iit_key, sizeof(sdm_hashKey));
+                get(sp.cme_key, sizeof(sdm_CMEKey));
+                get(&sp.iitBase, sizeof(sp.iitBase));
+                get(&sp.hmacBase, sizeof(sp.hmacBase));
+                get(&sp.height, sizeof(sp.height));
+                get(sp.levelStart, sizeof(sp.levelStart));
+                get(sp.levelCount, sizeof(sp.levelCount));
+                get(&sp.root, sizeof(iit_Node));
+                get(&n, sizeof(n));
+                sp.extents.resize(n);
+                get(sp.extents.data(), n * sizeof(sdm_pagePtrPair));
+                fatal_if(sp.id != id, "%s: sDM checkpoint file '%s' is corrupted\n", name(), filename);
+                // 已释放的空间只保留表项
+                if (!sp.extents.empty())
+                {
+                    sp.extentIndex = sp.extents;
+                    std::sort(sp.extentIndex.begin(), sp.extentIndex.end(),
+                              [](const sdm_pagePtrPair &a, const sdm_pagePtrPair &b)
+                              { return a.curPageAddr < b.curPageAddr; });
+                    for (auto &pair : sp.extents)
+                        sdm_paddr2id.insert(RangeSize(pair.curPageAddr, (Addr)pair.cnum * PAGE_SIZE), sp.id);
+                    crypto->setCipherKey(&sp.cme_ctx, sp.cme_key);
+                    crypto->setMacKey(&sp.iit_hmac, sp.iit_key, sizeof(sdm_hashKey));
+                }
+                sdm_table.push_back(std::move(sp));
+            }
+            uint64_t n;
+            get(&n, sizeof(n));
+            for (uint64_t i = 0; i < n; i++)
+            {
+                Addr paddr;
+                sdm_size size;
+                get(&paddr, sizeof(paddr));
+                get(&size, sizeof(size));
+                metaFreeList[paddr] = size;
+            }
+            get(&n, sizeof(n));
+            for (uint64_t i = 0; i < n; i++)
+            {
+                Addr paddr;
+                DirtyNode d;
+                get(&paddr, sizeof(paddr));
+                get(&d.id, sizeof(d.id));
+                get(&d.level, sizeof(d.level));
+                get(&d.idx, sizeof(d.idx));
+                get(&d.node, sizeof(iit_Node));
+                d.lru = dirtyLRU.insert(dirtyLRU.end(), paddr);
+                dirtyNodes.emplace(paddr, d);
+            }
+            gzclose(blob);
+        }
+        /**
+         * @author yqy
+         * @brief 读取一页中从paddr开始的n个CL时进行校验并解密
+         * @param data 返回n个CL解密后的明文
+         * @return 是否通过校验
+         * @attention 校验失败时仍返回解密结果,由调用者决定立即报错还是在后台校验结束后报告完整性错误
+         */
+        bool sDMmanager::readLines(sdmIDtype id, Addr paddr, int n, uint8_t *data)
+        {
+            const Addr leafSpan = IIT_LEAF_ARITY * CL_SIZE;
+            Addr page = paddr & PAGE_ALIGN_MASK;
+            KeyPath paths[PAGE_LEAVES] = {};
+            bool verified = verify(id, paddr, n, paths, false, true);
+            SpaceStats &ss = getSpaceStats(id);
+            ss.dataBytes += n * CL_SIZE;
+            Addr rva = getVirtualOffset(id, paddr);
+            CL_Counter counter[PAGE_LINES];
+            int written = 0;
+            for (int i = 0; i < n; i++)
+            {
+                Addr line = paddr + (Addr)i * CL_SIZE;
+                getCounter(paths[(line - page) / leafSpan].node[0], rva + (Addr)i * CL_SIZE, counter[i]);
+                written += !isZeroCounter(counter[i]);
+            }
+            // 从未写过的缓存行读出全零,不读取密文
+            if (written == 0)
+            {
+                memset(data, 0, n * CL_SIZE);
+                return verified;
+            }
+            // OTP只依赖计数器与地址,计数器确定后即可生成,与取回密文重叠,密文到达后只需异或
+            // 所有行的OTP一次批量生成,再整体异或
+            uint8_t OTP[PAGE_SIZE];
+            ss.cryptoOps[OP_DECRYPT] += written;
+            CME::sDM_GenerateOTP((uint8_t *)counter, sizeof(CL_Counter), paddr, n, &sdm_table[id].cme_ctx, OTP);
+            remoteMem->readBlob(paddr, data, n * CL_SIZE);
+            CME::sDM_ApplyOTP(data, OTP, n);
+            for (int i = 0; i < n; i++)
+            {
+                if (isZeroCounter(counter[i]))
+                    memset(data + i * CL_SIZE, 0, CL_SIZE);
+            }
+            return verified;
+        }
+        /**
+         * @author yqy
+         * @brief 写入一页中从paddr开始的n个CL时进行校验,并加密、维护iit、计算hmac
+         * @param data 输入n个CL的明文,返回写入远端的密文
+         * @param reencrypted 追加叶节点溢出后重加密的半页物理地址
+         * @return 是否通过校验,未通过时不做任何修改
+         * @attention 每个叶节点只修改一次,每个半页的HMAC只计算一次,整页写入时使用页接口加密
+         */
+        bool sDMmanager::writeLines(sdmIDtype id, Addr paddr, int n, uint8_t *data, std::vector<Addr> &reencrypted)
+        {
+            sdm_space &sp = sdm_table[id];
+            const Addr leafSpan = IIT_LEAF_ARITY * CL_SIZE;
+            Addr page = paddr & PAGE_ALIGN_MASK;
+            Addr end = paddr + (Addr)n * CL_SIZE;
+            KeyPath paths[PAGE_LEAVES] = {};
+            // 写回模式下只修改叶节点,与读一样遇到可信节点即可结束校验
+            // 校验失败时不能在被篡改的内容上重新计算MAC和hash_tag
+            if (!verify(id, paddr, n, paths, !iitWriteBack))
+                return false;
+            SpaceStats &ss = getSpaceStats(id);
+            ss.dataBytes += n * CL_SIZE;
+            Addr pageRva = getVirtualOffset(id, page);
 
             // 写入数据
             // 假设写队列是安全的
             // 真正写入内存时才进行修改,读取写队列中的数据不需要校验
             // 在修改完成之前不允许读取
 
-            // 1. 需要对数据包进行加密
-            //  uint8_t* data = PacketPtr->getdataPtr<uint8_t*>;
-            CL_Counter cl;
-            uint32_t cur_k = rva / (IIT_LEAF_ARITY * CL_SIZE);
-            int node_type = IIT_LEAF_TYPE;
-            bool OF;
-            keyPathNode[0].inc_counter(node_type, cur_k, OF);
-            keyPathNode[0].get_hash_tag(node_type, hash_key, paddr);
-            cur_k /= IIT_MID_ARITY;
+            // 1. 写入的缓存行的计数器加1
+            // 每个叶节点只解码一次,计数器的修改与读取都在解码形式上进行
+            // 同一叶节点中后写的行溢出时可能改变先写的行的计数器,加密使用最终的计数器
+            iit_LeafNode::Decoded old_leaf[PAGE_LEAVES], leaf[PAGE_LEAVES];
+            bool leafOF[PAGE_LEAVES] = {false};
+            Addr firstLeaf = paddr & ~(leafSpan - 1);
+            for (Addr l = firstLeaf; l < end; l += leafSpan)
+            {
+                int j = (l - page) / leafSpan;
+                paths[j].node[0].asLeaf().decode(old_leaf[j]);
+                leaf[j] = old_leaf[j];
+                for (Addr line = std::max(l, paddr); line < std::min(l + leafSpan, end); line += CL_SIZE)
+                {
+                    bool OF;
+                    leaf[j].inc_counter((line - l) / CL_SIZE, OF);
+                    leafOF[j] |= OF;
+                }
+                paths[j].node[0].asLeaf().encode(leaf[j]);
+                if (leafOF[j])
+                    ss.leafOverflows++;
+            }
+            // 页中每行的新旧计数器,写入的行的旧计数器取新值
+            CL_Counter old_counter[PAGE_LINES], new_counter[PAGE_LINES];
+            for (Addr l = firstLeaf; l < end; l += leafSpan)
+            {
+                int j = (l - page) / leafSpan;
+                for (uint32_t k = 0; k < IIT_LEAF_ARITY; k++)
+                {
+                    Addr line = l + k * CL_SIZE;
+                    int i = (line - page) / CL_SIZE;
+                    leaf[j].getCounter_k(k, new_counter[i]);
+                    if (line >= paddr && line < end)
+                        memcpy(old_counter[i], new_counter[i], sizeof(CL_Counter));
+                    else
+                        old_leaf[j].getCounter_k(k, old_counter[i]);
+                }
+            }
 
-            sdm_CMEKey cme_key;
-            sdm_table[id].key_get(CME_KEY_TYPE, cme_key);
-            if (OF)
+            // 2. 加密写入的缓存行,整页一次加密
+            int first = (paddr - page) / CL_SIZE;
+            ss.cryptoOps[OP_ENCRYPT] += n;
+            if (n == PAGE_LINES)
+                CME::sDM_EncryptPage(data, (uint8_t *)new_counter, sizeof(CL_Counter), page, &sp.cme_ctx);
+            else
+                CME::sDM_EncryptLines(data, (uint8_t *)new_counter[first], sizeof(CL_Counter), paddr, n, &sp.cme_ctx);
+            remoteMem->writeBlob(paddr, data, n * CL_SIZE);
+
+            // 3. 溢出时计数器发生变化的其余缓存行需要重加密,只有写入或重加密的半页需要重新计算HMAC
+            // 打包格式溢出改变主计数器,叶节点覆盖的所有半页都要重加密;可变编码可能只重置了一组
+            // sideband布局下MAC只覆盖写入的行,只有重加密时才需要访问半页
+            const int halfLines = HALF_PAGE_SIZE / CL_SIZE;
+            bool reencrypt[2] = {false, false}, rehash[2] = {false, false};
+            for (int h = 0; h < 2; h++)
+            {
+                Addr half = page + h * HALF_PAGE_SIZE;
+                for (int i = h * halfLines; leafOF[h * PAGE_LEAVES / 2] && !reencrypt[h] && i < (h + 1) * halfLines; i++)
+                    reencrypt[h] = memcmp(old_counter[i], new_counter[i], sizeof(CL_Counter)) != 0;
+                rehash[h] = !sidebandMacs && (reencrypt[h] || (half < end && half + HALF_PAGE_SIZE > paddr));
+            }
+            uint8_t pageData[PAGE_SIZE];
+            for (int h = 0; h < 2; h++)
+            {
+                if (!reencrypt[h] && !rehash[h])
+                    continue;
+                Addr half = page + h * HALF_PAGE_SIZE;
+                // 重新计算HMAC需要半页中其余的缓存行
+                Addr lo = std::max(paddr, half), hi = std::min(end, half + HALF_PAGE_SIZE);
+                ss.extraBytes += HALF_PAGE_SIZE - (lo < hi ? hi - lo : 0);
+                // null后端只有重加密需要半页内容(写入从未写过的缓存行)
+                if (reencrypt[h] || crypto->functional())
+                    remoteMem->readBlob(half, pageData + h * HALF_PAGE_SIZE, HALF_PAGE_SIZE);
+                if (!reencrypt[h])
+                    continue;
+                reencrypted.push_back(half);
+                ss.reencryptions++;
+                ss.cryptoOps[OP_DECRYPT] += halfLines;
+                ss.cryptoOps[OP_ENCRYPT] += halfLines;
+            }
+            if (reencrypt[0] || reencrypt[1])
             {
                 // 引发重加密所在半页
-                // ...
+                // 溢出使半页内其余缓存行的计数器都发生变化
+                // 先用旧计数器批量解密,再用新计数器批量加密,两个半页都需要重加密时整页一次完成
+                // 刚写入的缓存行已经使用新计数器,解密时也使用新计数器
+                int lo = reencrypt[0] ? 0 : halfLines, hi = reencrypt[1] ? PAGE_LINES : halfLines;
+                uint8_t *buf = pageData + lo * CL_SIZE;
+                if (hi - lo == PAGE_LINES)
+                    CME::sDM_DecryptPage(buf, (uint8_t *)old_counter, sizeof(CL_Counter), page, &sp.cme_ctx);
+                else
+                    CME::sDM_EncryptLines(buf, (uint8_t *)old_counter[lo], sizeof(CL_Counter), page + lo * CL_SIZE, hi - lo,
+                                          &sp.cme_ctx);
+                // 从未写过的缓存行的计数器不再为0,写入全零明文的密文
+                for (int i = lo; i < hi; i++)
+                {
+                    if (isZeroCounter(old_counter[i]))
+                        memset(pageData + i * CL_SIZE, 0, CL_SIZE);
+                }
+                if (hi - lo == PAGE_LINES)
+                    CME::sDM_EncryptPage(buf, (uint8_t *)new_counter, sizeof(CL_Counter), page, &sp.cme_ctx);
+                else
+                    CME::sDM_EncryptLines(buf, (uint8_t *)new_counter[lo], sizeof(CL_Counter), page + lo * CL_SIZE, hi - lo,
+                                          &sp.cme_ctx);
+                remoteMem->writeBlob(page + lo * CL_SIZE, buf, (hi - lo) * CL_SIZE);
+                if (sidebandMacs)
+                {
+                    // 每个重加密的缓存行换用新计数器,边带中的MAC随新密文一起写回,一次批量计算
+                    uint8_t macs[PAGE_LINES][INLINE_MAC_SIZE];
+                    uint8_t *in[PAGE_LINES], *ctr[PAGE_LINES], *out[PAGE_LINES];
+                    Addr addrs[PAGE_LINES];
+                    for (int i = lo; i < hi; i++)
+                    {
+                        in[i - lo] = pageData + i * CL_SIZE;
+                        ctr[i - lo] = new_counter[i];
+                        out[i - lo] = macs[i - lo];
+                        addrs[i - lo] = page + i * CL_SIZE;
+                    }
+                    ss.cryptoOps[OP_HMAC] += hi - lo;
+                    ss.sidebandBytes += (hi - lo) * INLINE_MAC_SIZE;
+                    CME::sDM_HMAC_xN(in, CL_SIZE, &sp.iit_hmac, addrs, ctr, sizeof(CL_Counter), out, INLINE_MAC_SIZE, hi - lo);
+                    remoteMem->writeBlob(getHMACAddr(id, pageRva + lo * CL_SIZE), macs, (hi - lo) * INLINE_MAC_SIZE);
+                }
+            }
+            if (sidebandMacs)
+            {
+                // MAC只覆盖写入的行,不需要读取半页中其余的缓存行,所有行一次批量计算
+                // 重加密的半页包含写入的行时,其MAC已经随重加密写回
+                uint8_t macs[PAGE_LINES][INLINE_MAC_SIZE];
+                uint8_t *in[PAGE_LINES], *ctr[PAGE_LINES], *out[PAGE_LINES];
+                Addr addrs[PAGE_LINES];
+                for (int i = 0; i < n; i++)
+                {
+                    in[i] = data + i * CL_SIZE;
+                    ctr[i] = new_counter[first + i];
+                    out[i] = macs[i];
+                    addrs[i] = paddr + (Addr)i * CL_SIZE;
+                }
+                ss.cryptoOps[OP_HMAC] += n;
+                ss.sidebandBytes += n * INLINE_MAC_SIZE;
+                CME::sDM_HMAC_xN(in, CL_SIZE, &sp.iit_hmac, addrs, ctr, sizeof(CL_Counter), out, INLINE_MAC_SIZE, n);
+                remoteMem->writeBlob(getHMACAddr(id, pageRva + (paddr - page)), macs, n * INLINE_MAC_SIZE);
+            }
+            else if (rehash[0] || rehash[1])
+            {
+                // 4. 重新计算HMAC并写入,两个半页一次计算
+                sdm_HMACPtr hmac[2];
+                ss.cryptoOps[OP_HMAC] += rehash[0] + rehash[1];
+                pageHMAC(sp, paths, page, rehash, pageData, hmac);
+                for (int h = 0; h < 2; h++)
+                {
+                    if (rehash[h])
+                        metaWrite(getHMACAddr(id, pageRva + h * HALF_PAGE_SIZE), hmac[h], HMAC_SIZE);
+                }
             }
-            // 加密该缓存行
-            // CME::sDM_Encrypt(data, counter, paddr, cl, cme_key);
-            // 2. 重新计算HMAC并写入
-            // CME::sDM_HMAC(data, CL_SIZE, hash_key, paddr, cl,cme_key);
 
-            // 3. 修改iit tree
-            for (int i = 1; i < h; i++)
+            // 5. 修改iit tree,叶节点依次沿关键路径更新
+            int updated = 0;
+            for (Addr l = firstLeaf; l < end; l += leafSpan)
+            {
+                int j = (l - page) / leafSpan;
+                // 同一页的叶节点共享上层节点,使用前一个叶节点更新后的副本
+                for (int i = 1; j > 0 && i <= updated; i++)
+                {
+                    if (paths[j].addr[i] == paths[j - 1].addr[i])
+                        paths[j].node[i] = paths[j - 1].node[i];
+                }
+                updated = updatePath(sp, pageRva + (l - page), paths[j]);
+            }
+            return true;
+        }
+        /**
+         * @author yqy
+         * @brief 叶节点修改后沿关键路径维护iit
+         * @param rva 叶节点覆盖的第一个缓存行的相对偏移
+         * @param path 叶节点及其已校验的关键路径,叶节点已经修改
+         * @return path中被修改的最高一层
+         * @attention 写回模式下只记录脏叶节点,否则父节点(含本地root)中对应的计数器加1并重算整条路径的hash_tag
+         * @attention 功能性写不产生脏节点:写回模式下写直达到关键路径上第一个脏节点为止,只修改它的本地副本,
+         * 不改变脏节点的替换顺序,其上的节点在它传播时更新
+         */
+        int sDMmanager::updatePath(sdm_space &sp, Addr rva, KeyPath &path)
+        {
+            SpaceStats &ss = getSpaceStats(sp.id);
+            int h = sp.height;
+            if (iitWriteBack && !functional)
+            {
+                // 叶节点留在本地,同一叶节点上的连续写只在其被替换或epoch结束时传播一次
+                if (readDirty(path.addr[0], nullptr))
+                    stats.coalescedWrites++;
+                markDirty(sp, 0, rva / (IIT_LEAF_ARITY * CL_SIZE), path.node[0]);
+                while (dirtyNodes.size() > maxDirtyNodes)
+                    flushNode(dirtyLRU.front());
+                if (epochWrites && ++writesInEpoch >= epochWrites)
+                {
+                    writesInEpoch = 0;
+                    stats.epochFlushes++;
+                    flushAll();
+                }
+                return 0;
+            }
+            int top = h;
+            for (int i = 0; iitWriteBack && i < h; i++)
+            {
+                if (readDirty(path.addr[i], nullptr))
+                {
+                    top = i;
+                    break;
+                }
+            }
+            // 父节点(含本地root)中对应的计数器加1
+            bool OF;
+            uint64_t idx = rva / (IIT_LEAF_ARITY * CL_SIZE);
+            for (int i = 1; i <= top; i++)
+            {
+                iit_NodePtr node = (i < h) ? &path.node[i] : &sp.root;
+                iit_Node old_node = *node;
+                node->asMid().incCounter(idx % IIT_MID_ARITY, OF);
+                if (OF)
+                {
+                    ss.midOverflows++;
+                    retagChildren(sp, i - 1, idx / IIT_MID_ARITY, old_node, *node, idx);
+                }
+                idx /= IIT_MID_ARITY;
+            }
+            // 自底向上使用新的父计数器重新计算hash_tag并写回,整条路径一次批量计算
+            idx = rva / (IIT_LEAF_ARITY * CL_SIZE);
+            int types[MAX_HEIGHT];
+            CL_Counter f_cl[MAX_HEIGHT];
+            iit_NodePtr nodes[MAX_HEIGHT];
+            uint8_t *f_ptr[MAX_HEIGHT];
+            iit_hash_tag tags[MAX_HEIGHT];
+            for (int i = 0; i < top; i++)
+            {
+                iit_NodePtr father = (i + 1 < h) ? &path.node[i + 1] : &sp.root;
+                father->asMid().getCounter_k(idx % IIT_MID_ARITY, f_cl[i]);
+                types[i] = i == 0 ? IIT_LEAF_TYPE : IIT_MID_TYPE;
+                nodes[i] = &path.node[i];
+                f_ptr[i] = f_cl[i];
+                idx /= IIT_MID_ARITY;
+            }
+            ss.cryptoOps[OP_HASH_TAG] += top;
+            iit_Node::get_hash_tags(top, nodes, types, &sp.iit_hmac, path.addr, f_ptr, tags);
+            for (int i = 0; i < top; i++)
+            {
+                path.node[i].embed_hash_tag(types[i], tags[i]);
+                // 写回所有数据
+                metaWrite(path.addr[i], &path.node[i], IIT_NODE_SIZE);
+            }
+            // 脏节点的hash_tag在传播时重新计算
+            if (top < h)
+            {
+                dirtyNodes.at(path.addr[top]).node = path.node[top];
+                return top;
+            }
+            return h - 1;
+        }
+        /**
+         * @author yqy
+         * @brief 读取Packet覆盖的sdm缓存行:校验并将Packet中的密文解密为明文
+         * @attention 需要在内存控制器将密文读入Packet之后调用
+         * @attention 同一页中的缓存行一次校验和解密
+         * @return 是否通过校验
+         */
+        bool sDMmanager::read(PacketPtr pkt)
+        {
+            Addr start = pkt->getAddr();
+            Addr end = start + pkt->getSize();
+            uint8_t *data = pkt->getPtr<uint8_t>();
+            uint8_t buf[PAGE_SIZE];
+            bool verified = true;
+            for (Addr lo = start & CL_ALIGN_MASK; lo < end; lo = (lo & PAGE_ALIGN_MASK) + PAGE_SIZE)
+            {
+                sdmIDtype id = isContained(lo);
+                if (id == 0) // 该物理地址不包含在任何sdm中,无需对数据包做修改
+                    continue;
+                Addr hi = std::min((lo & PAGE_ALIGN_MASK) + PAGE_SIZE, end);
+                verified &= readLines(id, lo, ceil(hi - lo, CL_SIZE), buf);
+                Addr from = std::max(lo, start);
+                memcpy(data + (from - start), buf + (from - lo), hi - from);
+            }
+            return verified;
+        }
+        /**
+         * @author yqy
+         * @brief 写入Packet覆盖的sdm缓存行:加密、维护iit、计算hmac
+         * @attention 需要在内存控制器将Packet写入内存之前调用,调用后Packet中的数据被替换为密文
+         * @attention 部分写需要先解密原缓存行再合并,同一页中的缓存行一次加密并维护iit
+         * @param overflows 不为空时记录副计数器溢出并已重加密的半页物理地址,供内存控制器模拟后台重加密的访存
+         * @return 是否通过校验
+         * @attention 校验失败时该页及其后的缓存行都不写入,Packet中的数据不能再写入内存
+         */
+        bool sDMmanager::write(PacketPtr pkt, std::vector<Addr> *overflows)
+        {
+            Addr start = pkt->getAddr();
+            Addr end = start + pkt->getSize();
+            Addr first = start & CL_ALIGN_MASK;
+            std::vector<uint8_t> buf(ceil(end - first, CL_SIZE) * CL_SIZE);
+            std::vector<Addr> reencrypted;
+            // 解密原有缓存行,合并写入的数据,同一页中连续的部分写的缓存行一次读取
+            // 原缓存行未通过校验时不能与被篡改的明文合并,整个写操作被拒绝
+            auto partial = [&](Addr line) {
+                return line < start || line + CL_SIZE > end || pkt->isMaskedWrite();
+            };
+            for (Addr line = first; line < end;)
+            {
+                sdmIDtype id = isContained(line);
+                if (id == 0 || !partial(line))
+                {
+                    line += CL_SIZE;
+                    continue;
+                }
+                Addr run = line;
+                for (line += CL_SIZE; line < end && line % PAGE_SIZE && partial(line); line += CL_SIZE)
+                    ;
+                if (!readLines(id, run, (line - run) / CL_SIZE, buf.data() + (run - first)))
+                    return false;
+            }
+            pkt->writeData(buf.data() + (start - first));
+            bool verified = true;
+            for (Addr lo = first; verified && lo < end; lo = (lo & PAGE_ALIGN_MASK) + PAGE_SIZE)
+            {
+                sdmIDtype id = isContained(lo);
+                if (id == 0) // 无需修改任何数据包
+                    continue;
+                Addr hi = std::min((lo & PAGE_ALIGN_MASK) + PAGE_SIZE, end);
+                verified = writeLines(id, lo, ceil(hi - lo, CL_SIZE), buf.data() + (lo - first), reencrypted);
+            }
+            if (overflows)
+                overflows->insert(overflows->end(), reencrypted.begin(), reencrypted.end());
+            // 后写的缓存行溢出时可能重加密了先写的缓存行,从远端取回它们最终的密文
+            for (Addr line = first; !reencrypted.empty() && line < end; line += CL_SIZE)
+            {
+                if (isContained(line))
+                    remoteMem->readBlob(line, buf.data() + (line - first), CL_SIZE);
+            }
+            // 将Packet中的明文替换为密文
+            if (verified)
+                memcpy(pkt->getPtr<uint8_t>(), buf.data() + (start - first), pkt->getSize());
+            publishShared();
+            return verified;
+        }
+        /**
+         * @author yqy
+         * @brief 功能性读(调试器读取、检查点等):与read相同地校验并解密,但不影响之后的时序和统计
+         * @attention 不查询、不填充元数据缓存,不更新统计
+         */
+        bool sDMmanager::functionalRead(PacketPtr pkt)
+        {
+            functional = true;
+            bool verified = read(pkt);
+            functional = false;
+            return verified;
+        }
+        /**
+         * @author yqy
+         * @brief 功能性写(加载程序等):与write相同地加密并维护iit和HMAC,但不影响之后的时序和统计
+         * @attention 不查询、不填充元数据缓存,不更新统计,不产生脏节点、传播流量和一致性消息
+         * @attention 溢出的半页同样立即重加密,只是不记录供内存控制器模拟的访存
+         */
+        bool sDMmanager::functionalWrite(PacketPtr pkt)
+        {
+            functional = true;
+            bool verified = write(pkt);
+            functional = false;
+            return verified;
+        }
+        sDMmanager::sDMStats::sDMStats(sDMmanager &m)
+            : statistics::Group(&m),
+              ADD_STAT(metaCacheHits, statistics::units::Count::get(),
+                       "Number of IIT node and HMAC accesses hitting the metadata cache"),
+              ADD_STAT(metaCacheMisses, statistics::units::Count::get(),
+                       "Number of IIT node and HMAC accesses missing the metadata cache"),
+              ADD_STAT(earlyStops, statistics::units::Count::get(),
+                       "Number of key path walks ended early by a cached node"),
+              ADD_STAT(implicitNodes, statistics::units::Count::get(),
+                       "Number of never written IIT nodes taken as all-zero without a fetch"),
+              ADD_STAT(coalescedWrites, statistics::units::Count::get(),
+                       "Number of writes to a leaf already dirty in write-back mode"),
+              ADD_STAT(dirtyFlushes, statistics::units::Count::get(),
+                       "Number of dirty IIT nodes propagated to their parent"),
+              ADD_STAT(epochFlushes, statistics::units::Count::get(),
+                       "Number of epochs ended by propagating every dirty IIT node"),
+              ADD_STAT(invalsSent, statistics::units::Count::get(),
+                       "Number of IIT node and HMAC line invalidations sent to the other hosts of shared spaces"),
+              ADD_STAT(invalsReceived, statistics::units::Count::get(),
+                       "Number of invalidations received from the other hosts of shared spaces"),
+              ADD_STAT(staleInvals, statistics::units::Count::get(),
+                       "Number of invalidations dropping a line from the metadata cache"),
+              ADD_STAT(staleRefetches, statistics::units::Count::get(),
+                       "Number of invalidated lines fetched again from remote memory"),
+              ADD_STAT(rootUpdates, statistics::units::Count::get(),
+                       "Number of root updates received from the other hosts of shared spaces")
+        {
+        }
+        sDMmanager::SpaceStats::SpaceStats(statistics::Group *parent, const std::string &name)
+            : statistics::Group(parent, name.c_str()),
+              ADD_STAT(verifies, statistics::units::Count::get(),
+                       "Number of data verifications, one per run of lines within a page"),
+              ADD_STAT(verifyFailures, statistics::units::Count::get(),
+                       "Number of data verifications that failed"),
+              ADD_STAT(zeroReads, statistics::units::Count::get(),
+                       "Number of reads of never written lines served without fetching their data and HMAC"),
+              ADD_STAT(pathLength, statistics::units::Count::get(),
+                       "IIT nodes walked per key path verification"),
+              ADD_STAT(levelHits, statistics::units::Count::get(),
+                       "IIT nodes found in the metadata cache or dirty, per level"),
+              ADD_STAT(levelMisses, statistics::units::Count::get(),
+                       "IIT nodes fetched from remote memory, per level"),
+              ADD_STAT(hmacHits, statistics::units::Count::get(),
+                       "Number of HMAC line accesses hitting the metadata cache"),
+              ADD_STAT(hmacMisses, statistics::units::Count::get(),
+                       "Number of HMAC lines fetched from remote memory"),
+              ADD_STAT(leafOverflows, statistics::units::Count::get(),
+                       "Number of leaf minor counter overflows"),
+              ADD_STAT(midOverflows, statistics::units::Count::get(),
+                       "Number of intermediate node and root minor counter overflows"),
+              ADD_STAT(reencryptions, statistics::units::Count::get(),
+                       "Number of half pages re-encrypted after a leaf overflow"),
+              ADD_STAT(cryptoOps, statistics::units::Count::get(),
+                       "Number of crypto operations by type"),
+              ADD_STAT(dataBytes, statistics::units::Byte::get(),
+                       "Number of data bytes read or written"),
+              ADD_STAT(extraBytes, statistics::units::Byte::get(),
+                       "Number of remote bytes read to verify and maintain metadata"),
+              ADD_STAT(sidebandBytes, statistics::units::Byte::get(),
+                       "Number of line MAC bytes carried in the side band of data bursts"),
+              ADD_STAT(extraBytesPerByte, statistics::units::Ratio::get(),
+                       "Extra remote bytes read per data byte",
+                       extraBytes / dataBytes)
+        {
+            pathLength.init(0, MAX_HEIGHT, 1);
+            levelHits.init(MAX_HEIGHT);
+            levelMisses.init(MAX_HEIGHT);
+            for (int l = 0; l < MAX_HEIGHT; l++)
             {
-                keyPathNode[i].inc_counter(node_type, cur_k, OF);
-                keyPathNode[i].get_hash_tag(node_type, hash_key, paddr);
-                cur_k /= IIT_MID_ARITY;
+                levelHits.subname(l, "level" + std::to_string(l));
+                levelMisses.subname(l, "level" + std::to_string(l));
             }
-            // 写回所有数据
+            cryptoOps.init(NUM_CRYPTO_OPS);
+            cryptoOps.subname(OP_ENCRYPT, "encrypt");
+            cryptoOps.subname(OP_DECRYPT, "decrypt");
+            cryptoOps.subname(OP_HMAC, "hmac");
+            cryptoOps.subname(OP_HASH_TAG, "hashTag");
+            extraBytesPerByte.precision(4);
         }
     }
 }
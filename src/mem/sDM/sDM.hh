@@ -15,17 +15,36 @@
 #ifndef _SDM_HH_
 #define _SDM_HH_
 
+#include "base/addr_range.hh"
+#include "base/addr_range_map.hh"
+#include "base/statistics.hh"
+#include "mem/packet.hh"
+#include "mem/port_proxy.hh"
+#include "params/SDMManager.hh"
+#include "sim/serialize.hh"
+#include "sim/sim_object.hh"
+
 #include "sDM_def.hh"
 #include "./IIT/IIT.hh"
 #include "CME/CME.hh"
+#include "MetaCache/MetaCache.hh"
 
-#include <unordered_map>
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #define MAX_HEIGHT 5 // 32G
+#define PAGE_LINES (PAGE_SIZE / CL_SIZE)                      // 一页的缓存行数
+#define PAGE_LEAVES (PAGE_SIZE / (IIT_LEAF_ARITY * CL_SIZE)) // 一页的叶节点数,叶节点覆盖半页或一页
 /**
  * 约定
  * 1.远端内存的分配的粒度是页面(4K),传输粒度也应为4K以上
@@ -43,8 +62,8 @@ namespace gem5
         typedef uint64_t sdmIDtype;                // sdm空间编号类型 u64
         typedef uint64_t sdm_size;                 // sdm保护的数据的大小
         typedef uint8_t *sdm_dataPtr;              // 数据区指针
-        typedef uint8_t sdm_hashKey[SM4_KEY_SIZE]; // sdm空间密钥
-        typedef uint8_t sdm_CMEKey[SM3_KEY_SIZE];  // sdm hash密钥
+        typedef uint8_t sdm_hashKey[SM3_KEY_SIZE]; // sdm hash密钥(sm3 hmac)
+        typedef uint8_t sdm_CMEKey[SM4_KEY_SIZE];  // sdm空间内存加密密钥(sm4)
         typedef uint8_t sdm_HMACPtr[HMAC_SIZE];    // 一个SM3 HASH 256bit
         typedef uint8_t CL[CL_SIZE];
         uint64_t ceil(uint64_t a, uint64_t b);
@@ -83,19 +102,19 @@ namespace gem5
              * @author yqy
              * @brief 返回本页存储的数据页面指针集的最大地址范围
              * @brief 用于查找地址所在页的物理地址
-             * @param 本页首地址
-             * @attention 需要接入Packet
+             * @return 本页所有有效二元组覆盖的最大物理地址,没有有效二元组时返回0
+             * @attention cnum为0的二元组无效
              */
-            Addr getMaxBound(Addr paddr)
+            Addr getMaxBound() const
             {
-                // 构造Packet访问 pair[PAGE_SIZE / PAIR_SIZE - 1 - 1]
-                // addr: paddr + (PAGE_SIZE / PAIR_SIZE - 1 - 1) * PAIR_SIZE;
-                // 构造packet并访问
-                // ...
-                // 假设得到的结果存储在rbound中
-                sdm_pagePtrPair rbound;
-                Addr p = rbound.curPageAddr + (rbound.cnum * PAGE_SIZE) - 1;
-                return p;
+                Addr bound = 0;
+                for (const auto &rbound : pair)
+                {
+                    if (rbound.cnum == 0)
+                        continue;
+                    bound = std::max(bound, rbound.curPageAddr + ((Addr)rbound.cnum * PAGE_SIZE) - 1);
+                }
+                return bound;
             }
         } sdm_dataPagePtrPage;
         typedef sdm_dataPagePtrPage *sdm_dataPagePtrPagePtr;
@@ -132,6 +151,37 @@ namespace gem5
         } sdm_iitNodePagePtrPage;
         typedef sdm_iitNodePagePtrPage *sdm_iitNodePagePtrPagePtr;
 
+        /**
+         * @author yqy
+         * @brief 一次访问涉及的一个叶节点及其关键路径,自底向上存放
+         */
+        struct KeyPath
+        {
+            Addr addr[MAX_HEIGHT];     // 节点的远端物理地址
+            iit_Node node[MAX_HEIGHT]; // 已校验的节点
+        };
+
+        class sDMmanager;
+        /**
+         * @author yqy
+         * @brief 映射同一sdm空间的所有sDMmanager及其中该空间的本地id
+         * @attention members[0]为注册该空间的home,iit和HMAC区域由它分配和归还
+         */
+        struct ShareGroup
+        {
+            std::vector<std::pair<sDMmanager *, sdmIDtype>> members;
+        };
+        /**
+         * @author yqy
+         * @brief 共享空间的一条失效消息:peer缓存中的line失效,root为真时是peer的root副本更新
+         */
+        struct CoherenceMsg
+        {
+            sDMmanager *peer;
+            Addr line;
+            bool root;
+        };
+
         /**
          * 单个sdm的metadata结构如下
          * |metadata|
@@ -149,6 +199,24 @@ namespace gem5
             // iit_root Root;                        // 当前空间树Root
             sdm_hashKey iit_key; // 当前空间完整性树密钥
             sdm_CMEKey cme_key;  // 当前空间内存加密密钥
+            CME::CipherKey cme_ctx; // 由cme_key扩展的轮密钥
+            CME::MacKey iit_hmac;   // 由iit_key预处理的MAC密钥(sm3为预先压缩的hmac内外层中间状态)
+            Addr iitBase;        // 完整性树在远端内存的起始物理地址
+            Addr hmacBase;       // HMAC在远端内存的起始物理地址
+            int height;          // 远端存放的iit层数(不含root),即关键路径长度
+            uint64_t levelStart[MAX_HEIGHT]; // 每层第一个节点在iit区域中的节点序号,第0层为叶节点
+            uint64_t levelCount[MAX_HEIGHT]; // 每层节点数
+            iit_Node root;       // root保存在本地可信存储中,不需要hash_tag
+            std::vector<sdm_pagePtrPair> extents; // 数据页指针二元组<起始地址,之前页数,连续页数>,按虚拟偏移排序
+            std::vector<sdm_pagePtrPair> extentIndex; // 同一组二元组按物理地址排序,用于二分查找虚拟偏移
+            std::shared_ptr<ShareGroup> share;       // 被多个主机共享时所在的共享组,私有空间为空
+            /**
+             * @brief 返回第level层第idx个节点的远端物理地址
+             */
+            Addr nodeAddr(int level, uint64_t idx)
+            {
+                return iitBase + (levelStart[level] + idx) * IIT_NODE_SIZE;
+            }
             /**
              * @brief 返回解密的密钥
              * @param key_type 需要返回的密钥标识:HASH_KEY_TYPE,CME_KEY_TYPE
@@ -199,8 +267,10 @@ namespace gem5
 
         /**
          * sDMmanager管理所有sdm相关操作，是sdm的硬件抽象
+         * 数据、iit节点和HMAC都存放在远端内存中,通过内存控制器提供的remoteMem访问
+         * 远端内存中只保存密文,明文只出现在Packet中
          */
-        class sDMmanager
+        class sDMmanager : public SimObject
         {
         private:
             // 数据页页指针集指针
@@ -209,18 +279,171 @@ namespace gem5
             sdmIDtype sdm_space_cnt;                         // 全局单增,2^64永远不会耗尽, start from 1
             int sdm_pool_id;                                 // 可用本地内存池(内存段)编号
             std::vector<sdm_space> sdm_table;                // id->sdm
-            std::unordered_map<Addr, uint64_t> sdm_paddr2id; // paddr -> id
+            AddrRangeMap<sdmIDtype> sdm_paddr2id;            // 数据页物理地址范围 -> id,每个物理连续段一项
+            AddrRange lastHitRange;                          // isContained上次命中的物理连续段
+            sdmIDtype lastHitId;                             // lastHitRange所属sdm的id
+            PortProxy *remoteMem;                            // 远端内存功能性访问接口
+            AddrRange metaRange;                             // 远端内存中用于存放iit和HMAC的区域
+            Addr metaNext;                                   // 元数据区下一个可分配的地址
+            std::map<Addr, sdm_size> metaFreeList;           // 已释放的元数据区<起始地址,字节数>,相邻的区域合并
+            MetaCache metaCache;                             // 本地元数据缓存,缓存已校验的iit节点和HMAC
+            const CME::CryptoBackend *crypto;                // CME和IIT使用的密码算法后端
+
+            /**
+             * 写回模式下已修改但尚未传播到父节点的iit节点
+             * 与root一样位于本地可信存储,远端内存中的副本已经过时
+             */
+            struct DirtyNode
+            {
+                sdmIDtype id;
+                int level;
+                uint64_t idx;
+                iit_Node node;
+                std::list<Addr>::iterator lru;
+            };
+            bool sidebandMacs;                    // sideband布局:每个缓存行一个截断MAC,随数据突发在ECC边带中传输,不经过元数据缓存
+            bool iitWriteBack;                    // 写回模式:写只修改叶节点,父计数器和hash_tag在替换或epoch结束时才传播
+            unsigned maxDirtyNodes;               // 脏节点的最大个数
+            unsigned epochWrites;                 // 每隔多少次写传播所有脏节点,0表示只在替换时传播
+            unsigned writesInEpoch;               // 本epoch内的写次数
+            std::map<Addr, DirtyNode> dirtyNodes; // 节点物理地址 -> 脏节点,同一空间中低层节点地址较小
+            std::list<Addr> dirtyLRU;             // 脏节点的替换顺序,最近修改的在尾部
+            std::vector<std::pair<Addr, bool>> flushTraffic; // 传播脏节点产生的远端访问<地址,是否为读>,供内存控制器模拟时序
+            bool functional; // 正在进行功能性访问:不使用元数据缓存,不更新统计,不产生脏节点和需要模拟时序的访存
+
+            /**
+             * 共享空间的一致性:写操作修改的iit节点和HMAC缓存行在写结束时使其他主机缓存中的副本失效,
+             * 同时更新它们本地的root副本
+             */
+            AddrRangeMap<sdmIDtype> sharedMeta;                 // 共享空间的iit和HMAC区域 -> 本地id
+            std::map<sdmIDtype, std::set<Addr>> touchedShared;  // 本次写修改的共享元数据缓存行,按空间记录
+            std::unordered_set<Addr> staleLines;                // 被其他主机的写失效、尚未重新取回的缓存行
+            std::vector<CoherenceMsg> coherenceMsgs;            // 发往其他主机的失效消息,供内存池模拟时序
+
+            struct sDMStats : public statistics::Group
+            {
+                sDMStats(sDMmanager &m);
+
+                statistics::Scalar metaCacheHits;   // 元数据缓存命中次数
+                statistics::Scalar metaCacheMisses; // 元数据缓存缺失次数
+                statistics::Scalar earlyStops;      // 因命中已校验节点而提前结束的关键路径校验次数
+                statistics::Scalar implicitNodes;   // 父计数器为0而无需取回的隐式全零节点数
+                statistics::Scalar coalescedWrites; // 写回模式下命中已修改叶节点而无需传播的写次数
+                statistics::Scalar dirtyFlushes;    // 写回模式下传播到父节点的脏节点数
+                statistics::Scalar epochFlushes;    // 写回模式下epoch结束时传播所有脏节点的次数
+                statistics::Scalar invalsSent;      // 发往共享空间其他主机的失效消息数
+                statistics::Scalar invalsReceived;  // 收到的失效消息数
+                statistics::Scalar staleInvals;     // 收到时缓存中确有副本的失效消息数
+                statistics::Scalar staleRefetches;  // 被失效后重新从远端取回的缓存行数
+                statistics::Scalar rootUpdates;     // 其他主机的写带来的root更新次数
+            } stats;
+
+            /**
+             * 每个sdm空间的统计,配置中的范围在init中依次注册为space1, space2, ...
+             * 运行时注册的空间(包括释放后重新注册的)共用dynamicSpaces
+             */
+            struct SpaceStats : public statistics::Group
+            {
+                SpaceStats(statistics::Group *parent, const std::string &name);
+
+                statistics::Scalar verifies;           // 数据的校验次数,同一页中的连续缓存行校验一次
+                statistics::Scalar verifyFailures;     // 未通过的校验次数
+                statistics::Scalar zeroReads;          // 计数器为0、不需要取回密文和HMAC的读
+                statistics::Distribution pathLength;   // 每次关键路径校验取回并校验的节点数
+                statistics::Vector levelHits;          // 各层关键路径节点命中元数据缓存或脏节点的次数
+                statistics::Vector levelMisses;        // 各层从远端取回的节点数
+                statistics::Scalar hmacHits;           // HMAC缓存行命中元数据缓存的次数
+                statistics::Scalar hmacMisses;         // HMAC缓存行从远端取回的次数
+                statistics::Scalar leafOverflows;      // 叶节点副计数器溢出次数
+                statistics::Scalar midOverflows;       // 中间节点和root副计数器溢出次数
+                statistics::Scalar reencryptions;      // 因叶节点溢出而重加密的半页数
+                statistics::Vector cryptoOps;          // 按类型统计的密码运算次数
+                statistics::Scalar dataBytes;          // 读写的数据字节数
+                statistics::Scalar extraBytes;         // 为校验和维护元数据额外读取的远端字节数
+                statistics::Scalar sidebandBytes;      // sideband布局下随数据突发传输的MAC字节数
+                statistics::Formula extraBytesPerByte; // 每个数据字节带来的额外读取字节数
+            };
+            std::vector<std::unique_ptr<SpaceStats>> spaceStats;
+            std::unique_ptr<SpaceStats> functionalStats; // 功能性访问的统计,不属于任何统计组,不输出
+            SpaceStats &getSpaceStats(sdmIDtype id);
+            /**
+             * cryptoOps的下标
+             */
+            enum CryptoOp
+            {
+                OP_ENCRYPT, // 缓存行加密
+                OP_DECRYPT, // 缓存行解密
+                OP_HMAC,    // 半页HMAC或缓存行MAC
+                OP_HASH_TAG, // iit节点hash_tag
+                NUM_CRYPTO_OPS
+            };
+
+            Addr metaAlloc(sdm_size size);
+            void metaFree(Addr paddr, sdm_size size);
+            void deriveKey(sdmIDtype id, int key_type, uint8_t *key, int keyLen);
+            void getCounter(iit_Node &leaf, Addr rva, CL_Counter counter);
+            static bool isZeroCounter(const CL_Counter counter);
+            static void halfPageSum(iit_Node &leaf, Addr halfPageAddr, CL_Counter sum);
+            static bool isUnwritten(iit_Node &leaf, Addr halfPageAddr);
+            void pageHMAC(sdm_space &sp, KeyPath *paths, Addr page, const bool half[2], uint8_t *pageData, sdm_HMACPtr hmac[2]);
+            void lineMAC(sdm_space &sp, Addr paddr, uint8_t *cl, CL_Counter counter, uint8_t *mac);
+            sdm_size getMACsize(sdm_size data_size) const;
+            void retagChildren(sdm_space &sp, int level, uint64_t fidx, iit_Node &old_father, iit_Node &father, uint64_t skip);
+            bool metaRead(Addr paddr, void *data, int size);
+            void metaWrite(Addr paddr, const void *data, int size);
+            bool readLines(sdmIDtype id, Addr paddr, int n, uint8_t *data);
+            bool writeLines(sdmIDtype id, Addr paddr, int n, uint8_t *data, std::vector<Addr> &reencrypted);
+            int updatePath(sdm_space &sp, Addr rva, KeyPath &path);
+            bool registerExtents(std::vector<sdm_pagePtrPair> &extents);
+            bool verifyPath(sdmIDtype id, Addr rva, int from, Addr *keyPathAddr, iit_NodePtr keyPathNode,
+                            const CME::MacKey *key, bool full_path, bool record = false);
+            bool readDirty(Addr paddr, iit_Node *node);
+            void markDirty(sdm_space &sp, int level, uint64_t idx, const iit_Node &node);
+            void flushNode(Addr paddr);
+            void addSharedMeta(sdm_space &sp);
+            void publishShared();
+            void coherenceUpdate(sdmIDtype id, const std::set<Addr> &lines, const iit_Node &root);
+            void noteFetch(Addr lineAddr);
 
         public:
-            sDMmanager(int sdm_pool_id);
+            PARAMS(SDMManager);
+            sDMmanager(const Params &p);
             ~sDMmanager();
+            void init() override;
+            /**
+             * @brief 由内存控制器在构造时提供远端内存的功能性访问接口
+             */
+            void setRemoteMemory(PortProxy *proxy) { remoteMem = proxy; }
+            const AddrRange &getMetaRange() const { return metaRange; }
             sdmIDtype isContained(Addr paddr);
             bool sDMspace_register(std::vector<Addr> &pageList);
+            bool sDMspace_register(const AddrRange &range);
+            bool sDMspace_release(sdmIDtype id);
+            sdmIDtype sDMspace_attach(sDMmanager &home, sdmIDtype home_id);
             Addr getVirtualOffset(sdmIDtype id, Addr paddr);
+            int getKeyPathAddr(sdmIDtype id, Addr rva, Addr *keyPathAddr);
             int getKeyPath(sdmIDtype id, Addr rva, Addr *keyPathAddr, iit_NodePtr keyPathNode);
-            void read(Addr paddr);
-            bool verify(Addr paddr, sdmIDtype id, Addr *rva, int &h, Addr *keyPathAddr, iit_NodePtr keyPathNode, sdm_hashKey key);
-            void write(Addr paddr);
+            Addr getHMACAddr(sdmIDtype id, Addr rva);
+            int getMetaMisses(sdmIDtype id, Addr rva, bool full_path, std::vector<Addr> &missAddrs, bool *zeroLine = nullptr);
+            bool read(PacketPtr pkt);
+            bool verify(sdmIDtype id, Addr paddr, int n, KeyPath *paths, bool full_path = true, bool skip_zero = false);
+            bool write(PacketPtr pkt, std::vector<Addr> *overflows = nullptr);
+            bool functionalRead(PacketPtr pkt);
+            bool functionalWrite(PacketPtr pkt);
+            /**
+             * @brief 写回模式下写操作只需要读到第一个可信节点,也只立即写HMAC
+             */
+            bool writeBack() const { return iitWriteBack; }
+            /**
+             * @brief sideband布局下MAC随数据一起传输,没有HMAC缓存行的访存
+             */
+            bool sidebandMac() const { return sidebandMacs; }
+            void flushAll();
+            void takeFlushTraffic(std::vector<std::pair<Addr, bool>> &traffic);
+            void takeCoherenceMsgs(std::vector<CoherenceMsg> &msgs);
+            DrainState drain() override;
+            void serialize(CheckpointOut &cp) const override;
+            void unserialize(CheckpointIn &cp) override;
         };
     }
 }
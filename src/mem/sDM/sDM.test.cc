@@ -0,0 +1,541 @@
+/**
+ * @author yqy
+ * @brief sDMmanager的单元测试:空间的注册与查找、释放、检查点以及多行Packet的读写
+ * 远端内存是一段普通数组,通过功能性的PortProxy访问
+ */
+#include <gtest/gtest.h>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mem/cache/replacement_policies/lru_rp.hh"
+#include "mem/cache/tags/indexing_policies/set_associative.hh"
+#include "mem/port_proxy.hh"
+#include "mem/sDM/sDM.hh"
+#include "params/LRURP.hh"
+#include "params/SetAssociative.hh"
+#include "sim/serialize.hh"
+
+using namespace gem5;
+using namespace gem5::sDM;
+
+namespace
+{
+
+const Addr dataBase = 0x100000;
+const Addr metaBase = 32 << 20;
+const Addr memSize = 64 << 20;
+
+class SDMManagerTest : public ::testing::Test
+{
+  protected:
+    std::vector<uint8_t> mem;
+    SDMManagerParams params;
+    std::unique_ptr<PortProxy> proxy;
+
+    SDMManagerTest() : mem(memSize, 0x5a)
+    {
+        params.name = "sdm";
+        params.pool_id = 0;
+        params.metadata_range = AddrRange(metaBase, memSize);
+        params.meta_cache_size = 4096;
+        params.meta_cache_assoc = 8;
+        SetAssociativeParams ip;
+        ip.name = "idx";
+        ip.assoc = 8;
+        ip.size = params.meta_cache_size;
+        ip.entry_size = CL_SIZE;
+        LRURPParams rp;
+        rp.name = "lru";
+        params.meta_cache_indexing_policy = new SetAssociative(ip);
+        params.meta_cache_replacement_policy = new replacement_policy::LRU(rp);
+        params.crypto_backend = enums::sm4_sm3;
+        params.mac_layout = enums::half_page;
+        params.iit_write_back = false;
+        params.iit_dirty_nodes = 64;
+        params.iit_epoch_writes = 0;
+        proxy.reset(new PortProxy([this](PacketPtr pkt) {
+            if (pkt->isRead())
+                pkt->setData(&mem[pkt->getAddr()]);
+            else
+                pkt->writeData(&mem[pkt->getAddr()]);
+            pkt->makeResponse();
+        }, CL_SIZE));
+    }
+
+    std::unique_ptr<sDMmanager>
+    makeManager()
+    {
+        auto m = std::make_unique<sDMmanager>(params);
+        m->setRemoteMemory(proxy.get());
+        m->init();
+        return m;
+    }
+
+    static std::vector<Addr>
+    pages(Addr start, int n)
+    {
+        std::vector<Addr> list;
+        for (int i = 0; i < n; i++)
+            list.push_back(start + (Addr)i * PAGE_SIZE);
+        return list;
+    }
+
+    void
+    write(sDMmanager &m, Addr paddr, const uint8_t *data, unsigned size,
+          std::vector<Addr> *overflows = nullptr)
+    {
+        auto req = std::make_shared<Request>(paddr, size, 0, 0);
+        Packet pkt(req, MemCmd::WriteReq);
+        std::vector<uint8_t> d(data, data + size);
+        pkt.dataStatic(d.data());
+        ASSERT_TRUE(m.write(&pkt, overflows));
+    }
+
+    void
+    write(sDMmanager &m, Addr paddr, uint8_t v, std::vector<Addr> *overflows = nullptr)
+    {
+        std::vector<uint8_t> d(CL_SIZE, v);
+        write(m, paddr, d.data(), CL_SIZE, overflows);
+    }
+
+    bool
+    read(sDMmanager &m, Addr paddr, std::vector<uint8_t> &d, unsigned size = CL_SIZE)
+    {
+        auto req = std::make_shared<Request>(paddr, size, 0, 0);
+        Packet pkt(req, MemCmd::ReadReq);
+        d.assign(&mem[paddr], &mem[paddr] + size);
+        pkt.dataStatic(d.data());
+        return m.read(&pkt);
+    }
+
+    bool
+    functionalRead(sDMmanager &m, Addr paddr, std::vector<uint8_t> &d)
+    {
+        auto req = std::make_shared<Request>(paddr, CL_SIZE, 0, 0);
+        Packet pkt(req, MemCmd::ReadReq);
+        d.assign(CL_SIZE, 0);
+        pkt.dataStatic(d.data());
+        return m.functionalRead(&pkt);
+    }
+
+    void
+    functionalWrite(sDMmanager &m, Addr paddr, uint8_t v)
+    {
+        auto req = std::make_shared<Request>(paddr, CL_SIZE, 0, 0);
+        Packet pkt(req, MemCmd::WriteReq);
+        std::vector<uint8_t> d(CL_SIZE, v);
+        pkt.dataStatic(d.data());
+        ASSERT_TRUE(m.functionalWrite(&pkt));
+    }
+
+    /**
+     * @brief 第一个iit叶节点的地址,即空间的iit区域起始地址
+     */
+    static Addr
+    iitBase(sDMmanager &m, sdmIDtype id)
+    {
+        Addr keyPath[MAX_HEIGHT];
+        m.getKeyPathAddr(id, 0, keyPath);
+        return keyPath[0];
+    }
+
+    /**
+     * @brief 读出检查点目录中sDM状态文件的全部内容
+     */
+    static std::string
+    readBlob(const std::string &path)
+    {
+        gzFile f = gzopen(path.c_str(), "rb");
+        EXPECT_NE(nullptr, f) << path;
+        std::string s;
+        char buf[4096];
+        int n;
+        while (f && (n = gzread(f, buf, sizeof(buf))) > 0)
+            s.append(buf, n);
+        if (f)
+            gzclose(f);
+        return s;
+    }
+
+    static std::string
+    checkpoint(const sDMmanager &m, const std::string &dir)
+    {
+        std::ofstream os;
+        Serializable::generateCheckpointOut(dir, os);
+        m.serializeSection(os, "sdm");
+        os.close();
+        return readBlob(dir + "/sdm.sdm");
+    }
+};
+
+} // anonymous namespace
+
+/**
+ * @brief 物理不连续的页按物理连续段查找,每页返回所属空间与虚拟偏移
+ */
+TEST_F(SDMManagerTest, ContainsDiscontiguousPages)
+{
+    auto m = makeManager();
+    // 两段物理连续的页,以逆序交错组成虚拟空间
+    std::vector<Addr> list = pages(dataBase + 64 * PAGE_SIZE, 8);
+    std::vector<Addr> low = pages(dataBase, 8);
+    list.insert(list.end(), low.begin(), low.end());
+    ASSERT_TRUE(m->sDMspace_register(list));
+    sdmIDtype id = m->isContained(dataBase);
+    ASSERT_NE(0u, id);
+    for (size_t i = 0; i < list.size(); i++) {
+        for (Addr off : {(Addr)0, (Addr)CL_SIZE, (Addr)PAGE_SIZE - 1}) {
+            EXPECT_EQ(id, m->isContained(list[i] + off));
+            EXPECT_EQ(i * PAGE_SIZE + off, m->getVirtualOffset(id, list[i] + off));
+        }
+    }
+    EXPECT_EQ(0u, m->isContained(dataBase - 1));
+    EXPECT_EQ(0u, m->isContained(dataBase + 8 * PAGE_SIZE));
+    EXPECT_EQ(0u, m->isContained(dataBase + 63 * PAGE_SIZE));
+    EXPECT_EQ(0u, m->isContained(dataBase + 72 * PAGE_SIZE));
+}
+
+/**
+ * @brief 与已注册空间重叠的页列表被拒绝,不留下部分注册的映射,id不被消耗
+ */
+TEST_F(SDMManagerTest, RejectsOverlap)
+{
+    auto m = makeManager();
+    ASSERT_TRUE(m->sDMspace_register(AddrRange(dataBase, dataBase + 16 * PAGE_SIZE)));
+    sdmIDtype first = m->isContained(dataBase);
+
+    // 先是不重叠的一段,最后一页与已注册的空间重叠
+    std::vector<Addr> list = pages(dataBase + 32 * PAGE_SIZE, 4);
+    list.push_back(dataBase + 15 * PAGE_SIZE);
+    EXPECT_FALSE(m->sDMspace_register(list));
+    EXPECT_EQ(0u, m->isContained(dataBase + 32 * PAGE_SIZE));
+    EXPECT_EQ(first, m->isContained(dataBase + 15 * PAGE_SIZE));
+
+    // 跨越已注册空间边界的连续范围
+    EXPECT_FALSE(m->sDMspace_register(
+        AddrRange(dataBase + 8 * PAGE_SIZE, dataBase + 24 * PAGE_SIZE)));
+    EXPECT_EQ(0u, m->isContained(dataBase + 20 * PAGE_SIZE));
+
+    list.pop_back();
+    ASSERT_TRUE(m->sDMspace_register(list));
+    EXPECT_EQ(first + 1, m->isContained(dataBase + 32 * PAGE_SIZE));
+}
+
+/**
+ * @brief 同一个页在列表中出现两次时与自身重叠,注册失败
+ */
+TEST_F(SDMManagerTest, RejectsDuplicatePages)
+{
+    auto m = makeManager();
+    std::vector<Addr> list = pages(dataBase, 4);
+    list.push_back(dataBase + 64 * PAGE_SIZE);
+    list.push_back(dataBase + 2 * PAGE_SIZE);
+    EXPECT_FALSE(m->sDMspace_register(list));
+    for (Addr p : list)
+        EXPECT_EQ(0u, m->isContained(p));
+}
+
+/**
+ * @brief 释放后的空间不再被查找到,即使它是上次命中的物理连续段;id无效或重复释放返回false
+ */
+TEST_F(SDMManagerTest, ReleaseResetsLastHit)
+{
+    auto m = makeManager();
+    ASSERT_TRUE(m->sDMspace_register(AddrRange(dataBase, dataBase + 16 * PAGE_SIZE)));
+    sdmIDtype id = m->isContained(dataBase + PAGE_SIZE);
+    ASSERT_NE(0u, id);
+    // 再次命中同一段,走lastHit的快速路径
+    ASSERT_EQ(id, m->isContained(dataBase + 2 * PAGE_SIZE));
+    EXPECT_TRUE(m->sDMspace_release(id));
+    EXPECT_EQ(0u, m->isContained(dataBase + 2 * PAGE_SIZE));
+    EXPECT_FALSE(m->sDMspace_release(id));
+    EXPECT_FALSE(m->sDMspace_release(0));
+    EXPECT_FALSE(m->sDMspace_release(id + 100));
+}
+
+/**
+ * @brief 在同一批页上重新注册的空间使用新的id和密钥,之前写入的数据读出为全零
+ */
+TEST_F(SDMManagerTest, ReleaseAndReregister)
+{
+    auto m = makeManager();
+    AddrRange range(dataBase, dataBase + 16 * PAGE_SIZE);
+    ASSERT_TRUE(m->sDMspace_register(range));
+    sdmIDtype id = m->isContained(dataBase);
+    for (int i = 0; i < 8; i++)
+        write(*m, dataBase + i * CL_SIZE, 0xab);
+    std::vector<uint8_t> d;
+    ASSERT_TRUE(read(*m, dataBase + CL_SIZE, d));
+    EXPECT_EQ(0xab, d[0]);
+
+    ASSERT_TRUE(m->sDMspace_release(id));
+    ASSERT_TRUE(m->sDMspace_register(range));
+    sdmIDtype id2 = m->isContained(dataBase);
+    EXPECT_NE(id, id2);
+    for (int i = 0; i < 8; i++) {
+        ASSERT_TRUE(read(*m, dataBase + i * CL_SIZE, d));
+        EXPECT_EQ(std::vector<uint8_t>(CL_SIZE, 0), d);
+    }
+}
+
+/**
+ * @brief 释放的元数据区域与相邻的空闲区域合并,合并后的区域可以容纳更大的空间
+ */
+TEST_F(SDMManagerTest, ReleaseCoalescesFreeList)
+{
+    auto m = makeManager();
+    const Addr size = 256 * PAGE_SIZE;
+    ASSERT_TRUE(m->sDMspace_register(AddrRange(dataBase, dataBase + size)));
+    ASSERT_TRUE(m->sDMspace_register(AddrRange(dataBase + size, dataBase + 2 * size)));
+    ASSERT_TRUE(m->sDMspace_register(AddrRange(dataBase + 2 * size, dataBase + 3 * size)));
+    sdmIDtype a = m->isContained(dataBase);
+    sdmIDtype b = m->isContained(dataBase + size);
+    sdmIDtype c = m->isContained(dataBase + 2 * size);
+    Addr base = iitBase(*m, a);
+    ASSERT_LT(iitBase(*m, a), iitBase(*m, b));
+    ASSERT_LT(iitBase(*m, b), iitBase(*m, c));
+
+    // 两倍大小空间的iit放不进a一个空间的元数据区域,只有与b的区域合并后才放得下
+    ASSERT_TRUE(m->sDMspace_release(a));
+    ASSERT_TRUE(m->sDMspace_release(b));
+    ASSERT_TRUE(m->sDMspace_register(AddrRange(dataBase + 4 * size, dataBase + 6 * size)));
+    sdmIDtype d = m->isContained(dataBase + 4 * size);
+    EXPECT_EQ(base, iitBase(*m, d));
+
+    // 全部释放后末尾的空闲区域退回未分配区域,下一个空间从元数据区起始处分配
+    ASSERT_TRUE(m->sDMspace_release(c));
+    ASSERT_TRUE(m->sDMspace_release(d));
+    ASSERT_TRUE(m->sDMspace_register(AddrRange(dataBase + 8 * size, dataBase + 9 * size)));
+    EXPECT_EQ(base, iitBase(*m, m->isContained(dataBase + 8 * size)));
+}
+
+/**
+ * @brief 检查点恢复后再保存的状态与原状态逐字节相同:空间表、元数据空闲表和脏节点的替换顺序
+ */
+TEST_F(SDMManagerTest, CheckpointRoundTrip)
+{
+    params.iit_write_back = true;
+    auto m = makeManager();
+    const Addr size = 64 * PAGE_SIZE;
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(m->sDMspace_register(
+            AddrRange(dataBase + i * size, dataBase + (i + 1) * size)));
+    }
+    // 释放中间的空间,使空闲表和已释放的表项都出现在检查点中
+    ASSERT_TRUE(m->sDMspace_release(m->isContained(dataBase + size)));
+    for (int i = 0; i < 40; i++) {
+        write(*m, dataBase + (i * 37 % 64) * PAGE_SIZE + i % 8 * CL_SIZE, i);
+        write(*m, dataBase + 2 * size + i * 5 * PAGE_SIZE % size, i);
+    }
+
+    char dir1[] = "/tmp/sdm_ckpt1XXXXXX", dir2[] = "/tmp/sdm_ckpt2XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(dir1));
+    ASSERT_NE(nullptr, mkdtemp(dir2));
+    std::string saved = checkpoint(*m, dir1);
+    ASSERT_FALSE(saved.empty());
+
+    auto m2 = makeManager();
+    CheckpointIn cp(dir1);
+    m2->unserializeSection(cp, "sdm");
+    EXPECT_EQ(saved, checkpoint(*m2, dir2));
+
+    // 恢复的管理器读出原来写入的数据
+    EXPECT_EQ(0u, m2->isContained(dataBase + size));
+    for (int i = 0; i < 40; i++) {
+        std::vector<uint8_t> d, d2;
+        Addr paddr = dataBase + 2 * size + i * 5 * PAGE_SIZE % size;
+        ASSERT_TRUE(read(*m, paddr, d));
+        ASSERT_TRUE(read(*m2, paddr, d2));
+        EXPECT_EQ(d, d2);
+        EXPECT_EQ(m->isContained(paddr), m2->isContained(paddr));
+    }
+    for (const char *dir : {dir1, dir2}) {
+        std::remove((std::string(dir) + "/sdm.sdm").c_str());
+        std::remove((std::string(dir) + "/m5.cpt").c_str());
+        std::remove(dir);
+    }
+}
+
+/**
+ * @brief 一个Packet写入多行与逐行写入得到相同的密文和MAC,整体和逐行读回的明文相同
+ * 分别覆盖对齐的整页和跨页、首尾为部分行的范围,以及两种MAC布局
+ */
+TEST_F(SDMManagerTest, MultiLinePacketMatchesPerLine)
+{
+    const Addr page = dataBase + PAGE_SIZE;
+    std::vector<uint8_t> plain(2 * PAGE_SIZE);
+    for (size_t i = 0; i < plain.size(); i++)
+        plain[i] = (uint8_t)(i * 7 + 3);
+    const std::pair<Addr, unsigned> cases[] = {{0, PAGE_SIZE}, {100, 5000}};
+    for (auto layout : {enums::half_page, enums::sideband}) {
+        params.mac_layout = layout;
+        for (const auto &c : cases) {
+            Addr start = page + c.first, end = start + c.second;
+            std::vector<uint8_t> cipher[2], macs[2];
+            for (int perLine = 0; perLine < 2; perLine++) {
+                std::fill(mem.begin(), mem.end(), 0x5a);
+                auto m = makeManager();
+                ASSERT_TRUE(m->sDMspace_register(AddrRange(dataBase, dataBase + 16 * PAGE_SIZE)));
+                sdmIDtype id = m->isContained(page);
+                const uint8_t *src = plain.data() + c.first;
+                if (perLine) {
+                    for (Addr a = start; a < end; a = (a & CL_ALIGN_MASK) + CL_SIZE) {
+                        Addr next = std::min((a & CL_ALIGN_MASK) + CL_SIZE, end);
+                        write(*m, a, src + (a - start), next - a);
+                    }
+                } else {
+                    write(*m, start, src, c.second);
+                }
+                cipher[perLine].assign(&mem[page], &mem[page] + 2 * PAGE_SIZE);
+                Addr mac = m->getHMACAddr(id, PAGE_SIZE);
+                macs[perLine].assign(&mem[mac], &mem[m->getHMACAddr(id, 3 * PAGE_SIZE)]);
+
+                std::vector<uint8_t> d;
+                ASSERT_TRUE(read(*m, start, d, c.second));
+                EXPECT_EQ(std::vector<uint8_t>(src, src + c.second), d);
+                for (Addr a = start & CL_ALIGN_MASK; a < end; a += CL_SIZE) {
+                    ASSERT_TRUE(read(*m, a, d));
+                    for (int i = 0; i < CL_SIZE; i++) {
+                        uint8_t expect = a + i >= start && a + i < end ? src[a + i - start] : 0;
+                        ASSERT_EQ(expect, d[i]) << std::hex << a + i;
+                    }
+                }
+            }
+            EXPECT_EQ(cipher[0], cipher[1]) << "offset " << c.first;
+            EXPECT_EQ(macs[0], macs[1]) << "offset " << c.first;
+            EXPECT_NE(std::vector<uint8_t>(plain.begin() + c.first, plain.begin() + c.first + CL_SIZE),
+                      std::vector<uint8_t>(cipher[0].begin() + c.first, cipher[0].begin() + c.first + CL_SIZE));
+        }
+    }
+}
+
+/**
+ * @brief 反复写同一行直到叶节点副计数器溢出,只有该行所在的半页被重加密,整页数据不变
+ * 打包格式溢出改变叶节点覆盖的半页;可变编码格式(SDM_MORPHABLE_LEAF)只重置热点行所在的组
+ */
+TEST_F(SDMManagerTest, LeafOverflowReencryptsHotHalf)
+{
+    auto m = makeManager();
+    ASSERT_TRUE(m->sDMspace_register(AddrRange(dataBase, dataBase + 16 * PAGE_SIZE)));
+    const Addr page = dataBase + 2 * PAGE_SIZE;
+    const Addr hot = page + HALF_PAGE_SIZE + 3 * CL_SIZE;
+    // 除第一行外都写两次:可变编码下非0增量的行多,稀疏编码容纳不了热点行的增量
+    for (int i = 0; i < PAGE_SIZE / CL_SIZE; i++) {
+        for (int k = 0; k < (i ? 2 : 1); k++)
+            write(*m, page + i * CL_SIZE, i + 1);
+    }
+
+    std::vector<Addr> overflows;
+    const int maxWrites = 2 << IIT_LEAF_MINOR_BIT_SIZE;
+    int writes = 0;
+    for (; writes < maxWrites && overflows.empty(); writes++)
+        write(*m, hot, 0xee - writes % 2, &overflows);
+    ASSERT_FALSE(overflows.empty()) << writes << " writes";
+    for (Addr half : overflows)
+        EXPECT_EQ(page + HALF_PAGE_SIZE, half);
+
+    // 溢出后继续写热点行,所有行仍能通过校验并读回原值
+    for (int i = 0; i < 4; i++, writes++)
+        write(*m, hot, 0xee - writes % 2);
+    std::vector<uint8_t> d;
+    for (int i = 0; i < PAGE_SIZE / CL_SIZE; i++) {
+        Addr line = page + i * CL_SIZE;
+        ASSERT_TRUE(read(*m, line, d)) << std::hex << line;
+        uint8_t expect = line == hot ? 0xee - (writes - 1) % 2 : i + 1;
+        EXPECT_EQ(std::vector<uint8_t>(CL_SIZE, expect), d) << std::hex << line;
+    }
+}
+
+/**
+ * @brief 功能性读写不查询也不填充元数据缓存,之后计时访问需要取回的元数据不变
+ */
+TEST_F(SDMManagerTest, FunctionalAccessBypassesMetaCache)
+{
+    auto m = makeManager();
+    ASSERT_TRUE(m->sDMspace_register(AddrRange(dataBase, dataBase + 16 * PAGE_SIZE)));
+    const Addr line = dataBase + 3 * PAGE_SIZE + 5 * CL_SIZE;
+    write(*m, line, 0x11);
+
+    // 从检查点恢复的管理器元数据缓存为空
+    char dir[] = "/tmp/sdm_ckptXXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(dir));
+    checkpoint(*m, dir);
+    auto m2 = makeManager();
+    CheckpointIn cp(dir);
+    m2->unserializeSection(cp, "sdm");
+    std::remove((std::string(dir) + "/sdm.sdm").c_str());
+    std::remove((std::string(dir) + "/m5.cpt").c_str());
+    std::remove(dir);
+
+    sdmIDtype id = m2->isContained(line);
+    Addr rva = m2->getVirtualOffset(id, line);
+    std::vector<Addr> cold, misses;
+    m2->getMetaMisses(id, rva, false, cold);
+    ASSERT_FALSE(cold.empty());
+
+    std::vector<uint8_t> d;
+    ASSERT_TRUE(functionalRead(*m2, line, d));
+    EXPECT_EQ(std::vector<uint8_t>(CL_SIZE, 0x11), d);
+    functionalWrite(*m2, line + CL_SIZE, 0x22);
+    m2->getMetaMisses(id, rva, false, misses);
+    EXPECT_EQ(cold, misses);
+
+    // 计时读校验功能性写入的数据,并填充元数据缓存
+    ASSERT_TRUE(read(*m2, line + CL_SIZE, d));
+    EXPECT_EQ(std::vector<uint8_t>(CL_SIZE, 0x22), d);
+    misses.clear();
+    m2->getMetaMisses(id, rva, false, misses);
+    EXPECT_LT(misses.size(), cold.size());
+}
+
+/**
+ * @brief 写回模式下功能性写不产生脏节点:写直达到关键路径上的第一个脏节点,之后传播的节点与没有功能性写时相同
+ */
+TEST_F(SDMManagerTest, FunctionalWriteKeepsDirtyNodes)
+{
+    params.iit_write_back = true;
+    // 只容纳一个脏节点:两个叶节点先后传播后只剩它们的父节点是脏的
+    params.iit_dirty_nodes = 1;
+    const Addr lines[] = {dataBase + CL_SIZE, dataBase + 5 * PAGE_SIZE, dataBase + 5 * PAGE_SIZE + 7 * CL_SIZE};
+    size_t flushes[2];
+    for (int functional = 0; functional < 2; functional++) {
+        std::fill(mem.begin(), mem.end(), 0x5a);
+        auto m = makeManager();
+        // 叶节点多于一个中间节点的arity,树中有中间节点
+        ASSERT_TRUE(m->sDMspace_register(AddrRange(dataBase, dataBase + 128 * PAGE_SIZE)));
+        write(*m, dataBase, 0x11);
+        write(*m, dataBase + PAGE_SIZE, 0x12);
+        std::vector<std::pair<Addr, bool>> traffic;
+        m->takeFlushTraffic(traffic);
+        if (functional) {
+            for (int i = 0; i < 3; i++)
+                functionalWrite(*m, lines[i], 0x21 + i);
+        }
+        std::vector<uint8_t> d;
+        for (int pass = 0; pass < 2; pass++) {
+            ASSERT_TRUE(read(*m, dataBase, d));
+            EXPECT_EQ(std::vector<uint8_t>(CL_SIZE, 0x11), d);
+            ASSERT_TRUE(read(*m, dataBase + PAGE_SIZE, d));
+            EXPECT_EQ(std::vector<uint8_t>(CL_SIZE, 0x12), d);
+            for (int i = 0; i < 3; i++) {
+                ASSERT_TRUE(read(*m, lines[i], d));
+                EXPECT_EQ(std::vector<uint8_t>(CL_SIZE, functional ? 0x21 + i : 0), d);
+            }
+            if (pass == 0) {
+                traffic.clear();
+                m->flushAll();
+                m->takeFlushTraffic(traffic);
+                flushes[functional] = std::count_if(traffic.begin(), traffic.end(),
+                                                    [](const std::pair<Addr, bool> &t) { return !t.second; });
+            }
+        }
+    }
+    EXPECT_EQ(flushes[0], flushes[1]);
+}
@@ -1,5 +1,9 @@
+#ifndef _SDM_DEF_HH_
+#define _SDM_DEF_HH_
 #include <stdint.h>
 
+#include "config/sdm_morphable_leaf.hh"
+
 #define BYTE2BIT 8
 
 #define SDM_HMAC_ZOOM 64 // 缩放系数与选择的输入长度和hash算法有关 1/2Page -> 1/2CL(sm3) sizeof(HMAC)=sDataSize/sDMHMACZOOM
@@ -9,6 +13,8 @@
 #define CL_ALIGNED_CHK 0x03F               // 检查地址是否按CL对齐
 #define PAGE_ALIGN_MASK 0xfffffffffffff000 // 转换为页面对齐地址  , +by psj:PAGE mask错误
 #define HMAC_SIZE (SM3_len >> 3)           // SM3
+#define HALF_PAGE_SIZE (PAGE_SIZE >> 1)    // HMAC保护粒度:半页
+#define INLINE_MAC_SIZE 8                  // sideband布局:每个缓存行64bit的截断MAC,位于数据突发的ECC边带
 #define PAIR_SIZE 16                       // ptr+num(8+8) 数据页指针集合二元组的大小
 
 #define IIT_NODE_SIZE 64 // 64B = 512 bit = CacheLine_Size
@@ -17,24 +23,22 @@
 // #define IIT_HASHTAG_SIZE 8       // 12B = 64 bit
 #define IIT_LEAF_MINOR_BIT_SIZE 12 // 12bit -> 2B
 #define IIT_MID_MINOR_BIT_SIZE 6   // 6 bit -> 1B
+// 1:叶节点使用可变编码的压缩格式(iit_MorphNodeT),一个叶节点覆盖一页
+// 由构建选项SDM_MORPHABLE_LEAF决定(scons ... SDM_MORPHABLE_LEAF=True)
+#define IIT_LEAF_MORPHABLE SDM_MORPHABLE_LEAF
+#if IIT_LEAF_MORPHABLE
+#define IIT_LEAF_ARITY 64          // 叶节点压缩存放64个计数器
+#else
 #define IIT_LEAF_ARITY 32          // 叶节点打包32个计数器
+#endif
 #define IIT_MID_ARITY 64           // 中间/root打包64个计数器
 #define IIT_LEAF_TYPE 0            // 节点类型是叶子
 #define IIT_MID_TYPE 1             // 节点类型是中间节点
+// 节点内各字段的掩码由iit_NodeT从arity、副计数器位数和嵌入位数在编译期导出
 #define INVALID_NODE 0x0
-#define IIT_LEAF_NODE_HASH_TAG_MASK 0xC000
-#define IIT_MID_NODE_HASH_TAG_MASK 0x80
-#define IIT_LEAF_NODE_MAJOR_MASK 0x3000
-#define IIT_MID_NODE_MAJOR_MASK 0x40
 #define IIT_LEAF_NODE_EMB 2                   // 叶节点unit中major和hash_tag等bit数嵌入
 #define IIT_MID_NODE_EMB 1                    // 中间节点unit中major和hash_tag等bit数嵌入
-#define IIT_LEAF_COUNTER_RESERVED_MASK 0x3FFF //
-#define IIT_MID_COUNTER_RESERVED_MASK 0x7F
-#define IIT_LEAF_MINOR_RESERVED_MASK 0x0FFF
-#define IIT_MID_MINOR_RESERVED_MASK 0x3F // 保留节点中的所有计数器相关位
-#define IIT_LEAF_MINOR_MAXM 0x0FFF       // 叶节点的major counter最大值
-#define IIT_MID_MINOR_MAXM 0x3F          // 中间节点点的minor counter最大值
-#define LITTLE_ENDIAN 1                  // 使用小端模式嵌入
+#define SDM_LITTLE_ENDIAN 1              // 使用小端模式嵌入(避免与系统LITTLE_ENDIAN宏冲突)
 #define SM3_KEY_SIZE SM3_len / 8         // 基于sm3的hmac密钥
 #define HASH_KEY_TYPE 0
 #define CME_KEY_TYPE 1
@@ -45,3 +49,4 @@ namespace gem5
         typedef uint64_t Addr; // 64位地址类型
     }
 }
+#endif // _SDM_DEF_HH_
@@ -0,0 +1,973 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met: redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer;
+ * redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution;
+ * neither the name of the copyright holders nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "mem/secure_mem_ctrl.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#include "base/trace.hh"
+#include "debug/SecureMemCtrl.hh"
+#include "mem/mem_interface.hh"
+#include "sim/system.hh"
+
+namespace gem5
+{
+
+namespace memory
+{
+
+Tick
+SecureMemCtrl::CryptoStage::reserve(Tick ready)
+{
+    Tick start = std::max(ready, nextFree);
+    nextFree = start + issueInterval;
+    return start + latency;
+}
+
+SecureMemCtrl::SecureMemCtrl(const SecureMemCtrlParams &p) :
+    MemCtrl(p), sdm(p.sdm),
+    metaProxy([this](PacketPtr pkt) { dram->functionalAccess(pkt); },
+              CL_SIZE),
+    sdmRequestorId(p.system->getRequestorId(this, "sdm")),
+    verifyStage(p.verify_latency, p.crypto_pipelined ?
+                p.crypto_issue_interval : p.verify_latency),
+    hmacStage(p.hmac_latency, p.crypto_pipelined ?
+              p.crypto_issue_interval : p.hmac_latency),
+    decryptStage(p.decrypt_latency, p.crypto_pipelined ?
+                 p.crypto_issue_interval : p.decrypt_latency),
+    encryptStage(p.encrypt_latency, p.crypto_pipelined ?
+                 p.crypto_issue_interval : p.encrypt_latency),
+    treeStage(p.tree_update_latency, p.crypto_pipelined ?
+              p.crypto_issue_interval : p.tree_update_latency),
+    speculativeOtp(p.speculative_otp),
+    verifyLater(p.verify_later),
+    faultEvent([this]{ processFaults(); }, name() + ".faultEvent"),
+    reencInFlight(0),
+    reencQueueDepth(p.reencrypt_queue_depth),
+    reencMaxBursts(p.reencrypt_max_bursts),
+    reencDemandThreshold(p.reencrypt_demand_threshold),
+    reencMaxWait(p.reencrypt_max_wait),
+    reencEvent([this]{ processReencrypt(); }, name() + ".reencEvent"),
+    backlogEvent([this]{ processMetaBacklog(); }, name() + ".backlogEvent"),
+    secureStats(*this)
+{
+    fatal_if(reencQueueDepth == 0 || reencMaxBursts == 0,
+             "%s: the re-encryption engine needs a queue and a budget\n",
+             name());
+    sdm->setRemoteMemory(&metaProxy);
+}
+
+void
+SecureMemCtrl::init()
+{
+    MemCtrl::init();
+
+    fatal_if(!sdm->getMetaRange().isSubset(dram->getAddrRange()),
+             "%s: sDM metadata range %s is not backed by %s\n", name(),
+             sdm->getMetaRange().to_string(),
+             dram->getAddrRange().to_string());
+}
+
+void
+SecureMemCtrl::regProbePoints()
+{
+    MemCtrl::regProbePoints();
+
+    ppIntegrityFault.reset(new ProbePointArg<IntegrityFault>(
+        getProbeManager(), "IntegrityFault"));
+}
+
+DrainState
+SecureMemCtrl::drain()
+{
+    // the sDM manager rewrote the overflowed half pages functionally,
+    // the re-encryption bursts not issued yet only carry timing and are
+    // dropped, the ones in the queues are drained by MemCtrl; the same
+    // goes for the backlog of propagated IIT nodes
+    for (auto &job : reencJobs) {
+        for (; job.next < job.half + HALF_PAGE_SIZE; job.next += CL_SIZE) {
+            if (job.next != job.skip)
+                job.remaining--;
+        }
+    }
+    for (auto &write : reencWrites)
+        std::get<2>(write)->remaining--;
+    reencWrites.clear();
+    reencJobs.remove_if([](const ReencryptJob &job)
+                        { return job.remaining == 0; });
+    if (reencEvent.scheduled())
+        deschedule(reencEvent);
+    metaBacklog.clear();
+    if (backlogEvent.scheduled())
+        deschedule(backlogEvent);
+
+    // the verifications still running in the background are done, so
+    // that no fault is lost across a checkpoint
+    for (auto &fault : pendingFaults)
+        raiseIntegrityFault(fault.second);
+    pendingFaults.clear();
+    if (faultEvent.scheduled())
+        deschedule(faultEvent);
+
+    return MemCtrl::drain();
+}
+
+void
+SecureMemCtrl::serialize(CheckpointOut &cp) const
+{
+    // the poison outlives the checkpoint, the faults that caused it
+    // were all raised by drain()
+    std::vector<Addr> lines(poisoned.begin(), poisoned.end());
+    std::sort(lines.begin(), lines.end());
+    arrayParamOut(cp, "poisoned", lines);
+}
+
+void
+SecureMemCtrl::unserialize(CheckpointIn &cp)
+{
+    std::vector<Addr> lines;
+    arrayParamIn(cp, "poisoned", lines);
+    poisoned.clear();
+    poisoned.insert(lines.begin(), lines.end());
+}
+
+bool
+SecureMemCtrl::isProtected(PacketPtr pkt)
+{
+    Addr end = pkt->getAddr() + pkt->getSize();
+    for (Addr line = pkt->getAddr() & CL_ALIGN_MASK; line < end;
+         line += CL_SIZE) {
+        if (sdm->isContained(line))
+            return true;
+    }
+    return false;
+}
+
+bool
+SecureMemCtrl::isPoisoned(PacketPtr pkt) const
+{
+    if (poisoned.empty())
+        return false;
+    Addr end = pkt->getAddr() + pkt->getSize();
+    for (Addr line = pkt->getAddr() & CL_ALIGN_MASK; line < end;
+         line += CL_SIZE) {
+        if (poisoned.count(line))
+            return true;
+    }
+    return false;
+}
+
+void
+SecureMemCtrl::raiseIntegrityFault(const IntegrityFault &fault)
+{
+    warn("%s: integrity check failed for [%#x:%#x] read by requestor "
+         "%d\n", name(), fault.addr, fault.addr + fault.size,
+         fault.requestor);
+
+    Addr end = fault.addr + fault.size;
+    for (Addr line = fault.addr & CL_ALIGN_MASK; line < end;
+         line += CL_SIZE) {
+        if (sdm->isContained(line))
+            poisoned.insert(line);
+    }
+    secureStats.integrityFaults++;
+    ppIntegrityFault->notify(fault);
+}
+
+void
+SecureMemCtrl::processFaults()
+{
+    while (!pendingFaults.empty() &&
+           pendingFaults.begin()->first <= curTick()) {
+        raiseIntegrityFault(pendingFaults.begin()->second);
+        pendingFaults.erase(pendingFaults.begin());
+    }
+    if (!pendingFaults.empty())
+        schedule(faultEvent, pendingFaults.begin()->first);
+}
+
+int
+SecureMemCtrl::collectMetadata(PacketPtr pkt, std::vector<Addr> &meta_reads,
+                               std::vector<Addr> &meta_writes,
+                               bool *counters_local, bool *zero_lines)
+{
+    int levels = 0;
+    if (counters_local)
+        *counters_local = true;
+    if (zero_lines)
+        *zero_lines = pkt->isRead();
+    Addr key_path[MAX_HEIGHT];
+    Addr end = pkt->getAddr() + pkt->getSize();
+    for (Addr line = pkt->getAddr() & CL_ALIGN_MASK; line < end;
+         line += CL_SIZE) {
+        sDM::sdmIDtype id = sdm->isContained(line);
+        if (!id) {
+            if (zero_lines)
+                *zero_lines = false;
+            continue;
+        }
+        Addr rva = sdm->getVirtualOffset(id, line);
+        // only the lines missing in the metadata cache are fetched, a
+        // read stops at the first cached node of its key path, and does
+        // not need the HMAC of a never written line
+        bool full_path = pkt->isWrite() && !sdm->writeBack();
+        bool zero = false;
+        int verified = sdm->getMetaMisses(id, rva, full_path, meta_reads,
+                                          pkt->isRead() ? &zero : nullptr);
+        if (zero_lines && !zero)
+            *zero_lines = false;
+        // a counter is known locally unless a node of its key path has
+        // to come from the media, a never written leaf is all-zero
+        if (counters_local && verified > 0)
+            *counters_local = false;
+        if (pkt->isWrite() && sdm->writeBack()) {
+            // only the leaf changes, its parents are updated when it is
+            // propagated, see processMetaBacklog
+            if (!sdm->sidebandMac())
+                meta_writes.push_back(sdm->getHMACAddr(id, rva) & CL_ALIGN_MASK);
+            levels = std::max(levels, 1);
+        } else if (pkt->isWrite()) {
+            // the whole key path is updated, and the metadata cache is
+            // write-through
+            int h = sdm->getKeyPathAddr(id, rva, key_path);
+            meta_writes.insert(meta_writes.end(), key_path, key_path + h);
+            // a side-band MAC is written in the ECC bits of the data burst
+            if (!sdm->sidebandMac())
+                meta_writes.push_back(sdm->getHMACAddr(id, rva) & CL_ALIGN_MASK);
+            levels = std::max(levels, h);
+        } else {
+            levels = std::max(levels, verified);
+        }
+    }
+    for (auto meta_addrs : {&meta_reads, &meta_writes}) {
+        std::sort(meta_addrs->begin(), meta_addrs->end());
+        meta_addrs->erase(std::unique(meta_addrs->begin(), meta_addrs->end()),
+                          meta_addrs->end());
+    }
+    return levels;
+}
+
+unsigned
+SecureMemCtrl::burstCount(Addr addr, unsigned size) const
+{
+    uint32_t burst_size = dram->bytesPerBurst();
+    return divCeil((addr & (burst_size - 1)) + size, burst_size);
+}
+
+void
+SecureMemCtrl::sendMetadata(const std::vector<Addr> &meta_addrs,
+                            bool is_read, PacketPtr owner)
+{
+    for (Addr addr : meta_addrs) {
+        // the metadata contents are kept up to date functionally by the
+        // sDM manager, these packets only carry the timing of the
+        // bursts and never touch the media
+        RequestPtr req = std::make_shared<Request>(addr, CL_SIZE, 0,
+                                                   sdmRequestorId);
+        PacketPtr meta_pkt = new Packet(req, is_read ? MemCmd::ReadReq :
+                                        MemCmd::WriteReq);
+        unsigned pkt_count = burstCount(addr, CL_SIZE);
+        metaOwner[meta_pkt] = owner;
+
+        DPRINTF(SecureMemCtrl, "Metadata %s to addr %#x\n",
+                is_read ? "read" : "write", addr);
+
+        if (is_read) {
+            secureStats.metaReadBursts += pkt_count;
+            addToReadQueue(meta_pkt, pkt_count, dram);
+        } else {
+            secureStats.metaWriteBursts += pkt_count;
+            addToWriteQueue(meta_pkt, pkt_count, dram);
+        }
+    }
+
+    if (!meta_addrs.empty() && !nextReqEvent.scheduled())
+        schedule(nextReqEvent, curTick());
+}
+
+void
+SecureMemCtrl::sendReencrypt(Addr addr, bool is_read, ReencryptJobIt job)
+{
+    // as for the metadata, the sDM manager already rewrote the half
+    // page functionally, these packets only carry the timing
+    RequestPtr req = std::make_shared<Request>(addr, CL_SIZE, 0,
+                                               sdmRequestorId);
+    PacketPtr re_pkt = new Packet(req, is_read ? MemCmd::ReadReq :
+                                  MemCmd::WriteReq);
+    unsigned pkt_count = burstCount(addr, CL_SIZE);
+    reencOwner.emplace(re_pkt, job);
+    reencInFlight++;
+
+    DPRINTF(SecureMemCtrl, "Re-encryption %s to addr %#x\n",
+            is_read ? "read" : "write", addr);
+
+    if (is_read) {
+        secureStats.reencReadBursts += pkt_count;
+        addToReadQueue(re_pkt, pkt_count, dram);
+    } else {
+        secureStats.reencWriteBursts += pkt_count;
+        addToWriteQueue(re_pkt, pkt_count, dram);
+    }
+}
+
+void
+SecureMemCtrl::processMetaBacklog()
+{
+    unsigned line_bursts = burstCount(0, CL_SIZE);
+    std::vector<Addr> reads, writes;
+    while (!metaBacklog.empty()) {
+        auto [addr, is_read] = metaBacklog.front();
+        std::vector<Addr> &lines = is_read ? reads : writes;
+        unsigned needed = line_bursts * (lines.size() + 1);
+        if (is_read ? readQueueFull(needed) : writeQueueFull(needed))
+            break;
+        lines.push_back(addr);
+        metaBacklog.pop_front();
+    }
+    sendMetadata(reads, true, nullptr);
+    sendMetadata(writes, false, nullptr);
+}
+
+void
+SecureMemCtrl::queueReencrypt(const std::vector<Addr> &overflows, Addr skip)
+{
+    for (Addr half : overflows) {
+        bool skipped = skip >= half && skip < half + HALF_PAGE_SIZE;
+        unsigned lines = HALF_PAGE_SIZE / CL_SIZE - (skipped ? 1 : 0);
+        reencJobs.push_back(ReencryptJob{half, skipped ? skip : MaxAddr,
+                                         curTick(), half, lines});
+        secureStats.reencRequests++;
+
+        DPRINTF(SecureMemCtrl, "Minor counter overflow, re-encrypting "
+                "half page %#x\n", half);
+    }
+
+    if (!reencJobs.empty() && !reencEvent.scheduled())
+        schedule(reencEvent, curTick());
+}
+
+void
+SecureMemCtrl::processReencrypt()
+{
+    unsigned line_bursts = burstCount(0, CL_SIZE);
+    bool issued = false;
+
+    // write backs retire jobs, so they go first once their line has
+    // been through the crypto engine
+    while (!reencWrites.empty() && reencInFlight < reencMaxBursts &&
+           !writeQueueFull(line_bursts)) {
+        auto [ready, addr, job] = reencWrites.front();
+        if (ready > curTick()) {
+            if (!reencEvent.scheduled())
+                schedule(reencEvent, ready);
+            break;
+        }
+        reencWrites.pop_front();
+        sendReencrypt(addr, false, job);
+        issued = true;
+    }
+
+    for (auto job = reencJobs.begin(); job != reencJobs.end() &&
+         reencInFlight < reencMaxBursts; ++job) {
+        Addr end = job->half + HALF_PAGE_SIZE;
+        if (job->next == end)
+            continue;
+
+        // demand reads have priority, unless the job waited too long
+        Tick deadline = job->enqueued + reencMaxWait;
+        if (totalReadQueueSize >= reencDemandThreshold &&
+            curTick() < deadline) {
+            if (!reencEvent.scheduled())
+                schedule(reencEvent, deadline);
+            break;
+        }
+
+        while (job->next < end && reencInFlight < reencMaxBursts &&
+               !readQueueFull(line_bursts)) {
+            if (job->next != job->skip) {
+                sendReencrypt(job->next, true, job);
+                issued = true;
+            }
+            job->next += CL_SIZE;
+        }
+        // out of budget or of room in the read queue, the jobs are
+        // served in order
+        if (job->next < end)
+            break;
+    }
+
+    if (issued && !nextReqEvent.scheduled())
+        schedule(nextReqEvent, curTick());
+}
+
+void
+SecureMemCtrl::reencryptDone(PacketPtr pkt)
+{
+    auto it = reencOwner.find(pkt);
+    assert(it != reencOwner.end());
+    ReencryptJobIt job = it->second;
+    reencOwner.erase(it);
+    reencInFlight--;
+
+    if (pkt->isRead() && drainState() == DrainState::Running) {
+        // the old pad is removed and the new one applied, the engine
+        // shares the OTP stage with the demand writes
+        reencWrites.emplace_back(encryptStage.reserve(curTick()),
+                                 pkt->getAddr(), job);
+    } else if (--job->remaining == 0) {
+        // a write back, or a line read while draining which is dropped
+        // like the rest of the pending work, see drain()
+        secureStats.totReencLat += curTick() - job->enqueued;
+        reencJobs.erase(job);
+
+        // protected writes stalled on a full queue may come back
+        if (retryWrReq && reencJobs.size() < reencQueueDepth) {
+            retryWrReq = false;
+            port.sendRetryReq();
+        }
+    }
+    delete pkt;
+
+    if (!reencJobs.empty() && !reencEvent.scheduled())
+        schedule(reencEvent, curTick());
+}
+
+bool
+SecureMemCtrl::recvTimingReq(PacketPtr pkt)
+{
+    if (!isProtected(pkt))
+        return MemCtrl::recvTimingReq(pkt);
+
+    panic_if(pkt->isAtomicOp() || pkt->cmd == MemCmd::SwapReq ||
+             (pkt->isLLSC() && pkt->isWrite()),
+             "%s: unsupported access to protected memory %s\n", name(),
+             pkt->print());
+
+    // poisoned lines are never decrypted again, whoever consumes them
+    // gets an error, and their write backs are dropped
+    if (isPoisoned(pkt)) {
+        DPRINTF(SecureMemCtrl, "Access to poisoned line %s\n", pkt->print());
+        secureStats.poisonedAccesses++;
+        if (pkt->needsResponse()) {
+            pkt->makeResponse();
+            pkt->setBadAddress();
+            sendResponse(pkt, curTick() + frontendLatency);
+        } else {
+            pendingDelete.reset(pkt);
+        }
+        return true;
+    }
+
+    // any protected write may overflow a leaf, so writes are held back
+    // while the re-encryption engine is full
+    if (pkt->isWrite() && reencJobs.size() >= reencQueueDepth) {
+        DPRINTF(SecureMemCtrl, "Re-encryption queue full, not accepting\n");
+        retryWrReq = true;
+        stats.numWrRetry++;
+        secureStats.reencStalls++;
+        return false;
+    }
+
+    std::vector<Addr> meta_reads, meta_writes;
+    bool counters_local, zero_lines;
+    int levels = collectMetadata(pkt, meta_reads, meta_writes,
+                                 &counters_local, &zero_lines);
+    unsigned pkt_count = burstCount(pkt->getAddr(), pkt->getSize());
+
+    // the verified leaves say the lines were never written, they read
+    // back as zeros without any data, HMAC or crypto work
+    if (pkt->isRead() && counters_local && zero_lines) {
+        [[maybe_unused]] bool intact = sdm->read(pkt);
+        assert(intact);
+        DPRINTF(SecureMemCtrl, "Read of never written lines %s\n",
+                pkt->print());
+        // the read never reaches the queues, it is still a host read
+        // for the statistics of MemCtrl, served in the front end only
+        if (prevArrival != 0)
+            stats.totGap += curTick() - prevArrival;
+        prevArrival = curTick();
+        stats.readReqs++;
+        stats.bytesReadSys += pkt->getSize();
+        stats.requestorReadAccesses[pkt->requestorId()] += pkt_count;
+        stats.requestorReadBytes[pkt->requestorId()] += pkt->getSize();
+        stats.requestorReadTotalLat[pkt->requestorId()] += frontendLatency;
+        secureStats.protectedReads++;
+        secureStats.zeroReads++;
+        pkt->makeResponse();
+        sendResponse(pkt, curTick() + frontendLatency);
+        return true;
+    }
+    unsigned meta_rd_count = meta_reads.size() * burstCount(0, CL_SIZE);
+    unsigned meta_wr_count = meta_writes.size() * burstCount(0, CL_SIZE);
+
+    // the metadata bursts have to fit in the queues together with the
+    // request itself, otherwise the whole request is retried
+    if (pkt->isWrite()) {
+        if (writeQueueFull(pkt_count + meta_wr_count)) {
+            DPRINTF(SecureMemCtrl, "Write queue full, not accepting\n");
+            retryWrReq = true;
+            stats.numWrRetry++;
+            return false;
+        }
+        if (readQueueFull(meta_rd_count)) {
+            DPRINTF(SecureMemCtrl, "Read queue full, not accepting\n");
+            retryRdReq = true;
+            stats.numRdRetry++;
+            return false;
+        }
+
+        // a write has to read the key path and HMAC to verify and
+        // update them, and to write them back afterwards; MemCtrl hands
+        // it to accessAndRespond as soon as it is queued
+        pendingWrites[pkt] = levels;
+        [[maybe_unused]] bool accepted = MemCtrl::recvTimingReq(pkt);
+        assert(accepted);
+        sendMetadata(meta_reads, true, nullptr);
+        sendMetadata(meta_writes, false, nullptr);
+        secureStats.protectedWrites++;
+    } else {
+        if (readQueueFull(pkt_count + meta_rd_count)) {
+            DPRINTF(SecureMemCtrl, "Read queue full, not accepting\n");
+            retryRdReq = true;
+            stats.numRdRetry++;
+            return false;
+        }
+
+        // the pad of a read whose counter is already local is generated
+        // while the ciphertext is in flight
+        Tick otp_ready = 0;
+        if (counters_local) {
+            secureStats.localCounterReads++;
+            if (speculativeOtp)
+                otp_ready = decryptStage.reserve(curTick());
+        }
+
+        // register the read before handing it to MemCtrl, as it may be
+        // serviced by the write queue straight away
+        pendingReads[pkt] = PendingRead{(unsigned)meta_reads.size(), levels,
+                                        false, 0, curTick(), 0, otp_ready,
+                                        true};
+        [[maybe_unused]] bool accepted = MemCtrl::recvTimingReq(pkt);
+        assert(accepted);
+        sendMetadata(meta_reads, true, pkt);
+        secureStats.protectedReads++;
+    }
+
+    return true;
+}
+
+void
+SecureMemCtrl::accessAndRespond(PacketPtr pkt, Tick static_latency,
+                                MemInterface* mem_intr)
+{
+    // a burst left the queues, which may let the re-encryption engine
+    // issue more of its own
+    if (!reencJobs.empty() && !reencEvent.scheduled())
+        schedule(reencEvent, curTick());
+    if (!metaBacklog.empty() && !backlogEvent.scheduled())
+        schedule(backlogEvent, curTick());
+
+    if (reencOwner.count(pkt)) {
+        reencryptDone(pkt);
+        return;
+    }
+
+    auto meta = metaOwner.find(pkt);
+    if (meta != metaOwner.end()) {
+        PacketPtr owner = meta->second;
+        metaOwner.erase(meta);
+        delete pkt;
+
+        if (owner) {
+            PendingRead &pending = pendingReads.at(owner);
+            pending.metaReady = curTick();
+            if (--pending.outstanding == 0 && pending.dataDone)
+                finishRead(owner);
+        }
+        return;
+    }
+
+    auto pending = pendingReads.find(pkt);
+    if (pending != pendingReads.end()) {
+        // the ciphertext is decrypted and verified now, the response
+        // is held until the crypto pipeline is done with it, or until
+        // it is decrypted in verify-later mode
+        mem_intr->access(pkt);
+        pending->second.intact = sdm->read(pkt);
+        panic_if(!pending->second.intact && !verifyLater,
+                 "%s: integrity check failed for %s\n", name(),
+                 pkt->print());
+
+        pending->second.dataDone = true;
+        pending->second.dataReady = curTick();
+        pending->second.staticLatency = static_latency;
+        if (pending->second.outstanding == 0)
+            finishRead(pkt);
+        return;
+    }
+
+    auto write = pendingWrites.find(pkt);
+    if (write != pendingWrites.end()) {
+        int levels = write->second;
+        pendingWrites.erase(write);
+        bool needs_response = pkt->needsResponse();
+        Addr line = pkt->getAddr() & CL_ALIGN_MASK;
+        std::vector<Addr> overflows;
+        std::vector<std::pair<Addr, bool>> flushes;
+        bool intact = secureWrite(pkt, false, &overflows, &flushes);
+        // a partial write merges with the old contents of its lines,
+        // which failed their check: handled like a failed read
+        panic_if(!intact && !verifyLater,
+                 "%s: integrity check failed for %s\n", name(),
+                 pkt->print());
+        if (!intact) {
+            raiseIntegrityFault(IntegrityFault{pkt->getAddr(),
+                pkt->getSize(), pkt->requestorId(), curTick()});
+            if (needs_response)
+                pkt->setBadAddress();
+        }
+
+        // the write is accepted once encrypted, the tree update and
+        // the HMAC are computed in the background
+        Tick encrypted = encryptStage.reserve(curTick());
+        Tick updated = encrypted;
+        for (int i = 0; i < levels; i++)
+            updated = treeStage.reserve(updated);
+        hmacStage.reserve(encrypted);
+
+        if (needs_response)
+            sendResponse(pkt, encrypted + static_latency);
+        else
+            pendingDelete.reset(pkt);
+
+        // the rest of an overflowed half page is re-encrypted in the
+        // background, the write does not wait for it
+        queueReencrypt(overflows, line);
+
+        // dirty IIT nodes propagated by this write go in the background
+        metaBacklog.insert(metaBacklog.end(), flushes.begin(), flushes.end());
+        if (!metaBacklog.empty() && !backlogEvent.scheduled())
+            schedule(backlogEvent, curTick());
+        return;
+    }
+
+    MemCtrl::accessAndRespond(pkt, static_latency, mem_intr);
+}
+
+void
+SecureMemCtrl::finishRead(PacketPtr pkt)
+{
+    auto it = pendingReads.find(pkt);
+    assert(it != pendingReads.end());
+    PendingRead pending = it->second;
+    pendingReads.erase(it);
+
+    // the key path is verified bottom-up, one level after the other,
+    // and the HMAC needs both the data and the leaf
+    Tick verified = pending.metaReady;
+    for (int i = 0; i < pending.levels; i++)
+        verified = verifyStage.reserve(verified);
+    Tick authenticated = hmacStage.reserve(
+        std::max(pending.dataReady, pending.metaReady));
+
+    // the one-time pad is either generated once the data is back, or
+    // speculatively as soon as the counter is known, the metadata being
+    // the latest the counter can be known at, the XOR is free
+    Tick decrypted;
+    if (!speculativeOtp) {
+        decrypted = decryptStage.reserve(pending.dataReady);
+    } else {
+        Tick otp_ready = pending.otpReady ? pending.otpReady :
+            decryptStage.reserve(pending.metaReady);
+        decrypted = std::max(otp_ready, pending.dataReady);
+        if (otp_ready <= pending.dataReady)
+            secureStats.otpsBeforeData++;
+        Tick exposed = std::min(decrypted - pending.dataReady,
+                                decryptStage.latency);
+        secureStats.totOtpHiddenLat += decryptStage.latency - exposed;
+    }
+    Tick done = std::max({verified, authenticated, decrypted});
+
+    // the response does not wait for the verification, unless the
+    // verification fails: the data is then replaced by an error once
+    // the verification ends, and the lines are poisoned at that point
+    if (verifyLater && pending.intact) {
+        secureStats.totVerifyHiddenLat += done - decrypted;
+        done = decrypted;
+    } else if (verifyLater) {
+        pkt->setBadAddress();
+        pendingFaults.emplace(done, IntegrityFault{
+            pkt->getAddr(), pkt->getSize(), pkt->requestorId(),
+            done + pending.staticLatency});
+        if (!faultEvent.scheduled() ||
+            faultEvent.when() > pendingFaults.begin()->first) {
+            reschedule(faultEvent, pendingFaults.begin()->first, true);
+        }
+    }
+
+    secureStats.totSecureReadLat += done - pending.dataReady;
+    secureStats.secureReadLatDist.sample(done - pending.dataReady);
+    if (!reencJobs.empty()) {
+        // reads competing with an overflow storm
+        secureStats.readsDuringReenc++;
+        secureStats.reencReadLatDist.sample(done - pending.dataReady);
+    }
+
+    DPRINTF(SecureMemCtrl, "Protected read %#x done after %d ticks\n",
+            pkt->getAddr(), done - pending.dataReady);
+
+    sendResponse(pkt, done + pending.staticLatency);
+}
+
+void
+SecureMemCtrl::sendResponse(PacketPtr pkt, Tick ready)
+{
+    assert(pkt->isResponse());
+    // as in MemCtrl, the response is also charged with the delay
+    // provided by the xbar and the number of data beats
+    Tick response_time = ready + pkt->headerDelay + pkt->payloadDelay;
+    pkt->headerDelay = pkt->payloadDelay = 0;
+    port.schedTimingResp(pkt, response_time);
+}
+
+bool
+SecureMemCtrl::secureWrite(PacketPtr pkt, bool functional,
+                           std::vector<Addr> *overflows,
+                           std::vector<std::pair<Addr, bool>> *flushes)
+{
+    // the sDM manager replaces the payload with the ciphertext it wrote
+    // to the media, the requestor may still own the buffer so restore
+    // the plaintext once the controller has done its access
+    std::vector<uint8_t> plain(pkt->getConstPtr<uint8_t>(),
+                               pkt->getConstPtr<uint8_t>() + pkt->getSize());
+    // functional writes (e.g. loading a binary) leave the metadata cache,
+    // the dirty nodes and the statistics untouched
+    bool intact = functional ? sdm->functionalWrite(pkt) :
+                               sdm->write(pkt, overflows);
+    // the traffic of the propagated dirty nodes is only timing, it is
+    // dropped when nobody models it
+    std::vector<std::pair<Addr, bool>> traffic;
+    sdm->takeFlushTraffic(flushes ? *flushes : traffic);
+    if (overflows && !overflows->empty())
+        DPRINTF(SecureMemCtrl, "Write to %#x overflowed a minor counter\n",
+                pkt->getAddr());
+    // the payload still holds plaintext after a failed check, and must
+    // not reach the media
+    if (!intact) {
+        if (pkt->needsResponse())
+            pkt->makeResponse();
+    } else if (functional) {
+        dram->functionalAccess(pkt);
+    } else {
+        dram->access(pkt);
+    }
+    std::memcpy(pkt->getPtr<uint8_t>(), plain.data(), plain.size());
+    return intact;
+}
+
+Tick
+SecureMemCtrl::recvAtomic(PacketPtr pkt)
+{
+    if (!isProtected(pkt))
+        return MemCtrl::recvAtomic(pkt);
+
+    panic_if(pkt->isAtomicOp() || pkt->cmd == MemCmd::SwapReq ||
+             (pkt->isLLSC() && pkt->isWrite()),
+             "%s: unsupported access to protected memory %s\n", name(),
+             pkt->print());
+
+    if (isPoisoned(pkt)) {
+        secureStats.poisonedAccesses++;
+        if (pkt->needsResponse()) {
+            pkt->makeResponse();
+            pkt->setBadAddress();
+        }
+        return frontendLatency;
+    }
+
+    std::vector<Addr> meta_reads, meta_writes;
+    bool counters_local, zero_lines;
+    int levels = collectMetadata(pkt, meta_reads, meta_writes,
+                                 &counters_local, &zero_lines);
+
+    if (pkt->isRead() && counters_local && zero_lines) {
+        [[maybe_unused]] bool intact = sdm->read(pkt);
+        assert(intact);
+        secureStats.protectedReads++;
+        secureStats.zeroReads++;
+        pkt->makeResponse();
+        return frontendLatency;
+    }
+
+    if (pkt->isWrite()) {
+        // atomic mode has no background traffic, the re-encryption of
+        // an overflowed half page is only counted
+        std::vector<Addr> overflows;
+        secureStats.protectedWrites++;
+        bool intact = secureWrite(pkt, false, &overflows);
+        panic_if(!intact && !verifyLater,
+                 "%s: integrity check failed for %s\n", name(),
+                 pkt->print());
+        if (!intact) {
+            raiseIntegrityFault(IntegrityFault{pkt->getAddr(),
+                pkt->getSize(), pkt->requestorId(), curTick()});
+            if (pkt->isResponse())
+                pkt->setBadAddress();
+        }
+        secureStats.reencRequests += overflows.size();
+        return dram->accessLatency() + encryptStage.latency;
+    }
+
+    Tick latency = MemCtrl::recvAtomic(pkt);
+    secureStats.protectedReads++;
+    bool intact = sdm->read(pkt);
+    panic_if(!intact && !verifyLater, "%s: integrity check failed for %s\n",
+             name(), pkt->print());
+    // a pad generated speculatively overlaps with the media access
+    Tick decrypt = decryptStage.latency;
+    if (speculativeOtp && counters_local)
+        decrypt -= std::min(decrypt, latency);
+    if (verifyLater && intact)
+        return latency + decrypt;
+    if (verifyLater) {
+        // atomic mode has no background, the fault is raised at once
+        // and the access waits for the whole check like a failed timing
+        // read does
+        raiseIntegrityFault(IntegrityFault{pkt->getAddr(),
+            pkt->getSize(), pkt->requestorId(), curTick()});
+        if (pkt->isResponse())
+            pkt->setBadAddress();
+    }
+    return latency + std::max(levels * verifyStage.latency +
+                              hmacStage.latency, decrypt);
+}
+
+Tick
+SecureMemCtrl::recvAtomicBackdoor(PacketPtr pkt, MemBackdoorPtr &backdoor)
+{
+    // a backdoor would expose the ciphertext and bypass the integrity
+    // tree, so never hand one out
+    return recvAtomic(pkt);
+}
+
+void
+SecureMemCtrl::recvFunctional(PacketPtr pkt)
+{
+    if (!isProtected(pkt)) {
+        MemCtrl::recvFunctional(pkt);
+        return;
+    }
+
+    if (pkt->isWrite()) {
+        panic_if(!secureWrite(pkt, true),
+                 "%s: integrity check failed for %s\n", name(),
+                 pkt->print());
+    } else {
+        MemCtrl::recvFunctional(pkt);
+        // a debugger read must not change the later timing or statistics
+        panic_if(!sdm->functionalRead(pkt),
+                 "%s: integrity check failed for %s\n", name(), pkt->print());
+    }
+}
+
+SecureMemCtrl::SecureCtrlStats::SecureCtrlStats(SecureMemCtrl &ctrl)
+    : statistics::Group(&ctrl, "secure"),
+
+    ADD_STAT(protectedReads, statistics::units::Count::get(),
+             "Number of read requests to protected memory"),
+    ADD_STAT(protectedWrites, statistics::units::Count::get(),
+             "Number of write requests to protected memory"),
+    ADD_STAT(metaReadBursts, statistics::units::Count::get(),
+             "Number of IIT and HMAC read bursts"),
+    ADD_STAT(metaWriteBursts, statistics::units::Count::get(),
+             "Number of IIT and HMAC write bursts"),
+    ADD_STAT(totSecureReadLat, statistics::units::Tick::get(),
+             "Total latency added by the crypto pipeline to reads"),
+    ADD_STAT(reencRequests, statistics::units::Count::get(),
+             "Number of half pages re-encrypted after a minor counter "
+             "overflow"),
+    ADD_STAT(reencStalls, statistics::units::Count::get(),
+             "Number of protected writes refused while the re-encryption "
+             "queue was full"),
+    ADD_STAT(reencReadBursts, statistics::units::Count::get(),
+             "Number of re-encryption read bursts"),
+    ADD_STAT(reencWriteBursts, statistics::units::Count::get(),
+             "Number of re-encryption write bursts"),
+    ADD_STAT(totReencLat, statistics::units::Tick::get(),
+             "Total time from an overflow to its half page being rewritten"),
+    ADD_STAT(readsDuringReenc, statistics::units::Count::get(),
+             "Number of protected reads done while a re-encryption was "
+             "pending"),
+    ADD_STAT(localCounterReads, statistics::units::Count::get(),
+             "Number of protected reads whose counters were local when "
+             "they arrived"),
+    ADD_STAT(otpsBeforeData, statistics::units::Count::get(),
+             "Number of protected reads whose OTP was ready before their "
+             "data"),
+    ADD_STAT(totOtpHiddenLat, statistics::units::Tick::get(),
+             "Total decryption latency hidden behind the data fetch by "
+             "speculative OTP generation"),
+    ADD_STAT(zeroReads, statistics::units::Count::get(),
+             "Number of protected reads of never written lines served "
+             "without any media access"),
+    ADD_STAT(totVerifyHiddenLat, statistics::units::Tick::get(),
+             "Total verification latency taken off the reads in "
+             "verify-later mode"),
+    ADD_STAT(integrityFaults, statistics::units::Count::get(),
+             "Number of integrity faults raised after the data was "
+             "returned"),
+    ADD_STAT(poisonedAccesses, statistics::units::Count::get(),
+             "Number of accesses refused as their lines were poisoned"),
+
+    ADD_STAT(avgSecureReadLat, statistics::units::Rate<
+                statistics::units::Tick, statistics::units::Count>::get(),
+             "Average latency added by the crypto pipeline to reads"),
+    ADD_STAT(avgReencLat, statistics::units::Rate<
+                statistics::units::Tick, statistics::units::Count>::get(),
+             "Average time to re-encrypt an overflowed half page"),
+    ADD_STAT(avgOtpHiddenLat, statistics::units::Rate<
+                statistics::units::Tick, statistics::units::Count>::get(),
+             "Average decryption latency hidden per protected read"),
+
+    ADD_STAT(secureReadLatDist, statistics::units::Tick::get(),
+             "Latency added by the crypto pipeline to reads"),
+    ADD_STAT(reencReadLatDist, statistics::units::Tick::get(),
+             "Latency added by the crypto pipeline to reads done while a "
+             "re-encryption was pending")
+{
+    avgSecureReadLat.precision(2);
+    avgSecureReadLat = totSecureReadLat / protectedReads;
+    avgReencLat.precision(2);
+    avgReencLat = totReencLat / reencRequests;
+    avgOtpHiddenLat.precision(2);
+    avgOtpHiddenLat = totOtpHiddenLat / protectedReads;
+
+    secureReadLatDist.init(16);
+    reencReadLatDist.init(16);
+}
+
+} // namespace memory
+} // namespace gem5
@@ -0,0 +1,451 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met: redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer;
+ * redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution;
+ * neither the name of the copyright holders nor the names of its
+ * contributors may be used to endorse or promote products derived from
+ * this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * SecureMemCtrl declaration
+ */
+
+#ifndef __SECURE_MEM_CTRL_HH__
+#define __SECURE_MEM_CTRL_HH__
+
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "mem/mem_ctrl.hh"
+#include "mem/port_proxy.hh"
+#include "mem/sDM/sDM.hh"
+#include "params/SecureMemCtrl.hh"
+#include "sim/probe/probe.hh"
+
+namespace gem5
+{
+
+namespace memory
+{
+
+/**
+ * A memory controller whose media holds sDM protected spaces. The
+ * functional side of the protection (CME, IIT and HMAC maintenance) is
+ * delegated to the sDMmanager, which accesses the media through a
+ * functional proxy. This controller adds the timing side on top of
+ * MemCtrl: every access to a protected line injects the metadata
+ * bursts it needs (IIT key path and half-page HMAC) into the regular
+ * read and write queues, and the response is only sent once both the
+ * data and the metadata have gone through the crypto pipeline.
+ *
+ * The pipeline is made of independent stages (verification, HMAC,
+ * decryption, encryption and tree update), each with its own latency.
+ * When pipelined, a stage accepts a new operation every issue interval,
+ * so that independent requests overlap; otherwise a stage is busy for
+ * its whole latency.
+ *
+ * A leaf minor counter overflow re-encrypts its whole half page. The
+ * sDM manager does so functionally at write time, while the controller
+ * models the media traffic with a background re-encryption engine: the
+ * half page is queued, and its lines are read and written back later,
+ * behind demand traffic and within a budget of bursts in flight, so
+ * that the foreground write does not wait for the rewrite.
+ *
+ * With counter-mode encryption the one-time pad only depends on the
+ * address and the counter of a line. When speculative OTP generation is
+ * enabled, the pad of a read is generated as soon as its counter is
+ * known, i.e. when the request is accepted if the leaf is already in
+ * the metadata cache, or when its metadata comes back otherwise, and
+ * only the XOR is left once the ciphertext arrives.
+ *
+ * A never written line has a zero counter and reads back as zeros. The
+ * HMAC of such a line is never fetched, and when the counters of a read
+ * are local and all zero, the read does not go to the media at all.
+ *
+ * In verify-later mode a read is answered as soon as it is decrypted,
+ * and its key path and HMAC are checked in the background. The
+ * requestor may use the data early but cannot retire on it before the
+ * check ends, so a read that fails its check is not answered early:
+ * it gets a bad address response once the background verification
+ * ends, which delivers the fault to the very access that consumed the
+ * data. The lines are also poisoned, like after a memory poisoning
+ * error: every later access to them gets an error response. What a
+ * requestor does with an error response is up to its model, the simple
+ * CPUs stop the simulation. The IntegrityFault probe point is notified
+ * as well, for the tools that log or count the faults.
+ *
+ * When the sDM manager uses the side-band MAC layout, the truncated MAC
+ * of a line sits in the ECC bits of its own burst: it is read and
+ * written with the data, and no HMAC burst is ever queued.
+ */
+class SecureMemCtrl : public MemCtrl
+{
+  public:
+
+    /**
+     * Integrity fault raised by a failed background verification.
+     */
+    struct IntegrityFault
+    {
+        /** Address and size of the access that failed its check */
+        Addr addr;
+        unsigned size;
+        /** Requestor that consumed the unverified data */
+        RequestorID requestor;
+        /** Tick at which the error response was sent */
+        Tick consumed;
+    };
+
+  private:
+
+    /**
+     * One stage of the crypto pipeline.
+     */
+    struct CryptoStage
+    {
+        const Tick latency;
+        const Tick issueInterval;
+        Tick nextFree;
+
+        CryptoStage(Tick _latency, Tick issue_interval)
+            : latency(_latency), issueInterval(issue_interval), nextFree(0)
+        {}
+
+        /**
+         * Reserve the stage for an operation whose inputs are ready.
+         *
+         * @param ready Tick at which the inputs are available
+         * @return Tick at which the operation completes
+         */
+        Tick reserve(Tick ready);
+    };
+
+    /**
+     * State of a protected read waiting for its data and metadata.
+     */
+    struct PendingRead
+    {
+        /** Metadata packets still in flight */
+        unsigned outstanding;
+        /** Length of the IIT key path to verify */
+        int levels;
+        bool dataDone;
+        /** Tick at which the data burst(s) came back */
+        Tick dataReady;
+        /** Tick at which the last metadata burst came back */
+        Tick metaReady;
+        /** Static latency MemCtrl would have charged the response */
+        Tick staticLatency;
+        /**
+         * Tick at which the one-time pad generated speculatively is
+         * done, 0 if the counter was not known when the read arrived
+         */
+        Tick otpReady;
+        /** The data and its metadata passed the integrity check */
+        bool intact;
+    };
+
+    /**
+     * A half page waiting for the re-encryption engine.
+     */
+    struct ReencryptJob
+    {
+        /** Physical address of the half page */
+        Addr half;
+        /** Line written by the foreground write that overflowed */
+        Addr skip;
+        /** Tick at which the overflow happened */
+        Tick enqueued;
+        /** Next line to read */
+        Addr next;
+        /** Lines not written back yet */
+        unsigned remaining;
+    };
+
+    typedef std::list<ReencryptJob>::iterator ReencryptJobIt;
+
+    sDM::sDMmanager *sdm;
+
+    /** Functional access to the media used by the sDM manager */
+    PortProxy metaProxy;
+
+    /** Requestor id of the metadata bursts */
+    RequestorID sdmRequestorId;
+
+    CryptoStage verifyStage;
+    CryptoStage hmacStage;
+    CryptoStage decryptStage;
+    CryptoStage encryptStage;
+    CryptoStage treeStage;
+
+    /** Generate the one-time pad of a read before its data arrives */
+    const bool speculativeOtp;
+
+    /** Answer reads before their verification ends */
+    const bool verifyLater;
+
+    /**
+     * Failed verifications not reported yet, by the tick at which the
+     * background verification ends
+     */
+    std::multimap<Tick, IntegrityFault> pendingFaults;
+
+    /** Lines whose integrity check failed */
+    std::unordered_set<Addr> poisoned;
+
+    EventFunctionWrapper faultEvent;
+
+    std::unique_ptr<ProbePointArg<IntegrityFault>> ppIntegrityFault;
+
+    std::unordered_map<PacketPtr, PendingRead> pendingReads;
+
+    /**
+     * Protected writes accepted but not encrypted yet, with the number
+     * of key path levels they update as charged when they arrived.
+     */
+    std::unordered_map<PacketPtr, int> pendingWrites;
+
+    /**
+     * Metadata packet to the protected read waiting for it, nullptr
+     * for the metadata of a protected write that nobody waits for.
+     */
+    std::unordered_map<PacketPtr, PacketPtr> metaOwner;
+
+    /** Half pages to re-encrypt, oldest first */
+    std::list<ReencryptJob> reencJobs;
+
+    /** Re-encryption burst to the half page it belongs to */
+    std::unordered_map<PacketPtr, ReencryptJobIt> reencOwner;
+
+    /**
+     * Re-encrypted lines waiting to be written back: tick at which the
+     * crypto engine is done with the line, line and half page.
+     */
+    std::deque<std::tuple<Tick, Addr, ReencryptJobIt>> reencWrites;
+
+    /** Re-encryption bursts in the controller queues */
+    unsigned reencInFlight;
+
+    /** Half pages queued before protected writes are stalled */
+    const unsigned reencQueueDepth;
+    /** Re-encryption bursts allowed in flight at once */
+    const unsigned reencMaxBursts;
+    /** Queued read bursts above which re-encryption holds back */
+    const unsigned reencDemandThreshold;
+    /** Time after which a job ignores the demand traffic */
+    const Tick reencMaxWait;
+
+    EventFunctionWrapper reencEvent;
+
+    /**
+     * Metadata bursts of the dirty IIT nodes the sDM manager propagated
+     * in write-back mode, as line and read flag. They are issued in the
+     * background whenever the queues have room.
+     */
+    std::deque<std::pair<Addr, bool>> metaBacklog;
+
+    EventFunctionWrapper backlogEvent;
+
+    /**
+     * @return true if any line of the packet is in an sdm space
+     */
+    bool isProtected(PacketPtr pkt);
+
+    /**
+     * @return true if any line of the packet is poisoned
+     */
+    bool isPoisoned(PacketPtr pkt) const;
+
+    /**
+     * Poison the lines of an access and notify the listeners of the
+     * integrity fault.
+     */
+    void raiseIntegrityFault(const IntegrityFault &fault);
+
+    /**
+     * Report the failed verifications that ended by now.
+     */
+    void processFaults();
+
+    /**
+     * Collect the metadata lines touched by an access to a protected
+     * packet. Only the lines missing in the metadata cache of the sDM
+     * manager are read, and a read stops at the first cached node of
+     * its key path. A write updates and writes back the whole key path
+     * and the HMAC line, as the metadata cache is write-through, unless
+     * the manager is in write-back mode where a write only reads like a
+     * read and writes the HMAC line. With side-band MACs there is no
+     * HMAC line at all.
+     *
+     * @param pkt The protected packet
+     * @param meta_reads Unique, line aligned metadata lines to read
+     * @param meta_writes Unique, line aligned metadata lines to write
+     * @param counters_local Set if no line needs a key path node from
+     *        the media to know its counter
+     * @param zero_lines Set if a read only covers protected lines that
+     *        were never written, which need neither data nor HMAC
+     * @return For a read, the number of key path nodes to verify; for
+     *         a write, the number of key path levels to update
+     */
+    int collectMetadata(PacketPtr pkt, std::vector<Addr> &meta_reads,
+                        std::vector<Addr> &meta_writes,
+                        bool *counters_local = nullptr,
+                        bool *zero_lines = nullptr);
+
+    /**
+     * Inject one internal burst per metadata line.
+     *
+     * @param meta_addrs Metadata lines to access
+     * @param is_read Read or write the lines
+     * @param owner Protected read waiting for the lines, if any
+     */
+    void sendMetadata(const std::vector<Addr> &meta_addrs, bool is_read,
+                      PacketPtr owner);
+
+    /**
+     * Number of media bursts needed by an access.
+     */
+    unsigned burstCount(Addr addr, unsigned size) const;
+
+    /**
+     * Push a protected read through the crypto pipeline once its data
+     * and metadata are available, and schedule the response.
+     */
+    void finishRead(PacketPtr pkt);
+
+    /**
+     * Send a response once it is ready, charging it with the delay
+     * of the crossbar like MemCtrl does.
+     */
+    void sendResponse(PacketPtr pkt, Tick ready);
+
+    /**
+     * Encrypt a protected write, update its metadata and write the
+     * ciphertext to the media. The payload is left untouched for the
+     * requestor.
+     *
+     * @param pkt The write packet, turned into a response
+     * @param functional Use a functional access to the media
+     * @return false if a line failed its check, nothing is then written
+     *         to the media from that line on
+     */
+    bool secureWrite(PacketPtr pkt, bool functional,
+                     std::vector<Addr> *overflows = nullptr,
+                     std::vector<std::pair<Addr, bool>> *flushes = nullptr);
+
+    /**
+     * Issue as many of the background metadata bursts as the queues
+     * can take.
+     */
+    void processMetaBacklog();
+
+    /**
+     * Queue the half pages whose leaf overflowed for re-encryption.
+     *
+     * @param overflows Half pages re-encrypted by the sDM manager
+     * @param skip Line already written by the foreground write
+     */
+    void queueReencrypt(const std::vector<Addr> &overflows, Addr skip);
+
+    /**
+     * Issue re-encryption bursts. Write backs go first as they retire
+     * jobs, reads are only issued while the demand traffic is low or
+     * once the oldest job has waited too long.
+     */
+    void processReencrypt();
+
+    /**
+     * Account for a re-encryption burst coming back.
+     */
+    void reencryptDone(PacketPtr pkt);
+
+    /**
+     * Inject one internal re-encryption burst.
+     */
+    void sendReencrypt(Addr addr, bool is_read, ReencryptJobIt job);
+
+    struct SecureCtrlStats : public statistics::Group
+    {
+        SecureCtrlStats(SecureMemCtrl &ctrl);
+
+        statistics::Scalar protectedReads;
+        statistics::Scalar protectedWrites;
+        statistics::Scalar metaReadBursts;
+        statistics::Scalar metaWriteBursts;
+        statistics::Scalar totSecureReadLat;
+        statistics::Scalar reencRequests;
+        statistics::Scalar reencStalls;
+        statistics::Scalar reencReadBursts;
+        statistics::Scalar reencWriteBursts;
+        statistics::Scalar totReencLat;
+        statistics::Scalar readsDuringReenc;
+        statistics::Scalar localCounterReads;
+        statistics::Scalar otpsBeforeData;
+        statistics::Scalar totOtpHiddenLat;
+        statistics::Scalar zeroReads;
+        statistics::Scalar totVerifyHiddenLat;
+        statistics::Scalar integrityFaults;
+        statistics::Scalar poisonedAccesses;
+
+        statistics::Formula avgSecureReadLat;
+        statistics::Formula avgReencLat;
+        statistics::Formula avgOtpHiddenLat;
+
+        statistics::Histogram secureReadLatDist;
+        statistics::Histogram reencReadLatDist;
+    };
+
+    SecureCtrlStats secureStats;
+
+  protected:
+
+    void accessAndRespond(PacketPtr pkt, Tick static_latency,
+                          MemInterface* mem_intr) override;
+
+    Tick recvAtomic(PacketPtr pkt) override;
+    Tick recvAtomicBackdoor(PacketPtr pkt, MemBackdoorPtr &backdoor) override;
+    void recvFunctional(PacketPtr pkt) override;
+    bool recvTimingReq(PacketPtr pkt) override;
+
+  public:
+
+    SecureMemCtrl(const SecureMemCtrlParams &p);
+
+    void init() override;
+
+    void regProbePoints() override;
+
+    DrainState drain() override;
+
+    void serialize(CheckpointOut &cp) const override;
+    void unserialize(CheckpointIn &cp) override;
+};
+
+} // namespace memory
+} // namespace gem5
+
+#endif //__SECURE_MEM_CTRL_HH__
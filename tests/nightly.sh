@@ -67,11 +67,12 @@ fi
 
 unit_test () {
     build=$1
+    config=${2:-ALL}
 
     docker run -u $UID:$GID --volume "${gem5_root}":"${gem5_root}" -w \
         "${gem5_root}" --memory="${docker_mem_limit}" --rm \
         gcr.io/gem5-test/ubuntu-22.04_all-dependencies:${tag} \
-            scons build/ALL/unittests.${build} -j${compile_threads} \
+            scons build/${config}/unittests.${build} -j${compile_threads} \
             --ignore-style
 }
 
@@ -82,6 +83,10 @@ docker pull gcr.io/gem5-test/ubuntu-22.04_all-dependencies:${tag}
 unit_test opt
 unit_test debug
 
+# The sDM morphable IIT leaf format is a build option, so its unit tests need
+# their own build.
+unit_test opt NULL_SDM_MORPHABLE
+
 # Run the gem5 long tests.
 docker run -u $UID:$GID --volume "${gem5_root}":"${gem5_root}" -w \
     "${gem5_root}"/tests --memory="${docker_mem_limit}" --rm \